@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "stats.h"
+#include "log.h"
+
+/*
+ * Offline cache simulator. Replays an access trace through the proxy's own
+ * cache code (cache.c built with CACHE_SIMULATION, which keeps metadata only
+ * and runs on the trace clock) without touching the network.
+ *
+ * Trace lines are whitespace separated:
+ *
+ *     <timestamp-seconds> <key> <size-bytes> <max-age>
+ *
+ * max-age is "-" (or negative) when the response had none, in which case the
+ * object never goes stale; 0 marks a response that may not be cached. Lines
+ * starting with '#' are skipped.
+ *
+ * A row is printed for every interval of trace time with the object-hit and
+ * byte-hit ratios, the evictions (churn) and the expired entries swept in
+ * that interval. As in the proxy, the sweep runs once per second of trace
+ * time.
+ */
+
+/* ========== Constants ========== */
+#define LINE_SIZE 4096
+#define DEFAULT_INTERVAL 3600
+#define DEFAULT_MAX_OBJECT 102400
+
+/**
+ * Counters for one reporting interval or for the whole run
+ */
+typedef struct {
+    uint64_t requests;
+    uint64_t hits;
+    uint64_t stale;
+    uint64_t bytes;
+    uint64_t hit_bytes;
+    uint64_t evictions;
+    uint64_t expired;
+} sim_counts;
+
+/**
+ * Simulation settings from the command line
+ */
+typedef struct {
+    const char *trace;
+    int capacity;
+    uint64_t byte_budget;
+    uint64_t max_object;
+    cache_policy policy;
+    double interval;
+} sim_config;
+
+static sim_config config;
+
+/**
+ * @brief Log sink for the simulated cache: eviction lines are not wanted,
+ * evictions are read from STAT_EVICTIONS instead
+ *
+ * @param type Kind of line
+ * @param text1 First string argument
+ * @param text2 Second string argument
+ * @param num1 First numeric argument
+ * @param num2 Second numeric argument
+ */
+void log_event(log_event_type type, const char *text1, const char *text2,
+               int64_t num1, int64_t num2) {
+    (void)type;
+    (void)text1;
+    (void)text2;
+    (void)num1;
+    (void)num2;
+}
+
+/**
+ * @brief No access log in simulation builds
+ *
+ * @return int 0
+ */
+int log_access_enabled() {
+    return 0;
+}
+
+/**
+ * @brief Prints usage instructions and exits the program.
+ *
+ * @param prog_name Name of the running program (argv[0])
+ */
+static void print_usage(const char *prog_name) {
+    fprintf(stderr,
+            "Usage: %s [-f trace] [-n entries] [-b byte-budget] [-m max-object-bytes]\n"
+            "          [-P lru|fifo|clock] [-i interval-seconds]\n"
+            "Entries at most %d; sizes accept k/m/g suffixes; the trace defaults to stdin.\n",
+            prog_name, CACHE_SIZE);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parse a byte count with an optional k/m/g suffix
+ *
+ * @param text Text to parse
+ * @param bytes Receives the value
+ * @return int 0 on success, -1 on error
+ */
+static int parse_bytes(const char *text, uint64_t *bytes) {
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0) return -1;
+
+    switch (tolower((unsigned char)*end)) {
+    case 'k': value *= 1024; end++; break;
+    case 'm': value *= 1024 * 1024; end++; break;
+    case 'g': value *= 1024.0 * 1024 * 1024; end++; break;
+    default: break;
+    }
+    if (*end != '\0') return -1;
+
+    *bytes = (uint64_t)value;
+    return 0;
+}
+
+/**
+ * @brief Split one trace line into its fields
+ *
+ * @param line Line, modified in place (the key is NUL terminated)
+ * @param timestamp Receives the timestamp
+ * @param key Receives the key
+ * @param key_len Receives the key length
+ * @param size Receives the object size
+ * @param max_age Receives the max-age, -1 if none
+ * @return int 0 on success, -1 for a malformed or comment line
+ */
+static int parse_event(char *line, double *timestamp, char **key, int *key_len,
+                       uint64_t *size, long *max_age) {
+    char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '#' || *p == '\n' || *p == '\0') return -1;
+
+    char *end;
+    *timestamp = strtod(p, &end);
+    if (end == p) return -1;
+    p = end;
+
+    while (*p == ' ' || *p == '\t') p++;
+    *key = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    *key_len = (int)(p - *key);
+    if (*key_len == 0 || !*p) return -1;
+    *p++ = '\0';
+
+    long long value = strtoll(p, &end, 10);
+    if (end == p || value < 0) return -1;
+    *size = (uint64_t)value;
+    p = end;
+
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '-' && !isdigit((unsigned char)p[1])) {
+        *max_age = -1;
+        return 0;
+    }
+    value = strtoll(p, &end, 10);
+    if (end == p) return -1;
+    *max_age = value < 0 ? -1 : (long)value;
+    return 0;
+}
+
+/**
+ * @brief Print one interval row
+ *
+ * @param label Interval start in seconds since the first event, or "total"
+ * @param counts Interval counters
+ */
+static void print_row(const char *label, const sim_counts *counts) {
+    printf("%10s %10llu %9.4f %9.4f %8llu %10llu %9.3f %9llu %9d %12.1f\n",
+           label, (unsigned long long)counts->requests,
+           counts->requests ? (double)counts->hits / counts->requests : 0.0,
+           counts->bytes ? (double)counts->hit_bytes / counts->bytes : 0.0,
+           (unsigned long long)counts->stale, (unsigned long long)counts->evictions,
+           counts->requests ? (double)counts->evictions / counts->requests : 0.0,
+           (unsigned long long)counts->expired, cache.count, cache.bytes / (1024.0 * 1024.0));
+}
+
+/**
+ * @brief Add interval counters into the run totals
+ *
+ * @param total Run totals
+ * @param counts Interval counters
+ */
+static void accumulate(sim_counts *total, const sim_counts *counts) {
+    total->requests += counts->requests;
+    total->hits += counts->hits;
+    total->stale += counts->stale;
+    total->bytes += counts->bytes;
+    total->hit_bytes += counts->hit_bytes;
+    total->evictions += counts->evictions;
+    total->expired += counts->expired;
+}
+
+/**
+ * @brief Replay one event through the cache
+ *
+ * @param key Request key (NUL terminated)
+ * @param key_len Key length
+ * @param size Object size
+ * @param max_age Max-age, -1 if none, 0 if uncacheable
+ * @param counts Interval counters to update
+ */
+static void replay(const char *key, int key_len, uint64_t size, long max_age,
+                   sim_counts *counts) {
+    counts->requests++;
+    counts->bytes += size;
+
+    if (key_len >= MAX_REQUEST_SIZE) {
+        // Too long to be a cache key in the proxy either
+        return;
+    }
+
+    cache_entry *entry = find_in_cache(key, key_len);
+    if (entry && !cache_entry_stale(entry)) {
+        counts->hits++;
+        counts->hit_bytes += size;
+        return;
+    }
+
+    int cacheable = max_age != 0 && size <= config.max_object;
+    if (entry) {
+        // Stale: the refetched copy replaces it, or it just goes
+        counts->stale++;
+        evict_entry(key, !cacheable);
+    }
+    if (cacheable) {
+        add_to_cache(key, key_len, NULL, (int)size, "", key,
+                     max_age > 0 ? (uint32_t)max_age : 0, max_age > 0);
+    }
+}
+
+/**
+ * @brief Main function.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return int Exit status
+ */
+int main(int argc, char *argv[]) {
+    config.capacity = CACHE_SIZE;
+    config.max_object = DEFAULT_MAX_OBJECT;
+    config.policy = CACHE_POLICY_LRU;
+    config.interval = DEFAULT_INTERVAL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:b:m:P:i:")) != -1) {
+        switch (opt) {
+        case 'f': config.trace = optarg; break;
+        case 'n': config.capacity = atoi(optarg); break;
+        case 'b':
+            if (parse_bytes(optarg, &config.byte_budget) < 0) print_usage(argv[0]);
+            break;
+        case 'm':
+            if (parse_bytes(optarg, &config.max_object) < 0) print_usage(argv[0]);
+            break;
+        case 'P':
+            if (strcmp(optarg, "lru") == 0) config.policy = CACHE_POLICY_LRU;
+            else if (strcmp(optarg, "fifo") == 0) config.policy = CACHE_POLICY_FIFO;
+            else if (strcmp(optarg, "clock") == 0) config.policy = CACHE_POLICY_CLOCK;
+            else print_usage(argv[0]);
+            break;
+        case 'i': config.interval = atof(optarg); break;
+        default: print_usage(argv[0]);
+        }
+    }
+    if (config.capacity <= 0 || config.capacity > CACHE_SIZE || config.interval <= 0 ||
+        config.max_object > INT32_MAX) {
+        print_usage(argv[0]);
+    }
+
+    FILE *trace = stdin;
+    if (config.trace && strcmp(config.trace, "-") != 0) {
+        trace = fopen(config.trace, "r");
+        if (!trace) {
+            perror(config.trace);
+            return EXIT_FAILURE;
+        }
+    }
+
+    init_cache();
+    set_cache_limits(config.capacity, config.byte_budget);
+    set_cache_policy(config.policy);
+
+    printf("%10s %10s %9s %9s %8s %10s %9s %9s %9s %12s\n", "time_s", "requests", "obj_hit",
+           "byte_hit", "stale", "evictions", "churn", "expired", "objects", "cached_mib");
+
+    char line[LINE_SIZE];
+    sim_counts counts = {0}, total = {0};
+    uint64_t malformed = 0;
+    double first = 0, interval_start = 0;
+    char label[32];
+    int started = 0;
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    while (fgets(line, sizeof(line), trace)) {
+        double timestamp;
+        char *key;
+        int key_len;
+        uint64_t size;
+        long max_age;
+
+        if (parse_event(line, &timestamp, &key, &key_len, &size, &max_age) < 0) {
+            if (line[0] != '#' && line[0] != '\n') malformed++;
+            continue;
+        }
+
+        if (!started) {
+            first = interval_start = timestamp;
+            started = 1;
+        }
+
+        // Close every interval the trace has moved past
+        while (timestamp >= interval_start + config.interval) {
+            counts.evictions = stats_counter_total(STAT_EVICTIONS) - total.evictions;
+            counts.expired = stats_counter_total(STAT_EXPIRED) - total.expired;
+            snprintf(label, sizeof(label), "%.0f", interval_start - first);
+            print_row(label, &counts);
+            accumulate(&total, &counts);
+            memset(&counts, 0, sizeof(counts));
+            interval_start += config.interval;
+        }
+
+        if ((time_t)timestamp != cache_sim_time) {
+            cache_sim_time = (time_t)timestamp;
+            cache_sweep_expired(INT_MAX);
+        }
+        replay(key, key_len, size, max_age, &counts);
+    }
+
+    if (counts.requests > 0) {
+        counts.evictions = stats_counter_total(STAT_EVICTIONS) - total.evictions;
+        counts.expired = stats_counter_total(STAT_EXPIRED) - total.expired;
+        snprintf(label, sizeof(label), "%.0f", interval_start - first);
+        print_row(label, &counts);
+        accumulate(&total, &counts);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall = (wall_end.tv_sec - wall_start.tv_sec) +
+                  (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    print_row("total", &total);
+    fprintf(stderr, "%llu events in %.3f s (%.2f M events/s), %llu malformed lines\n",
+            (unsigned long long)total.requests, wall,
+            wall > 0 ? total.requests / wall / 1e6 : 0.0, (unsigned long long)malformed);
+
+    if (trace != stdin) fclose(trace);
+    return 0;
+}
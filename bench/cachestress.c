@@ -0,0 +1,405 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "epoch.h"
+#include "log.h"
+
+/*
+ * Stress test and scaling benchmark for concurrent cache hits. Reader
+ * threads look keys up while the main thread, as the cache's one writer,
+ * keeps inserting keys that aren't cached, so entries are evicted (and
+ * their slots, headers and bodies retired) under the readers' feet.
+ *
+ * Each configuration runs twice:
+ *   locked     every lookup and write takes one mutex, and a hit moves the
+ *              entry to the front of the list (find_in_cache)
+ *   lock-free  lookups use cache_lookup() inside an epoch section; the
+ *              writer takes no lock
+ *
+ * Every hit is checked against the key it was looked up by (header block
+ * and body bytes), so a slot or body reused while a reader still held it
+ * shows up as a mismatch. Any mismatch fails the run.
+ */
+
+/* ========== Constants ========== */
+// Keys looked up and written; twice the capacity, so about half the lookups hit
+#define KEY_SPACE (2 * CACHE_SIZE)
+#define KEY_SEQUENCE 65536
+#define BODY_SIZE 1024
+#define DEFAULT_DURATION_MS 1000
+#define DEFAULT_WRITE_RATE 20000
+#define MAX_THREADS 64
+
+/**
+ * Request and expected response for one key
+ */
+typedef struct {
+    char request[160];
+    int request_len;
+    char host[32];
+    char uri[32];
+    char headers[128];
+    int header_len;
+} stress_key;
+
+/**
+ * Results of one reader thread for one run, on its own cache line
+ */
+typedef struct {
+    _Alignas(64) int index;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t mismatches;
+    uint64_t failed;      // Lookups that could not enter an epoch section
+} reader_state;
+
+static stress_key keys[KEY_SPACE];
+static int sequence[KEY_SEQUENCE];
+
+// Run configuration, set by the main thread between barriers
+static int run_locked;
+static int run_threads;
+static int running;
+static int finished;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t run_start;
+static pthread_barrier_t run_end;
+
+// Results, on the original stdout
+static FILE *results;
+
+/**
+ * @brief Current monotonic time in nanoseconds
+ *
+ * @return uint64_t Nanoseconds since an arbitrary fixed point
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Body byte at an offset for a key; the first four bytes are the key itself
+ *
+ * @param key Key index
+ * @param offset Offset into the body
+ * @return unsigned char Expected byte
+ */
+static unsigned char body_byte(int key, int offset) {
+    if (offset < 4) {
+        return (unsigned char)(key >> (8 * offset));
+    }
+    return (unsigned char)(key * 31 + offset);
+}
+
+/**
+ * @brief Build the key space and the shared lookup sequence
+ */
+static void build_keys() {
+    for (int i = 0; i < KEY_SPACE; i++) {
+        stress_key *key = &keys[i];
+        snprintf(key->host, sizeof(key->host), "site%d.example.com", i % 13);
+        snprintf(key->uri, sizeof(key->uri), "/obj/%d", i);
+        key->request_len = snprintf(key->request, sizeof(key->request),
+                                    "GET http://site%d.example.com/obj/%d HTTP/1.1\r\n"
+                                    "Host: site%d.example.com\r\n\r\n", i % 13, i, i % 13);
+        key->header_len = snprintf(key->headers, sizeof(key->headers),
+                                   "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                   "Content-Length: %d\r\nX-Key: %d\r\n\r\n", BODY_SIZE, i);
+    }
+
+    unsigned seed = 12345;
+    for (int i = 0; i < KEY_SEQUENCE; i++) {
+        sequence[i] = rand_r(&seed) % KEY_SPACE;
+    }
+}
+
+/**
+ * @brief Check that an entry holds exactly what was cached for a key
+ *
+ * @param entry Entry found for the key
+ * @param key Key index
+ * @return int 1 if it matches, 0 otherwise
+ */
+static int verify(const cache_entry *entry, int key) {
+    const stress_key *expected = &keys[key];
+    if (entry->header_len != expected->header_len ||
+        memcmp(entry->headers, expected->headers, expected->header_len) != 0) {
+        return 0;
+    }
+
+    const cache_body *body = entry->body;
+    if (!body || body->size != BODY_SIZE) {
+        return 0;
+    }
+    for (int offset = 0; offset < 4; offset++) {
+        if ((unsigned char)body->data[offset] != body_byte(key, offset)) {
+            return 0;
+        }
+    }
+    return (unsigned char)body->data[BODY_SIZE - 1] == body_byte(key, BODY_SIZE - 1);
+}
+
+/**
+ * @brief Cache a key if it isn't cached, evicting the policy's victim
+ *
+ * @param key Key index
+ * @return int 1 if it was added, 0 if it was already cached
+ */
+static int write_key(int key) {
+    static char response[sizeof(keys[0].headers) + BODY_SIZE];
+    const stress_key *k = &keys[key];
+
+    if (find_in_cache(k->request, k->request_len)) {
+        return 0;
+    }
+    memcpy(response, k->headers, k->header_len);
+    for (int offset = 0; offset < BODY_SIZE; offset++) {
+        response[k->header_len + offset] = body_byte(key, offset);
+    }
+    add_to_cache(k->request, k->request_len, response, k->header_len + BODY_SIZE,
+                 k->host, k->uri, 0, 0);
+    return 1;
+}
+
+/**
+ * @brief Look keys up until the run is stopped
+ *
+ * @param state This thread's results
+ */
+static void run_reads(reader_state *state) {
+    int position = state->index * (KEY_SEQUENCE / MAX_THREADS);
+
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        // Check the stop flag every batch, not every lookup
+        for (int i = 0; i < 256; i++) {
+            int key = sequence[position++ & (KEY_SEQUENCE - 1)];
+            const stress_key *k = &keys[key];
+
+            if (run_locked) {
+                pthread_mutex_lock(&cache_mutex);
+                cache_entry *entry = find_in_cache(k->request, k->request_len);
+                if (entry) {
+                    state->hits++;
+                    state->mismatches += !verify(entry, key);
+                }
+                pthread_mutex_unlock(&cache_mutex);
+            } else {
+                if (epoch_enter() < 0) {
+                    state->failed++;
+                    continue;
+                }
+                cache_entry *entry = cache_lookup(k->request, k->request_len);
+                if (entry) {
+                    state->hits++;
+                    state->mismatches += !verify(entry, key);
+                }
+                epoch_exit();
+            }
+            state->lookups++;
+        }
+    }
+}
+
+/**
+ * @brief Reader thread: run reads for every run it takes part in
+ *
+ * @param arg reader_state for this thread
+ * @return void* NULL
+ */
+static void* reader_loop(void *arg) {
+    reader_state *state = arg;
+
+    while (1) {
+        pthread_barrier_wait(&run_start);
+        if (finished) {
+            return NULL;
+        }
+        if (state->index < run_threads) {
+            run_reads(state);
+        }
+        pthread_barrier_wait(&run_end);
+    }
+}
+
+/**
+ * @brief Run one configuration and print its line
+ *
+ * @param locked Whether lookups take the mutex
+ * @param threads Reader threads taking part
+ * @param duration_ms How long to run
+ * @param write_rate Writes attempted per second by the writer (0 for as fast as it can)
+ * @param states Reader results, one per thread
+ * @return uint64_t Mismatches seen
+ */
+static uint64_t run(int locked, int threads, int duration_ms, long write_rate, reader_state *states) {
+    for (int i = 0; i < threads; i++) {
+        states[i].lookups = states[i].hits = states[i].mismatches = states[i].failed = 0;
+    }
+    run_locked = locked;
+    run_threads = threads;
+    __atomic_store_n(&running, 1, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&run_start);
+
+    // The main thread is the writer, paced in 1 ms steps
+    uint64_t start = now_ns();
+    uint64_t end = start + duration_ms * 1000000ull;
+    uint64_t attempts = 0, writes = 0;
+    int position = KEY_SEQUENCE / 2;
+    uint64_t now;
+    while ((now = now_ns()) < end) {
+        uint64_t due = write_rate ? (now - start) * write_rate / 1000000000ull : attempts + 64;
+        while (attempts < due) {
+            int key = sequence[position++ & (KEY_SEQUENCE - 1)];
+            if (locked) pthread_mutex_lock(&cache_mutex);
+            writes += write_key(key);
+            if (locked) pthread_mutex_unlock(&cache_mutex);
+            attempts++;
+        }
+        if (write_rate) {
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&run_end);
+    double seconds = (now_ns() - start) / 1e9;
+
+    uint64_t lookups = 0, hits = 0, mismatches = 0, failed = 0;
+    for (int i = 0; i < threads; i++) {
+        lookups += states[i].lookups;
+        hits += states[i].hits;
+        mismatches += states[i].mismatches;
+        failed += states[i].failed;
+    }
+    fprintf(results, "%-10s %7d %14.0f %14.0f %9.3f %10.0f %10llu\n",
+            locked ? "locked" : "lock-free", threads, lookups / seconds, lookups / seconds / threads,
+            lookups ? (double)hits / lookups : 0.0, writes / seconds, (unsigned long long)mismatches);
+    if (failed) {
+        fprintf(stderr, "  %llu lookups found no free epoch slot\n", (unsigned long long)failed);
+    }
+    return mismatches;
+}
+
+/**
+ * @brief Print usage and exit
+ *
+ * @param prog_name Name of the running program (argv[0])
+ */
+static void usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s [-t <max-threads>] [-d <ms-per-run>] [-w <writes-per-second>] [-P lru|fifo|clock]\n",
+            prog_name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return int Exit status: 0 if no hit ever saw another key's data
+ */
+int main(int argc, char *argv[]) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = online > 0 ? (int)online : 1;
+    int duration_ms = DEFAULT_DURATION_MS;
+    long write_rate = DEFAULT_WRITE_RATE;
+    cache_policy policy = CACHE_POLICY_LRU;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            duration_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            write_rate = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-P") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "lru")) policy = CACHE_POLICY_LRU;
+            else if (!strcmp(argv[i], "fifo")) policy = CACHE_POLICY_FIFO;
+            else if (!strcmp(argv[i], "clock")) policy = CACHE_POLICY_CLOCK;
+            else usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS || duration_ms <= 0 || write_rate < 0) {
+        usage(argv[0]);
+    }
+
+    // Keep results on the original stdout, send the cache's log lines to /dev/null
+    int results_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (results_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        perror("stdout redirect");
+        return EXIT_FAILURE;
+    }
+    close(null_fd);
+    results = fdopen(results_fd, "w");
+    if (!results) {
+        perror("fdopen");
+        return EXIT_FAILURE;
+    }
+    setvbuf(results, NULL, _IOLBF, 0);
+
+    // Eviction lines go through the asynchronous writer, as in the proxy
+    init_logger();
+    build_keys();
+    init_cache();
+    set_cache_limits(CACHE_SIZE, 0);
+    set_cache_policy(policy);
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        write_key(sequence[i]);
+    }
+
+    pthread_barrier_init(&run_start, NULL, max_threads + 1);
+    pthread_barrier_init(&run_end, NULL, max_threads + 1);
+    static reader_state states[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < max_threads; i++) {
+        states[i].index = i;
+        if (pthread_create(&threads[i], NULL, reader_loop, &states[i]) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(results, "%-10s %7s %14s %14s %9s %10s %10s\n", "mode", "threads", "lookups/s",
+            "per-thread", "hit-ratio", "writes/s", "mismatches");
+    uint64_t mismatches = 0;
+    for (int locked = 1; locked >= 0; locked--) {
+        for (int count = 1; ; count *= 2) {
+            if (count > max_threads) {
+                count = max_threads;
+            }
+            mismatches += run(locked, count, duration_ms, write_rate, states);
+            if (count == max_threads) {
+                break;
+            }
+        }
+    }
+
+    finished = 1;
+    pthread_barrier_wait(&run_start);
+    for (int i = 0; i < max_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (mismatches) {
+        fprintf(stderr, "%llu hits returned another key's data\n", (unsigned long long)mismatches);
+    }
+    fclose(results);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,356 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+/*
+ * Closed-loop load generator. Each connection thread sends one request per
+ * TCP connection through the proxy (the proxy does not keep connections
+ * alive), reads the response to EOF and records its latency.
+ */
+
+/* ========== Constants ========== */
+#define READ_CHUNK (16 * 1024)
+#define MAX_AUTHORITY 128
+#define MAX_NAME 64
+#define MAX_CC_SIZE 128
+
+/**
+ * Scenario settings from the command line
+ */
+typedef struct {
+    char name[MAX_NAME];
+    char proxy_host[MAX_AUTHORITY];
+    char proxy_port[16];
+    char origin[MAX_AUTHORITY];       // Authority used in request URLs
+    char cache_control[MAX_CC_SIZE];
+    int connections;
+    long requests;
+    long keys;                        // 0 = every request a new key
+    long size;
+    long delay_ms;
+    long read_rate;                   // Bytes/s per connection, 0 = unlimited
+    const char *output;
+} scenario;
+
+/**
+ * Results gathered by one connection thread
+ */
+typedef struct {
+    double *latencies_ms;
+    long completed;
+    long errors;
+    uint64_t bytes;
+    unsigned seed;
+} worker_result;
+
+static scenario config;
+
+// Next request number, shared by all threads
+static long next_request;
+
+// Run id keeping keys of different scenarios and runs apart
+static long run_id;
+
+/**
+ * @brief Prints usage instructions and exits the program.
+ *
+ * @param prog_name Name of the running program (argv[0])
+ */
+static void print_usage(const char *prog_name) {
+    fprintf(stderr,
+            "Usage: %s -t <name> [-x proxy-host:port] [-o origin-host:port] [-c connections]\n"
+            "          [-n requests] [-k keys (0 = unique)] [-s size] [-l origin-delay-ms]\n"
+            "          [-m cache-control] [-r read-bytes-per-sec] [-O output-file]\n",
+            prog_name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Current monotonic time in milliseconds (fractional)
+ *
+ * @return double Milliseconds since an arbitrary fixed point
+ */
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Connect to the proxy
+ *
+ * @return int Socket, or -1 on error
+ */
+static int connect_proxy() {
+    struct addrinfo hints, *res, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(config.proxy_host, config.proxy_port, &hints, &res) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (rp = res; rp; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * @brief Issue one request and read the response to EOF
+ *
+ * @param key Object key
+ * @param bytes Receives bytes read
+ * @return int 0 on a complete 200 response, -1 otherwise
+ */
+static int run_request(long key, uint64_t *bytes) {
+    char request[1024];
+    int len = snprintf(request, sizeof(request),
+                       "GET http://%s/obj/%ld-%s-%ld?size=%ld&delay=%ld%s%s HTTP/1.1\r\n"
+                       "Host: %s\r\nConnection: close\r\n\r\n",
+                       config.origin, run_id, config.name, key, config.size, config.delay_ms,
+                       config.cache_control[0] ? "&cc=" : "", config.cache_control,
+                       config.origin);
+
+    int fd = connect_proxy();
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        close(fd);
+        return -1;
+    }
+
+    char buf[READ_CHUNK];
+    char status[16] = {0};
+    uint64_t received = 0;
+    double started = now_ms();
+
+    while (1) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        if (received < sizeof(status) - 1) {
+            size_t take = sizeof(status) - 1 - received;
+            memcpy(status + received, buf, (size_t)n < take ? (size_t)n : take);
+        }
+        received += n;
+
+        // Slow client: don't read faster than the configured rate
+        if (config.read_rate > 0) {
+            double due = started + received * 1e3 / config.read_rate;
+            double wait = due - now_ms();
+            if (wait > 0) {
+                long wait_ns = (long)(wait * 1e6);
+                struct timespec ts = {wait_ns / 1000000000, wait_ns % 1000000000};
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+
+    close(fd);
+    *bytes = received;
+
+    if (strncmp(status, "HTTP/1.1 200", 12) != 0 && strncmp(status, "HTTP/1.0 200", 12) != 0) {
+        return -1;
+    }
+    return received >= (uint64_t)config.size ? 0 : -1;
+}
+
+/**
+ * @brief Connection thread: issue requests until the shared budget runs out
+ *
+ * @param arg worker_result for this thread
+ * @return void* NULL
+ */
+static void* worker_loop(void *arg) {
+    worker_result *result = arg;
+
+    long request;
+    while ((request = __atomic_fetch_add(&next_request, 1, __ATOMIC_RELAXED)) < config.requests) {
+        long key = config.keys > 0 ? rand_r(&result->seed) % config.keys : request;
+        uint64_t bytes = 0;
+
+        double start = now_ms();
+        int ok = run_request(key, &bytes);
+        double elapsed = now_ms() - start;
+
+        result->bytes += bytes;
+        if (ok < 0) {
+            result->errors++;
+            continue;
+        }
+        result->latencies_ms[result->completed++] = elapsed;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief qsort comparator for doubles
+ *
+ * @param a First value
+ * @param b Second value
+ * @return int Ordering
+ */
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Value at a quantile of a sorted array
+ *
+ * @param sorted Sorted samples
+ * @param count Number of samples
+ * @param quantile Quantile in [0, 1]
+ * @return double Sample at the quantile, 0 if there are none
+ */
+static double percentile(const double *sorted, long count, double quantile) {
+    if (count == 0) return 0;
+    long index = (long)(quantile * count + 0.5) - 1;
+    if (index < 0) index = 0;
+    if (index >= count) index = count - 1;
+    return sorted[index];
+}
+
+/**
+ * @brief Split "host:port" into the proxy fields
+ *
+ * @param authority Proxy address
+ */
+static void set_proxy(const char *authority) {
+    const char *colon = strrchr(authority, ':');
+    if (!colon || colon == authority) {
+        fprintf(stderr, "Proxy must be host:port\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(config.proxy_host, sizeof(config.proxy_host), "%.*s",
+             (int)(colon - authority), authority);
+    snprintf(config.proxy_port, sizeof(config.proxy_port), "%s", colon + 1);
+}
+
+/**
+ * @brief Main function.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return int Exit status
+ */
+int main(int argc, char *argv[]) {
+    set_proxy("127.0.0.1:18080");
+    snprintf(config.origin, sizeof(config.origin), "127.0.0.1:18081");
+    snprintf(config.cache_control, sizeof(config.cache_control), "max-age=600");
+    config.connections = 8;
+    config.requests = 2000;
+    config.keys = 8;
+    config.size = 1024;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:x:o:c:n:k:s:l:m:r:O:")) != -1) {
+        switch (opt) {
+        case 't': snprintf(config.name, sizeof(config.name), "%s", optarg); break;
+        case 'x': set_proxy(optarg); break;
+        case 'o': snprintf(config.origin, sizeof(config.origin), "%s", optarg); break;
+        case 'c': config.connections = atoi(optarg); break;
+        case 'n': config.requests = atol(optarg); break;
+        case 'k': config.keys = atol(optarg); break;
+        case 's': config.size = atol(optarg); break;
+        case 'l': config.delay_ms = atol(optarg); break;
+        case 'm': snprintf(config.cache_control, sizeof(config.cache_control), "%s", optarg); break;
+        case 'r': config.read_rate = atol(optarg); break;
+        case 'O': config.output = optarg; break;
+        default: print_usage(argv[0]);
+        }
+    }
+    if (!config.name[0] || config.connections <= 0 || config.requests <= 0) {
+        print_usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    run_id = (long)time(NULL);
+
+    worker_result *results = calloc(config.connections, sizeof(worker_result));
+    pthread_t *threads = calloc(config.connections, sizeof(pthread_t));
+    if (!results || !threads) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    double start = now_ms();
+    for (int i = 0; i < config.connections; i++) {
+        results[i].latencies_ms = malloc(config.requests * sizeof(double));
+        results[i].seed = (unsigned)(run_id + i);
+        if (!results[i].latencies_ms ||
+            pthread_create(&threads[i], NULL, worker_loop, &results[i]) != 0) {
+            fprintf(stderr, "Failed to start connection thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    long completed = 0, errors = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < config.connections; i++) {
+        pthread_join(threads[i], NULL);
+        completed += results[i].completed;
+        errors += results[i].errors;
+        bytes += results[i].bytes;
+    }
+    double duration_s = (now_ms() - start) / 1e3;
+
+    // Merge and sort every latency sample
+    double *all = malloc((completed ? completed : 1) * sizeof(double));
+    long n = 0;
+    for (int i = 0; i < config.connections; i++) {
+        memcpy(all + n, results[i].latencies_ms, results[i].completed * sizeof(double));
+        n += results[i].completed;
+        free(results[i].latencies_ms);
+    }
+    qsort(all, n, sizeof(double), compare_double);
+
+    char line[512];
+    snprintf(line, sizeof(line),
+             "{\"scenario\":\"%s\",\"connections\":%d,\"requests\":%ld,\"errors\":%ld,"
+             "\"object_bytes\":%ld,\"duration_s\":%.3f,\"req_per_s\":%.1f,\"mib_per_s\":%.2f,"
+             "\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f}\n",
+             config.name, config.connections, completed, errors, config.size, duration_s,
+             completed / duration_s, bytes / duration_s / (1024.0 * 1024.0),
+             percentile(all, n, 0.5), percentile(all, n, 0.99), percentile(all, n, 0.999));
+
+    fputs(line, stdout);
+    if (config.output) {
+        FILE *out = fopen(config.output, "a");
+        if (!out) {
+            perror(config.output);
+            return EXIT_FAILURE;
+        }
+        fputs(line, out);
+        fclose(out);
+    }
+
+    free(all);
+    free(results);
+    free(threads);
+    return errors > 0 ? 2 : 0;
+}
@@ -0,0 +1,429 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "hpack.h"
+
+/*
+ * Origin stand-in for the benchmarks. Every response is described by the
+ * request's query string, so the load generator drives each scenario:
+ *
+ *     GET /obj/<key>?size=<bytes>&delay=<ms>&cc=<cache-control>
+ *
+ * The body is <size> bytes of filler, sent after <delay> ms, with the
+ * Cache-Control header set to <cc> when given. With -2 the same objects are
+ * served over prior-knowledge h2c instead, each request a stream on a
+ * connection that stays open.
+ */
+
+/* ========== Constants ========== */
+#define REQUEST_SIZE 8192
+#define FILLER_SIZE (64 * 1024)
+#define MAX_CC_SIZE 128
+
+// HTTP/2 framing for -2
+#define H2_FRAME_HEADER 9
+#define H2_MAX_FRAME 16384
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_SIZE 24
+
+// Body bytes, repeated as often as the requested size needs
+static char filler[FILLER_SIZE];
+
+/**
+ * Response parameters taken from the query string
+ */
+typedef struct {
+    long size;
+    long delay_ms;
+    char cache_control[MAX_CC_SIZE];
+} object_spec;
+
+/**
+ * @brief Prints usage instructions and exits the program.
+ *
+ * @param prog_name Name of the running program (argv[0])
+ */
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s -p <listen-port> [-2]\n", prog_name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Send a whole buffer
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on error
+ */
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fill an object_spec from a request target
+ *
+ * @param target Request target, origin-form or absolute-form
+ * @param spec Receives the parameters
+ */
+static void parse_target(const char *target, object_spec *spec) {
+    spec->size = 1024;
+    spec->delay_ms = 0;
+    spec->cache_control[0] = '\0';
+
+    const char *query = strchr(target, '?');
+    if (!query) {
+        return;
+    }
+
+    char params[REQUEST_SIZE];
+    snprintf(params, sizeof(params), "%s", query + 1);
+
+    char *saveptr = NULL;
+    for (char *param = strtok_r(params, "&", &saveptr); param;
+         param = strtok_r(NULL, "&", &saveptr)) {
+        char *value = strchr(param, '=');
+        if (!value) continue;
+        *value++ = '\0';
+
+        if (strcmp(param, "size") == 0) {
+            spec->size = atol(value);
+        } else if (strcmp(param, "delay") == 0) {
+            spec->delay_ms = atol(value);
+        } else if (strcmp(param, "cc") == 0) {
+            snprintf(spec->cache_control, sizeof(spec->cache_control), "%s", value);
+        }
+    }
+}
+
+/**
+ * @brief Serve one request on a connection, then close it
+ *
+ * @param arg Client socket, cast through intptr_t
+ * @return void* NULL
+ */
+static void* serve_client(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char request[REQUEST_SIZE];
+    size_t len = 0;
+
+    // Read up to the end of the headers
+    while (len < sizeof(request) - 1) {
+        ssize_t bytes = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) {
+            close(fd);
+            return NULL;
+        }
+        len += bytes;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+
+    char method[16], target[REQUEST_SIZE];
+    if (sscanf(request, "%15s %8191s", method, target) != 2) {
+        close(fd);
+        return NULL;
+    }
+
+    object_spec spec;
+    parse_target(target, &spec);
+
+    if (spec.delay_ms > 0) {
+        struct timespec ts = {spec.delay_ms / 1000, (spec.delay_ms % 1000) * 1000000};
+        nanosleep(&ts, NULL);
+    }
+
+    char header[512];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                              "Content-Length: %ld\r\n%s%s%sConnection: close\r\n\r\n",
+                              spec.size,
+                              spec.cache_control[0] ? "Cache-Control: " : "",
+                              spec.cache_control,
+                              spec.cache_control[0] ? "\r\n" : "");
+
+    if (send_all(fd, header, header_len) == 0) {
+        long remaining = spec.size;
+        while (remaining > 0) {
+            size_t chunk = remaining < FILLER_SIZE ? (size_t)remaining : FILLER_SIZE;
+            if (send_all(fd, filler, chunk) < 0) break;
+            remaining -= chunk;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Read exactly len bytes
+ *
+ * @param fd Socket to read from
+ * @param buf Destination
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on EOF or error
+ */
+static int recv_all(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t bytes = recv(fd, buf, len, 0);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) return -1;
+        buf += bytes;
+        len -= bytes;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send one HTTP/2 frame
+ *
+ * @param fd Socket to write to
+ * @param type Frame type
+ * @param flags Frame flags
+ * @param stream Stream identifier
+ * @param payload Payload
+ * @param len Payload length
+ * @return int 0 on success, -1 on error
+ */
+static int send_frame(int fd, uint8_t type, uint8_t flags, uint32_t stream,
+                      const void *payload, size_t len) {
+    // One write per frame, so Nagle never holds back a header without its payload
+    static _Thread_local char frame[H2_FRAME_HEADER + H2_MAX_FRAME];
+    uint8_t header[H2_FRAME_HEADER] = {
+        len >> 16, len >> 8, len, type, flags, stream >> 24, stream >> 16, stream >> 8, stream,
+    };
+    memcpy(frame, header, sizeof(header));
+    if (len) {
+        memcpy(frame + sizeof(header), payload, len);
+    }
+    return send_all(fd, frame, sizeof(header) + len);
+}
+
+/**
+ * @brief Keep the :path of a decoded request
+ *
+ * @param ctx Target buffer, REQUEST_SIZE bytes
+ * @return int 0
+ */
+static int take_path(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+    if (name_len == 5 && memcmp(name, ":path", 5) == 0 && value_len < REQUEST_SIZE) {
+        memcpy(ctx, value, value_len);
+        ((char *)ctx)[value_len] = '\0';
+    }
+    return 0;
+}
+
+/**
+ * @brief Answer one stream
+ *
+ * Bodies are sent without waiting on WINDOW_UPDATE; the proxy's 16 MiB
+ * windows cover every benchmark object.
+ *
+ * @param fd Socket to write to
+ * @param stream Stream identifier
+ * @param target Request :path
+ * @return int 0 on success, -1 on error
+ */
+static int serve_stream(int fd, uint32_t stream, const char *target) {
+    object_spec spec;
+    parse_target(target, &spec);
+
+    if (spec.delay_ms > 0) {
+        struct timespec ts = {spec.delay_ms / 1000, (spec.delay_ms % 1000) * 1000000};
+        nanosleep(&ts, NULL);
+    }
+
+    uint8_t block[512];
+    size_t block_len = 0;
+    char length[32];
+    snprintf(length, sizeof(length), "%ld", spec.size);
+    hpack_encode(block, sizeof(block), &block_len, ":status", 7, "200", 3);
+    hpack_encode(block, sizeof(block), &block_len, "content-type", 12, "application/octet-stream", 24);
+    hpack_encode(block, sizeof(block), &block_len, "content-length", 14, length, strlen(length));
+    if (spec.cache_control[0]) {
+        hpack_encode(block, sizeof(block), &block_len, "cache-control", 13,
+                     spec.cache_control, strlen(spec.cache_control));
+    }
+
+    // HEADERS with END_HEADERS, and END_STREAM too if there is no body
+    if (send_frame(fd, 0x1, spec.size > 0 ? 0x4 : 0x5, stream, block, block_len) < 0) {
+        return -1;
+    }
+
+    long remaining = spec.size;
+    long offset = 0;
+    while (remaining > 0) {
+        size_t chunk = remaining < H2_MAX_FRAME ? (size_t)remaining : H2_MAX_FRAME;
+        const char *data = filler + offset % FILLER_SIZE;
+        if ((size_t)(FILLER_SIZE - offset % FILLER_SIZE) < chunk) {
+            chunk = FILLER_SIZE - offset % FILLER_SIZE;
+        }
+        remaining -= chunk;
+        offset += chunk;
+        if (send_frame(fd, 0x0, remaining == 0 ? 0x1 : 0, stream, data, chunk) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Serve requests as HTTP/2 streams until the client closes the connection
+ *
+ * @param arg Client socket, cast through intptr_t
+ * @return void* NULL
+ */
+static void* serve_h2_client(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    static _Thread_local uint8_t payload[H2_MAX_FRAME];
+    static _Thread_local uint8_t header_block[4 * H2_MAX_FRAME];
+    size_t block_len = 0;
+    char target[REQUEST_SIZE];
+    hpack_table table;
+    hpack_init(&table);
+
+    // Responses end with a small frame that should not wait for an ACK
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint8_t preface[H2_PREFACE_SIZE];
+    if (recv_all(fd, preface, sizeof(preface)) < 0 || memcmp(preface, H2_PREFACE, H2_PREFACE_SIZE) != 0 ||
+        send_frame(fd, 0x4, 0, 0, NULL, 0) < 0) {
+        goto done;
+    }
+
+    while (1) {
+        uint8_t header[H2_FRAME_HEADER];
+        if (recv_all(fd, header, sizeof(header)) < 0) break;
+        size_t len = ((size_t)header[0] << 16) | (header[1] << 8) | header[2];
+        uint8_t type = header[3], flags = header[4];
+        uint32_t stream = ((uint32_t)(header[5] & 0x7f) << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+        if (len > H2_MAX_FRAME || recv_all(fd, payload, len) < 0) break;
+
+        if (type == 0x4 && !(flags & 0x1)) {
+            // SETTINGS: acknowledge
+            if (send_frame(fd, 0x4, 0x1, 0, NULL, 0) < 0) break;
+        } else if (type == 0x6 && !(flags & 0x1)) {
+            // PING: echo
+            if (send_frame(fd, 0x6, 0x1, 0, payload, len) < 0) break;
+        } else if (type == 0x1 || type == 0x9) {
+            // HEADERS (possibly padded or with priority) and CONTINUATION
+            const uint8_t *fragment = payload;
+            size_t fragment_len = len;
+            if (type == 0x1 && (flags & 0x8)) {
+                if (fragment_len < 1u + fragment[0]) break;
+                fragment_len -= 1 + fragment[0];
+                fragment++;
+            }
+            if (type == 0x1 && (flags & 0x20)) {
+                if (fragment_len < 5) break;
+                fragment += 5;
+                fragment_len -= 5;
+            }
+            if (type == 0x1) block_len = 0;
+            if (block_len + fragment_len > sizeof(header_block)) break;
+            memcpy(header_block + block_len, fragment, fragment_len);
+            block_len += fragment_len;
+
+            if (flags & 0x4) {
+                strcpy(target, "/");
+                if (hpack_decode(&table, header_block, block_len, take_path, target) < 0 ||
+                    serve_stream(fd, stream, target) < 0) {
+                    break;
+                }
+            }
+        } else if (type == 0x7) {
+            // GOAWAY
+            break;
+        }
+    }
+
+done:
+    hpack_free(&table);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Main function.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return int Exit status
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > 4 || strcmp(argv[1], "-p") != 0 || (argc == 4 && strcmp(argv[3], "-2") != 0)) {
+        print_usage(argv[0]);
+    }
+    void *(*serve)(void *) = argc == 4 ? serve_h2_client : serve_client;
+    int port = atoi(argv[2]);
+    if (port <= 0) {
+        print_usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < sizeof(filler); i++) {
+        filler[i] = 'a' + i % 26;
+    }
+
+    int listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    int re = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &re, sizeof(re));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listen_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_socket, 128) < 0) {
+        perror("bind/listen");
+        return EXIT_FAILURE;
+    }
+
+    while (1) {
+        int fd = accept(listen_socket, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) perror("accept");
+            continue;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return 0;
+}
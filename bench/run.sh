@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# End-to-end benchmark: starts the origin stand-in and the proxy on loopback,
+# runs each scenario through the load generator and appends one JSON line
+# per scenario to $BENCH_OUTPUT.
+#
+# Environment: PROXY (binary, default ./htproxy), BENCH_OUTPUT (default
+# bench_output.txt), PROXY_PORT (18080), ORIGIN_PORT (18081), ADMIN_PORT (18082),
+# H2_ORIGIN_PORT (18083, the origin stand-in speaking h2c)
+
+BENCH_DIR=$(dirname "$0")
+PROXY=${PROXY:-./htproxy}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench_output.txt}
+PROXY_PORT=${PROXY_PORT:-18080}
+ORIGIN_PORT=${ORIGIN_PORT:-18081}
+ADMIN_PORT=${ADMIN_PORT:-18082}
+H2_ORIGIN_PORT=${H2_ORIGIN_PORT:-18083}
+
+"$BENCH_DIR/origin" -p "$ORIGIN_PORT" &
+ORIGIN_PID=$!
+"$BENCH_DIR/origin" -p "$H2_ORIGIN_PORT" -2 &
+H2_ORIGIN_PID=$!
+"$PROXY" -p "$PROXY_PORT" -c -a "$ADMIN_PORT" -2 "127.0.0.1:$H2_ORIGIN_PORT" > /dev/null 2>&1 &
+PROXY_PID=$!
+trap 'kill $ORIGIN_PID $H2_ORIGIN_PID $PROXY_PID 2>/dev/null' EXIT INT TERM
+sleep 0.5
+
+: > "$BENCH_OUTPUT"
+status=0
+
+run() {
+    "$BENCH_DIR/loadgen" -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:${RUN_ORIGIN_PORT:-$ORIGIN_PORT}" \
+        -O "$BENCH_OUTPUT" "$@" || status=1
+}
+
+# Few keys, all cacheable: almost every request is a cache hit
+run -t hit-heavy -c 8 -n 4000 -k 8 -s 4096
+
+# Every key new: every request goes to the origin
+run -t miss-heavy -c 8 -n 2000 -k 0 -s 4096
+
+# Same misses as streams on a pooled h2c connection
+RUN_ORIGIN_PORT=$H2_ORIGIN_PORT run -t miss-heavy-h2 -c 8 -n 2000 -k 0 -s 4096
+
+# Objects too large to cache, streamed through
+run -t large-object -c 4 -n 100 -k 0 -s 2097152
+
+# Clients reading at 4 MiB/s each
+run -t slow-client -c 4 -n 40 -k 0 -s 262144 -r 4194304
+
+# Proxy's own view of the run
+curl -s "http://127.0.0.1:$ADMIN_PORT/metrics" > "$BENCH_OUTPUT.metrics" 2>/dev/null
+
+echo "Results written to $BENCH_OUTPUT"
+exit $status
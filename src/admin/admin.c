@@ -0,0 +1,392 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "admin.h"
+#include "stats.h"
+#include "cache.h"
+
+/**
+ * States of the job slot shared with the serving loop
+ */
+enum {
+    JOB_IDLE,
+    JOB_QUEUED,
+    JOB_DONE,
+};
+
+/**
+ * Purge handed from the admin thread to the serving loop
+ */
+typedef struct {
+    cache_purge_scope scope;
+    char host[MAX_HOSTNAME_SIZE];
+    char path[ADMIN_REQUEST_SIZE];
+    int purged;
+    int state;
+} purge_job;
+
+// Listening socket for the admin thread
+static int admin_socket = -1;
+
+// Single job slot; the admin thread serves one client at a time
+static purge_job job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Create the loopback-only admin listening socket
+ *
+ * @param port Port to listen on
+ * @return int Listening socket, or -1 on error
+ */
+static int create_admin_socket(int port) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("admin socket");
+        return -1;
+    }
+
+    int re = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &re, sizeof(re)) < 0) {
+        perror("admin setsockopt SO_REUSEADDR");
+        close(sockfd);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("admin bind");
+        close(sockfd);
+        return -1;
+    }
+
+    if (listen(sockfd, 8) < 0) {
+        perror("admin listen");
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+/**
+ * @brief Send a complete HTTP response and nothing else
+ *
+ * The admin thread uses plain blocking sockets; the I/O backend belongs to
+ * the serving loop.
+ *
+ * @param fd Client socket
+ * @param status Status line after "HTTP/1.1 "
+ * @param content_type Content-Type header value
+ * @param body Response body
+ * @param body_len Length of body
+ */
+static void send_response(int fd, const char *status, const char *content_type,
+                          const char *body, size_t body_len) {
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n",
+                              status, content_type, body_len);
+
+    if (send(fd, header, header_len, MSG_NOSIGNAL) < 0) {
+        return;
+    }
+
+    size_t sent = 0;
+    while (sent < body_len) {
+        ssize_t bytes = send(fd, body + sent, body_len - sent, MSG_NOSIGNAL);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        sent += bytes;
+    }
+}
+
+/**
+ * @brief Run cache jobs queued by the admin thread
+ */
+void admin_run_jobs() {
+    pthread_mutex_lock(&job_lock);
+    if (job.state == JOB_QUEUED) {
+        job.purged = cache_purge(job.host, job.path, job.scope);
+        job.state = JOB_DONE;
+        pthread_cond_signal(&job_cond);
+    }
+    pthread_mutex_unlock(&job_lock);
+}
+
+/**
+ * @brief Queue a purge for the serving loop and wait for the result
+ *
+ * @param scope What to match
+ * @param host Host
+ * @param path Path or path prefix
+ * @return int Entries purged, or -1 if the purge failed or the loop never picked it up
+ */
+static int submit_purge(cache_purge_scope scope, const char *host, const char *path) {
+    pthread_mutex_lock(&job_lock);
+
+    job.scope = scope;
+    snprintf(job.host, sizeof(job.host), "%s", host);
+    snprintf(job.path, sizeof(job.path), "%s", path);
+    job.state = JOB_QUEUED;
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ADMIN_JOB_TIMEOUT_MS / 1000;
+    until.tv_nsec += (long)(ADMIN_JOB_TIMEOUT_MS % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    while (job.state == JOB_QUEUED) {
+        if (pthread_cond_timedwait(&job_cond, &job_lock, &until) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    // A job still queued is withdrawn; the loop only runs it under the lock
+    int result = job.state == JOB_DONE ? job.purged : -1;
+    job.state = JOB_IDLE;
+
+    pthread_mutex_unlock(&job_lock);
+    return result;
+}
+
+/**
+ * @brief Value of a hex digit
+ *
+ * @param c Character
+ * @return int 0-15, or -1 if c is not a hex digit
+ */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * @brief Find a query string parameter and percent-decode its value
+ *
+ * @param query Query string (after '?')
+ * @param name Parameter name
+ * @param out Receives the decoded value
+ * @param out_size Size of out
+ * @return int 1 if found, 0 if absent, -1 if malformed or too long
+ */
+static int query_param(const char *query, const char *name, char *out, size_t out_size) {
+    size_t name_len = strlen(name);
+
+    while (*query) {
+        const char *end = strchr(query, '&');
+        if (!end) end = query + strlen(query);
+
+        if ((size_t)(end - query) > name_len && strncmp(query, name, name_len) == 0 &&
+            query[name_len] == '=') {
+            size_t len = 0;
+            for (const char *p = query + name_len + 1; p < end; p++) {
+                char c = *p;
+                if (c == '%') {
+                    if (end - p < 3 || hex_value(p[1]) < 0 || hex_value(p[2]) < 0) return -1;
+                    c = (char)(hex_value(p[1]) * 16 + hex_value(p[2]));
+                    p += 2;
+                } else if (c == '+') {
+                    c = ' ';
+                }
+                if (len + 1 >= out_size) return -1;
+                out[len++] = c;
+            }
+            out[len] = '\0';
+            return 1;
+        }
+
+        query = *end ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Handle PURGE /cache?...
+ *
+ * @param fd Client socket
+ * @param query Query string, or NULL if there was none
+ */
+static void handle_purge(int fd, const char *query) {
+    static char url[ADMIN_REQUEST_SIZE], host[MAX_HOSTNAME_SIZE], path[ADMIN_REQUEST_SIZE];
+    cache_purge_scope scope = CACHE_PURGE_URL;
+    const char *error = NULL;
+
+    int has_url = query ? query_param(query, "url", url, sizeof(url)) : 0;
+    int has_host = query ? query_param(query, "host", host, sizeof(host)) : 0;
+    int has_prefix = query ? query_param(query, "prefix", path, sizeof(path)) : 0;
+
+    if (has_url < 0 || has_host < 0 || has_prefix < 0) {
+        error = "Malformed or oversized parameter\n";
+    } else if (has_url == 1 && has_host == 0 && has_prefix == 0) {
+        // http://host[:port]/path, the host as clients send it in Host
+        if (strncasecmp(url, "http://", 7) != 0) {
+            error = "url must start with http://\n";
+        } else {
+            const char *authority = url + 7;
+            size_t host_len = strcspn(authority, "/");
+            if (host_len == 0 || host_len >= sizeof(host)) {
+                error = "url has no valid host\n";
+            } else {
+                memcpy(host, authority, host_len);
+                host[host_len] = '\0';
+                snprintf(path, sizeof(path), "%s", authority[host_len] ? authority + host_len : "/");
+                scope = CACHE_PURGE_URL;
+            }
+        }
+    } else if (has_url == 0 && has_host == 1 && host[0]) {
+        if (has_prefix == 1 && path[0] != '/') {
+            error = "prefix must start with /\n";
+        }
+        scope = has_prefix == 1 ? CACHE_PURGE_PREFIX : CACHE_PURGE_HOST;
+    } else {
+        error = "Give url=<absolute-url>, host=<host> or host=<host>&prefix=<path>\n";
+    }
+
+    if (error) {
+        send_response(fd, "400 Bad Request", "text/plain", error, strlen(error));
+        return;
+    }
+
+    int purged = submit_purge(scope, host, scope == CACHE_PURGE_HOST ? "/" : path);
+    if (purged < 0) {
+        static const char body[] = "Purge did not complete, try again\n";
+        send_response(fd, "503 Service Unavailable", "text/plain", body, sizeof(body) - 1);
+        return;
+    }
+
+    char body[64];
+    int body_len = snprintf(body, sizeof(body), "Purged %d\n", purged);
+    send_response(fd, "200 OK", "text/plain", body, body_len);
+}
+
+/**
+ * @brief Read one admin request and answer it
+ *
+ * @param fd Client socket
+ */
+static void handle_admin_client(int fd) {
+    char request[ADMIN_REQUEST_SIZE];
+    size_t len = 0;
+
+    struct timeval tv = {ADMIN_TIMEOUT_MS / 1000, (ADMIN_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // Read until the end of the headers (admin requests carry no body)
+    while (len < sizeof(request) - 1) {
+        ssize_t bytes = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) return;
+
+        len += bytes;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+    request[len] = '\0';
+
+    static char path[ADMIN_REQUEST_SIZE];
+    char method[16];
+    if (sscanf(request, "%15s %4095s", method, path) != 2) {
+        static const char body[] = "Bad request\n";
+        send_response(fd, "400 Bad Request", "text/plain", body, sizeof(body) - 1);
+        return;
+    }
+
+    if (strcmp(method, "GET") == 0 && strcmp(path, "/metrics") == 0) {
+        char *body = malloc(ADMIN_RESPONSE_SIZE);
+        if (!body) {
+            return;
+        }
+        size_t body_len = stats_format_prometheus(body, ADMIN_RESPONSE_SIZE);
+        send_response(fd, "200 OK", "text/plain; version=0.0.4", body, body_len);
+        free(body);
+        return;
+    }
+
+    if (strcmp(method, "PURGE") == 0 &&
+        (strcmp(path, "/cache") == 0 || strncmp(path, "/cache?", 7) == 0)) {
+        handle_purge(fd, path[6] == '?' ? path + 7 : NULL);
+        return;
+    }
+
+    static const char body[] = "Not found\n";
+    send_response(fd, "404 Not Found", "text/plain", body, sizeof(body) - 1);
+}
+
+/**
+ * @brief Admin thread: serve admin clients one at a time
+ *
+ * @param arg Unused
+ * @return void* Never returns
+ */
+static void* admin_loop(void *arg) {
+    (void)arg;
+
+    while (1) {
+        int fd = accept(admin_socket, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("admin accept");
+            }
+            continue;
+        }
+
+        handle_admin_client(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Start the admin server on 127.0.0.1 in a background thread
+ *
+ * @param port Port to listen on
+ * @return int 0 on success, -1 on error
+ */
+int start_admin_server(int port) {
+    admin_socket = create_admin_socket(port);
+    if (admin_socket < 0) {
+        return -1;
+    }
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, admin_loop, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start admin thread: %s\n", strerror(err));
+        close(admin_socket);
+        admin_socket = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+/* ========== Constants ========== */
+// Largest admin request accepted (request line plus headers)
+#define ADMIN_REQUEST_SIZE 4096
+
+// Room for the full metrics page
+#define ADMIN_RESPONSE_SIZE (64 * 1024)
+
+// Admin clients that don't finish their request in time are dropped (ms)
+#ifndef ADMIN_TIMEOUT_MS
+#define ADMIN_TIMEOUT_MS 2000
+#endif
+
+// How often the serving loop picks up cache jobs (ms)
+#ifndef ADMIN_POLL_MS
+#define ADMIN_POLL_MS 50
+#endif
+
+// Longest a purge waits for the serving loop, which may be busy with a request (ms)
+#ifndef ADMIN_JOB_TIMEOUT_MS
+#define ADMIN_JOB_TIMEOUT_MS 10000
+#endif
+
+/**
+ * @brief Start the admin server on 127.0.0.1 in a background thread
+ *
+ * Serves GET /metrics in Prometheus text format, and PURGE /cache with
+ * url=<absolute-url>, host=<host> or host=<host>&prefix=<path-prefix>.
+ *
+ * @param port Port to listen on
+ * @return int 0 on success, -1 on error
+ */
+int start_admin_server(int port);
+
+/**
+ * @brief Run cache jobs queued by the admin thread
+ *
+ * The cache belongs to the serving loop, so purges are handed over to it;
+ * call this from the serving loop every ADMIN_POLL_MS.
+ */
+void admin_run_jobs();
+
+#endif /* ADMIN_H */
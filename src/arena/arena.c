@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "arena.h"
+#include "stats.h"
+
+// mbind(2) policy, from <numaif.h> (libnuma is not needed for one syscall)
+#define ARENA_MPOL_BIND 2
+
+/**
+ * Free block, linked through its first bytes
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+} arena_block;
+
+/**
+ * Size-classed allocator over one large mapping
+ */
+typedef struct {
+    size_t configured_size;
+    int node;                              // -1 if not NUMA bound
+
+    char *base;
+    size_t size;
+    size_t used;                           // Bytes carved so far; blocks past it are untouched
+    arena_backing backing;
+
+    arena_block *free_lists[ARENA_CLASSES];
+} arena_state;
+
+static arena_state arena = {0, -1, NULL, 0, 0, ARENA_NONE, {NULL}};
+
+/**
+ * @brief Size class that holds a request
+ *
+ * @param size Bytes needed
+ * @return int Class index, or -1 if larger than the biggest block
+ */
+static int size_class(size_t size) {
+    size_t block = ARENA_MIN_BLOCK;
+    for (int class = 0; class < ARENA_CLASSES; class++, block <<= 1) {
+        if (size <= block) {
+            return class;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Bind a range to the configured NUMA node
+ *
+ * @param addr Page-aligned start
+ * @param len Length
+ * @return int 0 on success or if no node is configured, -1 on error
+ */
+static int bind_to_node(void *addr, size_t len) {
+    if (arena.node < 0) {
+        return 0;
+    }
+
+    unsigned long mask = 1UL << arena.node;
+    if (syscall(SYS_mbind, addr, len, ARENA_MPOL_BIND, &mask, ARENA_MAX_NODE + 2, 0) < 0) {
+        perror("mbind failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Pin the calling thread to the CPUs of the configured NUMA node
+ *
+ * @return int 0 on success or if no node is configured, -1 on error
+ */
+static int pin_to_node() {
+    if (arena.node < 0) {
+        return 0;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", arena.node);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "NUMA node %d not found\n", arena.node);
+        return -1;
+    }
+
+    char list[1024];
+    if (!fgets(list, sizeof(list), file)) {
+        list[0] = '\0';
+    }
+    fclose(file);
+
+    // "0-3,8-11"
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    char *p = list;
+    while (*p >= '0' && *p <= '9') {
+        long first = strtol(p, &p, 10);
+        long last = first;
+        if (*p == '-') {
+            last = strtol(p + 1, &p, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+
+    if (CPU_COUNT(&cpus) == 0) {
+        fprintf(stderr, "NUMA node %d has no CPUs\n", arena.node);
+        return -1;
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+        perror("sched_setaffinity failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Map ordinary pages aligned to the huge page size and ask for THP
+ *
+ * @param size Bytes, a multiple of the huge page size
+ * @return char* Mapping, or NULL on error
+ */
+static char* map_thp(size_t size) {
+    // Over-map so an aligned range of the full size fits, then trim the ends
+    size_t span = size + ARENA_HUGE_PAGE_SIZE;
+    char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    char *base = (char *)(((uintptr_t)raw + ARENA_HUGE_PAGE_SIZE - 1) &
+                          ~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1));
+    if (base > raw) {
+        munmap(raw, base - raw);
+    }
+    if (raw + span > base + size) {
+        munmap(base + size, raw + span - (base + size));
+    }
+
+    arena.backing = madvise(base, size, MADV_HUGEPAGE) == 0 ? ARENA_THP : ARENA_PAGES;
+    return base;
+}
+
+/**
+ * @brief Set the arena size and NUMA node before arena_init()
+ *
+ * @param size Bytes to reserve, 0 for no arena
+ * @param node NUMA node to bind memory and the calling thread to, -1 for none
+ */
+void arena_configure(size_t size, int node) {
+    arena.configured_size = size;
+    arena.node = node;
+}
+
+/**
+ * @brief Map the configured arena and bind it (and the calling thread) to its node
+ *
+ * @return int 0 on success or if no arena is configured, -1 if it could not be mapped
+ */
+int arena_init() {
+    // Threads started later (admin, log writer) inherit the node's CPUs
+    if (pin_to_node() < 0) {
+        arena.node = -1;
+    }
+
+    if (arena.configured_size == 0 || arena.base) {
+        return 0;
+    }
+
+    size_t size = (arena.configured_size + ARENA_HUGE_PAGE_SIZE - 1) &
+                  ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+
+    // Explicit huge pages are reserved up front, so this fails cleanly if the pool is short
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED) {
+        arena.backing = ARENA_HUGETLB;
+    } else {
+        base = map_thp(size);
+        if (!base) {
+            perror("arena mmap failed");
+            return -1;
+        }
+    }
+
+    // Pages are only placed when first touched, so binding now covers all of them
+    bind_to_node(base, size);
+
+    arena.base = base;
+    arena.size = size;
+    arena.used = 0;
+
+    static const char *backings[] = {"no", "explicit huge", "transparent huge", "ordinary"};
+    fprintf(stderr, "Cache arena: %zu MiB on %s pages\n", size >> 20, backings[arena.backing]);
+    return 0;
+}
+
+/**
+ * @brief Allocate from the arena, falling back to malloc when it is full or absent
+ *
+ * @param size Bytes needed
+ * @return void* Block, or NULL if out of memory
+ */
+void* arena_alloc(size_t size) {
+    if (!arena.base) {
+        return malloc(size);
+    }
+
+    int class = size_class(size);
+    if (class >= 0) {
+        arena_block *block = arena.free_lists[class];
+        if (block) {
+            arena.free_lists[class] = block->next;
+            return block;
+        }
+
+        size_t block_size = (size_t)ARENA_MIN_BLOCK << class;
+        if (arena.used + block_size <= arena.size) {
+            void *ptr = arena.base + arena.used;
+            arena.used += block_size;
+            return ptr;
+        }
+    }
+
+    stats_add(STAT_ARENA_FALLBACKS, 1);
+    return malloc(size);
+}
+
+/**
+ * @brief Free a block from arena_alloc()
+ *
+ * @param ptr Block, or NULL
+ * @param size Size it was allocated with
+ */
+void arena_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+
+    char *p = ptr;
+    if (!arena.base || p < arena.base || p >= arena.base + arena.size) {
+        free(ptr);
+        return;
+    }
+
+    int class = size_class(size);
+    arena_block *block = ptr;
+    block->next = arena.free_lists[class];
+    arena.free_lists[class] = block;
+}
+
+/**
+ * @brief Give memory outside the arena the arena's page treatment
+ *
+ * @param addr Start of the range
+ * @param len Length of the range
+ */
+void arena_advise(void *addr, size_t len) {
+    if (!arena.base) {
+        return;
+    }
+
+    uintptr_t start = ((uintptr_t)addr + ARENA_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1);
+    if (end > start) {
+        // Best effort: without THP the range just keeps ordinary pages
+        madvise((void *)start, end - start, MADV_HUGEPAGE);
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    start = ((uintptr_t)addr + page - 1) & ~(uintptr_t)(page - 1);
+    end = ((uintptr_t)addr + len) & ~(uintptr_t)(page - 1);
+    if (end > start) {
+        bind_to_node((void *)start, end - start);
+    }
+}
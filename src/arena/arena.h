@@ -0,0 +1,76 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* ========== Constants ========== */
+// Huge page size the arena is aligned and rounded to
+#ifndef ARENA_HUGE_PAGE_SIZE
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+// Smallest block handed out; blocks are powers of two from here up
+#define ARENA_MIN_BLOCK 64
+
+// Block size classes (64 bytes to 128 KiB); larger requests go to malloc
+#define ARENA_CLASSES 12
+
+// Highest NUMA node that can be bound to
+#define ARENA_MAX_NODE 63
+
+/**
+ * What backs the arena's memory
+ */
+typedef enum {
+    ARENA_NONE,        // No arena: everything comes from malloc
+    ARENA_HUGETLB,     // Explicit huge pages from the hugetlbfs pool
+    ARENA_THP,         // Ordinary pages with transparent huge pages requested
+    ARENA_PAGES,       // Ordinary pages (THP unavailable)
+} arena_backing;
+
+/**
+ * @brief Set the arena size and NUMA node before arena_init()
+ *
+ * @param size Bytes to reserve, 0 for no arena
+ * @param node NUMA node to bind memory and the calling thread to, -1 for none
+ */
+void arena_configure(size_t size, int node);
+
+/**
+ * @brief Map the configured arena and bind it (and the calling thread) to its node
+ *
+ * Explicit huge pages are tried first, then ordinary pages with transparent
+ * huge pages requested. Nothing happens if no arena was configured.
+ *
+ * @return int 0 on success or if no arena is configured, -1 if it could not be mapped
+ */
+int arena_init();
+
+/**
+ * @brief Allocate from the arena, falling back to malloc when it is full or absent
+ *
+ * @param size Bytes needed
+ * @return void* Block, or NULL if out of memory
+ */
+void* arena_alloc(size_t size);
+
+/**
+ * @brief Free a block from arena_alloc()
+ *
+ * @param ptr Block, or NULL
+ * @param size Size it was allocated with
+ */
+void arena_free(void *ptr, size_t size);
+
+/**
+ * @brief Give memory outside the arena the arena's page treatment
+ *
+ * Requests transparent huge pages for the 2 MiB-aligned part of the range
+ * and binds it to the arena's node. Nothing happens without an arena.
+ *
+ * @param addr Start of the range
+ * @param len Length of the range
+ */
+void arena_advise(void *addr, size_t len);
+
+#endif /* ARENA_H */
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "io.h"
+#include "stats.h"
+
+// Smallest in-memory allocation, grown by doubling up to the cap
+#define INITIAL_MEM_SIZE (16 * 1024)
+
+// Bytes the calling thread holds for its clients, behind the high-water mark metric
+static _Thread_local int64_t buffered_bytes;
+
+// Staging area for sending spilled bytes
+static char spill_chunk[IO_BUFFER_SIZE];
+
+/**
+ * @brief Initialise an empty response buffer
+ *
+ * @param buf Buffer to initialise
+ * @param mem_cap Bytes to hold in memory before spilling
+ */
+void init_client_buffer(client_buffer *buf, size_t mem_cap) {
+    memset(buf, 0, sizeof(*buf));
+    buf->mem_cap = mem_cap;
+    buf->spill_fd = -1;
+}
+
+/**
+ * @brief Account for bytes entering or leaving the buffer
+ *
+ * @param added Bytes queued
+ * @param removed Bytes sent or dropped
+ */
+static void account(size_t added, size_t removed) {
+    int64_t delta = (int64_t)added - (int64_t)removed;
+    buffered_bytes += delta;
+    stats_add(STAT_CLIENT_BUFFERED, delta);
+    stats_max(STAT_CLIENT_BUFFER_PEAK, buffered_bytes);
+}
+
+/**
+ * @brief Append bytes to the spill file, creating it on first use
+ *
+ * @param buf Response buffer
+ * @param data Bytes to write
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on error
+ */
+static int spill(client_buffer *buf, const char *data, size_t len) {
+    if (buf->spill_fd < 0) {
+        char path[] = CLIENT_SPILL_DIR "/htproxy-XXXXXX";
+        buf->spill_fd = mkstemp(path);
+        if (buf->spill_fd < 0) {
+            perror("mkstemp");
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (!buf->spilled) {
+        buf->spilled = 1;
+        stats_add(STAT_CLIENT_SPILLS, 1);
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t bytes = pwrite(buf->spill_fd, data + written, len - written,
+                               buf->spill_len + written);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            perror("pwrite");
+            return -1;
+        }
+        written += bytes;
+    }
+
+    buf->spill_len += len;
+    stats_add(STAT_CLIENT_SPILL_BYTES, len);
+    return 0;
+}
+
+/**
+ * @brief Queue bytes for the client
+ *
+ * @param buf Response buffer
+ * @param data Bytes to queue
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on error
+ */
+int append_to_client_buffer(client_buffer *buf, const char *data, size_t len) {
+    // Spilled bytes are newer than anything in memory, keep order by staying on disk
+    if (buf->spill_off < buf->spill_len) {
+        if (spill(buf, data, len) < 0) return -1;
+        account(len, 0);
+        return 0;
+    }
+    buf->spill_len = 0;
+    buf->spill_off = 0;
+
+    // Reclaim space already sent
+    if (buf->mem_off > 0) {
+        memmove(buf->mem, buf->mem + buf->mem_off, buf->mem_len - buf->mem_off);
+        buf->mem_len -= buf->mem_off;
+        buf->mem_off = 0;
+    }
+
+    size_t needed = buf->mem_len + len;
+    if (needed > buf->mem_cap) {
+        if (spill(buf, data, len) < 0) return -1;
+        account(len, 0);
+        return 0;
+    }
+
+    if (needed > buf->mem_size) {
+        size_t new_size = buf->mem_size ? buf->mem_size : INITIAL_MEM_SIZE;
+        while (new_size < needed) new_size *= 2;
+        if (new_size > buf->mem_cap) new_size = buf->mem_cap;
+
+        char *mem = realloc(buf->mem, new_size);
+        if (!mem) {
+            fprintf(stderr, "Failed to grow response buffer\n");
+            return -1;
+        }
+        buf->mem = mem;
+        buf->mem_size = new_size;
+    }
+
+    memcpy(buf->mem + buf->mem_len, data, len);
+    buf->mem_len += len;
+    account(len, 0);
+    return 0;
+}
+
+/**
+ * @brief Send as much queued data as the client accepts without blocking
+ *
+ * @param buf Response buffer
+ * @param fd Client socket
+ * @return ssize_t Bytes sent (possibly 0), -1 on error
+ */
+ssize_t flush_client_buffer(client_buffer *buf, int fd) {
+    ssize_t total = 0;
+
+    while (client_buffer_pending(buf) > 0) {
+        const char *data;
+        size_t len;
+
+        if (buf->mem_off < buf->mem_len) {
+            data = buf->mem + buf->mem_off;
+            len = buf->mem_len - buf->mem_off;
+        } else {
+            len = buf->spill_len - buf->spill_off;
+            if (len > sizeof(spill_chunk)) len = sizeof(spill_chunk);
+
+            ssize_t bytes = pread(buf->spill_fd, spill_chunk, len, buf->spill_off);
+            if (bytes <= 0) {
+                perror("pread");
+                return -1;
+            }
+            data = spill_chunk;
+            len = bytes;
+        }
+
+        ssize_t sent = io_send_some(fd, data, len);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                stats_add(STAT_CLIENT_STALLS, 1);
+                break;
+            }
+            return -1;
+        }
+
+        if (buf->mem_off < buf->mem_len) {
+            buf->mem_off += sent;
+        } else {
+            buf->spill_off += sent;
+        }
+        account(0, sent);
+        total += sent;
+
+        if ((size_t)sent < len) {
+            // Socket buffer is full
+            stats_add(STAT_CLIENT_STALLS, 1);
+            break;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * @brief Bytes queued but not yet sent
+ *
+ * @param buf Response buffer
+ * @return size_t Pending bytes
+ */
+size_t client_buffer_pending(const client_buffer *buf) {
+    return (buf->mem_len - buf->mem_off) + (buf->spill_len - buf->spill_off);
+}
+
+/**
+ * @brief Release memory and spill file held by a response buffer
+ *
+ * @param buf Response buffer
+ */
+void free_client_buffer(client_buffer *buf) {
+    account(0, client_buffer_pending(buf));
+
+    free(buf->mem);
+    if (buf->spill_fd >= 0) {
+        close(buf->spill_fd);
+    }
+
+    init_client_buffer(buf, buf->mem_cap);
+}
@@ -0,0 +1,80 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* ========== Constants ========== */
+// Bytes of a response held in memory before spilling to a temp file
+#ifndef CLIENT_BUFFER_MEM_CAP
+#define CLIENT_BUFFER_MEM_CAP (256 * 1024)
+#endif
+
+// Directory for spill files (unlinked as soon as they are created)
+#ifndef CLIENT_SPILL_DIR
+#define CLIENT_SPILL_DIR "/tmp"
+#endif
+
+/**
+ * Response bytes received from the origin but not yet accepted by the client.
+ * The oldest bytes sit in memory, anything past the cap goes to a spill file.
+ */
+typedef struct {
+    // In-memory part
+    char *mem;
+    size_t mem_size;     // Allocated bytes
+    size_t mem_cap;      // Most bytes ever held in memory
+    size_t mem_len;      // Bytes stored
+    size_t mem_off;      // Bytes already sent
+
+    // Spill file part
+    int spill_fd;
+    size_t spill_len;    // Bytes written
+    size_t spill_off;    // Bytes already sent
+    int spilled;         // Whether this response ever spilled
+} client_buffer;
+
+/**
+ * @brief Initialise an empty response buffer
+ *
+ * @param buf Buffer to initialise
+ * @param mem_cap Bytes to hold in memory before spilling
+ */
+void init_client_buffer(client_buffer *buf, size_t mem_cap);
+
+/**
+ * @brief Queue bytes for the client
+ *
+ * @param buf Response buffer
+ * @param data Bytes to queue
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on error
+ */
+int append_to_client_buffer(client_buffer *buf, const char *data, size_t len);
+
+/**
+ * @brief Send as much queued data as the client accepts without blocking
+ *
+ * @param buf Response buffer
+ * @param fd Client socket
+ * @return ssize_t Bytes sent (possibly 0), -1 on error
+ */
+ssize_t flush_client_buffer(client_buffer *buf, int fd);
+
+/**
+ * @brief Bytes queued but not yet sent
+ *
+ * @param buf Response buffer
+ * @return size_t Pending bytes
+ */
+size_t client_buffer_pending(const client_buffer *buf);
+
+/**
+ * @brief Release memory and spill file held by a response buffer
+ *
+ * @param buf Response buffer
+ */
+void free_client_buffer(client_buffer *buf);
+
+#endif /* BUFFER_H */
@@ -1,74 +1,364 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <time.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "cache.h"
+#include "stats.h"
+#include "log.h"
+#include "epoch.h"
+
+#ifdef CACHE_SIMULATION
+// Simulation builds store no headers or bodies, so there is nothing to place
+#define arena_free(ptr, size) ((void)(size), free(ptr))
+#else
+#include "arena.h"
+#endif
+
+_Static_assert((CACHE_HASH_BUCKETS & (CACHE_HASH_BUCKETS - 1)) == 0,
+               "CACHE_HASH_BUCKETS must be a power of two");
+_Static_assert(CACHE_ENTRIES >= 1 && CACHE_ENTRIES <= CACHE_SIZE,
+               "CACHE_ENTRIES must be between 1 and CACHE_SIZE");
+
+// Longest host+path key in the purge index
+#define PURGE_KEY_SIZE (MAX_HOSTNAME_SIZE + MAX_REQUEST_SIZE)
 
 // Global cache instance
 lru_cache cache;
 
+/**
+ * Configured negative-caching TTL for one status
+ */
+typedef struct {
+    int status;
+    int seconds;
+} negative_override;
+
+/**
+ * Origin that recently failed DNS or connect
+ */
+typedef struct {
+    char host[MAX_HOSTNAME_SIZE];
+    time_t expires;
+} failed_origin;
+
+static negative_override negative_overrides[NEGATIVE_TTL_OVERRIDES];
+static int negative_override_count;
+
+static failed_origin failed_origins[NEGATIVE_ORIGINS];
+
+#if defined(HAVE_ZLIB) && !defined(CACHE_SIMULATION)
+// Compressed copy of the response being added, before it has a slot
+static char compress_buffer[MAX_RESPONSE_SIZE];
+#endif
+
+/**
+ * Hits cache_lookup() made under LRU, waiting for the writer to move them to
+ * the front. Single producer (the reading thread), single consumer (the
+ * writer); head and tail sit on their own cache lines.
+ */
+typedef struct {
+    _Alignas(64) uint32_t head;   // Next hit the writer replays
+    _Alignas(64) uint32_t tail;   // Next slot the reader fills
+    cache_entry *slots[CACHE_HIT_BUFFER];
+} hit_buffer;
+
+// Buffers registered so far, one per reading thread
+static hit_buffer *hit_buffers[EPOCH_MAX_THREADS];
+static int hit_buffer_count;
+
+// Buffer owned by the calling thread
+static _Thread_local hit_buffer *local_hits;
+static _Thread_local int local_hits_failed;
+
+#ifdef CACHE_SIMULATION
+// Trace clock, advanced by the simulator
+time_t cache_sim_time;
+#endif
+
+/**
+ * @brief Size of the request hash index for a capacity
+ * 
+ * @param capacity Maximum entries
+ * @return uint32_t Smallest power of two holding capacity, at most CACHE_HASH_BUCKETS
+ */
+static uint32_t index_buckets(int capacity) {
+    uint32_t buckets = 1;
+    while (buckets < (uint32_t)capacity && buckets < CACHE_HASH_BUCKETS) {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
 /**
  * @brief Initialise the LRU cache
  */
 void init_cache() {
-    memset(&cache, 0, sizeof(cache));
+    // Entries are initialised as they are handed out, so a large
+    // CACHE_SIZE costs no memory until it is used
     cache.head = NULL;
     cache.tail = NULL;
     cache.count = 0;
     
-    // Mark all entries as invalid initially
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        cache.entries[i].valid = 0;
+    cache.capacity = CACHE_ENTRIES;
+    cache.byte_budget = 0;
+    cache.bytes = 0;
+    cache.policy = CACHE_POLICY_LRU;
+    
+    cache.next_unused = 0;
+    cache.free_list = NULL;
+    cache.heap_count = 0;
+    radix_clear(&cache.purge_index);
+    cache.bucket_mask = index_buckets(CACHE_ENTRIES) - 1;
+    memset(cache.buckets, 0, sizeof(cache.buckets));
+    memset(cache.body_buckets, 0, sizeof(cache.body_buckets));
+    
+#ifndef CACHE_SIMULATION
+    // Lookups walk the slots, so they get huge pages on the arena's node too
+    arena_advise(cache.entries, sizeof(cache.entries));
+#endif
+}
+
+/**
+ * @brief Current time as the cache sees it
+ * 
+ * @return time_t Wall-clock seconds, or the trace clock in simulation builds
+ */
+time_t cache_now() {
+#ifdef CACHE_SIMULATION
+    return cache_sim_time;
+#else
+    return time(NULL);
+#endif
+}
+
+/**
+ * @brief Check whether an entry has outlived its max-age
+ * 
+ * @param entry Cache entry
+ * @return int 1 if stale, 0 if fresh (entries without max-age never go stale)
+ */
+int cache_entry_stale(const cache_entry *entry) {
+    if (!entry->has_max_age) {
+        return 0;
     }
+    return cache_now() > entry->expires;
 }
 
 /**
- * @brief Find a request in the cache
+ * @brief Build the purge index key: lowercased host, then the path
  * 
- * @param request Request string to look for
- * @param request_len Length of the request
- * @return cache_entry* Pointer to cache entry if found, NULL otherwise
+ * @param host Host from the request
+ * @param uri Request URI, absolute or origin form
+ * @param key Output buffer of PURGE_KEY_SIZE bytes
+ * @return size_t Key length
  */
-cache_entry* find_in_cache(const char *request, int request_len) {
-    // Search through all valid cache entries
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache.entries[i].valid && 
-            memcmp(cache.entries[i].request, request, request_len) == 0) {
-            // Found in cache, move to front (most recently used)
-            move_to_front(&cache.entries[i]);
-            return &cache.entries[i];
+static size_t purge_key(const char *host, const char *uri, char *key) {
+    size_t len = 0;
+    
+    while (*host && len < MAX_HOSTNAME_SIZE - 1) {
+        key[len++] = tolower((unsigned char)*host++);
+    }
+    
+    // Absolute-form URIs repeat the host, keep only the path
+    const char *path = uri;
+    const char *scheme = strstr(uri, "://");
+    if (scheme) {
+        path = strchr(scheme + 3, '/');
+        if (!path) path = "/";
+    }
+    
+    size_t path_len = strlen(path);
+    if (path_len > PURGE_KEY_SIZE - len) {
+        path_len = PURGE_KEY_SIZE - len;
+    }
+    memcpy(key + len, path, path_len);
+    return len + path_len;
+}
+
+/**
+ * @brief Store an entry at a heap slot
+ * 
+ * @param entry Cache entry
+ * @param index Heap slot
+ */
+static void heap_place(cache_entry *entry, int index) {
+    cache.expiry_heap[index] = entry;
+    entry->heap_index = index;
+}
+
+/**
+ * @brief Move an entry up the expiry heap until its parent expires first
+ * 
+ * @param index Heap slot of the entry
+ */
+static void heap_sift_up(int index) {
+    cache_entry *entry = cache.expiry_heap[index];
+    
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (cache.expiry_heap[parent]->expires <= entry->expires) {
+            break;
         }
+        heap_place(cache.expiry_heap[parent], index);
+        index = parent;
     }
     
-    return NULL;  // Not found
+    heap_place(entry, index);
 }
 
 /**
- * @brief Move a cache entry to the front of the LRU list (most recently used)
+ * @brief Move an entry down the expiry heap until its children expire later
  * 
- * @param entry Cache entry to move
+ * @param index Heap slot of the entry
  */
-void move_to_front(cache_entry *entry) {
-    if (entry == cache.head) {
-        // Already at front
+static void heap_sift_down(int index) {
+    cache_entry *entry = cache.expiry_heap[index];
+    
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= cache.heap_count) {
+            break;
+        }
+        if (child + 1 < cache.heap_count &&
+            cache.expiry_heap[child + 1]->expires < cache.expiry_heap[child]->expires) {
+            child++;
+        }
+        if (entry->expires <= cache.expiry_heap[child]->expires) {
+            break;
+        }
+        heap_place(cache.expiry_heap[child], index);
+        index = child;
+    }
+    
+    heap_place(entry, index);
+}
+
+/**
+ * @brief Add an entry to the expiry heap, O(log n)
+ * 
+ * @param entry Cache entry with expires set
+ */
+static void heap_push(cache_entry *entry) {
+    heap_place(entry, cache.heap_count++);
+    heap_sift_up(entry->heap_index);
+}
+
+/**
+ * @brief Take an entry out of the expiry heap, O(log n)
+ * 
+ * @param entry Cache entry in the heap
+ */
+static void heap_remove(cache_entry *entry) {
+    int index = entry->heap_index;
+    cache_entry *last = cache.expiry_heap[--cache.heap_count];
+    entry->heap_index = -1;
+    
+    if (last == entry) {
         return;
     }
     
-    // Remove from current position
+    // Fill the hole with the last entry and restore the order either way
+    heap_place(last, index);
+    heap_sift_up(index);
+    heap_sift_down(last->heap_index);
+}
+
+/**
+ * @brief Hash a request string (or a body), eight bytes per step
+ * 
+ * @param request Request bytes
+ * @param request_len Number of bytes
+ * @return uint32_t Hash value
+ */
+static uint32_t hash_request(const char *request, int request_len) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ (uint64_t)request_len;
+    uint64_t word;
+    int i = 0;
+    
+    for (; i + 8 <= request_len; i += 8) {
+        memcpy(&word, request + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    
+    // Tail bytes, zero padded
+    word = 0;
+    memcpy(&word, request + i, request_len - i);
+    hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 29;
+    
+    return (uint32_t)hash;
+}
+
+/**
+ * @brief Add an entry to its hash chain
+ * 
+ * The entry is published by the release store, so a lock-free reader that
+ * finds it sees it filled in.
+ * 
+ * @param entry Cache entry with its hash set
+ */
+static void index_insert(cache_entry *entry) {
+    cache_entry **bucket = &cache.buckets[entry->hash & cache.bucket_mask];
+    __atomic_store_n(&entry->hash_next, *bucket, __ATOMIC_RELAXED);
+    __atomic_store_n(bucket, entry, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Unlink an entry from its hash chain
+ * 
+ * Its own link is left alone, so a reader standing on it can walk on.
+ * 
+ * @param entry Indexed cache entry
+ */
+static void index_remove(cache_entry *entry) {
+    cache_entry **link = &cache.buckets[entry->hash & cache.bucket_mask];
+    while (*link && *link != entry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        __atomic_store_n(link, entry->hash_next, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Unlink an entry from the LRU list
+ * 
+ * @param entry Listed cache entry
+ */
+static void list_remove(cache_entry *entry) {
     if (entry->prev) {
         entry->prev->next = entry->next;
+    } else {
+        // This was the head
+        cache.head = entry->next;
     }
     
     if (entry->next) {
         entry->next->prev = entry->prev;
-    }
-    
-    if (entry == cache.tail) {
+    } else {
+        // This was the tail
         cache.tail = entry->prev;
     }
     
-    // Move to front
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+/**
+ * @brief Put an unlisted entry at the front of the LRU list
+ * 
+ * @param entry Cache entry
+ */
+static void list_push_front(cache_entry *entry) {
     entry->next = cache.head;
     entry->prev = NULL;
     
@@ -83,6 +373,361 @@ void move_to_front(cache_entry *entry) {
     }
 }
 
+#ifndef CACHE_SIMULATION
+/**
+ * @brief Get a shared body with the given bytes, storing it if it is new
+ * 
+ * @param data Body bytes as stored
+ * @param size Number of bytes
+ * @param encoding How the bytes are encoded
+ * @return cache_body* Body with a reference taken for the caller, or NULL if out of memory
+ */
+static cache_body* body_acquire(const char *data, int size, cache_encoding encoding) {
+    uint32_t hash = hash_request(data, size);
+    cache_body **bucket = &cache.body_buckets[hash & (CACHE_HASH_BUCKETS - 1)];
+    
+    for (cache_body *body = *bucket; body; body = body->hash_next) {
+        if (body->hash == hash && body->size == size && body->encoding == encoding &&
+            memcmp(body->data, data, size) == 0) {
+            body->refs++;
+            stats_add(STAT_DEDUP_HITS, 1);
+            return body;
+        }
+    }
+    
+    cache_body *body = arena_alloc(sizeof(cache_body) + size);
+    if (!body) {
+        return NULL;
+    }
+    memcpy(body->data, data, size);
+    body->hash = hash;
+    body->size = size;
+    body->refs = 1;
+    body->encoding = encoding;
+    body->hash_next = *bucket;
+    *bucket = body;
+    
+    cache.bytes += size;
+    stats_add(STAT_BODY_STORED_BYTES, size);
+    return body;
+}
+#endif
+
+/**
+ * @brief Free a header block or body once readers are done with it
+ * 
+ * @param ptr Block from arena_alloc()
+ * @param size Its size
+ */
+static void release_block(void *ptr, size_t size) {
+    arena_free(ptr, size);
+}
+
+/**
+ * @brief Drop a reference to a shared body, freeing it with the last one
+ * 
+ * @param body Body, or NULL
+ */
+static void body_release(cache_body *body) {
+    if (!body || --body->refs > 0) {
+        return;
+    }
+    
+    cache_body **link = &cache.body_buckets[body->hash & (CACHE_HASH_BUCKETS - 1)];
+    while (*link != body) {
+        link = &(*link)->hash_next;
+    }
+    *link = body->hash_next;
+    
+    cache.bytes -= body->size;
+    stats_add(STAT_BODY_STORED_BYTES, -(int64_t)body->size);
+    epoch_retire(body, sizeof(cache_body) + body->size, release_block);
+}
+
+/**
+ * @brief Put a slot back on the free list once readers are done with it
+ * 
+ * @param ptr Cache entry
+ * @param size Unused
+ */
+static void release_slot(void *ptr, size_t size) {
+    (void)size;
+    cache_entry *entry = ptr;
+    entry->next = cache.free_list;
+    cache.free_list = entry;
+}
+
+/**
+ * @brief Take an entry out of the list and index and return its slot
+ * 
+ * A lock-free reader may still hold the entry, so its headers, body and
+ * slot are retired rather than freed and stay intact until it is done.
+ * 
+ * @param entry Valid cache entry
+ */
+static void release_entry(cache_entry *entry) {
+    list_remove(entry);
+    index_remove(entry);
+    if (entry->heap_index >= 0) {
+        heap_remove(entry);
+    }
+    radix_remove(&cache.purge_index, &entry->purge_item);
+    
+    if (entry->body) {
+        stats_add(STAT_BODY_BYTES, -(int64_t)entry->body->size);
+    }
+    body_release(entry->body);
+    epoch_retire(entry->headers, entry->header_len ? entry->header_len : 1, release_block);
+    
+    __atomic_store_n(&entry->valid, 0, __ATOMIC_RELEASE);
+    cache.bytes -= entry->header_len;
+    cache.count--;
+    
+    epoch_retire(entry, 0, release_slot);
+}
+
+/**
+ * @brief Hand out an unused entry slot
+ * 
+ * @return cache_entry* Free slot, or NULL if every slot is in use
+ */
+static cache_entry* take_slot() {
+    // Slots released lately come back once readers have moved past them;
+    // reclaiming on every insert also keeps retired bodies from piling up
+    epoch_reclaim();
+    for (int tries = 1; !cache.free_list && cache.next_unused == CACHE_SIZE && tries < 3; tries++) {
+        epoch_reclaim();
+    }
+    if (cache.free_list) {
+        cache_entry *entry = cache.free_list;
+        cache.free_list = entry->next;
+        entry->next = NULL;
+        return entry;
+    }
+    if (cache.next_unused < CACHE_SIZE) {
+        return &cache.entries[cache.next_unused++];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Set the entry and byte limits, evicting down to them
+ * 
+ * @param capacity Maximum entries (clamped to 1..CACHE_SIZE)
+ * @param byte_budget Maximum response bytes held, 0 for no limit
+ */
+void set_cache_limits(int capacity, uint64_t byte_budget) {
+    if (capacity < 1) capacity = 1;
+    if (capacity > CACHE_SIZE) capacity = CACHE_SIZE;
+    
+    cache.capacity = capacity;
+    cache.byte_budget = byte_budget;
+    
+    while (cache.count > cache.capacity ||
+           (cache.byte_budget && cache.bytes > cache.byte_budget)) {
+        evict_lru();
+    }
+    
+    // Shrink or grow the index to the capacity so its buckets stay dense
+    uint32_t buckets = index_buckets(capacity);
+    // (lock-free readers racing the rebuild may miss, but never loop or see a freed entry)
+    if (buckets - 1 != cache.bucket_mask) {
+        for (uint32_t i = 0; i <= cache.bucket_mask; i++) {
+            __atomic_store_n(&cache.buckets[i], NULL, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&cache.bucket_mask, buckets - 1, __ATOMIC_RELAXED);
+        for (cache_entry *entry = cache.head; entry; entry = entry->next) {
+            index_insert(entry);
+        }
+    }
+}
+
+/**
+ * @brief Choose the replacement policy
+ * 
+ * @param policy Policy to use from now on
+ */
+void set_cache_policy(cache_policy policy) {
+    __atomic_store_n(&cache.policy, policy, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Find a request in the cache
+ * 
+ * @param request Request string to look for
+ * @param request_len Length of the request
+ * @return cache_entry* Pointer to cache entry if found, NULL otherwise
+ */
+cache_entry* find_in_cache(const char *request, int request_len) {
+    uint32_t hash = hash_request(request, request_len);
+    
+    // Walk the request's hash chain
+    for (cache_entry *entry = cache.buckets[hash & cache.bucket_mask];
+         entry; entry = entry->hash_next) {
+        if (entry->hash == hash && entry->request_len == request_len &&
+            memcmp(entry->request, request, request_len) == 0) {
+            // Found in cache, move to front (most recently used)
+            move_to_front(entry);
+            return entry;
+        }
+    }
+    
+    return NULL;  // Not found
+}
+
+/**
+ * @brief Check for a fresh entry without touching its recency
+ * 
+ * @param request Request string to look for
+ * @param request_len Length of the request
+ * @return int 1 if a fresh entry is cached for the request, 0 otherwise
+ */
+int cache_has_fresh(const char *request, int request_len) {
+    if (request_len >= MAX_REQUEST_SIZE) {
+        return 0;
+    }
+    
+    uint32_t hash = hash_request(request, request_len);
+    for (cache_entry *entry = cache.buckets[hash & cache.bucket_mask];
+         entry; entry = entry->hash_next) {
+        if (entry->hash == hash && entry->request_len == request_len &&
+            memcmp(entry->request, request, request_len) == 0) {
+            return !cache_entry_stale(entry);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Hit buffer owned by the calling thread, created on first use
+ * 
+ * @return hit_buffer* Buffer, or NULL if every buffer is taken
+ */
+static hit_buffer* thread_hits() {
+    if (local_hits || local_hits_failed) {
+        return local_hits;
+    }
+    
+    int index = __atomic_fetch_add(&hit_buffer_count, 1, __ATOMIC_RELAXED);
+    hit_buffer *buffer = index < EPOCH_MAX_THREADS ? calloc(1, sizeof(hit_buffer)) : NULL;
+    if (!buffer) {
+        local_hits_failed = 1;
+        return NULL;
+    }
+    
+    __atomic_store_n(&hit_buffers[index], buffer, __ATOMIC_RELEASE);
+    local_hits = buffer;
+    return buffer;
+}
+
+/**
+ * @brief Record a lock-free hit without writing to anything other threads write
+ * 
+ * CLOCK sets the reference bit (only if it is clear, so a hot entry's line
+ * isn't dirtied on every hit). LRU queues the hit for the writer, dropping
+ * it if the queue is full. FIFO ignores hits.
+ * 
+ * @param entry Entry that was hit
+ */
+static void note_hit(cache_entry *entry) {
+    cache_policy policy = __atomic_load_n(&cache.policy, __ATOMIC_RELAXED);
+    
+    if (policy == CACHE_POLICY_CLOCK) {
+        if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+        }
+    } else if (policy == CACHE_POLICY_LRU) {
+        hit_buffer *buffer = thread_hits();
+        if (!buffer) {
+            return;
+        }
+        uint32_t tail = buffer->tail;
+        if (tail - __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE) == CACHE_HIT_BUFFER) {
+            return;
+        }
+        buffer->slots[tail & (CACHE_HIT_BUFFER - 1)] = entry;
+        __atomic_store_n(&buffer->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Replay hits buffered by lock-free readers into the LRU order
+ * 
+ * A buffered entry may have been evicted since, or its slot even reused;
+ * the first is skipped and the second only costs the new entry some
+ * undeserved recency.
+ */
+static void apply_buffered_hits() {
+    int count = __atomic_load_n(&hit_buffer_count, __ATOMIC_ACQUIRE);
+    if (count > EPOCH_MAX_THREADS) count = EPOCH_MAX_THREADS;
+    
+    for (int i = 0; i < count; i++) {
+        hit_buffer *buffer = __atomic_load_n(&hit_buffers[i], __ATOMIC_ACQUIRE);
+        if (!buffer) continue;
+        
+        uint32_t head = buffer->head;
+        uint32_t tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            cache_entry *entry = buffer->slots[head & (CACHE_HIT_BUFFER - 1)];
+            if (entry->valid && cache.policy == CACHE_POLICY_LRU) {
+                move_to_front(entry);
+            }
+            head++;
+        }
+        __atomic_store_n(&buffer->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Find a request in the cache without locking, from any thread
+ * 
+ * @param request Request string to look for
+ * @param request_len Length of the request
+ * @return cache_entry* Entry, valid until epoch_exit(), or NULL if not found
+ */
+cache_entry* cache_lookup(const char *request, int request_len) {
+    uint32_t hash = hash_request(request, request_len);
+    uint32_t mask = __atomic_load_n(&cache.bucket_mask, __ATOMIC_RELAXED);
+    
+    for (cache_entry *entry = __atomic_load_n(&cache.buckets[hash & mask], __ATOMIC_ACQUIRE);
+         entry; entry = __atomic_load_n(&entry->hash_next, __ATOMIC_ACQUIRE)) {
+        if (entry->hash == hash && entry->request_len == request_len &&
+            memcmp(entry->request, request, request_len) == 0 &&
+            __atomic_load_n(&entry->valid, __ATOMIC_ACQUIRE)) {
+            note_hit(entry);
+            return entry;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * @brief Move a cache entry to the front of the LRU list (most recently used)
+ * 
+ * @param entry Cache entry to move
+ */
+void move_to_front(cache_entry *entry) {
+    if (cache.policy == CACHE_POLICY_FIFO) {
+        // Order is insertion order only
+        return;
+    }
+    
+    if (cache.policy == CACHE_POLICY_CLOCK) {
+        // Recency is settled lazily at eviction time
+        __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    if (entry == cache.head) {
+        // Already at front
+        return;
+    }
+    
+    list_remove(entry);
+    list_push_front(entry);
+}
+
 /**
  * @brief Evict the least recently used cache entry
  * 
@@ -94,29 +739,188 @@ cache_entry* evict_lru() {
         return &cache.entries[0];
     }
     
-    cache_entry *to_evict = cache.tail;
+    cache_entry *to_evict;
+    apply_buffered_hits();
+    
+    if (cache.heap_count > 0 && cache_entry_stale(cache.expiry_heap[0])) {
+        // An expired entry can only be refetched, take it before a live one
+        to_evict = cache.expiry_heap[0];
+    } else {
+        // CLOCK: referenced entries get a second chance at the front
+        while (__atomic_load_n(&cache.tail->referenced, __ATOMIC_RELAXED)) {
+            cache_entry *second_chance = cache.tail;
+            __atomic_store_n(&second_chance->referenced, 0, __ATOMIC_RELAXED);
+            list_remove(second_chance);
+            list_push_front(second_chance);
+        }
+        
+        to_evict = cache.tail;
+    }
     
     // Log eviction
-    printf("Evicting %s %s from cache\n", to_evict->host, to_evict->uri);
-    fflush(stdout);
+    log_event(LOG_EVICTING, to_evict->host, to_evict->uri, 0, 0);
+    stats_add(STAT_EVICTIONS, 1);
     
-    // Update tail pointer
-    cache.tail = to_evict->prev;
+    release_entry(to_evict);
     
-    if (cache.tail) {
-        cache.tail->next = NULL;
-    } else {
-        // Cache is now empty
-        cache.head = NULL;
+    return to_evict;
+}
+
+#ifndef CACHE_SIMULATION
+/**
+ * @brief Length of a response's header block
+ * 
+ * @param response Full response
+ * @param response_len Length of response
+ * @return int Bytes up to and including the blank line, or -1 if there is none
+ */
+static int header_block_length(const char *response, int response_len) {
+    const char *end = response + response_len;
+    const char *p = response;
+    
+    while ((p = memchr(p, '\r', end - p)) && end - p >= 4) {
+        if (memcmp(p, "\r\n\r\n", 4) == 0) {
+            return (int)(p - response) + 4;
+        }
+        p++;
+    }
+    return -1;
+}
+#endif
+
+#if defined(HAVE_ZLIB) && !defined(CACHE_SIMULATION)
+/**
+ * @brief Find a header's value within a header block
+ * 
+ * @param headers Header block (not NUL terminated)
+ * @param len Length of the block
+ * @param name Header name including the colon, lowercase
+ * @param value_len Receives the value length
+ * @return const char* Start of the value, or NULL if absent
+ */
+static const char* find_header(const char *headers, int len, const char *name, int *value_len) {
+    int name_len = strlen(name);
+    const char *end = headers + len;
+    
+    for (const char *line = headers; line < end; ) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (!eol) break;
+        
+        if (eol - line > name_len && strncasecmp(line, name, name_len) == 0) {
+            const char *value = line + name_len;
+            while (value < eol && (*value == ' ' || *value == '\t')) value++;
+            *value_len = (eol > value && eol[-1] == '\r') ? eol - 1 - value : eol - value;
+            return value;
+        }
+        line = eol + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check whether a response is text the proxy should compress
+ * 
+ * @param headers Header block
+ * @param header_len Length of the block
+ * @param body_len Body length
+ * @return int 1 for an uncompressed 200 text body large enough to be worth it
+ */
+static int compressible(const char *headers, int header_len, int body_len) {
+    if (body_len < CACHE_COMPRESS_MIN_SIZE || header_len < 12 ||
+        strncmp(headers + 8, " 200", 4) != 0) {
+        return 0;
     }
     
-    to_evict->valid = 0;
-    to_evict->prev = NULL;
-    to_evict->next = NULL;
+    int len;
+    if (find_header(headers, header_len, "content-encoding:", &len)) {
+        return 0;
+    }
     
-    cache.count--;
+    const char *type = find_header(headers, header_len, "content-type:", &len);
+    if (!type) {
+        return 0;
+    }
     
-    return to_evict;
+    static const char *text_types[] = {"text/", "json", "javascript", "xml", "svg"};
+    for (size_t i = 0; i < sizeof(text_types) / sizeof(text_types[0]); i++) {
+        size_t type_len = strlen(text_types[i]);
+        for (int j = 0; j + (int)type_len <= len && type[j] != ';'; j++) {
+            if (strncasecmp(type + j, text_types[i], type_len) == 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Gzip-compress a response body
+ * 
+ * @param body Body bytes
+ * @param body_len Length of body
+ * @param out Receives the compressed body
+ * @param out_size Size of out
+ * @return int Length written, or -1 if it failed or saved nothing
+ */
+static int compress_body(const char *body, int body_len, char *out, int out_size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    
+    // windowBits 15 + 16 writes a gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    
+    stream.next_in = (Bytef *)body;
+    stream.avail_in = body_len;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = out_size < body_len ? out_size : body_len;
+    
+    int status = deflate(&stream, Z_FINISH);
+    int written = (int)stream.total_out;
+    deflateEnd(&stream);
+    
+    return status == Z_STREAM_END ? written : -1;
+}
+#endif
+
+/**
+ * @brief Decompress the body of an entry stored compressed
+ * 
+ * @param entry Entry with encoding other than CACHE_ENCODING_IDENTITY
+ * @param out Buffer for the body, at least identity_size - header_len bytes
+ * @param out_size Size of out
+ * @return int Body length, or -1 on error (or without HAVE_ZLIB)
+ */
+int cache_decode_body(const cache_entry *entry, char *out, int out_size) {
+#if defined(HAVE_ZLIB) && !defined(CACHE_SIMULATION)
+    if (entry->encoding != CACHE_ENCODING_GZIP || !entry->body) {
+        return -1;
+    }
+    
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return -1;
+    }
+    
+    stream.next_in = (Bytef *)entry->body->data;
+    stream.avail_in = entry->body->size;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = out_size;
+    
+    int status = inflate(&stream, Z_FINISH);
+    int written = (int)stream.total_out;
+    inflateEnd(&stream);
+    
+    return status == Z_STREAM_END ? written : -1;
+#else
+    (void)entry;
+    (void)out;
+    (void)out_size;
+    return -1;
+#endif
 }
 
 /**
@@ -130,29 +934,88 @@ cache_entry* evict_lru() {
  * @param uri URI from the request
  * @param max_age Max-age value from Cache-Control header
  * @param has_max_age Whether max-age was specified
+ * @return cache_entry* The new entry, or NULL if it was not cached
  */
-void add_to_cache(const char *request, int request_len, const char *response, int response_len, 
-                  const char *host, const char *uri, uint32_t max_age, int has_max_age) {
-    cache_entry *entry = NULL;
-    
-    // Find an empty slot or evict LRU if full
-    if (cache.count < CACHE_SIZE) {
-        // Find an invalid entry
-        for (int i = 0; i < CACHE_SIZE; i++) {
-            if (!cache.entries[i].valid) {
-                entry = &cache.entries[i];
-                break;
-            }
+cache_entry* add_to_cache(const char *request, int request_len, const char *response, int response_len, 
+                          const char *host, const char *uri, uint32_t max_age, int has_max_age) {
+    cache_encoding encoding = CACHE_ENCODING_IDENTITY;
+    int identity_size = response_len;
+    
+#ifdef CACHE_SIMULATION
+    // No bytes are kept, the whole response is charged to the entry
+    (void)response;
+    int header_len = response_len;
+    int body_len = 0;
+#else
+    int header_len = header_block_length(response, response_len);
+    if (header_len < 0) {
+        header_len = 0;
+    }
+    const char *body_data = response + header_len;
+    int body_len = response_len - header_len;
+#endif
+    
+#if defined(HAVE_ZLIB) && !defined(CACHE_SIMULATION)
+    // Text is stored compressed if that shrinks it; the budget sees the stored size
+    if (header_len > 0 && compressible(response, header_len, body_len)) {
+        int compressed = compress_body(body_data, body_len, compress_buffer, sizeof(compress_buffer));
+        if (compressed > 0 && compressed < body_len) {
+            stats_add(STAT_COMPRESSED, 1);
+            stats_add(STAT_COMPRESSION_SAVED, body_len - compressed);
+            encoding = CACHE_ENCODING_GZIP;
+            body_data = compress_buffer;
+            body_len = compressed;
         }
-    } else {
-        // Cache is full, evict LRU
-        entry = evict_lru();
+    }
+#endif
+    
+    if (cache.byte_budget && (uint64_t)(header_len + body_len) > cache.byte_budget) {
+        // Would push out everything else and still not fit
+        return NULL;
+    }
+    
+    char *headers = NULL;
+    cache_body *body = NULL;
+#ifndef CACHE_SIMULATION
+    // Hold the body (shared if an identical one is cached) so eviction can't free it
+    headers = arena_alloc(header_len ? header_len : 1);
+    if (body_len > 0) {
+        body = body_acquire(body_data, body_len, encoding);
+    }
+    if (!headers || (body_len > 0 && !body)) {
+        arena_free(headers, header_len ? header_len : 1);
+        body_release(body);
+        return NULL;
+    }
+    memcpy(headers, response, header_len);
+#endif
+    
+    // Evict LRU until there is room for one more entry of this size
+    while (cache.count > 0 &&
+           (cache.count >= cache.capacity ||
+            (cache.byte_budget && cache.bytes + header_len > cache.byte_budget))) {
+        evict_lru();
+    }
+    
+    cache_entry *entry = take_slot();
+    if (!entry) {
+        arena_free(headers, header_len ? header_len : 1);
+        body_release(body);
+        return NULL;
     }
     
     // Copy request and response data
     memcpy(entry->request, request, request_len);
-    memcpy(entry->response, response, response_len);
-    entry->response_size = response_len;
+    entry->request_len = request_len;
+    entry->headers = headers;
+    entry->header_len = header_len;
+    entry->body = body;
+    entry->response_size = header_len + body_len;
+    entry->encoding = encoding;
+    entry->identity_size = identity_size;
+    if (body) {
+        stats_add(STAT_BODY_BYTES, body_len);
+    }
     
     // Copy host and URI for logging
     strncpy(entry->host, host, sizeof(entry->host) - 1);
@@ -162,28 +1025,36 @@ void add_to_cache(const char *request, int request_len, const char *response, in
     entry->uri[sizeof(entry->uri) - 1] = '\0';
     
     entry->valid = 1;
-    
-    // Add to front of LRU list
-    entry->next = cache.head;
-    entry->prev = NULL;
+    entry->referenced = 0;
     
     entry->max_age = max_age;
-    entry->cached_time = time(NULL);
+    entry->cached_time = cache_now();
     entry->has_max_age = has_max_age;
     
-    if (cache.head) {
-        cache.head->prev = entry;
+    // Entries that can expire are queued by deadline for the sweep
+    entry->heap_index = -1;
+    if (has_max_age) {
+        entry->expires = entry->cached_time + max_age;
+        heap_push(entry);
     }
     
-    cache.head = entry;
+    // Add to front of LRU list and to the index
+    list_push_front(entry);
     
-    if (!cache.tail) {
-        cache.tail = entry;
-    }
+    entry->hash = hash_request(request, request_len);
+    index_insert(entry);
+    
+    entry->purge_item.node = NULL;
+#ifndef CACHE_SIMULATION
+    // Without memory for the purge index the entry just can't be purged
+    char key[PURGE_KEY_SIZE];
+    radix_insert(&cache.purge_index, &entry->purge_item, key, purge_key(host, uri, key));
+#endif
     
+    cache.bytes += header_len;
     cache.count++;
-
-    move_to_front(entry);
+    
+    return entry;
 }
 
 /**
@@ -203,30 +1074,160 @@ void evict_entry(const char *request, int should_print) {
     }
     
     // Log eviction
+    // A silent eviction is a stale entry being replaced, not a removal
     if (should_print) {
-        printf("Evicting %s %s from cache\n", entry->host, entry->uri);
-        fflush(stdout);
+        log_event(LOG_EVICTING, entry->host, entry->uri, 0, 0);
+        stats_add(STAT_EVICTIONS, 1);
     }
     
-    // Remove from LRU linked list
-    if (entry->prev) {
-        entry->prev->next = entry->next;
-    } else {
-        // This was the head
-        cache.head = entry->next;
+    // Remove from LRU linked list and index, mark as invalid
+    release_entry(entry);
+}
+
+/**
+ * @brief Reclaim entries whose max-age has run out, soonest expiry first
+ * 
+ * @param limit Most entries to reclaim, so a sweep stays short
+ * @return int Number reclaimed
+ */
+int cache_sweep_expired(int limit) {
+    int reclaimed = 0;
+    
+    // The heap top expires first, so stop at the first live one
+    while (reclaimed < limit && cache.heap_count > 0 &&
+           cache_entry_stale(cache.expiry_heap[0])) {
+        release_entry(cache.expiry_heap[0]);
+        stats_add(STAT_EXPIRED, 1);
+        reclaimed++;
     }
     
-    if (entry->next) {
-        entry->next->prev = entry->prev;
-    } else {
-        // This was the tail
-        cache.tail = entry->prev;
+    return reclaimed;
+}
+
+/**
+ * @brief Remove every entry matching a URL, a host or a host and path prefix
+ * 
+ * @param host Host as it appeared in the Host header (case-insensitive)
+ * @param path Path (or path prefix) starting with '/'; ignored for CACHE_PURGE_HOST
+ * @param scope What to match
+ * @return int Number of entries removed, or -1 on error
+ */
+int cache_purge(const char *host, const char *path, cache_purge_scope scope) {
+    // Paths start with '/' and hosts never contain one, so "host/" covers a host exactly
+    char key[PURGE_KEY_SIZE];
+    size_t key_len = purge_key(host, scope == CACHE_PURGE_HOST ? "/" : path, key);
+    
+    radix_item **matches;
+    long count = radix_collect(&cache.purge_index, key, key_len, scope != CACHE_PURGE_URL, &matches);
+    if (count < 0) {
+        return -1;
     }
     
-    // Mark as invalid and clear pointers
-    entry->valid = 0;
-    entry->prev = NULL;
-    entry->next = NULL;
+    for (long i = 0; i < count; i++) {
+        cache_entry *entry = (cache_entry *)((char *)matches[i] - offsetof(cache_entry, purge_item));
+        log_event(LOG_EVICTING, entry->host, entry->uri, 0, 0);
+        stats_add(STAT_PURGED, 1);
+        release_entry(entry);
+    }
     
-    cache.count--;
-}
\ No newline at end of file
+    free(matches);
+    return (int)count;
+}
+
+/**
+ * @brief Set how long responses with a status are cached
+ * 
+ * @param status HTTP status (400-599), or NEGATIVE_STATUS_CONNECT
+ * @param seconds TTL in seconds, 0 to never cache
+ * @return int 0 on success, -1 if the status is out of range or the table is full
+ */
+int set_negative_ttl(int status, int seconds) {
+    if (seconds < 0 || (status != NEGATIVE_STATUS_CONNECT && (status < 400 || status > 599))) {
+        return -1;
+    }
+    
+    for (int i = 0; i < negative_override_count; i++) {
+        if (negative_overrides[i].status == status) {
+            negative_overrides[i].seconds = seconds;
+            return 0;
+        }
+    }
+    
+    if (negative_override_count == NEGATIVE_TTL_OVERRIDES) {
+        return -1;
+    }
+    negative_overrides[negative_override_count].status = status;
+    negative_overrides[negative_override_count].seconds = seconds;
+    negative_override_count++;
+    return 0;
+}
+
+/**
+ * @brief Look up the negative-caching TTL for a status
+ * 
+ * @param status HTTP status, or NEGATIVE_STATUS_CONNECT
+ * @return int TTL in seconds, 0 if never cached, -1 if the normal rules apply
+ */
+int negative_ttl(int status) {
+    for (int i = 0; i < negative_override_count; i++) {
+        if (negative_overrides[i].status == status) {
+            return negative_overrides[i].seconds;
+        }
+    }
+    
+    if (status == NEGATIVE_STATUS_CONNECT) {
+        return NEGATIVE_TTL_CONNECT_FAILURE;
+    }
+    if (status == 404 || status == 410) {
+        return NEGATIVE_TTL_NOT_FOUND;
+    }
+    if (status >= 500 && status <= 599) {
+        return NEGATIVE_TTL_SERVER_ERROR;
+    }
+    return -1;
+}
+
+/**
+ * @brief Remember that an origin could not be resolved or connected to
+ * 
+ * @param host Host header value naming the origin
+ */
+void cache_origin_failure(const char *host) {
+    int ttl = negative_ttl(NEGATIVE_STATUS_CONNECT);
+    if (ttl <= 0) {
+        return;
+    }
+    
+    // Reuse the host's own slot if it has one, otherwise the one expiring soonest
+    failed_origin *slot = &failed_origins[0];
+    for (int i = 0; i < NEGATIVE_ORIGINS; i++) {
+        if (strcasecmp(failed_origins[i].host, host) == 0) {
+            slot = &failed_origins[i];
+            break;
+        }
+        if (failed_origins[i].expires < slot->expires) {
+            slot = &failed_origins[i];
+        }
+    }
+    
+    snprintf(slot->host, sizeof(slot->host), "%s", host);
+    slot->expires = cache_now() + ttl;
+}
+
+/**
+ * @brief Check whether an origin failed recently enough to fail fast
+ * 
+ * @param host Host header value naming the origin (case-insensitive)
+ * @return int 1 if its last failure is still within the connect-failure TTL
+ */
+int cache_origin_failed(const char *host) {
+    time_t now = cache_now();
+    
+    for (int i = 0; i < NEGATIVE_ORIGINS; i++) {
+        if (failed_origins[i].host[0] && now <= failed_origins[i].expires &&
+            strcasecmp(failed_origins[i].host, host) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
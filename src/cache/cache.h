@@ -4,7 +4,66 @@
 #include <stdint.h>
 #include <time.h>
 
-#define CACHE_SIZE 10
+#include "radix.h"
+
+// Entry slots; the most cache_entries can be raised to (slots cost memory only once used)
+#ifndef CACHE_SIZE
+#define CACHE_SIZE 65536
+#endif
+
+// Entries held until a config file sets cache_entries (at most CACHE_SIZE)
+#ifndef CACHE_ENTRIES
+#define CACHE_ENTRIES 10
+#endif
+
+// Expired entries the background sweep reclaims per run
+#ifndef CACHE_SWEEP_BATCH
+#define CACHE_SWEEP_BATCH 64
+#endif
+
+// Time between sweeps (ms)
+#ifndef CACHE_SWEEP_INTERVAL_MS
+#define CACHE_SWEEP_INTERVAL_MS 1000
+#endif
+
+// Buckets in the request hash index (power of two, no smaller than CACHE_SIZE)
+#ifndef CACHE_HASH_BUCKETS
+#define CACHE_HASH_BUCKETS 65536
+#endif
+
+// LRU hits a lock-free reader queues for the writer before dropping more (power of two)
+#ifndef CACHE_HIT_BUFFER
+#define CACHE_HIT_BUFFER 256
+#endif
+
+// Default negative-caching TTLs (seconds): 404/410, other 5xx, unreachable origins
+#ifndef NEGATIVE_TTL_NOT_FOUND
+#define NEGATIVE_TTL_NOT_FOUND 10
+#endif
+
+#ifndef NEGATIVE_TTL_SERVER_ERROR
+#define NEGATIVE_TTL_SERVER_ERROR 5
+#endif
+
+#ifndef NEGATIVE_TTL_CONNECT_FAILURE
+#define NEGATIVE_TTL_CONNECT_FAILURE 5
+#endif
+
+// Pseudo-status used to configure the TTL for origins that failed DNS or connect
+#define NEGATIVE_STATUS_CONNECT 0
+
+// Per-status TTL overrides that can be configured
+#define NEGATIVE_TTL_OVERRIDES 16
+
+// Unreachable origins remembered at once
+#ifndef NEGATIVE_ORIGINS
+#define NEGATIVE_ORIGINS 64
+#endif
+
+// Smallest body worth storing compressed (bytes), with HAVE_ZLIB
+#ifndef CACHE_COMPRESS_MIN_SIZE
+#define CACHE_COMPRESS_MIN_SIZE 256
+#endif
 
 #ifndef MAX_REQUEST_SIZE
 #define MAX_REQUEST_SIZE 2000
@@ -22,14 +81,47 @@
 #define MAX_URI_SIZE 256
 #endif
 
+/**
+ * How a cached response body is stored
+ */
+typedef enum {
+    CACHE_ENCODING_IDENTITY,   // As the origin sent it
+    CACHE_ENCODING_GZIP,       // Compressed by the proxy; headers are the origin's
+} cache_encoding;
+
+/**
+ * Response body shared by every entry whose stored body has the same bytes
+ */
+typedef struct cache_body {
+    uint32_t hash;                       // Content hash
+    int size;
+    int refs;                            // Entries using it
+    cache_encoding encoding;
+    struct cache_body *hash_next;
+    char data[];
+} cache_body;
+
 /**
  * Cache entry structure for storing HTTP requests and responses
  */
 typedef struct cache_entry {
-    // Request and response data
+    // Request hash index chain, next to the request so a lookup touches one line
+    uint32_t hash;
+    int request_len;
+    struct cache_entry *hash_next;
+    
+    // Request data
     char request[MAX_REQUEST_SIZE];      
-    char response[MAX_RESPONSE_SIZE];    
-    int response_size;
+    
+    // Response: the origin's header block, then a body shared by content
+    char *headers;                       // NULL in simulation builds
+    int header_len;                      // Header block length, including the blank line
+    cache_body *body;                    // NULL in simulation builds or for an empty body
+    int response_size;                   // header_len plus the stored body size
+    
+    // Compressed storage
+    cache_encoding encoding;             // How body is stored
+    int identity_size;                   // Headers plus the body as the origin sent it
     
     // Request metadata
     char host[MAX_HOSTNAME_SIZE];          
@@ -40,31 +132,120 @@ typedef struct cache_entry {
     uint32_t max_age;
     time_t cached_time;
     int has_max_age;
+    time_t expires;                      // cached_time + max_age, if has_max_age
+    int heap_index;                      // Slot in the expiry heap, -1 if not in it
+    int referenced;                      // CLOCK reference bit, set by lock-free readers too
+    
+    // Place in the host+path purge index
+    radix_item purge_item;
     
     // LRU linked list pointers
     struct cache_entry *prev;
     struct cache_entry *next;
 } cache_entry;
 
+/**
+ * What a purge matches
+ */
+typedef enum {
+    CACHE_PURGE_URL,       // One host and path, every cached variant of it
+    CACHE_PURGE_HOST,      // Everything cached for a host
+    CACHE_PURGE_PREFIX,    // Paths on a host starting with a prefix
+} cache_purge_scope;
+
+/**
+ * Replacement policies. Eviction always takes the entry at the tail.
+ */
+typedef enum {
+    CACHE_POLICY_LRU,      // Hits move the entry to the front
+    CACHE_POLICY_FIFO,     // Insertion order only, hits don't reorder
+    CACHE_POLICY_CLOCK,    // Hits set a reference bit, eviction gives it a second chance
+} cache_policy;
+
 // LRU Cache structure
 typedef struct {
     cache_entry entries[CACHE_SIZE];  
     cache_entry *head;                
     cache_entry *tail;                
     int count;                        
+    
+    // Limits, set with set_cache_limits()
+    int capacity;                     // Entries, at most CACHE_SIZE
+    uint64_t byte_budget;             // Response bytes, 0 = unlimited
+    uint64_t bytes;                   // Response bytes held
+    cache_policy policy;
+    
+    // Slot allocation: entries past next_unused have never been handed out
+    int next_unused;
+    cache_entry *free_list;
+    
+    // Min-heap of entries with a max-age, soonest expiry first
+    cache_entry *expiry_heap[CACHE_SIZE];
+    int heap_count;
+    
+    // Host+path index for purges
+    radix_tree purge_index;
+    
+    // Request hash index, sized to the capacity
+    uint32_t bucket_mask;
+    cache_entry *buckets[CACHE_HASH_BUCKETS];
+    
+    // Body index by content hash
+    cache_body *body_buckets[CACHE_HASH_BUCKETS];
 } lru_cache;
 
 // Global cache instance
 extern lru_cache cache;
 
+#ifdef CACHE_SIMULATION
+// Simulation builds keep metadata only and run on the trace's clock
+extern time_t cache_sim_time;
+#endif
+
 /**
  * @brief Initialise the LRU cache
  */
 void init_cache();
 
+/**
+ * @brief Set the entry and byte limits, evicting down to them
+ * 
+ * @param capacity Maximum entries (clamped to 1..CACHE_SIZE)
+ * @param byte_budget Maximum response bytes held, 0 for no limit
+ */
+void set_cache_limits(int capacity, uint64_t byte_budget);
+
+/**
+ * @brief Choose the replacement policy
+ * 
+ * @param policy Policy to use from now on
+ */
+void set_cache_policy(cache_policy policy);
+
+/**
+ * @brief Current time as the cache sees it
+ * 
+ * @return time_t Wall-clock seconds, or the trace clock in simulation builds
+ */
+time_t cache_now();
+
+/**
+ * @brief Check whether an entry has outlived its max-age
+ * 
+ * @param entry Cache entry
+ * @return int 1 if stale, 0 if fresh (entries without max-age never go stale)
+ */
+int cache_entry_stale(const cache_entry *entry);
+
 /**
  * @brief Add a new entry to the cache
  * 
+ * Evicts until both the entry limit and the byte budget have room. A
+ * response larger than the whole byte budget is not cached. With
+ * HAVE_ZLIB, text bodies (HTML, CSS, JS, JSON, XML) are stored
+ * gzip-compressed when that makes them smaller. A body already held by
+ * another entry is shared rather than copied.
+ * 
  * @param request Request string
  * @param request_len Length of the request
  * @param response Response data
@@ -73,10 +254,21 @@ void init_cache();
  * @param uri URI from the request
  * @param max_age Max-age value from Cache-Control header
  * @param has_max_age Whether max-age was specified
+ * @return cache_entry* The new entry, or NULL if it was not cached
  */
-void add_to_cache(const char *request, int request_len, const char *response, int response_len, 
+cache_entry* add_to_cache(const char *request, int request_len, const char *response, int response_len, 
                   const char *host, const char *uri, uint32_t max_age, int has_max_age);
 
+/**
+ * @brief Decompress the body of an entry stored compressed
+ * 
+ * @param entry Entry with encoding other than CACHE_ENCODING_IDENTITY
+ * @param out Buffer for the body, at least identity_size - header_len bytes
+ * @param out_size Size of out
+ * @return int Body length, or -1 on error (or without HAVE_ZLIB)
+ */
+int cache_decode_body(const cache_entry *entry, char *out, int out_size);
+
 /**
  * @brief Find a request in the cache
  * 
@@ -86,9 +278,39 @@ void add_to_cache(const char *request, int request_len, const char *response, in
  */
 cache_entry* find_in_cache(const char *request, int request_len);
 
+/**
+ * @brief Find a request in the cache without locking, from any thread
+ * 
+ * The serving loop is the cache's one writer; every other function here
+ * belongs to it. cache_lookup() may run on any number of other threads at
+ * the same time, between epoch_enter() and epoch_exit(). The entry, its
+ * headers and its body stay intact until epoch_exit() even if the writer
+ * evicts it meanwhile. A hit writes nothing shared with other readers:
+ * under CLOCK it sets the reference bit, under LRU it is queued on a
+ * per-thread buffer the writer replays before evicting, so recency is
+ * approximate. Freshness is left to the caller (cache_entry_stale()).
+ * Lookups racing a set_cache_limits() that resizes the index may miss.
+ * 
+ * @param request Request string to look for
+ * @param request_len Length of the request
+ * @return cache_entry* Entry, valid until epoch_exit(), or NULL if not found
+ */
+cache_entry* cache_lookup(const char *request, int request_len);
+
+/**
+ * @brief Check for a fresh entry without touching its recency
+ * 
+ * @param request Request string to look for
+ * @param request_len Length of the request
+ * @return int 1 if a fresh entry is cached for the request, 0 otherwise
+ */
+int cache_has_fresh(const char *request, int request_len);
+
 /**
  * @brief Move a cache entry to the front of the LRU list (most recently used)
  * 
+ * Under FIFO this does nothing, under CLOCK it only sets the reference bit.
+ * 
  * @param entry Cache entry to move
  */
 void move_to_front(cache_entry *entry);
@@ -103,8 +325,65 @@ void evict_entry(const char *request, int should_print);
 
 /** Evict the least recently used cache entry
 * 
+* An entry that has already expired is taken first, whatever its recency.
+* 
 * @return cache_entry* Pointer to the evicted entry (now invalid)
 */
 cache_entry* evict_lru();
 
+/**
+ * @brief Reclaim entries whose max-age has run out, soonest expiry first
+ * 
+ * @param limit Most entries to reclaim, so a sweep stays short
+ * @return int Number reclaimed
+ */
+int cache_sweep_expired(int limit);
+
+/**
+ * @brief Set how long responses with a status are cached
+ * 
+ * The TTL caps the response's own max-age; 0 stops the status being cached.
+ * 
+ * @param status HTTP status (400-599), or NEGATIVE_STATUS_CONNECT for origins that
+ *               could not be resolved or connected to
+ * @param seconds TTL in seconds
+ * @return int 0 on success, -1 if the status is out of range or the table is full
+ */
+int set_negative_ttl(int status, int seconds);
+
+/**
+ * @brief Look up the negative-caching TTL for a status
+ * 
+ * @param status HTTP status, or NEGATIVE_STATUS_CONNECT
+ * @return int TTL in seconds, 0 if never cached, -1 if the normal rules apply
+ */
+int negative_ttl(int status);
+
+/**
+ * @brief Remember that an origin could not be resolved or connected to
+ * 
+ * @param host Host header value naming the origin
+ */
+void cache_origin_failure(const char *host);
+
+/**
+ * @brief Check whether an origin failed recently enough to fail fast
+ * 
+ * @param host Host header value naming the origin (case-insensitive)
+ * @return int 1 if its last failure is still within the connect-failure TTL
+ */
+int cache_origin_failed(const char *host);
+
+/**
+ * @brief Remove every entry matching a URL, a host or a host and path prefix
+ * 
+ * Runs in time proportional to the number of matches, not the cache size.
+ * 
+ * @param host Host as it appeared in the Host header (case-insensitive)
+ * @param path Path (or path prefix) starting with '/'; ignored for CACHE_PURGE_HOST
+ * @param scope What to match
+ * @return int Number of entries removed, or -1 on error
+ */
+int cache_purge(const char *host, const char *path, cache_purge_scope scope);
+
 #endif /* CACHE_H */
\ No newline at end of file
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "cluster.h"
+#include "stats.h"
+
+/**
+ * A node of the cluster: this proxy or one of its peers
+ */
+typedef struct {
+    char name[CLUSTER_NAME_SIZE];
+    int self;
+    time_t down_until;              // Routed around until then after a failure
+} cluster_node;
+
+/**
+ * A node's point on the ring
+ */
+typedef struct {
+    uint64_t hash;
+    int node;
+} ring_point;
+
+static cluster_node nodes[CLUSTER_MAX_PEERS + 1];
+static int node_count;
+static char self_name[CLUSTER_NAME_SIZE];
+
+static ring_point ring[(CLUSTER_MAX_PEERS + 1) * CLUSTER_VNODES];
+static int ring_size;
+
+// Addresses the peers resolved to at startup, IPv4 ones as IPv4-mapped IPv6
+static struct in6_addr peer_addresses[CLUSTER_MAX_PEER_ADDRESSES];
+static int peer_address_count;
+
+/**
+ * @brief Hash a string onto the ring (FNV-1a with a final mix)
+ *
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @param hash Running hash, or the FNV offset basis to start
+ * @return uint64_t Updated hash
+ */
+static uint64_t fnv1a(const char *data, size_t len, uint64_t hash) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief Spread the bits of a short-string FNV hash over the whole ring
+ *
+ * @param hash FNV hash
+ * @return uint64_t Ring position
+ */
+static uint64_t mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * @brief Order ring points by position, then node name, the same way on every node
+ */
+static int compare_points(const void *a, const void *b) {
+    const ring_point *pa = a, *pb = b;
+    if (pa->hash != pb->hash) {
+        return pa->hash < pb->hash ? -1 : 1;
+    }
+    return strcmp(nodes[pa->node].name, nodes[pb->node].name);
+}
+
+/**
+ * @brief Put an address in the form peer addresses are kept in
+ *
+ * @param addr Socket address
+ * @param out IPv6 address, IPv4 ones mapped into it
+ * @return int 0 on success, -1 for other families
+ */
+static int to_ipv6(const struct sockaddr *addr, struct in6_addr *out) {
+    if (addr->sa_family == AF_INET6) {
+        *out = ((const struct sockaddr_in6 *)addr)->sin6_addr;
+        return 0;
+    }
+    if (addr->sa_family == AF_INET) {
+        memset(out, 0, sizeof(*out));
+        out->s6_addr[10] = 0xff;
+        out->s6_addr[11] = 0xff;
+        memcpy(&out->s6_addr[12], &((const struct sockaddr_in *)addr)->sin_addr, 4);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Remember the addresses a peer's name resolves to
+ *
+ * @param name Peer's "host:port" ("[v6addr]:port" for IPv6)
+ */
+static void resolve_peer(const char *name) {
+    char host[CLUSTER_NAME_SIZE];
+    snprintf(host, sizeof(host), "%s", name[0] == '[' ? name + 1 : name);
+    char *colon = strrchr(host, name[0] == '[' ? ']' : ':');
+    if (colon) {
+        *colon = '\0';
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(host, NULL, &hints, &result);
+    if (status != 0) {
+        fprintf(stderr, "Peer %s: %s, its requests won't be trusted\n", name, gai_strerror(status));
+        return;
+    }
+    for (struct addrinfo *ai = result; ai && peer_address_count < CLUSTER_MAX_PEER_ADDRESSES;
+         ai = ai->ai_next) {
+        if (to_ipv6(ai->ai_addr, &peer_addresses[peer_address_count]) == 0) {
+            peer_address_count++;
+        }
+    }
+    freeaddrinfo(result);
+}
+
+/**
+ * @brief Add a peer proxy to the cluster
+ *
+ * @param address Peer's listen address, "host:port"
+ * @return int 0 on success, -1 if too many peers or the name is too long
+ */
+int cluster_add_peer(const char *address) {
+    if (node_count == CLUSTER_MAX_PEERS || strlen(address) >= CLUSTER_NAME_SIZE) {
+        return -1;
+    }
+    snprintf(nodes[node_count].name, CLUSTER_NAME_SIZE, "%s", address);
+    nodes[node_count].self = 0;
+    node_count++;
+    return 0;
+}
+
+/**
+ * @brief Name this node on the ring (the address its peers reach it at)
+ *
+ * @param address "host:port", by default 127.0.0.1 and the listen port
+ * @return int 0 on success, -1 if the name is too long
+ */
+int cluster_set_self(const char *address) {
+    if (strlen(address) >= CLUSTER_NAME_SIZE) {
+        return -1;
+    }
+    snprintf(self_name, sizeof(self_name), "%s", address);
+    return 0;
+}
+
+/**
+ * @brief Build the ring once the options are in
+ *
+ * @param listen_port Port this node listens on, for the default name
+ * @return int 0 on success (or with no peers), -1 on error
+ */
+int cluster_init(int listen_port) {
+    if (node_count == 0) {
+        return 0;
+    }
+
+    if (!self_name[0]) {
+        snprintf(self_name, sizeof(self_name), "127.0.0.1:%d", listen_port);
+    }
+    for (int i = 0; i < node_count; i++) {
+        if (strcmp(nodes[i].name, self_name) == 0) {
+            fprintf(stderr, "Peer %s is this node\n", self_name);
+            return -1;
+        }
+    }
+    snprintf(nodes[node_count].name, CLUSTER_NAME_SIZE, "%s", self_name);
+    nodes[node_count].self = 1;
+    node_count++;
+
+    ring_size = 0;
+    for (int i = 0; i < node_count; i++) {
+        for (int vnode = 0; vnode < CLUSTER_VNODES; vnode++) {
+            char label[CLUSTER_NAME_SIZE + 16];
+            int len = snprintf(label, sizeof(label), "%s#%d", nodes[i].name, vnode);
+            ring[ring_size].hash = mix(fnv1a(label, len, 0xcbf29ce484222325ull));
+            ring[ring_size].node = i;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring_point), compare_points);
+
+    for (int i = 0; i < node_count; i++) {
+        if (!nodes[i].self) {
+            resolve_peer(nodes[i].name);
+        }
+    }
+
+    fprintf(stderr, "Cluster of %d nodes, this one %s\n", node_count, self_name);
+    return 0;
+}
+
+/**
+ * @brief Check whether peers are configured
+ *
+ * @return int 1 if they are, 0 otherwise
+ */
+int cluster_enabled() {
+    return ring_size > 0;
+}
+
+/**
+ * @brief Find the node that owns an object
+ *
+ * @param hostname Host header value
+ * @param uri Request target
+ * @return const char* Owning peer's address, or NULL if this node owns it
+ */
+const char* cluster_owner(const char *hostname, const char *uri) {
+    if (ring_size == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = fnv1a(hostname, strlen(hostname), 0xcbf29ce484222325ull);
+    hash = mix(fnv1a(uri, strlen(uri), fnv1a(" ", 1, hash)));
+
+    // First point at or after the key
+    int low = 0, high = ring_size;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (ring[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    time_t now = time(NULL);
+    for (int i = 0; i < ring_size; i++) {
+        cluster_node *node = &nodes[ring[(low + i) % ring_size].node];
+        if (node->self) {
+            return NULL;
+        }
+        if (node->down_until <= now) {
+            return node->name;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Route around a peer that could not be reached for a while
+ *
+ * @param address Peer's address as returned by cluster_owner()
+ */
+void cluster_peer_failed(const char *address) {
+    for (int i = 0; i < node_count; i++) {
+        if (!nodes[i].self && strcmp(nodes[i].name, address) == 0) {
+            nodes[i].down_until = time(NULL) + CLUSTER_RETRY_SECONDS;
+            stats_add(STAT_PEER_FAILURES, 1);
+            fprintf(stderr, "Peer %s unreachable, routing around it for %d s\n",
+                    address, CLUSTER_RETRY_SECONDS);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Check whether a connection comes from a configured peer
+ *
+ * @param socket Connected client socket
+ * @return int 1 if its address is one a peer resolved to, 0 otherwise
+ */
+int cluster_is_peer(int socket) {
+    if (peer_address_count == 0) {
+        return 0;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    struct in6_addr client;
+    if (getpeername(socket, (struct sockaddr *)&addr, &len) < 0 ||
+        to_ipv6((struct sockaddr *)&addr, &client) < 0) {
+        return 0;
+    }
+    for (int i = 0; i < peer_address_count; i++) {
+        if (memcmp(&peer_addresses[i], &client, sizeof(client)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+/* ========== Constants ========== */
+// Peers a node can be configured with
+#define CLUSTER_MAX_PEERS 32
+
+// Points each node gets on the ring; more spread the key space more evenly
+#ifndef CLUSTER_VNODES
+#define CLUSTER_VNODES 160
+#endif
+
+// How long a peer that could not be reached is routed around (seconds)
+#ifndef CLUSTER_RETRY_SECONDS
+#define CLUSTER_RETRY_SECONDS 10
+#endif
+
+// Addresses kept for recognising peers' connections, over all peers
+#define CLUSTER_MAX_PEER_ADDRESSES (4 * CLUSTER_MAX_PEERS)
+
+// Longest node name ("host:port")
+#define CLUSTER_NAME_SIZE 128
+
+// Marks a request forwarded by a peer, so the owner fetches it itself instead of forwarding again.
+// Only believed on connections from a peer's address (cluster_is_peer()); stripped from any other.
+#define CLUSTER_PEER_HEADER "X-Htproxy-Peer"
+
+/**
+ * @brief Add a peer proxy to the cluster
+ *
+ * Every node must be given the same set of nodes (itself plus its peers)
+ * under the same names, so they all build the same ring.
+ *
+ * @param address Peer's listen address, "host:port"
+ * @return int 0 on success, -1 if too many peers or the name is too long
+ */
+int cluster_add_peer(const char *address);
+
+/**
+ * @brief Name this node on the ring (the address its peers reach it at)
+ *
+ * @param address "host:port", by default 127.0.0.1 and the listen port
+ * @return int 0 on success, -1 if the name is too long
+ */
+int cluster_set_self(const char *address);
+
+/**
+ * @brief Build the ring once the options are in
+ *
+ * @param listen_port Port this node listens on, for the default name
+ * @return int 0 on success (or with no peers), -1 on error
+ */
+int cluster_init(int listen_port);
+
+/**
+ * @brief Check whether peers are configured
+ *
+ * @return int 1 if they are, 0 otherwise
+ */
+int cluster_enabled();
+
+/**
+ * @brief Find the node that owns an object
+ *
+ * Walks the ring from the object's point to the first node that is not
+ * being routed around, so a failed peer's keys spread over the others.
+ *
+ * @param hostname Host header value
+ * @param uri Request target
+ * @return const char* Owning peer's address, or NULL if this node owns it
+ */
+const char* cluster_owner(const char *hostname, const char *uri);
+
+/**
+ * @brief Route around a peer that could not be reached for a while
+ *
+ * @param address Peer's address as returned by cluster_owner()
+ */
+void cluster_peer_failed(const char *address);
+
+/**
+ * @brief Check whether a connection comes from a configured peer
+ *
+ * Peer names are resolved once, by cluster_init(), and the connection's
+ * address is compared against them without its port (peers connect from
+ * ephemeral ones). Peers sharing a host with clients can't be told apart
+ * from them.
+ *
+ * @param socket Connected client socket
+ * @return int 1 if its address is one a peer resolved to, 0 otherwise
+ */
+int cluster_is_peer(int socket);
+
+#endif /* CLUSTER_H */
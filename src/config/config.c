@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "utils.h"
+#include "cache.h"
+#include "http.h"
+#include "socket.h"
+#include "tunnel.h"
+#include "proxy.h"
+#include "dispatch.h"
+#include "prefetch.h"
+
+/**
+ * How a setting's value is written
+ */
+typedef enum {
+    SETTING_NUMBER,        // Plain decimal count or milliseconds
+    SETTING_SIZE,          // Byte count with an optional k/m/g suffix
+    SETTING_POLICY,        // lru, fifo or clock
+} setting_kind;
+
+/**
+ * Settings a config file can hold
+ */
+typedef enum {
+    SETTING_CACHE_ENTRIES,
+    SETTING_CACHE_MEMORY,
+    SETTING_CACHE_POLICY,
+    SETTING_MAX_OBJECT_SIZE,
+    SETTING_CLIENT_BUFFER,
+    SETTING_BACKLOG,
+    SETTING_QUEUE_TARGET,
+    SETTING_ORIGIN_LIMIT,
+    SETTING_PREFETCH_WORKERS,
+    SETTING_PREFETCH_BUDGET,
+    SETTING_HEADER_TIMEOUT,
+    SETTING_CONNECT_TIMEOUT,
+    SETTING_FIRST_BYTE_TIMEOUT,
+    SETTING_BODY_IDLE_TIMEOUT,
+    SETTING_TUNNEL_IDLE_TIMEOUT,
+    SETTING_COUNT
+} setting_id;
+
+/**
+ * Name and accepted range of a setting
+ */
+typedef struct {
+    const char *name;
+    setting_kind kind;
+    uint64_t min;
+    uint64_t max;
+} setting_info;
+
+static const setting_info settings[SETTING_COUNT] = {
+    [SETTING_CACHE_ENTRIES]       = {"cache_entries", SETTING_NUMBER, 1, CACHE_SIZE},
+    [SETTING_CACHE_MEMORY]        = {"cache_memory", SETTING_SIZE, 0, UINT64_MAX},
+    [SETTING_CACHE_POLICY]        = {"cache_policy", SETTING_POLICY, 0, 0},
+    [SETTING_MAX_OBJECT_SIZE]     = {"max_object_size", SETTING_SIZE, 1, MAX_RESPONSE_SIZE},
+    [SETTING_CLIENT_BUFFER]       = {"client_buffer", SETTING_SIZE, 1, INT32_MAX},
+    [SETTING_BACKLOG]             = {"backlog", SETTING_NUMBER, 1, 65535},
+    [SETTING_QUEUE_TARGET]        = {"queue_target_ms", SETTING_NUMBER, 0, CONFIG_MAX_TIMEOUT_MS},
+    [SETTING_ORIGIN_LIMIT]        = {"origin_limit", SETTING_NUMBER, 0, DISPATCH_QUEUE_SIZE},
+    [SETTING_PREFETCH_WORKERS]    = {"prefetch_workers", SETTING_NUMBER, 0, PREFETCH_MAX_WORKERS},
+    [SETTING_PREFETCH_BUDGET]     = {"prefetch_budget", SETTING_SIZE, 1, UINT64_MAX},
+    [SETTING_HEADER_TIMEOUT]      = {"header_timeout_ms", SETTING_NUMBER, 1, CONFIG_MAX_TIMEOUT_MS},
+    [SETTING_CONNECT_TIMEOUT]     = {"connect_timeout_ms", SETTING_NUMBER, 1, CONFIG_MAX_TIMEOUT_MS},
+    [SETTING_FIRST_BYTE_TIMEOUT]  = {"first_byte_timeout_ms", SETTING_NUMBER, 1, CONFIG_MAX_TIMEOUT_MS},
+    [SETTING_BODY_IDLE_TIMEOUT]   = {"body_idle_timeout_ms", SETTING_NUMBER, 1, CONFIG_MAX_TIMEOUT_MS},
+    [SETTING_TUNNEL_IDLE_TIMEOUT] = {"tunnel_idle_timeout_ms", SETTING_NUMBER, 1, CONFIG_MAX_TIMEOUT_MS},
+};
+
+/**
+ * Everything read from one version of the file
+ */
+typedef struct {
+    int given[SETTING_COUNT];
+    uint64_t value[SETTING_COUNT];
+
+    // negative_ttl lines, which may repeat
+    int ttl_status[NEGATIVE_TTL_OVERRIDES];
+    int ttl_seconds[NEGATIVE_TTL_OVERRIDES];
+    int ttl_count;
+} config_values;
+
+static char config_path[CONFIG_LINE_SIZE];
+
+// File as last applied
+static config_values applied;
+
+/**
+ * @brief Parse one setting's value
+ *
+ * @param info Setting being set
+ * @param text Value text
+ * @param value Receives the value
+ * @return int 0 on success, -1 if malformed or out of range
+ */
+static int parse_value(const setting_info *info, const char *text, uint64_t *value) {
+    if (info->kind == SETTING_POLICY) {
+        if (!strcasecmp(text, "lru")) {
+            *value = CACHE_POLICY_LRU;
+        } else if (!strcasecmp(text, "fifo")) {
+            *value = CACHE_POLICY_FIFO;
+        } else if (!strcasecmp(text, "clock")) {
+            *value = CACHE_POLICY_CLOCK;
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (info->kind == SETTING_SIZE) {
+        size_t bytes;
+        if (parse_size(text, &bytes) < 0) {
+            return -1;
+        }
+        *value = bytes;
+    } else {
+        if (!*text || strlen(text) > 19) {
+            return -1;
+        }
+        for (const char *p = text; *p; p++) {
+            if (!isdigit((unsigned char)*p)) {
+                return -1;
+            }
+        }
+        *value = strtoull(text, NULL, 10);
+    }
+    return *value >= info->min && *value <= info->max ? 0 : -1;
+}
+
+/**
+ * @brief Read and check a config file without applying any of it
+ *
+ * @param path Config file path
+ * @param values Receives the settings
+ * @return int 0 on success, -1 on error (reported on stderr)
+ */
+static int read_config(const char *path, config_values *values) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+
+    memset(values, 0, sizeof(*values));
+    char line[CONFIG_LINE_SIZE];
+    int line_number = 0;
+    int result = 0;
+
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        line_number++;
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(file)) {
+            fprintf(stderr, "%s:%d: line too long\n", path, line_number);
+            result = -1;
+            break;
+        }
+
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char *text = trim(line);
+        if (!*text) {
+            continue;
+        }
+
+        char *eq = strchr(text, '=');
+        if (!eq) {
+            fprintf(stderr, "%s:%d: expected name = value\n", path, line_number);
+            result = -1;
+            break;
+        }
+        *eq = '\0';
+        char *name = trim(text);
+        char *value = trim(eq + 1);
+
+        if (!strcmp(name, "negative_ttl")) {
+            int status, seconds;
+            if (parse_negative_ttl(value, &status, &seconds) < 0 ||
+                (status != NEGATIVE_STATUS_CONNECT && (status < 400 || status > 599))) {
+                fprintf(stderr, "%s:%d: negative_ttl must be <status|connect>=<seconds>\n",
+                        path, line_number);
+                result = -1;
+            } else if (values->ttl_count == NEGATIVE_TTL_OVERRIDES) {
+                fprintf(stderr, "%s:%d: more than %d negative_ttl lines\n",
+                        path, line_number, NEGATIVE_TTL_OVERRIDES);
+                result = -1;
+            } else {
+                values->ttl_status[values->ttl_count] = status;
+                values->ttl_seconds[values->ttl_count] = seconds;
+                values->ttl_count++;
+            }
+            continue;
+        }
+
+        int id = 0;
+        while (id < SETTING_COUNT && strcmp(name, settings[id].name)) {
+            id++;
+        }
+        if (id == SETTING_COUNT) {
+            fprintf(stderr, "%s:%d: unknown setting '%s'\n", path, line_number, name);
+            result = -1;
+        } else if (parse_value(&settings[id], value, &values->value[id]) < 0) {
+            if (settings[id].kind == SETTING_POLICY) {
+                fprintf(stderr, "%s:%d: %s must be lru, fifo or clock\n", path, line_number, name);
+            } else {
+                fprintf(stderr, "%s:%d: %s must be %llu to %llu\n", path, line_number, name,
+                        (unsigned long long)settings[id].min, (unsigned long long)settings[id].max);
+            }
+            result = -1;
+        } else {
+            values->given[id] = 1;
+        }
+    }
+
+    if (result == 0 && ferror(file)) {
+        perror(path);
+        result = -1;
+    }
+    fclose(file);
+    return result;
+}
+
+/**
+ * @brief Push a checked set of settings into the modules that use them
+ *
+ * @param values Settings read from the file
+ * @param listen_socket Listening socket, for the backlog setting
+ */
+static void apply_config(const config_values *values, int listen_socket) {
+    const int *given = values->given;
+    const uint64_t *value = values->value;
+
+    // Resizing keeps what is cached, evicting only down to a smaller limit
+    if (g_cache_enabled && (given[SETTING_CACHE_ENTRIES] || given[SETTING_CACHE_MEMORY])) {
+        set_cache_limits(given[SETTING_CACHE_ENTRIES] ? (int)value[SETTING_CACHE_ENTRIES] : cache.capacity,
+                         given[SETTING_CACHE_MEMORY] ? value[SETTING_CACHE_MEMORY] : cache.byte_budget);
+    }
+    if (g_cache_enabled && given[SETTING_CACHE_POLICY]) {
+        set_cache_policy((cache_policy)value[SETTING_CACHE_POLICY]);
+    }
+    for (int i = 0; i < values->ttl_count; i++) {
+        if (set_negative_ttl(values->ttl_status[i], values->ttl_seconds[i]) < 0) {
+            fprintf(stderr, "No room for negative_ttl %d, ignored\n", values->ttl_status[i]);
+        }
+    }
+
+    set_relay_limits(given[SETTING_MAX_OBJECT_SIZE] ? (int)value[SETTING_MAX_OBJECT_SIZE] : 0,
+                     given[SETTING_CLIENT_BUFFER] ? (size_t)value[SETTING_CLIENT_BUFFER] : 0);
+
+    // Calling listen() again only changes the backlog; queued connections stay
+    if (given[SETTING_BACKLOG] && listen(listen_socket, (int)value[SETTING_BACKLOG]) < 0) {
+        perror("listen failed");
+    }
+
+    dispatch_configure(given[SETTING_QUEUE_TARGET] ? (int)value[SETTING_QUEUE_TARGET] : -1,
+                       given[SETTING_ORIGIN_LIMIT] ? (int)value[SETTING_ORIGIN_LIMIT] : -1);
+    if (given[SETTING_PREFETCH_BUDGET]) {
+        prefetch_set_budget((size_t)value[SETTING_PREFETCH_BUDGET]);
+    }
+
+    if (given[SETTING_HEADER_TIMEOUT]) {
+        set_header_timeout((int)value[SETTING_HEADER_TIMEOUT]);
+    }
+    if (given[SETTING_CONNECT_TIMEOUT]) {
+        set_connect_timeout((int)value[SETTING_CONNECT_TIMEOUT]);
+    }
+    set_origin_timeouts(given[SETTING_FIRST_BYTE_TIMEOUT] ? (int)value[SETTING_FIRST_BYTE_TIMEOUT] : 0,
+                        given[SETTING_BODY_IDLE_TIMEOUT] ? (int)value[SETTING_BODY_IDLE_TIMEOUT] : 0);
+    if (given[SETTING_TUNNEL_IDLE_TIMEOUT]) {
+        set_tunnel_idle_timeout((int)value[SETTING_TUNNEL_IDLE_TIMEOUT]);
+    }
+}
+
+/**
+ * @brief Read the config file and apply it on top of the command-line options
+ *
+ * @param path Config file path, kept for config_reload()
+ * @param listen_socket Listening socket, for the backlog setting
+ * @return int 0 on success, -1 if the file could not be read or has an error
+ */
+int config_init(const char *path, int listen_socket) {
+    if (strlen(path) >= sizeof(config_path)) {
+        fprintf(stderr, "Config path too long\n");
+        return -1;
+    }
+    snprintf(config_path, sizeof(config_path), "%s", path);
+
+    config_values values;
+    if (read_config(config_path, &values) < 0) {
+        return -1;
+    }
+
+    // The prefetch threads are only started once, so their number is fixed from here on
+    if (values.given[SETTING_PREFETCH_WORKERS]) {
+        prefetch_configure((int)values.value[SETTING_PREFETCH_WORKERS], 0);
+    }
+    apply_config(&values, listen_socket);
+    applied = values;
+    return 0;
+}
+
+/**
+ * @brief Read the config file again and apply what changed
+ *
+ * @param listen_socket Listening socket, for the backlog setting
+ * @return int 0 on success (or with no config file), -1 on error
+ */
+int config_reload(int listen_socket) {
+    if (!config_path[0]) {
+        return 0;
+    }
+
+    config_values values;
+    if (read_config(config_path, &values) < 0) {
+        fprintf(stderr, "Keeping the current settings\n");
+        return -1;
+    }
+
+    if (values.given[SETTING_PREFETCH_WORKERS] &&
+        (!applied.given[SETTING_PREFETCH_WORKERS] ||
+         values.value[SETTING_PREFETCH_WORKERS] != applied.value[SETTING_PREFETCH_WORKERS])) {
+        fprintf(stderr, "prefetch_workers only changes on restart\n");
+    }
+    apply_config(&values, listen_socket);
+    applied = values;
+
+    fprintf(stderr, "Reloaded %s\n", config_path);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* ========== Constants ========== */
+// Longest line in a config file
+#define CONFIG_LINE_SIZE 512
+
+// Upper bound on any timeout setting (ms)
+#define CONFIG_MAX_TIMEOUT_MS 86400000
+
+/**
+ * @brief Read the config file and apply it on top of the command-line options
+ *
+ * The file holds one "name = value" setting per line; blank lines and
+ * anything after a '#' are ignored. Call once the cache is initialised and
+ * the listening socket is up, and before the prefetch threads start.
+ *
+ * @param path Config file path, kept for config_reload()
+ * @param listen_socket Listening socket, for the backlog setting
+ * @return int 0 on success, -1 if the file could not be read or has an error
+ */
+int config_init(const char *path, int listen_socket);
+
+/**
+ * @brief Read the config file again and apply what changed
+ *
+ * The whole file is checked before anything is applied, so a file with an
+ * error leaves every setting as it was. Connections in progress are not
+ * touched and the cache keeps its contents, losing entries only if it is
+ * made smaller. Settings removed from the file keep their current values.
+ * Call from the serving loop.
+ *
+ * @param listen_socket Listening socket, for the backlog setting
+ * @return int 0 on success (or with no config file), -1 on error
+ */
+int config_reload(int listen_socket);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "dispatch.h"
+#include "cache.h"
+#include "cluster.h"
+#include "prefetch.h"
+#include "io.h"
+#include "log.h"
+#include "stats.h"
+
+// Using global cache flag from main.c
+extern int g_cache_enabled;
+
+/**
+ * Waiting connections in arrival order
+ */
+typedef struct {
+    dispatch_client clients[DISPATCH_QUEUE_SIZE];
+    int count;
+    int hits_ahead;           // Hits served ahead of the oldest since it last moved
+    int listener;
+
+    // Admission control
+    uint64_t target_us;       // Delay allowed while overloaded, 0 when shedding on delay is off
+    uint64_t interval_us;
+    int origin_limit;
+    uint64_t interval_end_us; // When the current interval's lowest delay is judged
+    uint64_t min_delay_us;    // Lowest delay seen in the current interval, UINT64_MAX if none
+    int drained;              // The queue ran empty during the current interval
+    int overloaded;           // Shedding at the target rather than the interval
+} dispatch_queue;
+
+static dispatch_queue queue = {
+    .listener = -1,
+    .target_us = DISPATCH_TARGET_MS * 1000ull,
+    .interval_us = DISPATCH_INTERVAL_MS * 1000ull,
+    .origin_limit = DISPATCH_ORIGIN_LIMIT,
+    .min_delay_us = UINT64_MAX,
+};
+
+/**
+ * @brief Hash the Host header of a peeked header block, ignoring case
+ *
+ * @param block Header block, NUL-terminated
+ * @param end Start of the blank line ending it
+ * @return uint64_t FNV-1a hash of the value, 0 if there is none
+ */
+static uint64_t hash_origin(const char *block, const char *end) {
+    const char *host = strcasestr(block, "\r\nHost:");
+    if (!host || host >= end) {
+        return 0;
+    }
+    host += strlen("\r\nHost:");
+    while (*host == ' ' || *host == '\t') {
+        host++;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (; *host && *host != '\r' && *host != ' ' && *host != '\t'; host++) {
+        hash ^= (unsigned char)tolower((unsigned char)*host);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief Work out what a connection's request will cost from its buffered bytes
+ *
+ * Sets the client's class, DISPATCH_UNKNOWN if the header block is still
+ * incomplete, and its origin once the headers are in.
+ *
+ * @param client Queued connection
+ */
+static void classify(dispatch_client *client) {
+    char peek[MAX_REQUEST_SIZE];
+    ssize_t n = recv(client->socket, peek, sizeof(peek) - 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        client->class = DISPATCH_UNKNOWN;
+        return;
+    }
+    if (n <= 0) {
+        // Closed or broken, serving it will find out
+        client->class = DISPATCH_MISS;
+        return;
+    }
+    peek[n] = '\0';
+
+    // The cache key is the header block exactly as the client sent it
+    char *end = strstr(peek, "\r\n\r\n");
+    if (!end) {
+        client->class = n == sizeof(peek) - 1 ? DISPATCH_MISS : DISPATCH_UNKNOWN;
+        return;
+    }
+    client->origin = hash_origin(peek, end);
+
+    char *marker = strstr(peek, "\r\n" CLUSTER_PEER_HEADER ":");
+    char *prefetch = strstr(peek, "\r\n" PREFETCH_HEADER ":");
+    if (marker && marker < end && cluster_is_peer(client->socket)) {
+        client->class = DISPATCH_PEER;
+    } else if (prefetch && prefetch < end) {
+        client->class = DISPATCH_PREFETCH;
+    } else if (g_cache_enabled && cache_has_fresh(peek, (int)(end + 4 - peek))) {
+        client->class = DISPATCH_HIT;
+    } else {
+        client->class = DISPATCH_MISS;
+    }
+}
+
+/**
+ * @brief Shed a newly classified request if too many for its origin are already waiting
+ *
+ * @param client Queued connection
+ */
+static void limit_origin(dispatch_client *client) {
+    if (queue.origin_limit == 0 || client->class != DISPATCH_MISS || client->origin == 0) {
+        return;
+    }
+
+    int waiting = 0;
+    for (int i = 0; i < queue.count; i++) {
+        const dispatch_client *other = &queue.clients[i];
+        if (other != client && other->class == DISPATCH_MISS && !other->shed &&
+            other->origin == client->origin) {
+            waiting++;
+        }
+    }
+    if (waiting >= queue.origin_limit) {
+        client->shed = 1;
+        stats_add(STAT_SHED_ORIGIN_LIMIT, 1);
+    }
+}
+
+/**
+ * @brief Track the queueing delay of a request needing the origin as it leaves the queue
+ *
+ * @param delay_us How long it waited
+ * @param now_us Current time (stats_now_us())
+ */
+static void observe_delay(uint64_t delay_us, uint64_t now_us) {
+    if (now_us >= queue.interval_end_us) {
+        // A standing queue starts overload, which lasts until the queue runs empty. Shedding
+        // brings delays under the target, so they alone would end it while clients still pile up
+        int standing = queue.min_delay_us != UINT64_MAX && queue.min_delay_us > queue.target_us;
+        int idle = queue.drained || now_us >= queue.interval_end_us + queue.interval_us;
+        queue.overloaded = standing || (queue.overloaded && !idle);
+        queue.min_delay_us = UINT64_MAX;
+        queue.drained = 0;
+        queue.interval_end_us = now_us + queue.interval_us;
+    }
+    if (delay_us < queue.min_delay_us) {
+        queue.min_delay_us = delay_us;
+    }
+}
+
+/**
+ * @brief Set up admission control
+ *
+ * @param target_ms Queueing delay target (0 turns shedding on delay off, negative keeps the current value)
+ * @param origin_limit Requests for one origin allowed to wait at once (0 for no limit, negative keeps the current value)
+ */
+void dispatch_configure(int target_ms, int origin_limit) {
+    if (target_ms >= 0) {
+        queue.target_us = target_ms * 1000ull;
+    }
+    if (origin_limit >= 0) {
+        queue.origin_limit = origin_limit;
+    }
+}
+
+/**
+ * @brief Set the listening socket connections are accepted from
+ *
+ * @param listen_socket Listening socket
+ */
+void dispatch_init(int listen_socket) {
+    queue.listener = listen_socket;
+}
+
+/**
+ * @brief Listening socket given to dispatch_init()
+ *
+ * @return int Socket file descriptor
+ */
+int dispatch_listener() {
+    return queue.listener;
+}
+
+/**
+ * @brief Wait for a connection, then queue everything in the backlog
+ *
+ * @param timeout_ms Longest wait for the first connection (0 to only drain)
+ * @return int Connections queued
+ */
+int dispatch_accept(int timeout_ms) {
+    int accepted = 0;
+    int client_socket = io_accept(queue.listener, timeout_ms);
+
+    // Queue everything in the backlog so hits can be picked out of it
+    while (client_socket >= 0) {
+        log_event(LOG_ACCEPTED, NULL, NULL, 0, 0);
+        stats_add(STAT_ACTIVE_CONNECTIONS, 1);
+        dispatch_add(client_socket);
+        accepted++;
+
+        if (queue.count == DISPATCH_QUEUE_SIZE) {
+            break;
+        }
+        client_socket = io_accept(queue.listener, 0);
+    }
+    // A signal (SIGHUP asking for a reload) cuts the wait short; that is not an error
+    if (client_socket < 0 && errno != ETIMEDOUT && errno != EINTR) {
+        perror("accept failed");
+    }
+    return accepted;
+}
+
+/**
+ * @brief Queue a freshly accepted connection
+ *
+ * @param socket Connected client socket
+ * @return int 0 on success, -1 if the queue is full
+ */
+int dispatch_add(int socket) {
+    if (queue.count == DISPATCH_QUEUE_SIZE) {
+        return -1;
+    }
+
+    dispatch_client *client = &queue.clients[queue.count++];
+    client->socket = socket;
+    client->accepted_us = stats_now_us();
+    client->origin = 0;
+    client->shed = 0;
+    classify(client);
+    limit_origin(client);
+    return 0;
+}
+
+/**
+ * @brief Number of connections waiting
+ *
+ * @return int Queued connections
+ */
+int dispatch_pending() {
+    return queue.count;
+}
+
+/**
+ * @brief Check for waiting connections whose headers are not complete yet
+ *
+ * @return int 1 if there are any, 0 otherwise
+ */
+int dispatch_unclassified() {
+    for (int i = 0; i < queue.count; i++) {
+        if (queue.clients[i].class == DISPATCH_UNKNOWN) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Take the queued connection at a position
+ *
+ * @param pick Position in the queue
+ * @param client Receives the connection
+ */
+static void take(int pick, dispatch_client *client) {
+    *client = queue.clients[pick];
+    memmove(&queue.clients[pick], &queue.clients[pick + 1],
+            (queue.count - pick - 1) * sizeof(dispatch_client));
+    queue.count--;
+}
+
+/**
+ * @brief Classify waiting connections whose headers have arrived since the last look
+ */
+void dispatch_classify() {
+    for (int i = 0; i < queue.count; i++) {
+        if (queue.clients[i].class == DISPATCH_UNKNOWN) {
+            classify(&queue.clients[i]);
+            limit_origin(&queue.clients[i]);
+        }
+    }
+}
+
+/**
+ * @brief Take the next connection to serve
+ *
+ * @param client Receives the connection
+ * @return int 0 if one was taken, -1 if the queue is empty
+ */
+int dispatch_next(dispatch_client *client) {
+    if (queue.count == 0) {
+        queue.drained = 1;
+        return -1;
+    }
+
+    // A peer is waiting on these with its own client
+    if (dispatch_next_peer(client) == 0) {
+        return 0;
+    }
+
+    // Turning a request away is cheap, and the sooner the better for its client
+    uint64_t now_us = stats_now_us();
+    uint64_t shed_after_us = queue.overloaded ? queue.target_us : queue.interval_us;
+    for (int i = 0; i < queue.count; i++) {
+        dispatch_client *waiting = &queue.clients[i];
+        if (waiting->shed) {
+            take(i, client);
+            return 0;
+        }
+        if (queue.target_us && (waiting->class == DISPATCH_MISS || waiting->class == DISPATCH_PREFETCH) &&
+            now_us - waiting->accepted_us > shed_after_us) {
+            if (waiting->class == DISPATCH_MISS) {
+                observe_delay(now_us - waiting->accepted_us, now_us);
+            }
+            stats_add(STAT_SHED_QUEUE_DELAY, 1);
+            take(i, client);
+            client->shed = 1;
+            return 0;
+        }
+    }
+
+    // Prefetches wait until nothing else does
+    int oldest = -1, first_hit = -1;
+    for (int i = 0; i < queue.count; i++) {
+        if (queue.clients[i].class == DISPATCH_PREFETCH) {
+            continue;
+        }
+        if (oldest < 0) {
+            oldest = i;
+        }
+        if (queue.clients[i].class == DISPATCH_HIT) {
+            first_hit = i;
+            break;
+        }
+    }
+    if (oldest < 0) {
+        oldest = 0;
+    }
+
+    // Oldest first, unless a hit can go ahead within its budget
+    int pick = oldest;
+    if (first_hit > oldest && queue.hits_ahead < DISPATCH_HIT_BUDGET) {
+        pick = first_hit;
+        queue.hits_ahead++;
+        stats_add(STAT_DISPATCH_HITS_AHEAD, 1);
+    } else {
+        queue.hits_ahead = 0;
+    }
+
+    take(pick, client);
+    if (queue.target_us && client->class == DISPATCH_MISS) {
+        observe_delay(now_us - client->accepted_us, now_us);
+    }
+    return 0;
+}
+
+/**
+ * @brief Take the oldest request forwarded by a peer, leaving everything else queued
+ *
+ * @param client Receives the connection
+ * @return int 0 if one was taken, -1 if none is waiting
+ */
+int dispatch_next_peer(dispatch_client *client) {
+    for (int i = 0; i < queue.count; i++) {
+        if (queue.clients[i].class == DISPATCH_PEER) {
+            take(i, client);
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,153 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdint.h>
+
+/* ========== Constants ========== */
+// Accepted connections held waiting to be served
+#ifndef DISPATCH_QUEUE_SIZE
+#define DISPATCH_QUEUE_SIZE 64
+#endif
+
+// Cache hits served ahead of an older waiting request before it gets its turn
+#ifndef DISPATCH_HIT_BUDGET
+#define DISPATCH_HIT_BUDGET 8
+#endif
+
+// Queueing delay a request needing the origin may build up while the proxy is overloaded (ms)
+#ifndef DISPATCH_TARGET_MS
+#define DISPATCH_TARGET_MS 50
+#endif
+
+// Window the lowest queueing delay is taken over, and the longest wait when not overloaded (ms)
+#ifndef DISPATCH_INTERVAL_MS
+#define DISPATCH_INTERVAL_MS 500
+#endif
+
+// Requests for one origin allowed to wait at once, more are shed (0 for no limit)
+#ifndef DISPATCH_ORIGIN_LIMIT
+#define DISPATCH_ORIGIN_LIMIT 0
+#endif
+
+// Seconds a turned-away client is told to wait before retrying
+#ifndef DISPATCH_RETRY_AFTER
+#define DISPATCH_RETRY_AFTER 1
+#endif
+
+/**
+ * What an accepted connection is expected to cost, from its request headers
+ */
+typedef enum {
+    DISPATCH_UNKNOWN,    // Headers not complete yet
+    DISPATCH_HIT,        // Fresh entry in the cache: one lookup and one send
+    DISPATCH_MISS,       // Anything else: origin work, tunnels, errors
+    DISPATCH_PEER,       // Forwarded by a cluster peer, which is blocked until it is served
+    DISPATCH_PREFETCH,   // Made by the prefetcher, served when nothing else is waiting
+} dispatch_class;
+
+/**
+ * Accepted connection waiting to be served
+ */
+typedef struct {
+    int socket;
+    dispatch_class class;
+    uint64_t accepted_us;     // stats_now_us() at accept, so queueing counts in latency
+    uint64_t origin;          // Hash of the Host header, 0 if not known yet
+    int shed;                 // Turned away by admission control: answer 503 instead of serving
+} dispatch_client;
+
+/**
+ * @brief Set up admission control
+ *
+ * May be called again while serving; requests already queued are judged by
+ * the new settings from then on.
+ *
+ * @param target_ms Queueing delay target (0 turns shedding on delay off, negative keeps the current value)
+ * @param origin_limit Requests for one origin allowed to wait at once (0 for no limit, negative keeps the current value)
+ */
+void dispatch_configure(int target_ms, int origin_limit);
+
+/**
+ * @brief Set the listening socket connections are accepted from
+ *
+ * @param listen_socket Listening socket
+ */
+void dispatch_init(int listen_socket);
+
+/**
+ * @brief Listening socket given to dispatch_init()
+ *
+ * @return int Socket file descriptor
+ */
+int dispatch_listener();
+
+/**
+ * @brief Wait for a connection, then queue everything in the backlog
+ *
+ * @param timeout_ms Longest wait for the first connection (0 to only drain)
+ * @return int Connections queued
+ */
+int dispatch_accept(int timeout_ms);
+
+/**
+ * @brief Queue a freshly accepted connection
+ *
+ * @param socket Connected client socket
+ * @return int 0 on success, -1 if the queue is full
+ */
+int dispatch_add(int socket);
+
+/**
+ * @brief Number of connections waiting
+ *
+ * @return int Queued connections
+ */
+int dispatch_pending();
+
+/**
+ * @brief Check for waiting connections whose headers are not complete yet
+ *
+ * @return int 1 if there are any, 0 otherwise
+ */
+int dispatch_unclassified();
+
+/**
+ * @brief Classify waiting connections whose headers have arrived since the last look
+ *
+ * Peeks at the socket without consuming anything, so the request is read
+ * again as usual when it is served.
+ */
+void dispatch_classify();
+
+/**
+ * @brief Take the next connection to serve
+ *
+ * Requests forwarded by peers go first, then requests admission control
+ * turned away (marked shed), which only cost a 503. Otherwise oldest
+ * first, except that a cache hit may go ahead of it, and prefetches only
+ * once nothing else is waiting. Once
+ * DISPATCH_HIT_BUDGET hits have gone ahead, the oldest is served so origin work
+ * is never starved.
+ *
+ * Admission control is CoDel applied to requests: a request that needs the
+ * origin is shed once it has waited DISPATCH_INTERVAL_MS. Once even the
+ * shortest wait over an interval is above the target, which means a
+ * standing queue rather than a burst, the proxy counts as overloaded and
+ * sheds at the target instead, until the queue runs empty. Prefetches are
+ * shed the same way but don't count towards the delay. Cache hits and
+ * peer requests are never shed.
+ *
+ * @param client Receives the connection
+ * @return int 0 if one was taken, -1 if the queue is empty
+ */
+int dispatch_next(dispatch_client *client);
+
+/**
+ * @brief Take the oldest request forwarded by a peer, leaving everything else queued
+ *
+ * @param client Receives the connection
+ * @return int 0 if one was taken, -1 if none is waiting
+ */
+int dispatch_next_peer(dispatch_client *client);
+
+#endif /* DISPATCH_H */
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "epoch.h"
+
+/**
+ * A reading thread's announcement of the epoch it entered in, on its own cache line
+ */
+typedef struct {
+    _Alignas(64) uint64_t epoch;   // 0 while outside a critical section
+} epoch_reader;
+
+/**
+ * Something waiting for the readers that might hold it to move on
+ */
+typedef struct {
+    void *ptr;
+    size_t size;
+    void (*release)(void *ptr, size_t size);
+} epoch_item;
+
+/**
+ * Items retired during one epoch
+ */
+typedef struct {
+    epoch_item *items;
+    int count;
+    int capacity;
+} epoch_limbo;
+
+// Readers registered so far
+static epoch_reader readers[EPOCH_MAX_THREADS];
+static int reader_count;
+
+// Reader slot of the calling thread and how deeply it is nested
+static _Thread_local epoch_reader *local_reader;
+static _Thread_local int local_depth;
+
+// Current epoch, starting at 1 so a reader's 0 means "outside"
+static uint64_t global_epoch = 1;
+
+// Retired items by epoch modulo 3, touched by the writer only
+static epoch_limbo limbo[3];
+
+/**
+ * @brief Claim a reader slot for the calling thread
+ *
+ * @return int 0 on success, -1 if every slot is taken
+ */
+static int register_reader() {
+    int index = __atomic_fetch_add(&reader_count, 1, __ATOMIC_SEQ_CST);
+    if (index >= EPOCH_MAX_THREADS) {
+        return -1;
+    }
+    local_reader = &readers[index];
+    return 0;
+}
+
+/**
+ * @brief Enter a read-side critical section
+ *
+ * @return int 0 on success, -1 if EPOCH_MAX_THREADS threads already read
+ */
+int epoch_enter() {
+    if (local_depth > 0) {
+        local_depth++;
+        return 0;
+    }
+    if (!local_reader && register_reader() < 0) {
+        return -1;
+    }
+
+    __atomic_store_n(&local_reader->epoch, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELAXED);
+    // The writer must see the announcement before this thread loads any shared pointer
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    local_depth = 1;
+    return 0;
+}
+
+/**
+ * @brief Leave a read-side critical section
+ */
+void epoch_exit() {
+    if (--local_depth == 0) {
+        __atomic_store_n(&local_reader->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Free every item in a limbo list
+ *
+ * @param list List to empty
+ * @return int Number freed
+ */
+static int free_limbo(epoch_limbo *list) {
+    int freed = list->count;
+    for (int i = 0; i < list->count; i++) {
+        list->items[i].release(list->items[i].ptr, list->items[i].size);
+    }
+    list->count = 0;
+    return freed;
+}
+
+/**
+ * @brief Free something once no reader can still hold it
+ *
+ * @param ptr Memory to free
+ * @param size Its size, passed back to release
+ * @param release Function that frees it
+ */
+void epoch_retire(void *ptr, size_t size, void (*release)(void *ptr, size_t size)) {
+    // Pairs with the fence in epoch_enter(): a reader registering after this sees the unlink
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&reader_count, __ATOMIC_SEQ_CST) == 0) {
+        release(ptr, size);
+        return;
+    }
+
+    epoch_limbo *list = &limbo[global_epoch % 3];
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        epoch_item *items = realloc(list->items, capacity * sizeof(epoch_item));
+        if (!items) {
+            // Freeing now could pull memory from under a reader; leaking is the safe failure
+            fprintf(stderr, "Out of memory retiring %zu bytes, leaking them\n", size);
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = (epoch_item){ptr, size, release};
+}
+
+/**
+ * @brief Advance the epoch if every reader has caught up, and free what is now safe
+ *
+ * @return int Number of retired items freed
+ */
+int epoch_reclaim() {
+    uint64_t now = global_epoch;
+
+    // Pairs with the fence in epoch_enter(): either the reader's epoch shows
+    // here, or the reader sees every unlink made before this point
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int count = __atomic_load_n(&reader_count, __ATOMIC_SEQ_CST);
+    if (count > EPOCH_MAX_THREADS) {
+        count = EPOCH_MAX_THREADS;
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t epoch = __atomic_load_n(&readers[i].epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch != now) {
+            return 0;
+        }
+    }
+
+    // Readers are all in this epoch or outside, so nothing retired in the
+    // one before is reachable any more; its list takes the epoch after next
+    __atomic_store_n(&global_epoch, now + 1, __ATOMIC_RELEASE);
+    return free_limbo(&limbo[(now + 2) % 3]);
+}
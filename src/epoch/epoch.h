@@ -0,0 +1,54 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+/* ========== Constants ========== */
+// Threads that can read under epoch protection
+#ifndef EPOCH_MAX_THREADS
+#define EPOCH_MAX_THREADS 64
+#endif
+
+/**
+ * @brief Enter a read-side critical section
+ *
+ * Anything reached through pointers loaded inside the section stays
+ * allocated until the matching epoch_exit(), even if the writer unlinks and
+ * retires it meanwhile. Sections may nest. Never blocks; costs a store and
+ * a fence on the thread's own cache line.
+ *
+ * @return int 0 on success, -1 if EPOCH_MAX_THREADS threads already read
+ */
+int epoch_enter();
+
+/**
+ * @brief Leave a read-side critical section
+ *
+ * Only after an epoch_enter() that returned 0.
+ */
+void epoch_exit();
+
+/**
+ * @brief Free something once no reader can still hold it
+ *
+ * The caller must already have unlinked it, so no reader entering from now
+ * on can find it. Until some thread has called epoch_enter() this frees at
+ * once. Retiring and reclaiming are for the one writer thread.
+ *
+ * @param ptr Memory to free
+ * @param size Its size, passed back to release
+ * @param release Function that frees it
+ */
+void epoch_retire(void *ptr, size_t size, void (*release)(void *ptr, size_t size));
+
+/**
+ * @brief Advance the epoch if every reader has caught up, and free what is now safe
+ *
+ * Memory retired in one epoch is freed two advances later. A reader parked
+ * inside a section holds back reclamation, never the writer.
+ *
+ * @return int Number of retired items freed
+ */
+int epoch_reclaim();
+
+#endif /* EPOCH_H */
@@ -0,0 +1,877 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "h2.h"
+#include "hpack.h"
+#include "http.h"
+#include "socket.h"
+#include "io.h"
+#include "stats.h"
+
+/* ========== Protocol constants (RFC 9113) ========== */
+#define FRAME_HEADER_SIZE 9
+
+// Largest frame payload we accept; SETTINGS_MAX_FRAME_SIZE is left at its default
+#define DEFAULT_MAX_FRAME 16384
+
+// Read-ahead buffer per connection, room for a full frame and the next one's start
+#define READ_BUFFER_SIZE (2 * (FRAME_HEADER_SIZE + DEFAULT_MAX_FRAME))
+
+// Initial connection window before any WINDOW_UPDATE
+#define DEFAULT_WINDOW 65535
+
+#define MAX_STREAM_ID 0x7fffffffu
+
+// Frame types
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_PUSH_PROMISE 0x5
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION 0x9
+
+// Frame flags
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+// Settings identifiers
+#define SETTINGS_ENABLE_PUSH 0x2
+#define SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define SETTINGS_MAX_FRAME_SIZE 0x5
+
+// RST_STREAM code for a stream the server never processed, safe to retry
+#define ERROR_REFUSED_STREAM 0x7
+
+// run_stream() result: nothing was processed, the request can go on a new connection
+#define STREAM_RETRY -4
+
+static const char connection_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/**
+ * Connection to one origin, reused for each of its requests in turn
+ */
+typedef struct {
+    char origin[MAX_HOSTNAME_SIZE];      // Host header value, "" for an unused slot
+    int socket;                          // -1 when closed
+    uint64_t last_used;
+
+    // Origin answered the preface with something other than HTTP/2
+    int unsupported;
+    time_t retry_at;
+
+    int settings_seen;                   // Server SETTINGS arrived, so it speaks HTTP/2
+    int goaway;                          // No new streams; reconnect for the next request
+    uint32_t next_stream_id;
+    uint32_t peer_max_frame;
+    uint32_t unacked;                    // DATA bytes not yet returned with WINDOW_UPDATE
+    hpack_table decoder;
+
+    uint8_t *in;                         // Read-ahead buffer, READ_BUFFER_SIZE bytes
+    size_t in_start;
+    size_t in_end;
+} h2_conn;
+
+/**
+ * One received frame; payload points into the connection's read buffer
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream;
+    uint32_t len;
+    const uint8_t *payload;
+} h2_frame;
+
+/**
+ * Response header block being translated to HTTP/1.1
+ */
+typedef struct {
+    int status;
+    int len;
+    int overflow;
+    char lines[H2_HEADER_BLOCK_SIZE];
+} response_head;
+
+static char origins[H2_MAX_ORIGINS][MAX_HOSTNAME_SIZE];
+static int origin_count;
+
+static h2_conn conns[H2_MAX_CONNECTIONS];
+static int conns_ready;
+static uint64_t use_clock;
+
+// Header block being reassembled from HEADERS and CONTINUATION frames
+static uint8_t header_block[H2_HEADER_BLOCK_SIZE];
+
+/**
+ * @brief Send requests for an origin over prior-knowledge h2c
+ *
+ * @param origin Host header value ("host" or "host:port"), or "*" for every origin
+ * @return int 0 on success, -1 if too many origins are configured
+ */
+int h2_add_origin(const char *origin) {
+    if (origin_count == H2_MAX_ORIGINS || strlen(origin) >= MAX_HOSTNAME_SIZE) {
+        return -1;
+    }
+    snprintf(origins[origin_count++], MAX_HOSTNAME_SIZE, "%s", origin);
+    return 0;
+}
+
+/**
+ * @brief Check whether requests for a host go over h2c
+ *
+ * @param hostname Host header value
+ * @return int 1 if they do, 0 for HTTP/1.1
+ */
+int h2_origin_enabled(const char *hostname) {
+    for (int i = 0; i < origin_count; i++) {
+        if (strcmp(origins[i], "*") == 0 || strcasecmp(origins[i], hostname) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Write a 32-bit big-endian value
+ *
+ * @param out Destination
+ * @param value Value
+ */
+static void put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/**
+ * @brief Read a 32-bit big-endian value
+ *
+ * @param in Source
+ * @return uint32_t Value
+ */
+static uint32_t get_u32(const uint8_t *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+/**
+ * @brief Fill in a frame header
+ *
+ * @param out 9-byte destination
+ * @param len Payload length
+ * @param type Frame type
+ * @param flags Frame flags
+ * @param stream Stream identifier
+ */
+static void put_frame_header(uint8_t *out, uint32_t len, uint8_t type, uint8_t flags, uint32_t stream) {
+    out[0] = len >> 16;
+    out[1] = len >> 8;
+    out[2] = len;
+    out[3] = type;
+    out[4] = flags;
+    put_u32(out + 5, stream & MAX_STREAM_ID);
+}
+
+/**
+ * @brief Send one frame
+ *
+ * @param conn Connection
+ * @param type Frame type
+ * @param flags Frame flags
+ * @param stream Stream identifier
+ * @param payload Payload
+ * @param len Payload length
+ * @param deadline Bounds the send
+ * @return int 0 on success, -1 on error
+ */
+static int send_frame(h2_conn *conn, uint8_t type, uint8_t flags, uint32_t stream,
+                      const void *payload, uint32_t len, const timer_entry *deadline) {
+    uint8_t header[FRAME_HEADER_SIZE];
+    put_frame_header(header, len, type, flags, stream);
+
+    struct iovec iov[2] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = (void *)payload, .iov_len = len},
+    };
+    return io_sendv(conn->socket, iov, len ? 2 : 1, deadline) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Return received DATA bytes to the sender's window
+ *
+ * @param conn Connection
+ * @param stream Stream, or 0 for the connection
+ * @param increment Bytes to return
+ * @param deadline Bounds the send
+ * @return int 0 on success, -1 on error
+ */
+static int send_window_update(h2_conn *conn, uint32_t stream, uint32_t increment,
+                              const timer_entry *deadline) {
+    uint8_t payload[4];
+    put_u32(payload, increment);
+    return send_frame(conn, FRAME_WINDOW_UPDATE, 0, stream, payload, sizeof(payload), deadline);
+}
+
+/**
+ * @brief Close a connection, keeping the slot for its origin
+ *
+ * @param conn Connection
+ */
+static void close_conn(h2_conn *conn) {
+    if (conn->socket >= 0) {
+        close(conn->socket);
+    }
+    conn->socket = -1;
+    conn->settings_seen = 0;
+    conn->goaway = 0;
+    conn->next_stream_id = 1;
+    conn->peer_max_frame = DEFAULT_MAX_FRAME;
+    conn->unacked = 0;
+    conn->in_start = 0;
+    conn->in_end = 0;
+    hpack_free(&conn->decoder);
+    hpack_init(&conn->decoder);
+}
+
+/**
+ * @brief Find the connection slot for an origin, taking the least recently used if it has none
+ *
+ * @param hostname Host header value
+ * @return h2_conn* Slot for the origin
+ */
+static h2_conn* find_conn(const char *hostname) {
+    if (!conns_ready) {
+        for (int i = 0; i < H2_MAX_CONNECTIONS; i++) {
+            conns[i].socket = -1;
+            close_conn(&conns[i]);
+        }
+        conns_ready = 1;
+    }
+
+    h2_conn *victim = &conns[0];
+    for (int i = 0; i < H2_MAX_CONNECTIONS; i++) {
+        h2_conn *conn = &conns[i];
+        if (conn->origin[0] && strcasecmp(conn->origin, hostname) == 0) {
+            return conn;
+        }
+        if (!conn->origin[0] || (victim->origin[0] && conn->last_used < victim->last_used)) {
+            victim = conn;
+        }
+    }
+
+    close_conn(victim);
+    victim->unsupported = 0;
+    snprintf(victim->origin, sizeof(victim->origin), "%s", hostname);
+    return victim;
+}
+
+/**
+ * @brief Connect and send the preface, our SETTINGS and the connection window
+ *
+ * @param conn Closed connection
+ * @param deadline Bounds the send
+ * @return int 0 on success, -1 on error, H2_UNREACHABLE if the origin can't be connected to
+ */
+static int open_conn(h2_conn *conn, const timer_entry *deadline) {
+    if (!conn->in) {
+        conn->in = malloc(READ_BUFFER_SIZE);
+        if (!conn->in) {
+            return -1;
+        }
+    }
+
+    conn->socket = connect_to_server(conn->origin);
+    if (conn->socket < 0) {
+        return H2_UNREACHABLE;
+    }
+
+    // Requests are single small writes that should not wait on Nagle
+    int one = 1;
+    setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint8_t out[sizeof(connection_preface) - 1 + 2 * FRAME_HEADER_SIZE + 12 + 4];
+    size_t len = sizeof(connection_preface) - 1;
+    memcpy(out, connection_preface, len);
+
+    // No server push; a stream window big enough that responses rarely wait on us
+    put_frame_header(out + len, 12, FRAME_SETTINGS, 0, 0);
+    len += FRAME_HEADER_SIZE;
+    out[len++] = 0;
+    out[len++] = SETTINGS_ENABLE_PUSH;
+    put_u32(out + len, 0);
+    len += 4;
+    out[len++] = 0;
+    out[len++] = SETTINGS_INITIAL_WINDOW_SIZE;
+    put_u32(out + len, H2_WINDOW_SIZE);
+    len += 4;
+
+    put_frame_header(out + len, 4, FRAME_WINDOW_UPDATE, 0, 0);
+    len += FRAME_HEADER_SIZE;
+    put_u32(out + len, H2_WINDOW_SIZE - DEFAULT_WINDOW);
+    len += 4;
+
+    if (io_send(conn->socket, out, len, deadline) < 0) {
+        close_conn(conn);
+        return -1;
+    }
+
+    stats_add(STAT_H2_CONNECTIONS, 1);
+    return 0;
+}
+
+/**
+ * @brief Make sure the read buffer holds at least some bytes
+ *
+ * @param conn Connection
+ * @param need Bytes wanted past in_start
+ * @param deadline Bounds each wait
+ * @return int 0 on success, -1 on EOF, error or expiry
+ */
+static int fill(h2_conn *conn, size_t need, const timer_entry *deadline) {
+    if (conn->in_start + need > READ_BUFFER_SIZE) {
+        memmove(conn->in, conn->in + conn->in_start, conn->in_end - conn->in_start);
+        conn->in_end -= conn->in_start;
+        conn->in_start = 0;
+    }
+
+    while (conn->in_end - conn->in_start < need) {
+        ssize_t n = io_recv(conn->socket, conn->in + conn->in_end, READ_BUFFER_SIZE - conn->in_end, deadline);
+        if (n <= 0) {
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        conn->in_end += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the next frame
+ *
+ * @param conn Connection
+ * @param frame Receives the frame, valid until the next read
+ * @param deadline Bounds each wait
+ * @return int 0 on success, -1 on EOF, error, expiry or an oversized frame
+ */
+static int read_frame(h2_conn *conn, h2_frame *frame, const timer_entry *deadline) {
+    if (fill(conn, FRAME_HEADER_SIZE, deadline) < 0) {
+        return -1;
+    }
+
+    const uint8_t *header = conn->in + conn->in_start;
+    frame->len = ((uint32_t)header[0] << 16) | ((uint32_t)header[1] << 8) | header[2];
+    frame->type = header[3];
+    frame->flags = header[4];
+    frame->stream = get_u32(header + 5) & MAX_STREAM_ID;
+
+    if (frame->len > DEFAULT_MAX_FRAME) {
+        // Also what an HTTP/1.1 reply to the preface looks like
+        errno = EPROTO;
+        return -1;
+    }
+    if (fill(conn, FRAME_HEADER_SIZE + frame->len, deadline) < 0) {
+        return -1;
+    }
+
+    frame->payload = conn->in + conn->in_start + FRAME_HEADER_SIZE;
+    conn->in_start += FRAME_HEADER_SIZE + frame->len;
+    return 0;
+}
+
+/**
+ * @brief Strip padding (and priority fields) from a DATA or HEADERS payload
+ *
+ * @param frame Frame, payload and len narrowed in place
+ * @return int 0 on success, -1 if the padding is malformed
+ */
+static int strip_padding(h2_frame *frame) {
+    uint32_t pad = 0;
+    if (frame->flags & FLAG_PADDED) {
+        if (frame->len < 1) {
+            return -1;
+        }
+        pad = frame->payload[0];
+        frame->payload++;
+        frame->len--;
+    }
+    if (frame->type == FRAME_HEADERS && (frame->flags & FLAG_PRIORITY)) {
+        if (frame->len < 5) {
+            return -1;
+        }
+        frame->payload += 5;
+        frame->len -= 5;
+    }
+    if (pad > frame->len) {
+        return -1;
+    }
+    frame->len -= pad;
+    return 0;
+}
+
+/**
+ * @brief Append a response field to the HTTP/1.1 header lines
+ *
+ * @param ctx response_head
+ * @param name Field name
+ * @param name_len Name length
+ * @param value Field value
+ * @param value_len Value length
+ * @return int 0 (overflow is reported through the head)
+ */
+static int add_response_field(void *ctx, const char *name, size_t name_len,
+                              const char *value, size_t value_len) {
+    response_head *head = ctx;
+
+    if (name_len > 0 && name[0] == ':') {
+        if (name_len == 7 && memcmp(name, ":status", 7) == 0 && value_len == 3) {
+            head->status = (value[0] - '0') * 100 + (value[1] - '0') * 10 + (value[2] - '0');
+        }
+        return 0;
+    }
+
+    if ((size_t)head->len + name_len + value_len + 4 > sizeof(head->lines)) {
+        head->overflow = 1;
+        return 0;
+    }
+    memcpy(head->lines + head->len, name, name_len);
+    head->len += name_len;
+    memcpy(head->lines + head->len, ": ", 2);
+    head->len += 2;
+    memcpy(head->lines + head->len, value, value_len);
+    head->len += value_len;
+    memcpy(head->lines + head->len, "\r\n", 2);
+    head->len += 2;
+    return 0;
+}
+
+/**
+ * @brief Reason phrase for a status line
+ *
+ * @param status Status code
+ * @return const char* Phrase, empty for codes without a common one
+ */
+static const char* reason_phrase(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 410: return "Gone";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: return "";
+    }
+}
+
+/**
+ * @brief Collect a header block (HEADERS plus CONTINUATION frames) and decode it
+ *
+ * @param conn Connection
+ * @param frame HEADERS frame, padding already stripped
+ * @param head Receives the translated fields
+ * @param deadline Bounds each wait
+ * @return int 0 on success, -1 on a connection error
+ */
+static int read_header_block(h2_conn *conn, const h2_frame *frame, response_head *head,
+                             const timer_entry *deadline) {
+    size_t len = 0;
+    uint32_t stream = frame->stream;
+    h2_frame part = *frame;
+
+    while (1) {
+        if (len + part.len > sizeof(header_block)) {
+            return -1;
+        }
+        memcpy(header_block + len, part.payload, part.len);
+        len += part.len;
+
+        if (part.flags & FLAG_END_HEADERS) {
+            break;
+        }
+        if (read_frame(conn, &part, deadline) < 0) {
+            return -1;
+        }
+        if (part.type != FRAME_CONTINUATION || part.stream != stream) {
+            return -1;
+        }
+    }
+
+    head->status = 0;
+    head->len = 0;
+    head->overflow = 0;
+    return hpack_decode(&conn->decoder, header_block, len, add_response_field, head);
+}
+
+/**
+ * @brief Hand a final response header block to the sink as HTTP/1.1
+ *
+ * @param head Translated fields
+ * @param sink Response sink
+ * @return int Sink result, -1 if the block does not fit
+ */
+static int deliver_headers(const response_head *head, const h2_sink *sink) {
+    static char block[H2_HEADER_BLOCK_SIZE + 64];
+
+    if (head->overflow || head->status < 100 || head->status > 999) {
+        return -1;
+    }
+
+    int len = snprintf(block, sizeof(block), "HTTP/1.1 %d %s\r\n", head->status, reason_phrase(head->status));
+    memcpy(block + len, head->lines, head->len);
+    len += head->len;
+    memcpy(block + len, "\r\n", 2);
+    len += 2;
+    block[len] = '\0';
+
+    return sink->on_headers(sink->ctx, block, len);
+}
+
+/**
+ * @brief Translate the request to an HPACK header block
+ *
+ * @param hostname Host header value, sent as :authority
+ * @param headers Request header lines, request line first
+ * @param header_count Number of header lines
+ * @param out Receives the block
+ * @param cap Size of out
+ * @param len Receives the block length
+ * @return int 0 on success, -1 if the request does not fit
+ */
+static int encode_request(const char *hostname, char **headers, int header_count,
+                          uint8_t *out, size_t cap, size_t *len) {
+    char method[MAX_METHOD_SIZE], uri[MAX_URI_SIZE], version[MAX_VERSION_SIZE];
+    parse_request_line(headers[0], method, uri, version);
+
+    // Absolute-form targets keep only the path
+    const char *path = uri;
+    if (strncasecmp(uri, "http://", 7) == 0) {
+        path = strchr(uri + 7, '/');
+        if (!path) {
+            path = "/";
+        }
+    }
+
+    *len = 0;
+    if (hpack_encode(out, cap, len, ":method", 7, method, strlen(method)) < 0 ||
+        hpack_encode(out, cap, len, ":scheme", 7, "http", 4) < 0 ||
+        hpack_encode(out, cap, len, ":authority", 10, hostname, strlen(hostname)) < 0 ||
+        hpack_encode(out, cap, len, ":path", 5, path, strlen(path)) < 0) {
+        return -1;
+    }
+
+    for (int i = 1; i < header_count; i++) {
+        const char *colon = strchr(headers[i], ':');
+        if (!colon || colon == headers[i]) {
+            continue;
+        }
+
+        // Field names go lowercase in HTTP/2
+        char name[MAX_HEADER_SIZE];
+        size_t name_len = colon - headers[i];
+        if (name_len >= sizeof(name)) {
+            return -1;
+        }
+        for (size_t j = 0; j < name_len; j++) {
+            name[j] = tolower((unsigned char)headers[i][j]);
+        }
+        name[name_len] = '\0';
+
+        const char *value = colon + 1;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+
+        // Hop-by-hop headers don't exist in HTTP/2, and Host became :authority
+        if (!strcmp(name, "host") || !strcmp(name, "connection") || !strcmp(name, "keep-alive") ||
+            !strcmp(name, "proxy-connection") || !strcmp(name, "transfer-encoding") ||
+            !strcmp(name, "upgrade") || (!strcmp(name, "te") && strcasecmp(value, "trailers") != 0)) {
+            continue;
+        }
+
+        if (hpack_encode(out, cap, len, name, name_len, value, strlen(value)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Send a request's HEADERS, split into CONTINUATION frames if needed
+ *
+ * @param conn Connection
+ * @param stream New stream identifier
+ * @param block Header block
+ * @param len Block length
+ * @param deadline Bounds the send
+ * @return int 0 on success, -1 on error
+ */
+static int send_headers(h2_conn *conn, uint32_t stream, const uint8_t *block, size_t len,
+                        const timer_entry *deadline) {
+    size_t sent = 0;
+    uint8_t type = FRAME_HEADERS;
+    uint8_t flags = FLAG_END_STREAM;
+
+    do {
+        size_t chunk = len - sent;
+        if (chunk > conn->peer_max_frame) {
+            chunk = conn->peer_max_frame;
+        }
+        if (sent + chunk == len) {
+            flags |= FLAG_END_HEADERS;
+        }
+        if (send_frame(conn, type, flags, stream, block + sent, chunk, deadline) < 0) {
+            return -1;
+        }
+        sent += chunk;
+        type = FRAME_CONTINUATION;
+        flags = 0;
+    } while (sent < len);
+
+    return 0;
+}
+
+/**
+ * @brief Run one request as a new stream and relay its response to the sink
+ *
+ * @param conn Open connection
+ * @param block Request header block
+ * @param block_len Block length
+ * @param sink Response sink
+ * @param deadline Bounds each wait
+ * @return int 0 when done, -1 on error, STREAM_RETRY if nothing was processed,
+ *             H2_UNSUPPORTED if the origin does not speak HTTP/2
+ */
+static int run_stream(h2_conn *conn, const uint8_t *block, size_t block_len, const h2_sink *sink,
+                      const timer_entry *deadline) {
+    static response_head head;
+    uint32_t stream = conn->next_stream_id;
+    conn->next_stream_id += 2;
+
+    if (send_headers(conn, stream, block, block_len, deadline) < 0) {
+        return conn->settings_seen ? STREAM_RETRY : H2_UNSUPPORTED;
+    }
+    stats_add(STAT_H2_STREAMS, 1);
+
+    int responded = 0;
+    uint32_t stream_unacked = 0;
+
+    while (1) {
+        h2_frame frame;
+        if (read_frame(conn, &frame, deadline) < 0) {
+            if (errno == ETIMEDOUT || responded) {
+                return -1;
+            }
+            return conn->settings_seen ? STREAM_RETRY : H2_UNSUPPORTED;
+        }
+
+        // A server's first frame is its SETTINGS
+        if (!conn->settings_seen && (frame.type != FRAME_SETTINGS || (frame.flags & FLAG_ACK))) {
+            return H2_UNSUPPORTED;
+        }
+
+        switch (frame.type) {
+        case FRAME_SETTINGS:
+            if (frame.flags & FLAG_ACK) {
+                break;
+            }
+            if (frame.stream != 0 || frame.len % 6 != 0) {
+                return -1;
+            }
+            for (uint32_t i = 0; i < frame.len; i += 6) {
+                uint16_t id = (frame.payload[i] << 8) | frame.payload[i + 1];
+                uint32_t value = get_u32(frame.payload + i + 2);
+                if (id == SETTINGS_MAX_FRAME_SIZE && value >= DEFAULT_MAX_FRAME) {
+                    conn->peer_max_frame = value;
+                }
+            }
+            conn->settings_seen = 1;
+            if (send_frame(conn, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0, deadline) < 0) {
+                return -1;
+            }
+            break;
+
+        case FRAME_PING:
+            if (!(frame.flags & FLAG_ACK) &&
+                send_frame(conn, FRAME_PING, FLAG_ACK, 0, frame.payload, frame.len, deadline) < 0) {
+                return -1;
+            }
+            break;
+
+        case FRAME_GOAWAY:
+            if (frame.len < 8) {
+                return -1;
+            }
+            conn->goaway = 1;
+            if (stream > (get_u32(frame.payload) & MAX_STREAM_ID)) {
+                // Our stream was never looked at
+                return responded ? -1 : STREAM_RETRY;
+            }
+            break;
+
+        case FRAME_RST_STREAM:
+            if (frame.stream != stream) {
+                break;
+            }
+            if (!responded && frame.len >= 4 && get_u32(frame.payload) == ERROR_REFUSED_STREAM) {
+                return STREAM_RETRY;
+            }
+            return -1;
+
+        case FRAME_PUSH_PROMISE:
+            // Disabled in our SETTINGS
+            return -1;
+
+        case FRAME_HEADERS:
+            if (strip_padding(&frame) < 0 || read_header_block(conn, &frame, &head, deadline) < 0) {
+                return -1;
+            }
+            if (frame.stream != stream) {
+                // Decoded only to keep the table in step
+                break;
+            }
+            // Interim (1xx) responses are dropped, trailers after the body ignored
+            if (!responded && head.status >= 200) {
+                if (deliver_headers(&head, sink) < 0) {
+                    return -1;
+                }
+                responded = 1;
+            }
+            if (frame.flags & FLAG_END_STREAM) {
+                return responded ? 0 : -1;
+            }
+            break;
+
+        case FRAME_DATA: {
+            uint32_t flow = frame.len;
+            if (strip_padding(&frame) < 0) {
+                return -1;
+            }
+
+            if (frame.stream == stream) {
+                if (!responded) {
+                    return -1;
+                }
+                if (frame.len > 0 && sink->on_data(sink->ctx, (const char *)frame.payload, frame.len) < 0) {
+                    return -1;
+                }
+                stream_unacked += flow;
+            }
+
+            // Hand the window back in large steps rather than per frame
+            conn->unacked += flow;
+            if (conn->unacked >= H2_WINDOW_SIZE / 2) {
+                if (send_window_update(conn, 0, conn->unacked, deadline) < 0) {
+                    return -1;
+                }
+                conn->unacked = 0;
+            }
+
+            if (frame.stream == stream && (frame.flags & FLAG_END_STREAM)) {
+                return 0;
+            }
+            if (stream_unacked >= H2_WINDOW_SIZE / 2) {
+                if (send_window_update(conn, stream, stream_unacked, deadline) < 0) {
+                    return -1;
+                }
+                stream_unacked = 0;
+            }
+            break;
+        }
+
+        default:
+            // PRIORITY, WINDOW_UPDATE (we send no DATA) and unknown types
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Fetch a GET request as a stream on a shared h2c connection
+ *
+ * @param hostname Host header value
+ * @param headers Request header lines, request line first
+ * @param header_count Number of header lines
+ * @param sink Receives the response
+ * @param deadline Bounds each wait for the origin (errno ETIMEDOUT on expiry)
+ * @return int 0 when the response is complete, -1 on error, or H2_UNSUPPORTED / H2_UNREACHABLE
+ */
+int h2_fetch(const char *hostname, char **headers, int header_count, const h2_sink *sink,
+             const timer_entry *deadline) {
+    h2_conn *conn = find_conn(hostname);
+    conn->last_used = ++use_clock;
+
+    if (conn->unsupported) {
+        if (time(NULL) < conn->retry_at) {
+            return H2_UNSUPPORTED;
+        }
+        conn->unsupported = 0;
+    }
+
+    uint8_t block[H2_HEADER_BLOCK_SIZE];
+    size_t block_len;
+    if (encode_request(hostname, headers, header_count, block, sizeof(block), &block_len) < 0) {
+        // Too big for us to translate; this one request goes over HTTP/1.1
+        return H2_UNSUPPORTED;
+    }
+
+    // A reused connection may have been closed while idle; that gets one retry on a fresh one
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (conn->socket >= 0 && (conn->goaway || conn->next_stream_id > MAX_STREAM_ID)) {
+            close_conn(conn);
+        }
+        int reused = conn->socket >= 0;
+        if (!reused) {
+            int opened = open_conn(conn, deadline);
+            if (opened < 0) {
+                return opened;
+            }
+        }
+
+        int result = run_stream(conn, block, block_len, sink, deadline);
+        if (result == 0) {
+            return 0;
+        }
+
+        // Keep ETIMEDOUT visible to the caller
+        int saved_errno = errno;
+        close_conn(conn);
+        errno = saved_errno;
+        if (result == H2_UNSUPPORTED) {
+            fprintf(stderr, "%s does not speak h2c, using HTTP/1.1\n", hostname);
+            conn->unsupported = 1;
+            conn->retry_at = time(NULL) + H2_FALLBACK_SECONDS;
+            return H2_UNSUPPORTED;
+        }
+        if (result != STREAM_RETRY || !reused) {
+            return -1;
+        }
+    }
+    return -1;
+}
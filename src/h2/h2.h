@@ -0,0 +1,78 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdint.h>
+
+#include "timer.h"
+
+/* ========== Constants ========== */
+// Origins that can be configured for h2c
+#define H2_MAX_ORIGINS 16
+
+// Origin connections kept open at once; the least recently used is closed for a new one
+#ifndef H2_MAX_CONNECTIONS
+#define H2_MAX_CONNECTIONS 16
+#endif
+
+// Receive window advertised per stream and for the connection (bytes)
+#define H2_WINDOW_SIZE (16 * 1024 * 1024)
+
+// How long an origin that turned out not to speak h2c goes over HTTP/1.1 (seconds)
+#ifndef H2_FALLBACK_SECONDS
+#define H2_FALLBACK_SECONDS 300
+#endif
+
+// Largest translated response header block
+#define H2_HEADER_BLOCK_SIZE (4 * 4096)
+
+// h2_fetch() results besides 0 (done) and -1 (failed once the exchange started)
+#define H2_UNSUPPORTED -2     // Origin does not speak h2c, nothing was sent to the client
+#define H2_UNREACHABLE -3     // Origin could not be connected to, nothing was sent to the client
+
+/**
+ * Receives a response translated to HTTP/1.1
+ */
+typedef struct {
+    // Status line and header block, ending with the blank line
+    int (*on_headers)(void *ctx, const char *block, int len);
+    // Body bytes as they arrive
+    int (*on_data)(void *ctx, const char *data, int len);
+    void *ctx;
+} h2_sink;
+
+/**
+ * @brief Send requests for an origin over prior-knowledge h2c
+ *
+ * @param origin Host header value ("host" or "host:port"), or "*" for every origin
+ * @return int 0 on success, -1 if too many origins are configured
+ */
+int h2_add_origin(const char *origin);
+
+/**
+ * @brief Check whether requests for a host go over h2c
+ *
+ * @param hostname Host header value
+ * @return int 1 if they do, 0 for HTTP/1.1
+ */
+int h2_origin_enabled(const char *hostname);
+
+/**
+ * @brief Fetch a GET request as a stream on a shared h2c connection
+ *
+ * The HTTP/1.1 request headers are translated to HPACK-coded HTTP/2 headers
+ * (hop-by-hop headers dropped, Host as :authority) and the response is
+ * handed to the sink as HTTP/1.1. The connection stays open for the
+ * origin's next request; one that went idle and was closed is replaced
+ * transparently.
+ *
+ * @param hostname Host header value
+ * @param headers Request header lines, request line first
+ * @param header_count Number of header lines
+ * @param sink Receives the response
+ * @param deadline Bounds each wait for the origin (errno ETIMEDOUT on expiry)
+ * @return int 0 when the response is complete, -1 on error, or H2_UNSUPPORTED / H2_UNREACHABLE
+ */
+int h2_fetch(const char *hostname, char **headers, int header_count, const h2_sink *sink,
+             const timer_entry *deadline);
+
+#endif /* H2_H */
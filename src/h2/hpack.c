@@ -0,0 +1,562 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+// Static table entries (RFC 7541 Appendix A), index 1 first
+#define HPACK_STATIC_ENTRIES 61
+
+// Longest Huffman code in bits
+#define HUFFMAN_MAX_BITS 30
+
+// Huffman symbol for end of string, never valid inside one
+#define HUFFMAN_EOS 256
+
+/**
+ * Static table entry
+ */
+typedef struct {
+    const char *name;
+    const char *value;
+} static_field;
+
+static const static_field static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// Huffman code length of each symbol (RFC 7541 Appendix B). The code is
+// canonical, so the codes themselves follow from the lengths.
+static const uint8_t huffman_lengths[HUFFMAN_EOS + 1] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/**
+ * Canonical decoding tables built from huffman_lengths
+ */
+typedef struct {
+    int built;
+    uint32_t first_code[HUFFMAN_MAX_BITS + 1];    // Code of the first symbol of each length
+    int count[HUFFMAN_MAX_BITS + 1];              // Symbols of each length
+    int offset[HUFFMAN_MAX_BITS + 1];             // Where each length starts in symbols
+    uint16_t symbols[HUFFMAN_EOS + 1];            // Ordered by length, then value
+} huffman_decoder;
+
+static huffman_decoder huffman;
+
+/**
+ * @brief Build the canonical decoding tables on first use
+ */
+static void build_huffman() {
+    if (huffman.built) {
+        return;
+    }
+
+    for (int sym = 0; sym <= HUFFMAN_EOS; sym++) {
+        huffman.count[huffman_lengths[sym]]++;
+    }
+
+    uint32_t code = 0;
+    int offset = 0;
+    for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits++) {
+        code = (code + huffman.count[bits - 1]) << 1;
+        huffman.first_code[bits] = code;
+        huffman.offset[bits] = offset;
+        offset += huffman.count[bits];
+    }
+
+    int next[HUFFMAN_MAX_BITS + 1];
+    memcpy(next, huffman.offset, sizeof(next));
+    for (int sym = 0; sym <= HUFFMAN_EOS; sym++) {
+        huffman.symbols[next[huffman_lengths[sym]]++] = sym;
+    }
+
+    huffman.built = 1;
+}
+
+/**
+ * @brief Decode a Huffman-coded string
+ *
+ * @param in Coded bytes
+ * @param len Number of coded bytes
+ * @param out Receives the decoded string
+ * @param cap Size of out
+ * @return long Decoded length, or -1 if malformed or too long
+ */
+static long huffman_decode(const uint8_t *in, size_t len, char *out, size_t cap) {
+    build_huffman();
+
+    size_t written = 0;
+    uint32_t code = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            bits++;
+
+            uint32_t index = code - huffman.first_code[bits];
+            if (code >= huffman.first_code[bits] && index < (uint32_t)huffman.count[bits]) {
+                int sym = huffman.symbols[huffman.offset[bits] + index];
+                if (sym == HUFFMAN_EOS || written == cap) {
+                    return -1;
+                }
+                out[written++] = (char)sym;
+                code = 0;
+                bits = 0;
+            } else if (bits == HUFFMAN_MAX_BITS) {
+                return -1;
+            }
+        }
+    }
+
+    // Padding is a prefix of EOS: fewer than 8 bits, all ones
+    if (bits >= 8 || code != (1u << bits) - 1) {
+        return -1;
+    }
+    return (long)written;
+}
+
+/**
+ * @brief Decode a prefixed integer
+ *
+ * @param pos Read position, advanced past the integer
+ * @param end End of the block
+ * @param prefix_bits Bits of the first byte holding the integer
+ * @param value Receives the value
+ * @return int 0 on success, -1 if truncated or too large
+ */
+static int decode_integer(const uint8_t **pos, const uint8_t *end, int prefix_bits, uint32_t *value) {
+    if (*pos >= end) {
+        return -1;
+    }
+
+    uint32_t mask = (1u << prefix_bits) - 1;
+    uint32_t result = *(*pos)++ & mask;
+    if (result < mask) {
+        *value = result;
+        return 0;
+    }
+
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (*pos >= end) {
+            return -1;
+        }
+        uint8_t byte = *(*pos)++;
+        result += (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Decode a string literal, Huffman-coded or raw
+ *
+ * @param pos Read position, advanced past the string
+ * @param end End of the block
+ * @param out Receives the string
+ * @param cap Size of out
+ * @return long String length, or -1 if malformed or too long
+ */
+static long decode_string(const uint8_t **pos, const uint8_t *end, char *out, size_t cap) {
+    if (*pos >= end) {
+        return -1;
+    }
+
+    int huffman_coded = **pos & 0x80;
+    uint32_t len;
+    if (decode_integer(pos, end, 7, &len) < 0 || len > (size_t)(end - *pos)) {
+        return -1;
+    }
+
+    const uint8_t *data = *pos;
+    *pos += len;
+
+    if (huffman_coded) {
+        return huffman_decode(data, len, out, cap);
+    }
+    if (len > cap) {
+        return -1;
+    }
+    memcpy(out, data, len);
+    return len;
+}
+
+/**
+ * @brief Drop the oldest dynamic table entry
+ *
+ * @param table Dynamic table with at least one entry
+ */
+static void evict_oldest(hpack_table *table) {
+    hpack_field *field = &table->entries[(table->first + table->count - 1) % HPACK_MAX_ENTRIES];
+    table->size -= field->name_len + field->value_len + 32;
+    free(field->name);
+    field->name = NULL;
+    field->value = NULL;
+    table->count--;
+}
+
+/**
+ * @brief Add a field to the dynamic table, evicting to make room
+ *
+ * @param table Dynamic table
+ * @param name Field name
+ * @param name_len Name length
+ * @param value Field value
+ * @param value_len Value length
+ * @return int 0 on success, -1 if out of memory
+ */
+static int table_add(hpack_table *table, const char *name, size_t name_len,
+                     const char *value, size_t value_len) {
+    size_t size = name_len + value_len + 32;
+
+    while (table->count > 0 && table->size + size > table->max_size) {
+        evict_oldest(table);
+    }
+    if (size > table->max_size) {
+        // Bigger than the whole table: adding it just empties the table
+        return 0;
+    }
+
+    char *copy = malloc(name_len + value_len + 2);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, name, name_len);
+    copy[name_len] = '\0';
+    memcpy(copy + name_len + 1, value, value_len);
+    copy[name_len + 1 + value_len] = '\0';
+
+    table->first = (table->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    hpack_field *field = &table->entries[table->first];
+    field->name = copy;
+    field->value = copy + name_len + 1;
+    field->name_len = name_len;
+    field->value_len = value_len;
+
+    table->count++;
+    table->size += size;
+    return 0;
+}
+
+/**
+ * @brief Look up a static or dynamic table index
+ *
+ * @param table Dynamic table
+ * @param index Index from the block (1-based, static entries first)
+ * @param name Receives the name
+ * @param name_len Receives the name length
+ * @param value Receives the value
+ * @param value_len Receives the value length
+ * @return int 0 on success, -1 if the index is out of range
+ */
+static int table_get(const hpack_table *table, uint32_t index, const char **name, size_t *name_len,
+                     const char **value, size_t *value_len) {
+    if (index == 0) {
+        return -1;
+    }
+
+    if (index <= HPACK_STATIC_ENTRIES) {
+        const static_field *field = &static_table[index - 1];
+        *name = field->name;
+        *name_len = strlen(field->name);
+        *value = field->value;
+        *value_len = strlen(field->value);
+        return 0;
+    }
+
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= (uint32_t)table->count) {
+        return -1;
+    }
+    const hpack_field *field = &table->entries[(table->first + index) % HPACK_MAX_ENTRIES];
+    *name = field->name;
+    *name_len = field->name_len;
+    *value = field->value;
+    *value_len = field->value_len;
+    return 0;
+}
+
+/**
+ * @brief Start an empty dynamic table
+ *
+ * @param table Table to initialise
+ */
+void hpack_init(hpack_table *table) {
+    memset(table, 0, sizeof(*table));
+    table->max_size = HPACK_TABLE_SIZE;
+}
+
+/**
+ * @brief Free every dynamic table entry
+ *
+ * @param table Table to clear (usable again after hpack_init())
+ */
+void hpack_free(hpack_table *table) {
+    while (table->count > 0) {
+        evict_oldest(table);
+    }
+}
+
+/**
+ * @brief Decode a complete header block
+ *
+ * @param table Connection's dynamic table
+ * @param block Header block (HEADERS plus any CONTINUATION fragments)
+ * @param len Block length
+ * @param emit Called for each field
+ * @param ctx Passed to emit
+ * @return int 0 on success, -1 on a malformed block or if emit aborts
+ */
+int hpack_decode(hpack_table *table, const uint8_t *block, size_t len, hpack_emit emit, void *ctx) {
+    const uint8_t *pos = block;
+    const uint8_t *end = block + len;
+    char name_buf[HPACK_MAX_STRING];
+    char value_buf[HPACK_MAX_STRING];
+
+    while (pos < end) {
+        uint8_t first = *pos;
+        const char *name, *value;
+        size_t name_len, value_len;
+        uint32_t index;
+
+        if (first & 0x80) {
+            // Indexed field
+            if (decode_integer(&pos, end, 7, &index) < 0 ||
+                table_get(table, index, &name, &name_len, &value, &value_len) < 0) {
+                return -1;
+            }
+            if (emit(ctx, name, name_len, value, value_len) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20) {
+            // Dynamic table size update, within what we advertised
+            if (decode_integer(&pos, end, 5, &index) < 0 || index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            table->max_size = index;
+            while (table->count > 0 && table->size > table->max_size) {
+                evict_oldest(table);
+            }
+            continue;
+        }
+
+        // Literal: with incremental indexing (01), without (0000) or never indexed (0001)
+        int indexing = (first & 0xc0) == 0x40;
+        if (decode_integer(&pos, end, indexing ? 6 : 4, &index) < 0) {
+            return -1;
+        }
+
+        if (index > 0) {
+            const char *unused;
+            size_t unused_len;
+            if (table_get(table, index, &name, &name_len, &unused, &unused_len) < 0) {
+                return -1;
+            }
+            // The name may live in an entry the insert below evicts
+            memcpy(name_buf, name, name_len);
+            name = name_buf;
+        } else {
+            long n = decode_string(&pos, end, name_buf, sizeof(name_buf));
+            if (n < 0) {
+                return -1;
+            }
+            name = name_buf;
+            name_len = n;
+        }
+
+        long n = decode_string(&pos, end, value_buf, sizeof(value_buf));
+        if (n < 0) {
+            return -1;
+        }
+        value = value_buf;
+        value_len = n;
+
+        if (indexing && table_add(table, name, name_len, value, value_len) < 0) {
+            return -1;
+        }
+        if (emit(ctx, name, name_len, value, value_len) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Append a prefixed integer
+ *
+ * @param out Block being built
+ * @param cap Size of out
+ * @param len Bytes already in out, advanced past the integer
+ * @param flags High bits of the first byte
+ * @param prefix_bits Bits of the first byte holding the integer
+ * @param value Value to encode
+ * @return int 0 on success, -1 if out is too small
+ */
+static int encode_integer(uint8_t *out, size_t cap, size_t *len, uint8_t flags, int prefix_bits,
+                          size_t value) {
+    size_t mask = (1u << prefix_bits) - 1;
+    if (*len >= cap) {
+        return -1;
+    }
+
+    if (value < mask) {
+        out[(*len)++] = flags | (uint8_t)value;
+        return 0;
+    }
+
+    out[(*len)++] = flags | (uint8_t)mask;
+    value -= mask;
+    while (value >= 0x80) {
+        if (*len >= cap) {
+            return -1;
+        }
+        out[(*len)++] = (uint8_t)(value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (*len >= cap) {
+        return -1;
+    }
+    out[(*len)++] = (uint8_t)value;
+    return 0;
+}
+
+/**
+ * @brief Append a raw (not Huffman-coded) string literal
+ *
+ * @param out Block being built
+ * @param cap Size of out
+ * @param len Bytes already in out, advanced past the string
+ * @param str String
+ * @param str_len String length
+ * @return int 0 on success, -1 if out is too small
+ */
+static int encode_string(uint8_t *out, size_t cap, size_t *len, const char *str, size_t str_len) {
+    if (encode_integer(out, cap, len, 0x00, 7, str_len) < 0 || cap - *len < str_len) {
+        return -1;
+    }
+    memcpy(out + *len, str, str_len);
+    *len += str_len;
+    return 0;
+}
+
+/**
+ * @brief Append one header field to a header block
+ *
+ * @param out Block being built
+ * @param cap Size of out
+ * @param len Bytes already in out, advanced past the field
+ * @param name Lowercase field name
+ * @param name_len Name length
+ * @param value Field value
+ * @param value_len Value length
+ * @return int 0 on success, -1 if out is too small
+ */
+int hpack_encode(uint8_t *out, size_t cap, size_t *len, const char *name, size_t name_len,
+                 const char *value, size_t value_len) {
+    size_t name_index = 0;
+
+    for (size_t i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+        const static_field *field = &static_table[i];
+        if (strlen(field->name) != name_len || memcmp(field->name, name, name_len) != 0) {
+            continue;
+        }
+        if (strlen(field->value) == value_len && memcmp(field->value, value, value_len) == 0) {
+            return encode_integer(out, cap, len, 0x80, 7, i + 1);
+        }
+        if (!name_index) {
+            name_index = i + 1;
+        }
+    }
+
+    // Literal without indexing, keeping the peer's table untouched
+    if (encode_integer(out, cap, len, 0x00, 4, name_index) < 0) {
+        return -1;
+    }
+    if (!name_index && encode_string(out, cap, len, name, name_len) < 0) {
+        return -1;
+    }
+    return encode_string(out, cap, len, value, value_len);
+}
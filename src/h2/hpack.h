@@ -0,0 +1,96 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ========== Constants ========== */
+// Dynamic table size (SETTINGS_HEADER_TABLE_SIZE), the protocol default
+#define HPACK_TABLE_SIZE 4096
+
+// Entries cost their name and value plus 32 bytes, so this many fit at most
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32)
+
+// Longest decoded name or value
+#ifndef HPACK_MAX_STRING
+#define HPACK_MAX_STRING 8192
+#endif
+
+/**
+ * Header field held in the dynamic table (name and value in one allocation)
+ */
+typedef struct {
+    char *name;
+    char *value;
+    size_t name_len;
+    size_t value_len;
+} hpack_field;
+
+/**
+ * Decoder state for one connection: the dynamic table, newest entry first
+ */
+typedef struct {
+    hpack_field entries[HPACK_MAX_ENTRIES];
+    int first;                     // Slot of the newest entry
+    int count;
+    size_t size;                   // Sum of entry sizes
+    size_t max_size;               // Current limit, set by the encoder up to HPACK_TABLE_SIZE
+} hpack_table;
+
+/**
+ * Receives each decoded header field, in order
+ *
+ * @return int 0 to continue, -1 to abort decoding
+ */
+typedef int (*hpack_emit)(void *ctx, const char *name, size_t name_len,
+                          const char *value, size_t value_len);
+
+/**
+ * @brief Start an empty dynamic table
+ *
+ * @param table Table to initialise
+ */
+void hpack_init(hpack_table *table);
+
+/**
+ * @brief Free every dynamic table entry
+ *
+ * @param table Table to clear (usable again after hpack_init())
+ */
+void hpack_free(hpack_table *table);
+
+/**
+ * @brief Decode a complete header block
+ *
+ * Handles indexed and literal fields, Huffman-coded strings and table size
+ * updates (RFC 7541). Any error is a connection error: the table may be left
+ * out of step with the encoder.
+ *
+ * @param table Connection's dynamic table
+ * @param block Header block (HEADERS plus any CONTINUATION fragments)
+ * @param len Block length
+ * @param emit Called for each field
+ * @param ctx Passed to emit
+ * @return int 0 on success, -1 on a malformed block or if emit aborts
+ */
+int hpack_decode(hpack_table *table, const uint8_t *block, size_t len, hpack_emit emit, void *ctx);
+
+/**
+ * @brief Append one header field to a header block
+ *
+ * Uses a static table index where one matches and otherwise a literal
+ * without indexing, so the encoder keeps no state.
+ *
+ * @param out Block being built
+ * @param cap Size of out
+ * @param len Bytes already in out, advanced past the field
+ * @param name Lowercase field name
+ * @param name_len Name length
+ * @param value Field value
+ * @param value_len Value length
+ * @return int 0 on success, -1 if out is too small
+ */
+int hpack_encode(uint8_t *out, size_t cap, size_t *len, const char *name, size_t name_len,
+                 const char *value, size_t value_len);
+
+#endif /* HPACK_H */
@@ -7,16 +7,22 @@
 
 #include "http.h"
 #include "utils.h"
+#include "io.h"
+#include "timer.h"
+
+// Time allowed for a client's request headers, changed with set_header_timeout()
+static int header_timeout_ms = HEADER_TIMEOUT_MS;
 
 /**
- * @brief Read HTTP headers from socket with dynamic allocation
+ * @brief Read HTTP headers from socket before a deadline
  * 
  * @param socket Socket to read from
  * @param headers Array to store header lines
  * @param header_count Number of headers read
+ * @param deadline Timer bounding the whole read
  * @return int 0 on success, -1 on error
  */
-int read_http_headers(int socket, char ***headers, int *header_count) {
+static int read_headers(int socket, char ***headers, int *header_count, const timer_entry *deadline) {
     char *read_buffer = malloc(BUFFER_SIZE);
     if (!read_buffer) {
         fprintf(stderr, "Failed to allocate read buffer\n");
@@ -49,7 +55,7 @@ int read_http_headers(int socket, char ***headers, int *header_count) {
             space_left = buffer_capacity - total_received;
         }
         
-        int bytes = recv(socket, read_buffer + total_received, space_left, 0);
+        int bytes = io_recv(socket, read_buffer + total_received, space_left, deadline);
         if (bytes <= 0) {
             free(read_buffer);
             free_headers(*headers, *header_count);
@@ -109,6 +115,33 @@ int read_http_headers(int socket, char ***headers, int *header_count) {
     return 0;
 }
 
+/**
+ * @brief Read HTTP headers from socket with dynamic allocation
+ * 
+ * @param socket Socket to read from
+ * @param headers Array to store header lines
+ * @param header_count Number of headers read
+ * @return int 0 on success, -1 on error
+ */
+int read_http_headers(int socket, char ***headers, int *header_count) {
+    timer_entry deadline = {0};
+    timer_arm(&deadline, header_timeout_ms, NULL, NULL);
+    
+    int result = read_headers(socket, headers, header_count, &deadline);
+    
+    timer_cancel(&deadline);
+    return result;
+}
+
+/**
+ * @brief Change the time allowed for a client's request headers
+ *
+ * @param ms Timeout in milliseconds
+ */
+void set_header_timeout(int ms) {
+    header_timeout_ms = ms;
+}
+
 /**
  * @brief Free dynamically allocated headers
  * 
@@ -227,6 +260,115 @@ int should_cache_response(const char *headers, uint32_t *max_age, int *has_max_a
     return result;
 }
 
+/**
+ * @brief Read the status code from a response's status line
+ *
+ * @param headers Full HTTP response headers
+ * @return int Status code, or -1 if the status line is malformed
+ */
+int parse_status_code(const char *headers) {
+    if (strncmp(headers, "HTTP/", 5) != 0) return -1;
+
+    const char *p = strchr(headers, ' ');
+    if (!p) return -1;
+    while (*p == ' ') p++;
+
+    if (!isdigit((unsigned char)p[0]) || !isdigit((unsigned char)p[1]) ||
+        !isdigit((unsigned char)p[2]) || isdigit((unsigned char)p[3])) {
+        return -1;
+    }
+    return (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+}
+
+/**
+ * @brief Check whether a request's Accept-Encoding allows a content coding
+ *
+ * @param headers Array of request header strings
+ * @param header_count Number of headers
+ * @param coding Content coding, e.g. "gzip"
+ * @return int 1 if listed with a non-zero q-value, or not listed and "*" is, 0 otherwise
+ */
+int accepts_encoding(char **headers, int header_count, const char *coding) {
+    size_t coding_len = strlen(coding);
+    double named_q = -1.0, any_q = -1.0;   // -1 while not listed
+
+
+    for (int i = 1; i < header_count; i++) {
+        if (strncasecmp(headers[i], "accept-encoding:", 16) != 0) continue;
+
+        // Comma separated codings, each optionally followed by ;q=<weight>
+        const char *p = headers[i] + 16;
+        while (*p) {
+            while (*p == ' ' || *p == '\t' || *p == ',') p++;
+            const char *name = p;
+            while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+            size_t name_len = p - name;
+
+            double q = 1.0;
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p == ';') {
+                const char *qv = find_case_insensitive(p, "q=");
+                const char *next = strchr(p, ',');
+                if (qv && (!next || qv < next)) q = atof(qv + 2);
+                p = next ? next : p + strlen(p);
+            }
+
+            if (name_len == coding_len && strncasecmp(name, coding, coding_len) == 0) {
+                named_q = q;
+            } else if (name_len == 1 && *name == '*') {
+                any_q = q;
+            }
+        }
+    }
+
+    // A coding refused by name stays refused whatever "*" says (RFC 9110 12.5.3)
+    return named_q >= 0 ? named_q > 0 : any_q > 0;
+}
+
+/**
+ * @brief Rewrite a response header block for a re-encoded body
+ *
+ * @param headers Original header block, ending with the blank line
+ * @param header_len Length of headers
+ * @param coding Content coding of the new body, or NULL for identity
+ * @param body_len Length of the new body
+ * @param out Buffer for the new header block
+ * @param out_size Size of out
+ * @return int Length of the new block, or -1 if it does not fit
+ */
+int rewrite_encoded_headers(const char *headers, int header_len, const char *coding, int body_len,
+                            char *out, int out_size) {
+    const char *end = headers + header_len - 2;   // Drop the blank line, re-added below
+    const char *line = headers;
+    int len = 0;
+
+    while (line < end) {
+        const char *eol = line;
+        while (eol + 1 < end && !(eol[0] == '\r' && eol[1] == '\n')) eol++;
+        const char *next = eol + 2 <= end ? eol + 2 : end;
+
+        if (strncasecmp(line, "content-length:", 15) != 0) {
+            int line_len = next - line;
+            if (len + line_len >= out_size) return -1;
+            memcpy(out + len, line, line_len);
+            len += line_len;
+        }
+        line = next;
+    }
+
+    int added;
+    if (coding) {
+        added = snprintf(out + len, out_size - len,
+                         "Content-Length: %d\r\nContent-Encoding: %s\r\nVary: Accept-Encoding\r\n\r\n",
+                         body_len, coding);
+    } else {
+        added = snprintf(out + len, out_size - len,
+                         "Content-Length: %d\r\nVary: Accept-Encoding\r\n\r\n", body_len);
+    }
+    if (added < 0 || added >= out_size - len) return -1;
+    return len + added;
+}
+
 /**
  * @brief Build a complete request string from headers
  * 
@@ -258,6 +400,7 @@ void build_request_string(char **headers, int header_count, char *request_buffer
     if (*request_len + 2 < MAX_REQUEST_SIZE) {
         memcpy(request_buffer + *request_len, "\r\n", 2);
         *request_len += 2;
+        request_buffer[*request_len] = '\0';  // evict_entry() takes it as a string
     } else {
         *request_len = MAX_REQUEST_SIZE;  // Mark as too large
     }
@@ -17,8 +17,16 @@
 #define MAX_VERSION_SIZE 16
 #define MAX_HOSTNAME_SIZE 256
 
+// Time allowed for a client to deliver its full request headers by default (ms)
+#ifndef HEADER_TIMEOUT_MS
+#define HEADER_TIMEOUT_MS 30000
+#endif
+
 /**
  * @brief Read HTTP headers from socket with dynamic allocation
+ *
+ * Gives up once the header timeout (HEADER_TIMEOUT_MS unless changed with
+ * set_header_timeout()) passes without a complete header block.
  * 
  * @param socket Socket to read from
  * @param headers Array to store header lines
@@ -27,6 +35,13 @@
  */
 int read_http_headers(int socket, char ***headers, int *header_count);
 
+/**
+ * @brief Change the time allowed for a client's request headers
+ *
+ * @param ms Timeout in milliseconds
+ */
+void set_header_timeout(int ms);
+
 /**
  * @brief Free dynamically allocated headers
  * 
@@ -74,6 +89,42 @@ int parse_cache_control(const char *value, uint32_t *max_age, int *has_max_age);
  */
 int should_cache_response(const char *headers, uint32_t *max_age, int *has_max_age);
 
+/**
+ * @brief Read the status code from a response's status line
+ *
+ * @param headers Full HTTP response headers
+ * @return int Status code, or -1 if the status line is malformed
+ */
+int parse_status_code(const char *headers);
+
+/**
+ * @brief Check whether a request's Accept-Encoding allows a content coding
+ *
+ * @param headers Array of request header strings
+ * @param header_count Number of headers
+ * @param coding Content coding, e.g. "gzip"
+ * @return int 1 if listed with a non-zero q-value, or not listed and "*" is, 0 otherwise
+ */
+int accepts_encoding(char **headers, int header_count, const char *coding);
+
+/**
+ * @brief Rewrite a response header block for a re-encoded body
+ *
+ * Copies every line except Content-Length, then adds Content-Length,
+ * Content-Encoding (unless the body is identity-coded) and
+ * Vary: Accept-Encoding.
+ *
+ * @param headers Original header block, ending with the blank line
+ * @param header_len Length of headers
+ * @param coding Content coding of the new body, or NULL for identity
+ * @param body_len Length of the new body
+ * @param out Buffer for the new header block
+ * @param out_size Size of out
+ * @return int Length of the new block, or -1 if it does not fit
+ */
+int rewrite_encoded_headers(const char *headers, int header_len, const char *coding, int body_len,
+                            char *out, int out_size);
+
 /**
  * @brief Build a complete request string from headers
  * 
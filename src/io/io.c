@@ -0,0 +1,1011 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_IO_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#ifdef HAVE_MSG_ZEROCOPY
+#include <stdint.h>
+#include <linux/errqueue.h>
+#endif
+
+#include "io.h"
+#include "timer.h"
+
+// Relay buffer for the request being served (one request is served at a time)
+static char relay_buffer[IO_BUFFER_SIZE];
+
+// Pipe used as the in-kernel staging area for splice()
+static int splice_pipe[2] = {-1, -1};
+
+#ifdef HAVE_IO_URING
+
+// user_data tags for telling completions apart
+#define TAG_OP 1
+#define TAG_ACCEPT 2
+#define TAG_TIMEOUT 3
+#define TAG_CANCEL 4
+
+/**
+ * io_uring instance state (mapped rings plus bookkeeping for multishot accept)
+ */
+typedef struct {
+    int fd;
+
+    // Submission ring
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // Completion ring
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Mappings (sq_ring and cq_ring may be the same with IORING_FEAT_SINGLE_MMAP)
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    int buffers_registered;
+
+    // Multishot accept
+    int multishot_accept;
+    int accept_armed;         // Until the accept's last completion (no IORING_CQE_F_MORE)
+    int accept_cancelling;    // Cancel submitted because the queue is nearly full
+    int accept_error;
+    int *accepted;            // Ring of accepted sockets, grown for bursts past IO_ACCEPT_QUEUE
+    int accepted_capacity;
+    int accepted_head;
+    int accepted_count;
+
+    // Result of the synchronous operation in flight
+    int op_done;
+    int op_res;
+} uring_state;
+
+static uring_state ring = {.fd = -1};
+
+/**
+ * @brief Set up the ring, map it and register the relay buffer
+ *
+ * @return int 0 on success, -1 if io_uring is unavailable
+ */
+static int uring_setup() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (ring.fd < 0) {
+        return -1;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_ring_size > ring.sq_ring_size) {
+            ring.sq_ring_size = ring.cq_ring_size;
+        }
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            munmap(ring.sq_ring, ring.sq_ring_size);
+            close(ring.fd);
+            ring.fd = -1;
+            return -1;
+        }
+    }
+
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        if (ring.cq_ring != ring.sq_ring) {
+            munmap(ring.cq_ring, ring.cq_ring_size);
+        }
+        munmap(ring.sq_ring, ring.sq_ring_size);
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    char *sq = ring.sq_ring;
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = ring.cq_ring;
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Registered buffers are an optimisation only, carry on without them
+    struct iovec iov = {.iov_base = relay_buffer, .iov_len = IO_BUFFER_SIZE};
+    ring.buffers_registered =
+        syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    ring.multishot_accept = 1;
+    return 0;
+}
+
+/**
+ * @brief Enter the kernel to submit and/or wait for completions
+ *
+ * @param to_submit Number of queued SQEs to submit
+ * @param min_complete Number of completions to wait for
+ * @return int 0 on success, -1 on error
+ */
+static int uring_enter(unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    while (syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Grab the next free submission entry (zeroed)
+ *
+ * @return struct io_uring_sqe* Submission entry
+ */
+static struct io_uring_sqe* uring_get_sqe() {
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    return sqe;
+}
+
+/**
+ * @brief Publish the entry returned by the last uring_get_sqe() to the kernel
+ */
+static void uring_queue() {
+    __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Stop a multishot accept so further connections wait in the listen backlog
+ */
+static void uring_cancel_accept() {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = TAG_ACCEPT;
+    sqe->user_data = TAG_CANCEL;
+    uring_queue();
+
+    if (uring_enter(1, 0) == 0) {
+        ring.accept_cancelling = 1;
+    }
+}
+
+/**
+ * @brief Check whether the accepted queue has room for another accept to be armed
+ *
+ * @return int 1 if an accept may be armed
+ */
+static int uring_accept_room() {
+    return ring.accepted_count <= IO_ACCEPT_QUEUE / 2;
+}
+
+/**
+ * @brief Queue an accepted socket for io_accept()
+ *
+ * A multishot accept takes the whole backlog in one go, so a burst can pass
+ * IO_ACCEPT_QUEUE before the cancel lands; the ring grows rather than drop it.
+ *
+ * @param fd Accepted socket
+ */
+static void uring_push_accepted(int fd) {
+    if (ring.accepted_count == ring.accepted_capacity) {
+        int capacity = ring.accepted_capacity ? ring.accepted_capacity * 2 : IO_ACCEPT_QUEUE;
+        int *accepted = malloc(capacity * sizeof(int));
+        if (!accepted) {
+            perror("malloc");
+            close(fd);
+            return;
+        }
+        for (int i = 0; i < ring.accepted_count; i++) {
+            accepted[i] = ring.accepted[(ring.accepted_head + i) % ring.accepted_capacity];
+        }
+        free(ring.accepted);
+        ring.accepted = accepted;
+        ring.accepted_capacity = capacity;
+        ring.accepted_head = 0;
+    }
+
+    ring.accepted[(ring.accepted_head + ring.accepted_count) % ring.accepted_capacity] = fd;
+    ring.accepted_count++;
+}
+
+/**
+ * @brief Drain the completion ring, routing accept and operation results
+ */
+static void uring_reap() {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+
+        if (cqe->user_data == TAG_ACCEPT) {
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                ring.accept_armed = 0;
+                ring.accept_cancelling = 0;
+            }
+
+            if (cqe->res >= 0) {
+                uring_push_accepted(cqe->res);
+
+                // Leave the rest in the listen backlog until the queue drains
+                if (ring.accept_armed && !ring.accept_cancelling &&
+                    ring.accepted_count >= IO_ACCEPT_QUEUE) {
+                    uring_cancel_accept();
+                }
+            } else if (cqe->res == -ECANCELED) {
+                // Our own cancel, see uring_cancel_accept()
+            } else if (cqe->res == -EINVAL && ring.multishot_accept) {
+                // Kernel predates multishot accept, re-arm one shot at a time
+                ring.multishot_accept = 0;
+            } else {
+                ring.accept_error = -cqe->res;
+            }
+        } else if (cqe->user_data == TAG_OP) {
+            ring.op_done = 1;
+            ring.op_res = cqe->res;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Submit a prepared operation and wait for its completion
+ *
+ * With a deadline the operation is linked to a timeout, so the kernel cancels
+ * it once the deadline passes.
+ *
+ * @param sqe Entry prepared with uring_get_sqe()
+ * @param deadline Timer bounding the operation, or NULL
+ * @return int Operation result (negative errno on failure)
+ */
+static int uring_run(struct io_uring_sqe *sqe, const timer_entry *deadline) {
+    struct __kernel_timespec ts;
+    unsigned to_submit = 1;
+
+    sqe->user_data = TAG_OP;
+
+    if (deadline) {
+        int left = timer_remaining(deadline);
+        if (left == 0) {
+            // Entry was never published, the slot is simply reused
+            return -ETIMEDOUT;
+        }
+
+        sqe->flags |= IOSQE_IO_LINK;
+        uring_queue();
+
+        ts.tv_sec = left / 1000;
+        ts.tv_nsec = (long long)(left % 1000) * 1000000;
+
+        struct io_uring_sqe *timeout = uring_get_sqe();
+        timeout->opcode = IORING_OP_LINK_TIMEOUT;
+        timeout->addr = (uintptr_t)&ts;
+        timeout->len = 1;
+        timeout->user_data = TAG_TIMEOUT;
+        to_submit = 2;
+    }
+
+    ring.op_done = 0;
+    uring_queue();
+
+    if (uring_enter(to_submit, 1) < 0) {
+        return -errno;
+    }
+    uring_reap();
+
+    while (!ring.op_done) {
+        if (uring_enter(0, 1) < 0) {
+            return -errno;
+        }
+        uring_reap();
+    }
+
+    // A linked timeout firing shows up as a cancelled operation
+    if (deadline && ring.op_res == -ECANCELED) {
+        return -ETIMEDOUT;
+    }
+    return ring.op_res;
+}
+
+/**
+ * @brief Queue an accept on the listening socket (multishot when supported)
+ *
+ * @param listen_fd Listening socket
+ * @return int 0 on success, -1 on error
+ */
+static int uring_arm_accept(int listen_fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = ring.multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = TAG_ACCEPT;
+    uring_queue();
+
+    if (uring_enter(1, 0) < 0) {
+        return -1;
+    }
+    ring.accept_armed = 1;
+    return 0;
+}
+
+/**
+ * @brief Convert an io_uring result to the syscall convention
+ *
+ * @param res Result from uring_run()
+ * @return int res, or -1 with errno set
+ */
+static int uring_result(int res) {
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+#endif /* HAVE_IO_URING */
+
+/**
+ * @brief Check whether io_uring is the active backend
+ *
+ * @return int 1 if io_uring is in use, 0 otherwise
+ */
+static int using_uring() {
+#ifdef HAVE_IO_URING
+    return ring.fd >= 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Initialise the I/O backend
+ *
+ * @return int 0 on success, -1 on error
+ */
+int io_init() {
+    if (pipe(splice_pipe) < 0) {
+        perror("pipe");
+        return -1;
+    }
+
+#ifdef HAVE_IO_URING
+    if (uring_setup() < 0) {
+        fprintf(stderr, "io_uring unavailable, falling back to syscalls\n");
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * @brief Name of the active I/O backend
+ *
+ * @return const char* Backend name
+ */
+const char* io_backend_name() {
+    return using_uring() ? "io_uring" : "syscall";
+}
+
+/**
+ * @brief Relay buffer of IO_BUFFER_SIZE bytes
+ *
+ * @return char* Pointer to the relay buffer
+ */
+char* io_buffer() {
+    return relay_buffer;
+}
+
+/**
+ * @brief Accept a connection on a listening socket
+ *
+ * @param listen_fd Listening socket
+ * @param timeout_ms Milliseconds to wait, or -1 to block
+ * @return int Connected socket, or -1 on error / timeout / signal
+ */
+int io_accept(int listen_fd, int timeout_ms) {
+#ifdef HAVE_IO_URING
+    if (using_uring()) {
+        while (ring.accepted_count == 0) {
+            if (ring.accept_error) {
+                errno = ring.accept_error;
+                ring.accept_error = 0;
+                return -1;
+            }
+
+            if (!ring.accept_armed && uring_arm_accept(listen_fd) < 0) {
+                return -1;
+            }
+
+            // The ring fd turns readable once a completion is posted
+            struct pollfd pfd = {.fd = ring.fd, .events = POLLIN};
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready == 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            if (ready < 0) {
+                return -1;
+            }
+
+            uring_reap();
+        }
+
+        int fd = ring.accepted[ring.accepted_head];
+        ring.accepted_head = (ring.accepted_head + 1) % ring.accepted_capacity;
+        ring.accepted_count--;
+
+        // Resume accepting once the queue has drained to half
+        if (!ring.accept_armed && uring_accept_room()) {
+            uring_arm_accept(listen_fd);
+        }
+        return fd;
+    }
+#endif
+
+    // Wait in poll() even to block, since accept() would be restarted after a signal
+    struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready == 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (ready < 0) {
+        return -1;
+    }
+
+    return accept(listen_fd, NULL, NULL);
+}
+
+/**
+ * @brief Descriptor to poll for io_accept() having a connection ready
+ *
+ * @param listen_fd Listening socket
+ * @return int Descriptor that turns readable
+ */
+int io_accept_fd(int listen_fd) {
+#ifdef HAVE_IO_URING
+    if (using_uring()) {
+        // Armed accepts take connections off the backlog, so only the ring sees them
+        if (!ring.accept_armed && uring_accept_room()) {
+            uring_arm_accept(listen_fd);
+        }
+        // Paused for a full queue: new connections show on the listener
+        return ring.accept_armed ? ring.fd : listen_fd;
+    }
+#endif
+    return listen_fd;
+}
+
+/**
+ * @brief Wait until a socket is ready or a deadline passes
+ *
+ * @param fd Socket to wait on
+ * @param events poll() events to wait for
+ * @param deadline Timer bounding the wait, or NULL to wait indefinitely
+ * @return int 0 when ready, -1 on error / expiry (errno ETIMEDOUT)
+ */
+int io_wait(int fd, short events, const timer_entry *deadline) {
+    while (1) {
+        int timeout_ms = timer_remaining(deadline);
+        if (timeout_ms == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        struct pollfd pfd = {.fd = fd, .events = events};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready > 0) {
+            return 0;
+        }
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Receive data from a socket
+ *
+ * @param fd Socket to read from
+ * @param buf Buffer to read into
+ * @param len Maximum number of bytes to read
+ * @param deadline Timer bounding the wait for data, or NULL
+ * @return ssize_t Bytes read, 0 on EOF, -1 on error / expiry
+ */
+ssize_t io_recv(int fd, void *buf, size_t len, const timer_entry *deadline) {
+#ifdef HAVE_IO_URING
+    if (using_uring()) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        char *p = buf;
+
+        if (ring.buffers_registered && p >= relay_buffer &&
+            p + len <= relay_buffer + IO_BUFFER_SIZE) {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->buf_index = 0;
+        } else {
+            sqe->opcode = IORING_OP_RECV;
+        }
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)buf;
+        sqe->len = len;
+        return uring_result(uring_run(sqe, deadline));
+    }
+#endif
+
+    // Only pay for poll() when the data isn't already there
+    int flags = deadline ? MSG_DONTWAIT : 0;
+    while (1) {
+        ssize_t bytes = recv(fd, buf, len, flags);
+        if (bytes >= 0) {
+            return bytes;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (deadline && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (io_wait(fd, POLLIN, deadline) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Send a whole buffer to a socket
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t len on success, -1 on error / expiry
+ */
+ssize_t io_send(int fd, const void *buf, size_t len, const timer_entry *deadline) {
+    const char *p = buf;
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t bytes;
+#ifdef HAVE_IO_URING
+        if (using_uring()) {
+            struct io_uring_sqe *sqe = uring_get_sqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = fd;
+            sqe->addr = (uintptr_t)(p + sent);
+            sqe->len = len - sent;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            bytes = uring_result(uring_run(sqe, deadline));
+        } else
+#endif
+        {
+            int flags = MSG_NOSIGNAL | (deadline ? MSG_DONTWAIT : 0);
+            bytes = send(fd, p + sent, len - sent, flags);
+            if (bytes < 0 && deadline && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (io_wait(fd, POLLOUT, deadline) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+        }
+
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += bytes;
+    }
+
+    return sent;
+}
+
+/**
+ * @brief Send a list of buffers to a socket with as few syscalls as possible
+ *
+ * The iovec array is advanced in place when the kernel takes only part of it.
+ *
+ * @param fd Socket to write to
+ * @param iov Buffers to send, in order
+ * @param iovcnt Number of buffers (at most IOV_MAX)
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t Total bytes sent on success, -1 on error / expiry
+ */
+ssize_t io_sendv(int fd, struct iovec *iov, int iovcnt, const timer_entry *deadline) {
+    size_t total = 0;
+
+    while (iovcnt > 0) {
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t bytes;
+#ifdef HAVE_IO_URING
+        if (using_uring()) {
+            struct io_uring_sqe *sqe = uring_get_sqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = (uintptr_t)&msg;
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            bytes = uring_result(uring_run(sqe, deadline));
+        } else
+#endif
+        {
+            int flags = MSG_NOSIGNAL | (deadline ? MSG_DONTWAIT : 0);
+            bytes = sendmsg(fd, &msg, flags);
+            if (bytes < 0 && deadline && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (io_wait(fd, POLLOUT, deadline) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+        }
+
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += bytes;
+
+        // Skip the buffers the kernel took whole, trim the one it took part of
+        while (iovcnt > 0 && (size_t)bytes >= iov->iov_len) {
+            bytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + bytes;
+            iov->iov_len -= bytes;
+        }
+    }
+
+    return total;
+}
+
+#ifdef HAVE_MSG_ZEROCOPY
+
+/**
+ * @brief Wait for the kernel to release the pages of zerocopy sends
+ *
+ * @param fd Socket the sends went out on
+ * @param sends Number of MSG_ZEROCOPY sends issued
+ * @param deadline Timer bounding the wait, or NULL
+ * @return int 0 on success, -1 on error / expiry
+ */
+static int reap_zerocopy(int fd, uint32_t sends, const timer_entry *deadline) {
+    uint32_t done = 0;
+
+    while (done < sends) {
+        char control[128];
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Error queue readiness is always reported as POLLERR
+                if (io_wait(fd, 0, deadline) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            return -1;
+        }
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                // Notifications cover the inclusive range [ee_info, ee_data] of sends
+                done += err->ee_data - err->ee_info + 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Send a whole buffer with MSG_ZEROCOPY
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t len on success, -1 on error / expiry
+ */
+static ssize_t send_zerocopy(int fd, const char *buf, size_t len, const timer_entry *deadline) {
+    size_t sent = 0;
+    uint32_t sends = 0;
+
+    while (sent < len) {
+        ssize_t bytes = send(fd, buf + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT | MSG_ZEROCOPY);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (io_wait(fd, POLLOUT, deadline) < 0) {
+                    break;
+                }
+                continue;
+            }
+            if (errno == ENOBUFS && io_send(fd, buf + sent, len - sent, deadline) >= 0) {
+                // Out of pinned-page budget, the rest goes out copied
+                sent = len;
+            }
+            break;
+        }
+        sent += bytes;
+        sends++;
+    }
+
+    // Pages must not change until the kernel is done with them, even on failure
+    int saved_errno = errno;
+    if (reap_zerocopy(fd, sends, deadline) < 0) {
+        return -1;
+    }
+    if (sent < len) {
+        errno = saved_errno;
+        return -1;
+    }
+    return sent;
+}
+
+#endif /* HAVE_MSG_ZEROCOPY */
+
+/**
+ * @brief Send a whole buffer, using MSG_ZEROCOPY for large buffers when available
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t len on success, -1 on error / expiry
+ */
+ssize_t io_send_zerocopy(int fd, const void *buf, size_t len, const timer_entry *deadline) {
+#ifdef HAVE_MSG_ZEROCOPY
+    int one = 1;
+    if (len >= IO_ZEROCOPY_MIN && !using_uring() &&
+        setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        return send_zerocopy(fd, buf, len, deadline);
+    }
+#endif
+    return io_send(fd, buf, len, deadline);
+}
+
+/**
+ * @brief Send as much of a buffer as the socket accepts without blocking
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @return ssize_t Bytes sent, -1 on error (errno EAGAIN if the socket is full)
+ */
+ssize_t io_send_some(int fd, const void *buf, size_t len) {
+#ifdef HAVE_IO_URING
+    if (using_uring()) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)buf;
+        sqe->len = len;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+        return uring_result(uring_run(sqe, NULL));
+    }
+#endif
+
+    ssize_t bytes;
+    do {
+        bytes = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (bytes < 0 && errno == EINTR);
+    return bytes;
+}
+
+/**
+ * @brief Connect a socket to a remote address
+ *
+ * @param fd Socket to connect
+ * @param addr Remote address
+ * @param addrlen Length of addr
+ * @param deadline Timer bounding the handshake, or NULL
+ * @return int 0 on success, -1 on error / expiry
+ */
+int io_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, const timer_entry *deadline) {
+#ifdef HAVE_IO_URING
+    if (using_uring()) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)addr;
+        sqe->off = addrlen;
+        return uring_result(uring_run(sqe, deadline)) < 0 ? -1 : 0;
+    }
+#endif
+
+    if (!deadline) {
+        return connect(fd, addr, addrlen);
+    }
+
+    // Connect without blocking, then wait for the handshake under the deadline
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+
+    int result = connect(fd, addr, addrlen);
+    if (result < 0 && errno == EINPROGRESS) {
+        result = io_wait(fd, POLLOUT, deadline);
+        if (result == 0) {
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) {
+                result = -1;
+            } else if (error) {
+                errno = error;
+                result = -1;
+            }
+        }
+    }
+
+    int saved_errno = errno;
+    fcntl(fd, F_SETFL, flags);
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * @brief Splice bytes between a file descriptor and the staging pipe
+ *
+ * @param in_fd Source descriptor
+ * @param out_fd Destination descriptor
+ * @param len Maximum number of bytes to move
+ * @param deadline Timer bounding the wait for input, or NULL
+ * @return ssize_t Bytes moved, 0 on EOF, -1 on error / expiry
+ */
+static ssize_t splice_once(int in_fd, int out_fd, size_t len, const timer_entry *deadline) {
+#ifdef HAVE_IO_URING
+    if (using_uring()) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = in_fd;
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->fd = out_fd;
+        sqe->off = (uint64_t)-1;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        return uring_result(uring_run(sqe, deadline));
+    }
+#endif
+
+    unsigned flags = SPLICE_F_MOVE | (deadline ? SPLICE_F_NONBLOCK : 0);
+    while (1) {
+        ssize_t bytes = splice(in_fd, NULL, out_fd, NULL, len, flags);
+        if (bytes >= 0) {
+            return bytes;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (deadline && errno == EAGAIN) {
+            if (io_wait(in_fd, POLLIN, deadline) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Discard anything left in the staging pipe after a failed splice
+ */
+static void drain_splice_pipe() {
+    int pending = 0;
+    while (ioctl(splice_pipe[0], FIONREAD, &pending) == 0 && pending > 0) {
+        int chunk = pending < IO_BUFFER_SIZE ? pending : IO_BUFFER_SIZE;
+        if (read(splice_pipe[0], relay_buffer, chunk) <= 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Move bytes from one socket to another without copying through user space
+ *
+ * @param from_fd Socket to read from
+ * @param to_fd Socket to write to
+ * @param len Maximum number of bytes to move
+ * @param deadline Timer bounding the wait for input, or NULL
+ * @return ssize_t Bytes moved, 0 on EOF, -1 on error / expiry
+ */
+ssize_t io_splice(int from_fd, int to_fd, size_t len, const timer_entry *deadline) {
+    if (len > IO_SPLICE_CHUNK) {
+        len = IO_SPLICE_CHUNK;
+    }
+
+    ssize_t in = splice_once(from_fd, splice_pipe[1], len, deadline);
+    if (in < 0 && errno == EINVAL) {
+        // Descriptor doesn't support splice, copy through the relay buffer instead
+        if (len > IO_BUFFER_SIZE) {
+            len = IO_BUFFER_SIZE;
+        }
+        in = io_recv(from_fd, relay_buffer, len, deadline);
+        if (in > 0 && io_send(to_fd, relay_buffer, in, NULL) < 0) {
+            return -1;
+        }
+        return in;
+    }
+    if (in <= 0) {
+        return in;
+    }
+
+    ssize_t left = in;
+    while (left > 0) {
+        ssize_t out = splice_once(splice_pipe[0], to_fd, left, NULL);
+        if (out <= 0) {
+            drain_splice_pipe();
+            return -1;
+        }
+        left -= out;
+    }
+
+    return in;
+}
@@ -0,0 +1,168 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "timer.h"
+
+/* ========== Constants ========== */
+// Size of the relay buffer handed out by io_buffer()
+#define IO_BUFFER_SIZE 8192
+
+// Largest chunk moved per io_splice() call (default pipe capacity)
+#define IO_SPLICE_CHUNK 65536
+
+// Depth of the submission/completion rings
+#define IO_RING_ENTRIES 64
+
+// Connections accepted ahead by multishot accept before io_accept() is called;
+// accepting pauses at this many and resumes once half of them are taken
+#define IO_ACCEPT_QUEUE 64
+
+// Smallest send worth MSG_ZEROCOPY (built with HAVE_MSG_ZEROCOPY); below this copying is cheaper
+#ifndef IO_ZEROCOPY_MIN
+#define IO_ZEROCOPY_MIN (16 * 1024)
+#endif
+
+/**
+ * @brief Initialise the I/O backend
+ *
+ * Uses io_uring when built with HAVE_IO_URING and the running kernel supports
+ * it, otherwise falls back to plain blocking socket calls.
+ *
+ * @return int 0 on success, -1 on error
+ */
+int io_init();
+
+/**
+ * @brief Name of the active I/O backend ("io_uring" or "syscall")
+ *
+ * @return const char* Backend name
+ */
+const char* io_backend_name();
+
+/**
+ * @brief Relay buffer of IO_BUFFER_SIZE bytes, registered with the ring when possible
+ *
+ * Reads into this buffer skip per-call page pinning on the io_uring backend.
+ *
+ * @return char* Pointer to the relay buffer
+ */
+char* io_buffer();
+
+/**
+ * @brief Accept a connection on a listening socket
+ *
+ * @param listen_fd Listening socket
+ * @param timeout_ms Milliseconds to wait, or -1 to block
+ * @return int Connected socket, or -1 on error / timeout (errno ETIMEDOUT) /
+ *             a signal arriving while waiting (errno EINTR)
+ */
+int io_accept(int listen_fd, int timeout_ms);
+
+/**
+ * @brief Descriptor to poll for io_accept() having a connection ready
+ *
+ * The listening socket itself, or the ring once io_uring accepts on it.
+ *
+ * @param listen_fd Listening socket
+ * @return int Descriptor that turns readable
+ */
+int io_accept_fd(int listen_fd);
+
+/**
+ * @brief Wait until a socket is ready or a deadline passes
+ *
+ * @param fd Socket to wait on
+ * @param events poll() events to wait for
+ * @param deadline Timer bounding the wait, or NULL to wait indefinitely
+ * @return int 0 when ready, -1 on error / expiry (errno ETIMEDOUT)
+ */
+int io_wait(int fd, short events, const timer_entry *deadline);
+
+/**
+ * @brief Receive data from a socket
+ *
+ * @param fd Socket to read from
+ * @param buf Buffer to read into
+ * @param len Maximum number of bytes to read
+ * @param deadline Timer bounding the wait for data, or NULL
+ * @return ssize_t Bytes read, 0 on EOF, -1 on error / expiry
+ */
+ssize_t io_recv(int fd, void *buf, size_t len, const timer_entry *deadline);
+
+/**
+ * @brief Send a whole buffer to a socket
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t len on success, -1 on error / expiry
+ */
+ssize_t io_send(int fd, const void *buf, size_t len, const timer_entry *deadline);
+
+/**
+ * @brief Send a list of buffers to a socket with as few syscalls as possible
+ *
+ * The iovec array is advanced in place when the kernel takes only part of it.
+ *
+ * @param fd Socket to write to
+ * @param iov Buffers to send, in order
+ * @param iovcnt Number of buffers (at most IOV_MAX)
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t Total bytes sent on success, -1 on error / expiry
+ */
+ssize_t io_sendv(int fd, struct iovec *iov, int iovcnt, const timer_entry *deadline);
+
+/**
+ * @brief Send a whole buffer, using MSG_ZEROCOPY for large buffers when available
+ *
+ * Returns only once the kernel has released the pages, so the caller may
+ * modify or free buf afterwards. Without HAVE_MSG_ZEROCOPY, on the io_uring
+ * backend, or when the socket refuses SO_ZEROCOPY this is io_send().
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @param deadline Timer bounding the whole send, or NULL
+ * @return ssize_t len on success, -1 on error / expiry
+ */
+ssize_t io_send_zerocopy(int fd, const void *buf, size_t len, const timer_entry *deadline);
+
+/**
+ * @brief Send as much of a buffer as the socket accepts without blocking
+ *
+ * @param fd Socket to write to
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @return ssize_t Bytes sent, -1 on error (errno EAGAIN if the socket is full)
+ */
+ssize_t io_send_some(int fd, const void *buf, size_t len);
+
+/**
+ * @brief Connect a socket to a remote address
+ *
+ * @param fd Socket to connect
+ * @param addr Remote address
+ * @param addrlen Length of addr
+ * @param deadline Timer bounding the handshake, or NULL
+ * @return int 0 on success, -1 on error / expiry
+ */
+int io_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, const timer_entry *deadline);
+
+/**
+ * @brief Move bytes from one socket to another without copying through user space
+ *
+ * @param from_fd Socket to read from
+ * @param to_fd Socket to write to
+ * @param len Maximum number of bytes to move
+ * @param deadline Timer bounding the wait for input, or NULL
+ * @return ssize_t Bytes moved, 0 on EOF, -1 on error / expiry
+ */
+ssize_t io_splice(int from_fd, int to_fd, size_t len, const timer_entry *deadline);
+
+#endif /* IO_H */
@@ -0,0 +1,418 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+
+#define RING_MASK (LOG_RING_SLOTS - 1)
+
+// Longest formatted line: the strings plus the fixed text around them
+#define LOG_LINE_MAX (LOG_TEXT_SIZE + 128)
+
+/**
+ * One queued log line, kept in binary form until the writer formats it
+ */
+typedef struct {
+    uint16_t type;
+    uint16_t text2_off;        // Offset of the second string in text
+    int64_t num[2];
+    char text[LOG_TEXT_SIZE];  // First string, NUL, second string, NUL
+} log_record;
+
+/**
+ * Single-producer single-consumer ring owned by one thread. The owner only
+ * moves tail, the writer only moves head, each on its own cache line.
+ */
+typedef struct {
+    _Alignas(64) uint32_t head;   // Next record the writer reads
+    _Alignas(64) uint32_t tail;   // Next slot the owner fills
+    log_record slots[LOG_RING_SLOTS];
+} log_ring;
+
+// Rings registered so far
+static log_ring *rings[LOG_MAX_THREADS];
+static int ring_count;
+
+// Ring owned by the calling thread
+static _Thread_local log_ring *local_ring;
+static _Thread_local int local_ring_failed;
+
+// Access log, -1 when LOG_ACCESS lines are dropped
+static int access_fd = -1;
+static char access_path[LOG_PATH_SIZE];
+
+// Writer thread state
+static int writer_running;
+static int writer_sleeping;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Write a whole buffer to a file descriptor
+ *
+ * @param fd Where to write (stdout or the access log)
+ * @param buf Bytes to write
+ * @param len Number of bytes
+ */
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+/**
+ * @brief Turn a record into its output line
+ *
+ * @param rec Record to format
+ * @param out Output buffer of at least LOG_LINE_MAX bytes
+ * @return size_t Length of the line
+ */
+static size_t format_record(const log_record *rec, char *out) {
+    const char *text1 = rec->text;
+    const char *text2 = rec->text + rec->text2_off;
+    int len;
+
+    switch (rec->type) {
+    case LOG_ACCEPTED:
+        len = snprintf(out, LOG_LINE_MAX, "Accepted\n");
+        break;
+    case LOG_REQUEST_TAIL:
+        len = snprintf(out, LOG_LINE_MAX, "Request tail %s\n", text1);
+        break;
+    case LOG_GETTING:
+        len = snprintf(out, LOG_LINE_MAX, "GETting %s %s\n", text1, text2);
+        break;
+    case LOG_BODY_LENGTH:
+        len = snprintf(out, LOG_LINE_MAX, "Response body length %lld\n", (long long)rec->num[0]);
+        break;
+    case LOG_SERVING:
+        len = snprintf(out, LOG_LINE_MAX, "Serving %s %s from cache\n", text1, text2);
+        break;
+    case LOG_STALE:
+        len = snprintf(out, LOG_LINE_MAX, "Stale entry for %s %s\n", text1, text2);
+        break;
+    case LOG_NOT_CACHING:
+        len = snprintf(out, LOG_LINE_MAX, "Not caching %s %s\n", text1, text2);
+        break;
+    case LOG_EVICTING:
+        len = snprintf(out, LOG_LINE_MAX, "Evicting %s %s from cache\n", text1, text2);
+        break;
+    case LOG_CONNECTING:
+        len = snprintf(out, LOG_LINE_MAX, "CONNECTing %s %s\n", text1, text2);
+        break;
+    case LOG_TUNNEL_CLOSED:
+        len = snprintf(out, LOG_LINE_MAX, "Tunnel %s %s closed, %lld bytes up, %lld bytes down\n",
+                       text1, text2, (long long)rec->num[0], (long long)rec->num[1]);
+        break;
+    case LOG_ACCESS:
+        len = snprintf(out, LOG_LINE_MAX, "%s\n", text1);
+        break;
+    default:
+        return 0;
+    }
+
+    if (len < 0) return 0;
+    return (size_t)len < LOG_LINE_MAX ? (size_t)len : LOG_LINE_MAX - 1;
+}
+
+/**
+ * @brief Fill a record from log_event() arguments, truncating long strings
+ *
+ * @param rec Record to fill
+ * @param type Kind of line
+ * @param text1 First string argument (or NULL)
+ * @param text2 Second string argument (or NULL)
+ * @param num1 First numeric argument
+ * @param num2 Second numeric argument
+ */
+static void fill_record(log_record *rec, log_event_type type, const char *text1,
+                        const char *text2, int64_t num1, int64_t num2) {
+    size_t len2 = text2 ? strlen(text2) : 0;
+    if (len2 > LOG_TEXT_SIZE / 2 - 1) len2 = LOG_TEXT_SIZE / 2 - 1;
+
+    size_t len1 = text1 ? strlen(text1) : 0;
+    if (len1 > LOG_TEXT_SIZE - len2 - 2) len1 = LOG_TEXT_SIZE - len2 - 2;
+
+    rec->type = type;
+    rec->num[0] = num1;
+    rec->num[1] = num2;
+
+    memcpy(rec->text, text1 ? text1 : "", len1);
+    rec->text[len1] = '\0';
+    rec->text2_off = len1 + 1;
+    memcpy(rec->text + rec->text2_off, text2 ? text2 : "", len2);
+    rec->text[rec->text2_off + len2] = '\0';
+}
+
+/**
+ * @brief Ring owned by the calling thread, created on first use
+ *
+ * @return log_ring* Ring, or NULL if every ring slot is taken
+ */
+static log_ring* thread_ring() {
+    if (local_ring || local_ring_failed) {
+        return local_ring;
+    }
+
+    int index = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+    log_ring *ring = index < LOG_MAX_THREADS ? calloc(1, sizeof(log_ring)) : NULL;
+    if (!ring) {
+        local_ring_failed = 1;
+        return NULL;
+    }
+
+    __atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+    local_ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Wake the writer thread
+ */
+static void wake_writer() {
+    pthread_mutex_lock(&wake_lock);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+/**
+ * @brief Check whether any ring holds unwritten records
+ *
+ * @return int 1 if something is queued, 0 otherwise
+ */
+static int rings_pending() {
+    int count = __atomic_load_n(&ring_count, __ATOMIC_SEQ_CST);
+    if (count > LOG_MAX_THREADS) count = LOG_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        log_ring *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring && __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief File a record's line goes to
+ *
+ * @param type Kind of line
+ * @return int stdout or the access log
+ */
+static int record_fd(uint16_t type) {
+    return type == LOG_ACCESS ? __atomic_load_n(&access_fd, __ATOMIC_RELAXED) : STDOUT_FILENO;
+}
+
+/**
+ * @brief Format everything queued and write it out in batches
+ *
+ * Access log lines are batched apart from the stdout ones, in the second
+ * half of the buffer.
+ *
+ * @param batch Output buffer of 2 * LOG_BATCH_SIZE bytes
+ * @return int Number of records written
+ */
+static int drain_rings(char *batch) {
+    char *access_batch = batch + LOG_BATCH_SIZE;
+    size_t len = 0, access_len = 0;
+    int drained = 0;
+
+    int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+    if (count > LOG_MAX_THREADS) count = LOG_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        log_ring *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (!ring) continue;
+
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            const log_record *rec = &ring->slots[head & RING_MASK];
+            char *out = rec->type == LOG_ACCESS ? access_batch : batch;
+            size_t *out_len = rec->type == LOG_ACCESS ? &access_len : &len;
+            if (*out_len + LOG_LINE_MAX > LOG_BATCH_SIZE) {
+                write_all(record_fd(rec->type), out, *out_len);
+                *out_len = 0;
+            }
+            *out_len += format_record(rec, out + *out_len);
+            head++;
+            drained++;
+
+            // Hand the slot back as soon as it is formatted
+            __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (len > 0) {
+        write_all(STDOUT_FILENO, batch, len);
+    }
+    if (access_len > 0) {
+        write_all(record_fd(LOG_ACCESS), access_batch, access_len);
+    }
+    return drained;
+}
+
+/**
+ * @brief Writer thread: drain the rings, sleep when they are empty
+ *
+ * @param arg Batch buffers
+ * @return void* Never returns
+ */
+static void* writer_loop(void *arg) {
+    char *batch = arg;
+
+    while (1) {
+        if (drain_rings(batch) > 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&wake_lock);
+        __atomic_store_n(&writer_sleeping, 1, __ATOMIC_SEQ_CST);
+
+        // Producers check writer_sleeping after publishing, so a record
+        // queued from here on either shows up below or signals us
+        if (!rings_pending()) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += (long)LOG_IDLE_WAIT_MS * 1000000;
+            until.tv_sec += until.tv_nsec / 1000000000;
+            until.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &until);
+        }
+
+        __atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&wake_lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Start the writer thread
+ *
+ * @return int 0 on success, -1 on error
+ */
+int init_logger() {
+    char *batch = malloc(2 * LOG_BATCH_SIZE);
+    if (!batch) {
+        fprintf(stderr, "Failed to allocate log batch buffer\n");
+        return -1;
+    }
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, writer_loop, batch);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start log writer: %s\n", strerror(err));
+        free(batch);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief Send LOG_ACCESS lines to a file, appending
+ *
+ * @param path Access log path
+ * @return int 0 on success, -1 on error
+ */
+int log_open_access(const char *path) {
+    if (strlen(path) >= sizeof(access_path)) {
+        fprintf(stderr, "Access log path too long\n");
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (path != access_path) {
+        snprintf(access_path, sizeof(access_path), "%s", path);
+    }
+
+    if (access_fd < 0) {
+        __atomic_store_n(&access_fd, fd, __ATOMIC_RELEASE);
+    } else {
+        // Swapped under the same number, so a write in progress finishes in one file or the other
+        dup2(fd, access_fd);
+        close(fd);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reopen the access log at the same path, after it has been rotated
+ */
+void log_reopen_access() {
+    if (access_fd >= 0) {
+        log_open_access(access_path);
+    }
+}
+
+/**
+ * @brief Check whether an access log is open
+ *
+ * @return int 1 if LOG_ACCESS lines are written somewhere, 0 if they are dropped
+ */
+int log_access_enabled() {
+    return __atomic_load_n(&access_fd, __ATOMIC_RELAXED) >= 0;
+}
+
+/**
+ * @brief Queue a log line on the calling thread's ring without blocking
+ *
+ * @param type Kind of line
+ * @param text1 First string argument (or NULL)
+ * @param text2 Second string argument (or NULL)
+ * @param num1 First numeric argument
+ * @param num2 Second numeric argument
+ */
+void log_event(log_event_type type, const char *text1, const char *text2,
+               int64_t num1, int64_t num2) {
+    if (type == LOG_ACCESS && !log_access_enabled()) {
+        return;
+    }
+
+    log_ring *ring = __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE) ? thread_ring() : NULL;
+
+    if (!ring) {
+        // No writer for this thread, format and write in place
+        log_record rec;
+        char line[LOG_LINE_MAX];
+        fill_record(&rec, type, text1, text2, num1, num2);
+        write_all(record_fd(type), line, format_record(&rec, line));
+        return;
+    }
+
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LOG_RING_SLOTS) {
+        // Writer is behind, never stall the request path on it
+        stats_add(STAT_LOG_DROPS, 1);
+        wake_writer();
+        return;
+    }
+
+    fill_record(&ring->slots[tail & RING_MASK], type, text1, text2, num1, num2);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST)) {
+        wake_writer();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+/* ========== Constants ========== */
+// Records each thread can queue before new ones are dropped (power of two)
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 256
+#endif
+
+// Threads that can own a ring; records from later threads are written synchronously
+#ifndef LOG_MAX_THREADS
+#define LOG_MAX_THREADS 16
+#endif
+
+// Room for a record's string arguments (a request tail line is up to 1 KiB)
+#define LOG_TEXT_SIZE 1280
+
+// Writer thread output batch
+#define LOG_BATCH_SIZE (64 * 1024)
+
+// Longest the writer sleeps before rechecking the rings on its own (ms)
+#define LOG_IDLE_WAIT_MS 100
+
+// Longest access log path
+#define LOG_PATH_SIZE 1024
+
+/**
+ * Log line kinds. Each maps to one fixed stdout format.
+ */
+typedef enum {
+    LOG_ACCEPTED,          // "Accepted"
+    LOG_REQUEST_TAIL,      // "Request tail <line>"
+    LOG_GETTING,           // "GETting <host> <uri>"
+    LOG_BODY_LENGTH,       // "Response body length <n>"
+    LOG_SERVING,           // "Serving <host> <uri> from cache"
+    LOG_STALE,             // "Stale entry for <host> <uri>"
+    LOG_NOT_CACHING,       // "Not caching <host> <uri>"
+    LOG_EVICTING,          // "Evicting <host> <uri> from cache"
+    LOG_CONNECTING,        // "CONNECTing <host> <port>"
+    LOG_TUNNEL_CLOSED,     // "Tunnel <host> <port> closed, <up> bytes up, <down> bytes down"
+    LOG_ACCESS,            // "<line>", to the access log instead of stdout
+    LOG_EVENT_COUNT
+} log_event_type;
+
+/**
+ * @brief Start the writer thread
+ *
+ * Until this is called (or if it fails) log_event() writes synchronously.
+ *
+ * @return int 0 on success, -1 on error
+ */
+int init_logger();
+
+/**
+ * @brief Send LOG_ACCESS lines to a file, appending
+ *
+ * @param path Access log path
+ * @return int 0 on success, -1 on error
+ */
+int log_open_access(const char *path);
+
+/**
+ * @brief Reopen the access log at the same path, after it has been rotated
+ *
+ * Lines already queued may land in either file; none are lost.
+ */
+void log_reopen_access();
+
+/**
+ * @brief Check whether an access log is open
+ *
+ * @return int 1 if LOG_ACCESS lines are written somewhere, 0 if they are dropped
+ */
+int log_access_enabled();
+
+/**
+ * @brief Queue a log line on the calling thread's ring without blocking
+ *
+ * Unused arguments are ignored. If the ring is full the record is dropped
+ * and counted rather than waiting for the writer.
+ *
+ * @param type Kind of line
+ * @param text1 First string argument (or NULL)
+ * @param text2 Second string argument (or NULL)
+ * @param num1 First numeric argument
+ * @param num2 Second numeric argument
+ */
+void log_event(log_event_type type, const char *text1, const char *text2,
+               int64_t num1, int64_t num2);
+
+#endif /* LOG_H */
@@ -4,23 +4,80 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 
 #include "utils/utils.h"
 #include "socket/socket.h"
 #include "proxy/proxy.h"
 #include "cache/cache.h"
+#include "io/io.h"
+#include "timer/timer.h"
+#include "stats/stats.h"
+#include "admin/admin.h"
+#include "arena/arena.h"
+#include "dispatch/dispatch.h"
+#include "cluster/cluster.h"
+#include "prefetch/prefetch.h"
+#include "config/config.h"
+#include "log/log.h"
+#include "tunnel/tunnel.h"
 
 /* Constants */
-#define BACKLOG 10
+// Default listen backlog; connections beyond the dispatch queue wait here (-b)
+#ifndef BACKLOG
+#define BACKLOG 128
+#endif
 
 /* Global variables */
 int g_cache_enabled = 0;
 
+// Periodic sweep of expired cache entries, run from the timer wheel
+static timer_entry sweep_timer;
+
+// Pickup of cache jobs (purges) queued by the admin thread
+static timer_entry admin_timer;
+
+// Set by SIGHUP; the config file is re-read from the serving loop
+static volatile sig_atomic_t reload_requested;
+
+/**
+ * @brief SIGHUP handler: ask the serving loop to reload the config file
+ *
+ * @param signum Signal number
+ */
+static void request_reload(int signum) {
+    (void)signum;
+    reload_requested = 1;
+}
+
+/**
+ * @brief Timer callback: reclaim a batch of expired cache entries and re-arm
+ *
+ * @param timer The sweep timer
+ */
+static void sweep_cache(timer_entry *timer) {
+    int reclaimed = cache_sweep_expired(CACHE_SWEEP_BATCH);
+    
+    // A full batch means more are waiting, come back on the next tick
+    timer_arm(timer, reclaimed == CACHE_SWEEP_BATCH ? 1 : CACHE_SWEEP_INTERVAL_MS, sweep_cache, NULL);
+}
+
+/**
+ * @brief Timer callback: run queued admin cache jobs and re-arm
+ *
+ * @param timer The admin timer
+ */
+static void run_admin_jobs(timer_entry *timer) {
+    admin_run_jobs();
+    timer_arm(timer, ADMIN_POLL_MS, run_admin_jobs, NULL);
+}
+
 /**
  * @brief Main function. 
  *
@@ -30,43 +87,122 @@ int g_cache_enabled = 0;
  */
 int main(int argc, char *argv[]) {
     int port;
+    int admin_port;
+    int backlog;
+    const char *config_path;
     
-    parse_args(argc, argv, &port, &g_cache_enabled);
+    parse_args(argc, argv, &port, &g_cache_enabled, &admin_port, &backlog, &config_path);
+    
+    // SIGHUP must wake the serving loop, so the threads started below never take it
+    sigset_t reload_signal;
+    sigemptyset(&reload_signal);
+    sigaddset(&reload_signal, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signal, NULL);
+    
+    if (cluster_init(port) < 0) {
+        return EXIT_FAILURE;
+    }
+    
+    // Log lines are written off the request path; without the writer they go out inline
+    if (init_logger() < 0) {
+        fprintf(stderr, "Logging synchronously\n");
+    }
+    
+    // Cache memory (and this thread) go on the configured huge pages and NUMA node
+    if (arena_init() < 0) {
+        fprintf(stderr, "Cache arena unavailable, using malloc\n");
+    }
     
     if (g_cache_enabled) {
         init_cache();
     }
     
+    // Peers closing early must not kill the proxy
+    signal(SIGPIPE, SIG_IGN);
+    
+    timer_init();
+    
+    if (g_cache_enabled) {
+        timer_arm(&sweep_timer, CACHE_SWEEP_INTERVAL_MS, sweep_cache, NULL);
+    }
+    
+    if (io_init() < 0) {
+        fprintf(stderr, "Failed to initialise I/O backend\n");
+        return EXIT_FAILURE;
+    }
+    
     int listen_socket = create_listening_socket(port);
     if (listen_socket < 0) {
         fprintf(stderr, "Failed to create listening socket\n");
         return EXIT_FAILURE;
     }
     
-    if (listen(listen_socket, BACKLOG) < 0) {
+    if (listen(listen_socket, backlog > 0 ? backlog : BACKLOG) < 0) {
         perror("listen failed");
         close(listen_socket);
         return EXIT_FAILURE;
     }
     
+    dispatch_init(listen_socket);
+    
+    // File settings override the command line; the cache and listener must exist by now
+    if (config_path && config_init(config_path, listen_socket) < 0) {
+        close(listen_socket);
+        return EXIT_FAILURE;
+    }
+    
+    // Prefetched links are only worth anything once they are in the cache
+    if (g_cache_enabled && prefetch_start(port) < 0) {
+        fprintf(stderr, "Prefetching off\n");
+    }
+    
+    if (tunnel_start() < 0) {
+        fprintf(stderr, "Failed to start tunnel relay\n");
+        close(listen_socket);
+        return EXIT_FAILURE;
+    }
+    
+    if (admin_port > 0 && start_admin_server(admin_port) < 0) {
+        fprintf(stderr, "Failed to start admin server\n");
+        close(listen_socket);
+        return EXIT_FAILURE;
+    }
+    if (admin_port > 0) {
+        timer_arm(&admin_timer, ADMIN_POLL_MS, run_admin_jobs, NULL);
+    }
+    
+    // Blocking reads and writes carry on through a reload; waits return early to run it
+    struct sigaction reload_action;
+    memset(&reload_action, 0, sizeof(reload_action));
+    reload_action.sa_handler = request_reload;
+    reload_action.sa_flags = SA_RESTART;
+    sigemptyset(&reload_action.sa_mask);
+    sigaction(SIGHUP, &reload_action, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &reload_signal, NULL);
+    
     while (1) {
-        struct sockaddr_storage client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_socket = accept(listen_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) {
-            perror("accept failed");
-            continue;
+        if (reload_requested) {
+            reload_requested = 0;
+            config_reload(listen_socket);
+            log_reopen_access();
         }
         
-        printf("Accepted\n");
-        fflush(stdout);
+        // Sleep until a client arrives or the next timer is due, unless clients are waiting
+        dispatch_accept(dispatch_pending() ? 0 : timer_next_timeout());
+        timer_advance();
         
-        if (handle_client_request(client_socket) < 0) {
-            fprintf(stderr, "Failed to handle client request\n");
+        dispatch_classify();
+        
+        dispatch_client client;
+        if (dispatch_next(&client) < 0) {
+            continue;
         }
         
-        close(client_socket);
+        if (client.shed) {
+            shed_client(client.socket);
+        } else {
+            serve_client(client.socket, client.accepted_us);
+        }
     }
     
     close(listen_socket);
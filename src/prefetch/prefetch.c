@@ -0,0 +1,565 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "prefetch.h"
+#include "cache.h"
+#include "stats.h"
+
+/**
+ * Link waiting to be prefetched
+ */
+typedef struct {
+    char request[MAX_REQUEST_SIZE];   // Request as it will be keyed, ending with the blank line
+    int request_len;
+} prefetch_job;
+
+// Configuration
+static int worker_count;
+static size_t budget = PREFETCH_BUDGET;
+static int proxy_port;
+static int started;
+
+// Links waiting, oldest at head
+static prefetch_job jobs[PREFETCH_QUEUE_SIZE];
+static int job_head;
+static int job_count;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+
+// Byte budget (token bucket), under job_lock
+static int64_t tokens;              // Bytes that may still be fetched, negative after an overrun
+static struct timespec refilled;    // When tokens were last topped up
+
+/**
+ * @brief Top the byte budget up for the time passed since the last refill
+ *
+ * @param now Current monotonic time
+ */
+static void refill(const struct timespec *now) {
+    double elapsed = (double)(now->tv_sec - refilled.tv_sec) + (now->tv_nsec - refilled.tv_nsec) / 1e9;
+    tokens += (int64_t)(elapsed * budget);
+    if (tokens > (int64_t)budget) {
+        tokens = (int64_t)budget;
+    }
+    refilled = *now;
+}
+
+/**
+ * @brief Request a link through the proxy and read the response to the end
+ *
+ * @param job Link to fetch
+ * @param ok Set to 1 on a 200 response
+ * @return long Bytes received, or -1 if the proxy could not be reached
+ */
+static long fetch(const prefetch_job *job, int *ok) {
+    *ok = 0;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    struct timeval timeout = {PREFETCH_TIMEOUT_MS / 1000, (PREFETCH_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(proxy_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    // The request as keyed, with the marker ahead of the blank line ending it
+    char request[MAX_REQUEST_SIZE + sizeof(PREFETCH_HEADER) + 8];
+    int len = job->request_len - 2;
+    memcpy(request, job->request, len);
+    len += snprintf(request + len, sizeof(request) - len, PREFETCH_HEADER ": 1\r\n\r\n");
+
+    for (int sent = 0; sent < len;) {
+        ssize_t n = send(sock, request + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(sock);
+            return 0;
+        }
+        sent += n;
+    }
+
+    char buffer[16 * 1024];
+    char status[13] = {0};
+    long received = 0;
+    ssize_t n;
+    while ((n = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+        if (received < 12) {
+            long take = 12 - received < n ? 12 - received : n;
+            memcpy(status + received, buffer, take);
+        }
+        received += n;
+    }
+    close(sock);
+
+    *ok = n == 0 && strncmp(status + 8, " 200", 4) == 0;
+    return received;
+}
+
+/**
+ * @brief Prefetch thread: fetch queued links within the byte budget
+ *
+ * @param arg Unused
+ * @return void* Never returns
+ */
+static void *prefetch_loop(void *arg) {
+    (void)arg;
+    prefetch_job job;
+
+    while (1) {
+        pthread_mutex_lock(&job_lock);
+        while (job_count == 0) {
+            pthread_cond_wait(&job_ready, &job_lock);
+        }
+        job = jobs[job_head];
+        job_head = (job_head + 1) % PREFETCH_QUEUE_SIZE;
+        job_count--;
+
+        // Sleep off an overdrawn budget before starting another fetch
+        while (1) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            refill(&now);
+            if (tokens > 0) {
+                break;
+            }
+            long wait_ns = (long)((1 - tokens) * 1e9 / budget);
+            struct timespec wait = {wait_ns / 1000000000L, wait_ns % 1000000000L};
+            pthread_mutex_unlock(&job_lock);
+            nanosleep(&wait, NULL);
+            pthread_mutex_lock(&job_lock);
+        }
+        pthread_mutex_unlock(&job_lock);
+
+        int ok;
+        long bytes = fetch(&job, &ok);
+        if (bytes < 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&job_lock);
+        tokens -= bytes;
+        pthread_mutex_unlock(&job_lock);
+
+        stats_add(STAT_PREFETCH_BYTES, bytes);
+        if (ok) {
+            stats_add(STAT_PREFETCH_FETCHED, 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Turn on prefetching of links from cached HTML pages
+ *
+ * @param workers Prefetches in flight at once (0 leaves prefetching off)
+ * @param bytes_per_second Bytes per second that may be prefetched (0 keeps the current budget, PREFETCH_BUDGET at first)
+ * @return int 0 on success, -1 if too many workers
+ */
+int prefetch_configure(int workers, size_t bytes_per_second) {
+    if (workers < 0 || workers > PREFETCH_MAX_WORKERS) {
+        return -1;
+    }
+    worker_count = workers;
+    prefetch_set_budget(bytes_per_second);
+    return 0;
+}
+
+/**
+ * @brief Change how many bytes per second may be prefetched
+ *
+ * @param bytes_per_second New budget (0 keeps the current one)
+ */
+void prefetch_set_budget(size_t bytes_per_second) {
+    if (bytes_per_second == 0) {
+        return;
+    }
+    pthread_mutex_lock(&job_lock);
+    budget = bytes_per_second;
+    if (tokens > (int64_t)budget) {
+        tokens = (int64_t)budget;
+    }
+    pthread_mutex_unlock(&job_lock);
+}
+
+/**
+ * @brief Start the prefetch threads, if prefetching was configured
+ *
+ * @param listen_port Port the proxy listens on
+ * @return int 0 on success (or with prefetching off), -1 on error
+ */
+int prefetch_start(int listen_port) {
+    proxy_port = listen_port;
+    tokens = (int64_t)budget;
+    clock_gettime(CLOCK_MONOTONIC, &refilled);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_t thread;
+        int err = pthread_create(&thread, NULL, prefetch_loop, NULL);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start prefetch thread: %s\n", strerror(err));
+            return started ? 0 : -1;
+        }
+        pthread_detach(thread);
+        started++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether prefetching is on
+ *
+ * @return int 1 if it is, 0 otherwise
+ */
+int prefetch_enabled() {
+    return started > 0;
+}
+
+/**
+ * @brief Check whether a tag starts with a name, ignoring case
+ *
+ * @param tag Text after the '<'
+ * @param end The tag's closing '>'
+ * @param name Lowercase tag name
+ * @return int 1 if it does, 0 otherwise
+ */
+static int tag_is(const char *tag, const char *end, const char *name) {
+    size_t len = strlen(name);
+    if ((size_t)(end - tag) < len || strncasecmp(tag, name, len) != 0) {
+        return 0;
+    }
+    return tag + len == end || isspace((unsigned char)tag[len]) || tag[len] == '/';
+}
+
+/**
+ * @brief Find an attribute's value inside a tag
+ *
+ * @param tag Text after the '<'
+ * @param end The tag's closing '>'
+ * @param name Lowercase attribute name
+ * @param len Receives the value's length
+ * @return const char* Start of the value (quotes removed), or NULL if the tag doesn't have it
+ */
+static const char* tag_attribute(const char *tag, const char *end, const char *name, int *len) {
+    size_t name_len = strlen(name);
+    for (const char *p = tag; p + name_len < end; p++) {
+        if (!isspace((unsigned char)p[0]) || strncasecmp(p + 1, name, name_len) != 0) {
+            continue;
+        }
+        const char *value = p + 1 + name_len;
+        while (value < end && isspace((unsigned char)*value)) value++;
+        if (value == end || *value != '=') {
+            continue;
+        }
+        value++;
+        while (value < end && isspace((unsigned char)*value)) value++;
+
+        const char *value_end;
+        if (value < end && (*value == '"' || *value == '\'')) {
+            value_end = memchr(value + 1, *value, end - value - 1);
+            if (!value_end) {
+                return NULL;
+            }
+            value++;
+        } else {
+            value_end = value;
+            while (value_end < end && !isspace((unsigned char)*value_end)) value_end++;
+        }
+        *len = (int)(value_end - value);
+        return value;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check whether a <link> points at something the page loads (stylesheet, icon, preload)
+ *
+ * @param tag Text after the '<'
+ * @param end The tag's closing '>'
+ * @return int 1 if it does, 0 otherwise
+ */
+static int link_loaded(const char *tag, const char *end) {
+    int len;
+    const char *rel = tag_attribute(tag, end, "rel", &len);
+    if (!rel || len >= 64) {
+        return 0;
+    }
+    char value[64];
+    memcpy(value, rel, len);
+    value[len] = '\0';
+    return strcasestr(value, "stylesheet") || strcasestr(value, "icon") || strcasestr(value, "preload");
+}
+
+/**
+ * @brief Resolve "." and ".." segments of a path in place (RFC 3986 section 5.2.4)
+ *
+ * @param path Path starting with '/', optionally followed by a query
+ */
+static void remove_dot_segments(char *path) {
+    char out[MAX_URI_SIZE + 1];
+    size_t out_len = 0;
+    char *query = strchr(path, '?');
+    const char *end = query ? query : path + strlen(path);
+
+    for (const char *p = path; p < end;) {
+        const char *next = memchr(p + 1, '/', end - p - 1);
+        if (!next) {
+            next = end;
+        }
+        size_t segment = next - p;
+        if (segment == 2 && p[1] == '.') {
+            if (next == end) out[out_len++] = '/';
+        } else if (segment == 3 && p[1] == '.' && p[2] == '.') {
+            while (out_len > 0 && out[--out_len] != '/');
+            if (next == end) out[out_len++] = '/';
+        } else {
+            memcpy(out + out_len, p, segment);
+            out_len += segment;
+        }
+        p = next;
+    }
+    if (out_len == 0) {
+        out[out_len++] = '/';
+    }
+
+    size_t query_len = query ? strlen(query) : 0;
+    memmove(path + out_len, end, query_len + 1);
+    memcpy(path, out, out_len);
+}
+
+/**
+ * @brief Turn a link into a request target on the page's own host
+ *
+ * @param page Page request target, absolute ("http://host/...") or origin form ("/...")
+ * @param hostname Host header value
+ * @param link Link as written in the page
+ * @param link_len Length of the link
+ * @param target Receives the target, in the same form as the page's
+ * @return int 0 on success, -1 if the link is to another host or scheme, or too long
+ */
+static int resolve_link(const char *page, const char *hostname, const char *link, int link_len,
+                        char target[MAX_URI_SIZE]) {
+    // Copy out the link without its fragment, undoing &amp;
+    char url[MAX_URI_SIZE];
+    int url_len = 0;
+    for (int i = 0; i < link_len && link[i] != '#'; i++) {
+        if (url_len == MAX_URI_SIZE - 1) {
+            return -1;
+        }
+        url[url_len++] = link[i];
+        if (link[i] == '&' && link_len - i >= 5 && strncmp(link + i, "&amp;", 5) == 0) {
+            i += 4;
+        }
+    }
+    url[url_len] = '\0';
+    if (url_len == 0) {
+        return -1;
+    }
+
+    // "http://host" the page was asked for with, empty in origin form
+    const char *page_path = page;
+    if (strncasecmp(page, "http://", 7) == 0) {
+        page_path = page + 7 + strcspn(page + 7, "/?");
+    }
+    int prefix_len = (int)(page_path - page);
+
+    char path[2 * MAX_URI_SIZE];
+    if (strncasecmp(url, "http://", 7) == 0 || strncmp(url, "//", 2) == 0) {
+        const char *authority = url + (url[0] == '/' ? 2 : 7);
+        size_t authority_len = strcspn(authority, "/?");
+        if (authority_len != strlen(hostname) || strncasecmp(authority, hostname, authority_len) != 0 ||
+            authority[authority_len] != '/') {
+            return -1;
+        }
+        snprintf(path, sizeof(path), "%s", authority + authority_len);
+    } else if (url[0] == '/') {
+        snprintf(path, sizeof(path), "%s", url);
+    } else if (url[strcspn(url, ":/?")] == ':') {
+        // https:, data:, javascript: and the like
+        return -1;
+    } else {
+        // Relative to the page's directory
+        int dir_len = (int)strcspn(page_path, "?");
+        while (dir_len > 0 && page_path[dir_len - 1] != '/') dir_len--;
+        if (dir_len == 0) {
+            snprintf(path, sizeof(path), "/%s", url);
+        } else {
+            snprintf(path, sizeof(path), "%.*s%s", dir_len, page_path, url);
+        }
+    }
+    if (strlen(path) >= MAX_URI_SIZE) {
+        return -1;
+    }
+    remove_dot_segments(path);
+
+    size_t path_len = strlen(path);
+    if (prefix_len + path_len >= MAX_URI_SIZE) {
+        return -1;
+    }
+    memcpy(target, page, prefix_len);
+    memcpy(target + prefix_len, path, path_len + 1);
+    return 0;
+}
+
+/**
+ * @brief Check a response header block for an uncompressed text/html body
+ *
+ * @param headers Response headers
+ * @param len Length of the headers
+ * @return int 1 if the body is HTML to scan, 0 otherwise
+ */
+static int is_html(const char *headers, int len) {
+    int html = 0;
+    for (const char *line = headers; line < headers + len;) {
+        const char *line_end = memmem(line, headers + len - line, "\r\n", 2);
+        if (!line_end) {
+            break;
+        }
+        if (line_end - line > 13 && strncasecmp(line, "Content-Type:", 13) == 0) {
+            const char *value = line + 13;
+            while (*value == ' ' || *value == '\t') value++;
+            html = line_end - value >= 9 && strncasecmp(value, "text/html", 9) == 0;
+        } else if (line_end - line > 17 && strncasecmp(line, "Content-Encoding:", 17) == 0) {
+            const char *value = line + 17;
+            while (*value == ' ' || *value == '\t') value++;
+            if (line_end - value < 8 || strncasecmp(value, "identity", 8) != 0) {
+                return 0;
+            }
+        }
+        line = line_end + 2;
+    }
+    return html;
+}
+
+/**
+ * @brief Queue a request for a link unless it is cached or already waiting
+ *
+ * @param request Request as it will be keyed
+ * @param request_len Length of the request
+ */
+static void queue_job(const char *request, int request_len) {
+    if (cache_has_fresh(request, request_len)) {
+        return;
+    }
+
+    pthread_mutex_lock(&job_lock);
+    for (int i = 0; i < job_count; i++) {
+        const prefetch_job *queued = &jobs[(job_head + i) % PREFETCH_QUEUE_SIZE];
+        if (queued->request_len == request_len && memcmp(queued->request, request, request_len) == 0) {
+            pthread_mutex_unlock(&job_lock);
+            return;
+        }
+    }
+    if (job_count == PREFETCH_QUEUE_SIZE) {
+        pthread_mutex_unlock(&job_lock);
+        stats_add(STAT_PREFETCH_DROPPED, 1);
+        return;
+    }
+
+    prefetch_job *job = &jobs[(job_head + job_count) % PREFETCH_QUEUE_SIZE];
+    memcpy(job->request, request, request_len);
+    job->request_len = request_len;
+    job_count++;
+    pthread_cond_signal(&job_ready);
+    pthread_mutex_unlock(&job_lock);
+
+    stats_add(STAT_PREFETCH_QUEUED, 1);
+}
+
+/**
+ * @brief Queue the same-host subresources an HTML page links to
+ *
+ * @param request Page request as keyed in the cache
+ * @param request_len Length of the request
+ * @param hostname Host header value
+ * @param uri Page request target
+ * @param response Page response, headers and body
+ * @param response_len Length of the response
+ */
+void prefetch_page(const char *request, int request_len, const char *hostname, const char *uri,
+                   const char *response, int response_len) {
+    if (!started) {
+        return;
+    }
+
+    const char *body = memmem(response, response_len, "\r\n\r\n", 4);
+    if (!body || !is_html(response, (int)(body + 2 - response))) {
+        return;
+    }
+    body += 4;
+    const char *body_end = response + response_len;
+
+    // Links are asked for with the page's headers; only the request line changes
+    const char *line_end = memmem(request, request_len, "\r\n", 2);
+    if (!line_end) {
+        return;
+    }
+    const char *version = line_end;
+    while (version > request && *version != ' ') version--;
+    int version_len = (int)(line_end - version);
+    int rest_len = request_len - (int)(line_end - request);
+
+    int links = 0;
+    for (const char *p = body; links < PREFETCH_PAGE_LINKS && p < body_end; ) {
+        const char *tag = memchr(p, '<', body_end - p);
+        if (!tag) {
+            break;
+        }
+        tag++;
+        const char *tag_end = memchr(tag, '>', body_end - tag);
+        if (!tag_end) {
+            break;
+        }
+        p = tag_end + 1;
+
+        const char *attribute = NULL;
+        if (tag_is(tag, tag_end, "img") || tag_is(tag, tag_end, "script")) {
+            attribute = "src";
+        } else if (tag_is(tag, tag_end, "link") && link_loaded(tag, tag_end)) {
+            attribute = "href";
+        }
+
+        int link_len;
+        const char *link = attribute ? tag_attribute(tag, tag_end, attribute, &link_len) : NULL;
+        char target[MAX_URI_SIZE];
+        if (!link || resolve_link(uri, hostname, link, link_len, target) < 0) {
+            continue;
+        }
+
+        char prefetch_request[MAX_REQUEST_SIZE];
+        int target_len = (int)strlen(target);
+        int len = 4 + target_len + version_len + rest_len;
+        if (len >= MAX_REQUEST_SIZE) {
+            continue;
+        }
+        memcpy(prefetch_request, "GET ", 4);
+        memcpy(prefetch_request + 4, target, target_len);
+        memcpy(prefetch_request + 4 + target_len, version, version_len);
+        memcpy(prefetch_request + 4 + target_len + version_len, line_end, rest_len);
+        prefetch_request[len] = '\0';
+
+        queue_job(prefetch_request, len);
+        links++;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+
+/* ========== Constants ========== */
+// Prefetches that can be in flight at once (one background thread each)
+#define PREFETCH_MAX_WORKERS 16
+
+// Bytes that may be prefetched per second when -B doesn't say, with up to a second's worth in one burst
+#ifndef PREFETCH_BUDGET
+#define PREFETCH_BUDGET (4 * 1024 * 1024)
+#endif
+
+// Links waiting to be fetched; more are dropped
+#ifndef PREFETCH_QUEUE_SIZE
+#define PREFETCH_QUEUE_SIZE 32
+#endif
+
+// Links taken from any one page
+#ifndef PREFETCH_PAGE_LINKS
+#define PREFETCH_PAGE_LINKS 16
+#endif
+
+// Longest a prefetch may take before it is given up on (ms)
+#ifndef PREFETCH_TIMEOUT_MS
+#define PREFETCH_TIMEOUT_MS 10000
+#endif
+
+// Marks a request made by the prefetcher, so it waits for idle time and its page isn't scanned
+#define PREFETCH_HEADER "X-Htproxy-Prefetch"
+
+/**
+ * @brief Turn on prefetching of links from cached HTML pages
+ *
+ * @param workers Prefetches in flight at once (0 leaves prefetching off)
+ * @param bytes_per_second Bytes per second that may be prefetched (0 keeps the current budget, PREFETCH_BUDGET at first)
+ * @return int 0 on success, -1 if too many workers
+ */
+int prefetch_configure(int workers, size_t bytes_per_second);
+
+/**
+ * @brief Change how many bytes per second may be prefetched
+ *
+ * Safe to call while the prefetch threads run; a burst already saved up is
+ * cut down to the new budget.
+ *
+ * @param bytes_per_second New budget (0 keeps the current one)
+ */
+void prefetch_set_budget(size_t bytes_per_second);
+
+/**
+ * @brief Start the prefetch threads, if prefetching was configured
+ *
+ * Prefetches are made as ordinary requests to the proxy's own port, so they
+ * are cached exactly as a client's request would be.
+ *
+ * @param listen_port Port the proxy listens on
+ * @return int 0 on success (or with prefetching off), -1 on error
+ */
+int prefetch_start(int listen_port);
+
+/**
+ * @brief Check whether prefetching is on
+ *
+ * @return int 1 if it is, 0 otherwise
+ */
+int prefetch_enabled();
+
+/**
+ * @brief Queue the same-host subresources an HTML page links to
+ *
+ * Stylesheets, scripts, images, icons and preloads are requested with the
+ * page request's own headers and only the target changed, which is how the
+ * client will ask for them and so how they are keyed in the cache. Links
+ * that are already cached are skipped. Call from the serving loop.
+ *
+ * @param request Page request as keyed in the cache
+ * @param request_len Length of the request
+ * @param hostname Host header value
+ * @param uri Page request target
+ * @param response Page response, headers and body
+ * @param response_len Length of the response
+ */
+void prefetch_page(const char *request, int request_len, const char *hostname, const char *uri,
+                   const char *response, int response_len);
+
+#endif /* PREFETCH_H */
@@ -3,16 +3,279 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <poll.h>
 
 #include "proxy.h"
 #include "http.h"
 #include "cache.h"
 #include "socket.h"
+#include "io.h"
+#include "timer.h"
+#include "buffer.h"
+#include "tunnel.h"
+#include "stats.h"
+#include "log.h"
+#include "h2.h"
+#include "cluster.h"
+#include "dispatch.h"
+#include "prefetch.h"
 
 // Using global cache flag from main.c
 
+// Sent when the origin never starts answering
+static const char gateway_timeout_response[] =
+    "HTTP/1.1 504 Gateway Timeout\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// Sent when the origin can't be resolved or connected to
+static const char bad_gateway_response[] =
+    "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// The request being handled was made by the prefetcher
+static int serving_prefetch;
+
+// Tunables, changed at runtime by the config file
+static int first_byte_timeout_ms = FIRST_BYTE_TIMEOUT_MS;
+static int body_idle_timeout_ms = BODY_IDLE_TIMEOUT_MS;
+static int max_object_size = MAX_RESPONSE_SIZE;
+static size_t client_buffer_cap = CLIENT_BUFFER_MEM_CAP;
+
+// Sent when admission control turns a request away
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+static const char service_unavailable_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " TOSTRING(DISPATCH_RETRY_AFTER)
+    "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+/**
+ * @brief Send a cache hit in the encoding the client accepts
+ * 
+ * The entry's headers and its (possibly shared) body go out together.
+ * Compressed bodies go out as stored to clients accepting gzip and are
+ * decompressed for everyone else; either way the headers are rewritten to
+ * say the response varies on Accept-Encoding. A client that stops reading
+ * for the body idle timeout is given up on, as on a miss.
+ * 
+ * @param client_socket Socket connected to client
+ * @param entry Fresh cache entry
+ * @param headers Request headers
+ * @param header_count Number of request headers
+ * @return ssize_t Bytes sent, or -1 on error
+ */
+static ssize_t send_cached_response(int client_socket, const cache_entry *entry,
+                                    char **headers, int header_count) {
+    const char *body = entry->body ? entry->body->data : "";
+    int body_len = entry->body ? entry->body->size : 0;
+    char header_block[BUFFER_SIZE * 4];
+    char *decoded = NULL;
+    
+    struct iovec iov[2] = {
+        {.iov_base = entry->headers, .iov_len = entry->header_len},
+        {.iov_base = (void *)body, .iov_len = body_len},
+    };
+    
+    if (entry->encoding != CACHE_ENCODING_IDENTITY) {
+        if (accepts_encoding(headers, header_count, "gzip")) {
+            int header_len = rewrite_encoded_headers(entry->headers, entry->header_len, "gzip",
+                                                     body_len, header_block, sizeof(header_block));
+            if (header_len < 0) {
+                return -1;
+            }
+            iov[0].iov_base = header_block;
+            iov[0].iov_len = header_len;
+        } else {
+            int decoded_len = entry->identity_size - entry->header_len;
+            decoded = malloc(decoded_len);
+            if (!decoded || cache_decode_body(entry, decoded, decoded_len) != decoded_len) {
+                fprintf(stderr, "Failed to decompress cached %s\n", entry->uri);
+                free(decoded);
+                return -1;
+            }
+            int header_len = rewrite_encoded_headers(entry->headers, entry->header_len, NULL,
+                                                     decoded_len, header_block, sizeof(header_block));
+            if (header_len < 0) {
+                free(decoded);
+                return -1;
+            }
+            iov[0].iov_base = header_block;
+            iov[0].iov_len = header_len;
+            iov[1].iov_base = decoded;
+            iov[1].iov_len = decoded_len;
+        }
+    }
+    
+    // Large bodies still go out zero-copy, behind the headers
+    int zerocopy = 0;
+#ifdef HAVE_MSG_ZEROCOPY
+    zerocopy = iov[1].iov_len >= IO_ZEROCOPY_MIN;
+#endif
+    
+    timer_entry deadline = {0};
+    timer_arm(&deadline, body_idle_timeout_ms, NULL, NULL);
+    
+    ssize_t sent;
+    if (zerocopy) {
+        sent = io_send(client_socket, iov[0].iov_base, iov[0].iov_len, &deadline);
+        if (sent >= 0) {
+            timer_arm(&deadline, body_idle_timeout_ms, NULL, NULL);
+            ssize_t body_sent = io_send_zerocopy(client_socket, iov[1].iov_base, iov[1].iov_len, &deadline);
+            sent = body_sent < 0 ? -1 : sent + body_sent;
+            if (body_sent < 0) {
+                // The kernel may still hold body pages the cache is about to reuse;
+                // reset on close so none of them are sent after this
+                struct linger abort_on_close = {.l_onoff = 1, .l_linger = 0};
+                setsockopt(client_socket, SOL_SOCKET, SO_LINGER, &abort_on_close, sizeof(abort_on_close));
+            }
+        }
+    } else {
+        sent = io_sendv(client_socket, iov, 2, &deadline);
+    }
+    timer_cancel(&deadline);
+    free(decoded);
+    
+    if (sent > 0) {
+        stats_add(STAT_BYTES_FROM_CACHE, sent);
+    }
+    return sent;
+}
+
+/**
+ * @brief Remove a marker header the proxy's own requests carry (cluster peer, prefetcher)
+ * 
+ * @param headers Request headers
+ * @param header_count Number of request headers, reduced if the header was there
+ * @param name Header name
+ * @return int 1 if the header was there, 0 otherwise
+ */
+static int take_marker_header(char **headers, int *header_count, const char *name) {
+    size_t len = strlen(name);
+    for (int i = 1; i < *header_count; i++) {
+        if (strncasecmp(headers[i], name, len) == 0 && headers[i][len] == ':') {
+            free(headers[i]);
+            memmove(&headers[i], &headers[i + 1], (*header_count - i - 1) * sizeof(char *));
+            (*header_count)--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Send a request's headers upstream as one vectored write
+ * 
+ * Each header line, its \r\n, then the final \r\n ending the headers.
+ * 
+ * @param server_socket Socket connected upstream
+ * @param headers Request headers
+ * @param header_count Number of request headers
+ * @param extra Header line to add, or NULL
+ * @return int 0 on success, -1 on error
+ */
+static int send_request(int server_socket, char **headers, int header_count, const char *extra) {
+    struct iovec request_iov[2 * MAX_HEADERS + 3];
+    int iov_count = 0;
+    for (int i = 0; i < header_count; i++) {
+        request_iov[iov_count].iov_base = headers[i];
+        request_iov[iov_count].iov_len = strlen(headers[i]);
+        iov_count++;
+        request_iov[iov_count].iov_base = (void *)"\r\n";
+        request_iov[iov_count].iov_len = 2;
+        iov_count++;
+    }
+    if (extra) {
+        request_iov[iov_count].iov_base = (void *)extra;
+        request_iov[iov_count].iov_len = strlen(extra);
+        iov_count++;
+        request_iov[iov_count].iov_base = (void *)"\r\n";
+        request_iov[iov_count].iov_len = 2;
+        iov_count++;
+    }
+    request_iov[iov_count].iov_base = (void *)"\r\n";
+    request_iov[iov_count].iov_len = 2;
+    iov_count++;
+
+    return io_sendv(server_socket, request_iov, iov_count, NULL) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Serve one queued connection start to finish, then close it unless it became a tunnel
+ * 
+ * @param client_socket Socket connected to client
+ * @param accepted_us When it was accepted (stats_now_us())
+ */
+void serve_client(int client_socket, uint64_t accepted_us) {
+    stats_request_begin_at(accepted_us);
+    
+    // Peer requests served while this one waits have their own
+    int outer_prefetch = serving_prefetch;
+    serving_prefetch = 0;
+    int result = handle_client_request(client_socket);
+    if (result < 0) {
+        fprintf(stderr, "Failed to handle client request\n");
+    }
+    serving_prefetch = outer_prefetch;
+    
+    stats_request_end();
+    
+    // A tunnel's relay thread closes the connection when the tunnel ends
+    if (result != 1) {
+        stats_add(STAT_ACTIVE_CONNECTIONS, -1);
+        close(client_socket);
+    }
+}
+
+/**
+ * @brief Turn away a queued connection admission control shed, then close it
+ * 
+ * @param client_socket Socket connected to client
+ */
+void shed_client(int client_socket) {
+    // Take the request off the socket, so closing it doesn't reset the connection under the 503
+    char discard[MAX_REQUEST_SIZE];
+    if (recv(client_socket, discard, sizeof(discard), MSG_DONTWAIT) < 0 && errno != EAGAIN) {
+        close(client_socket);
+        stats_add(STAT_ACTIVE_CONNECTIONS, -1);
+        return;
+    }
+    
+    io_send(client_socket, service_unavailable_response, sizeof(service_unavailable_response) - 1, NULL);
+    
+    stats_add(STAT_ACTIVE_CONNECTIONS, -1);
+    close(client_socket);
+}
+
+/**
+ * @brief Change how long origins may take to answer
+ *
+ * @param first_byte_ms Time allowed for the origin to start answering (0 keeps the current value)
+ * @param body_idle_ms Longest the origin may stall mid-response (0 keeps the current value)
+ */
+void set_origin_timeouts(int first_byte_ms, int body_idle_ms) {
+    if (first_byte_ms > 0) {
+        first_byte_timeout_ms = first_byte_ms;
+    }
+    if (body_idle_ms > 0) {
+        body_idle_timeout_ms = body_idle_ms;
+    }
+}
+
+/**
+ * @brief Change the largest cacheable object and the per-client buffer cap
+ *
+ * @param max_object Largest body cached, at most MAX_RESPONSE_SIZE (0 keeps the current value)
+ * @param client_buffer Response bytes held in memory per client before spilling (0 keeps the current value)
+ */
+void set_relay_limits(int max_object, size_t client_buffer) {
+    if (max_object > 0) {
+        max_object_size = max_object < MAX_RESPONSE_SIZE ? max_object : MAX_RESPONSE_SIZE;
+    }
+    if (client_buffer > 0) {
+        client_buffer_cap = client_buffer;
+    }
+}
+
 /**
  * @brief Handle client request 
  * 
@@ -26,7 +289,13 @@ int handle_client_request(int client_socket) {
     char *hostname = NULL;
     
     // Read HTTP headers
-    if (read_http_headers(client_socket, &headers, &header_count) < 0) {
+    PHASE_BEGIN(PHASE_HEADERS);
+    int header_result = read_http_headers(client_socket, &headers, &header_count);
+    PHASE_END(PHASE_HEADERS);
+    if (header_result < 0) {
+        if (errno == ETIMEDOUT) {
+            fprintf(stderr, "Timed out reading headers\n");
+        }
         fprintf(stderr, "Failed to read headers\n");
         return -1;
     }
@@ -36,16 +305,39 @@ int handle_client_request(int client_socket) {
         free_headers(headers, header_count);
         return -1;
     }
+    stats_add(STAT_REQUESTS, 1);
+    
+    // Requests from cluster peers are never forwarded again, and keyed as the client sent them;
+    // the marker is dropped unheeded from anyone else
+    int from_peer = take_marker_header(headers, &header_count, CLUSTER_PEER_HEADER) &&
+                    cluster_is_peer(client_socket);
+    if (from_peer) {
+        stats_add(STAT_PEER_REQUESTS, 1);
+    }
+    
+    // Prefetched pages are cached, but not scanned for links again
+    serving_prefetch = take_marker_header(headers, &header_count, PREFETCH_HEADER);
     
     // Parse request line (first header)
     parse_request_line(headers[0], method, uri, version);
 
+    // CONNECT opens a raw tunnel instead of a request/response exchange
+    if (strcasecmp(method, "CONNECT") == 0) {
+        PHASE_DESCRIBE(method, NULL, uri);
+        PHASE_OUTCOME("tunnel");
+        int result = run_tunnel(client_socket, uri);
+        free_headers(headers, header_count);
+        return result;
+    }
+
     hostname = find_host_header(headers, header_count);
     if (!hostname) {
         fprintf(stderr, "No Host header found\n");
         free_headers(headers, header_count);
         return -1;
     }
+    PHASE_DESCRIBE(method, hostname, uri);
+    PHASE_OUTCOME("pass");
 
     // Do not cache non-GET methods
     if (strcasecmp(method, "GET") != 0) {
@@ -54,8 +346,7 @@ int handle_client_request(int client_socket) {
 
     // Log request tail (last header line)
     if (header_count > 0) {
-        printf("Request tail %s\n", headers[header_count - 1]);
-        fflush(stdout);
+        log_event(LOG_REQUEST_TAIL, headers[header_count - 1], NULL, 0, 0);
     }
     
     // Build complete request string for cache lookup
@@ -70,24 +361,20 @@ int handle_client_request(int client_socket) {
         cache_entry *entry = find_in_cache(request_buffer, request_len);
         
         if (entry) {
-            int is_stale = 0;
-            
-            // Only check expiration if max-age was specified
-            if (entry->has_max_age) {
-                time_t age = time(NULL) - entry->cached_time;
-                if (age > entry->max_age) {
-                    is_stale = 1;
-                }
-            }
-            // If no max-age, entry is always fresh
-            
-            if (!is_stale) {
+            // Only entries with a max-age can go stale
+            if (!cache_entry_stale(entry)) {
                 // Serve from cache
-                printf("Serving %s %s from cache\n", entry->host, entry->uri);
-                fflush(stdout);
+                log_event(LOG_SERVING, entry->host, entry->uri, 0, 0);
                 move_to_front(entry);
                 
-                if (send(client_socket, entry->response, entry->response_size, 0) < 0) {
+                stats_add(STAT_CACHE_HITS, 1);
+                stats_first_byte();
+                PHASE_OUTCOME("hit");
+                
+                PHASE_BEGIN(PHASE_CLIENT_SEND);
+                ssize_t sent = send_cached_response(client_socket, entry, headers, header_count);
+                PHASE_END(PHASE_CLIENT_SEND);
+                if (sent < 0) {
                     free_headers(headers, header_count);
                     return -1;
                 }
@@ -96,14 +383,17 @@ int handle_client_request(int client_socket) {
                 return 0;
             } else {
                 // Entry is stale
-                printf("Stale entry for %s %s\n", entry->host, entry->uri);
-                fflush(stdout);
+                log_event(LOG_STALE, entry->host, entry->uri, 0, 0);
+                stats_add(STAT_STALE_HITS, 1);
+                PHASE_OUTCOME("stale");
                 stale = 1;
                 // Continue to fetch fresh copy
             }
         }
         else{
-            if (cache.count == CACHE_SIZE) {
+            stats_add(STAT_CACHE_MISSES, 1);
+            PHASE_OUTCOME("miss");
+            if (cache.count >= cache.capacity) {
                 entry = evict_lru();
             }
         }
@@ -111,28 +401,58 @@ int handle_client_request(int client_socket) {
     
     proxy_request:        
         // Log what we're forwarding
-        printf("GETting %s %s\n", hostname, uri);
-        fflush(stdout);
+        log_event(LOG_GETTING, hostname, uri, 0, 0);
+        
+        // An origin that just failed fails again without another lookup or connect
+        if (g_cache_enabled && cache_origin_failed(hostname)) {
+            stats_add(STAT_NEGATIVE_HITS, 1);
+            PHASE_OUTCOME("negative");
+            io_send(client_socket, bad_gateway_response, sizeof(bad_gateway_response) - 1, NULL);
+            free_headers(headers, header_count);
+            return -1;
+        }
+        
+        // Misses another node owns go to it, so the cluster fetches each object from the origin once
+        const char *owner = NULL;
+        if (strcasecmp(method, "GET") == 0 && !from_peer) {
+            owner = cluster_owner(hostname, uri);
+        }
+        if (owner) {
+            int peer_result = forward_peer(client_socket, owner, headers, header_count, request_buffer,
+                                           request_len, hostname, uri, stale);
+            if (peer_result != PEER_UNREACHABLE) {
+                free_headers(headers, header_count);
+                return peer_result;
+            }
+        }
+        
+        // GETs to h2c origins go as a stream on a pooled connection,
+        // falling back to HTTP/1.1 if the origin turns out not to speak it
+        int h2_result = H2_UNSUPPORTED;
+        if (strcasecmp(method, "GET") == 0 && h2_origin_enabled(hostname)) {
+            h2_result = forward_h2(client_socket, headers, header_count, request_buffer, request_len,
+                                   hostname, uri, stale);
+            if (h2_result == 0 || h2_result == -1) {
+                free_headers(headers, header_count);
+                return h2_result;
+            }
+        }
         
         // Connect to server and proxy the request
-        int server_socket = connect_to_server(hostname);
+        int server_socket = h2_result == H2_UNREACHABLE ? -1 : connect_to_server(hostname);
         if (server_socket < 0) {
             fprintf(stderr, "Failed to connect to %s\n", hostname);
+            stats_add(STAT_ORIGIN_FAILURES, 1);
+            if (g_cache_enabled) {
+                cache_origin_failure(hostname);
+            }
+            io_send(client_socket, bad_gateway_response, sizeof(bad_gateway_response) - 1, NULL);
             free_headers(headers, header_count);
             return -1;
         }
         
         // Forward original request to server
-        for (int i = 0; i < header_count; i++) {
-            if (send(server_socket, headers[i], strlen(headers[i]), 0) < 0 ||
-                send(server_socket, "\r\n", 2, 0) < 0) {
-                close(server_socket);
-                free_headers(headers, header_count);
-                return -1;
-            }
-        }
-        // Send final \r\n to end headers
-        if (send(server_socket, "\r\n", 2, 0) < 0) {
+        if (send_request(server_socket, headers, header_count, NULL) < 0) {
             close(server_socket);
             free_headers(headers, header_count);
             return -1;
@@ -147,29 +467,253 @@ int handle_client_request(int client_socket) {
 }
 
 /**
- * @brief Forward response from server to client
+ * @brief Send everything still buffered to the client
  * 
- * @param server_socket Socket connected to origin server
  * @param client_socket Socket connected to client
- * @param request Complete request string (for caching)
- * @param request_len Length of request
- * @param hostname Hostname of the server
- * @param uri URI being requested
- * @param stale Whether this is replacing a stale cache entry
+ * @param pending Buffered response bytes
+ * @param deadline Re-armed for the body idle timeout whenever the client makes progress
  * @return int 0 on success, -1 on error
  */
-int forward_response(int server_socket, int client_socket, const char *request, 
-                    int request_len, const char *hostname, const char *uri, int stale) {
-    char buffer[BUFFER_SIZE * 2];
-    int content_length = -1;
+static int drain_to_client(int client_socket, client_buffer *pending, timer_entry *deadline) {
+    timer_arm(deadline, body_idle_timeout_ms, NULL, NULL);
+    
+    while (client_buffer_pending(pending) > 0) {
+        if (io_wait(client_socket, POLLOUT, deadline) < 0) {
+            return -1;
+        }
+        
+        ssize_t sent = flush_client_buffer(pending, client_socket);
+        if (sent < 0) {
+            return -1;
+        }
+        if (sent > 0) {
+            timer_arm(deadline, body_idle_timeout_ms, NULL, NULL);
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Response on its way from an origin to the client (and possibly the cache)
+ */
+typedef struct {
+    int client_socket;
+    const char *request;            // Complete request string (cache key)
+    int request_len;
+    const char *hostname;
+    const char *uri;
+    int stale;                      // Replacing a stale cache entry
+    int via_peer;                   // Relayed from the cluster peer that owns (and caches) it
+    timer_entry *deadline;
+
+    int started;                    // relay_begin() ran; relay_end() must follow
+    client_buffer pending;          // Bytes the client has yet to take
+    int content_length;             // -1 if the origin sent none
+    int remaining;                  // Body bytes still expected, -1 until the origin closes
+
+    int should_cache;
+    uint32_t max_age;
+    int has_max_age;
+    char *response_buffer;          // Copy being collected for the cache
+    int response_size;
+} relay_state;
+
+/**
+ * @brief Find the Content-Length of a response header block
+ * 
+ * @param header_block Response headers, NUL-terminated
+ * @return int Length, or -1 if there is none
+ */
+static int response_content_length(const char *header_block) {
+    char *cl_pos = strstr(header_block, "Content-Length:");
+    if (!cl_pos) {
+        cl_pos = strstr(header_block, "content-length:");
+    }
+    return cl_pos ? atoi(cl_pos + 15) : -1;
+}
+
+/**
+ * @brief Start relaying once the response headers are in
+ * 
+ * Decides whether the response gets cached and queues the headers for the client.
+ * 
+ * @param relay Relay with its request fields filled in
+ * @param header_block Response headers ending with the blank line, NUL-terminated
+ * @param header_len Length of the headers
+ * @return int 0 on success, -1 on error (relay_end() still cleans up)
+ */
+static int relay_begin(relay_state *relay, const char *header_block, int header_len) {
+    relay->started = 1;
+    relay->content_length = response_content_length(header_block);
+    log_event(LOG_BODY_LENGTH, NULL, NULL, relay->content_length >= 0 ? relay->content_length : 0, 0);
+    
+    // Check if we should cache this response
+    relay->should_cache = 0;
+    int basic_cacheable = (g_cache_enabled && !relay->via_peer && relay->request_len < MAX_REQUEST_SIZE && 
+                          relay->content_length >= 0 && 
+                          relay->content_length <= max_object_size);
+    relay->max_age = 0; 
+    relay->has_max_age = 0;
+    if (basic_cacheable) {
+        relay->should_cache = should_cache_response(header_block, &relay->max_age, &relay->has_max_age);
+        if (!relay->should_cache) {
+            // Log that we're not caching due to Cache-Control
+            log_event(LOG_NOT_CACHING, relay->hostname, relay->uri, 0, 0);
+        }
+    }
+    
+    // Errors (404/410/5xx by default) are only cached briefly, if at all
+    int error_ttl = negative_ttl(parse_status_code(header_block));
+    if (relay->should_cache && error_ttl == 0) {
+        relay->should_cache = 0;
+    } else if (relay->should_cache && error_ttl > 0 &&
+               (!relay->has_max_age || relay->max_age > (uint32_t)error_ttl)) {
+        relay->max_age = error_ttl;
+        relay->has_max_age = 1;
+    }
+
+    // Prepare for possible caching
+    relay->response_buffer = NULL;
+    relay->response_size = header_len;
+    
+    if (relay->should_cache) {
+        // Allocate buffer for the complete response
+        relay->response_buffer = malloc(MAX_RESPONSE_SIZE);
+        if (relay->response_buffer) {
+            // Copy headers to response buffer
+            memcpy(relay->response_buffer, header_block, header_len);
+        } else {
+            relay->should_cache = 0; 
+        }
+    }
+    
+    // Everything for the client goes through a bounded buffer, so a slow
+    // client never throttles how fast we read from the origin
+    init_client_buffer(&relay->pending, client_buffer_cap);
+    
+    int result = append_to_client_buffer(&relay->pending, header_block, header_len);
+    stats_add(STAT_BYTES_FROM_ORIGIN, header_len);
+    stats_first_byte();
+    
+    relay->remaining = relay->content_length;
+    return result;
+}
+
+/**
+ * @brief Pass on a piece of the response body
+ * 
+ * @param relay Relay started with relay_begin()
+ * @param data Body bytes
+ * @param bytes Number of bytes
+ * @return int 0 on success, -1 on error
+ */
+static int relay_body(relay_state *relay, const char *data, int bytes) {
+    // Add to response buffer if caching
+    if (relay->response_buffer && relay->response_size + bytes <= MAX_RESPONSE_SIZE) {
+        memcpy(relay->response_buffer + relay->response_size, data, bytes);
+        relay->response_size += bytes;
+    } else {
+        relay->should_cache = 0; // Response too large to cache
+    }
+    
+    int result = append_to_client_buffer(&relay->pending, data, bytes);
+    stats_add(STAT_BYTES_FROM_ORIGIN, bytes);
+    
+    if (relay->remaining > 0) {
+        relay->remaining -= bytes;
+    }
+    return result;
+}
+
+/**
+ * @brief Finish a relay once the origin is done with: cache the response and drain the client
+ * 
+ * @param relay Relay started with relay_begin()
+ * @param result Outcome of relaying from the origin
+ * @return int 0 on success, -1 on error
+ */
+static int relay_end(relay_state *relay, int result) {
+    if (client_buffer_pending(&relay->pending) > 0) {
+        stats_add(STAT_EARLY_RELEASES, 1);
+    }
+    
+    if (result < 0) {
+        free_client_buffer(&relay->pending);
+        if (relay->response_buffer) free(relay->response_buffer);
+        return -1;
+    }
+    
+    // Without Content-Length the body runs until the origin closes, and only
+    // a complete body is worth caching
+    if (relay->content_length < 0 || relay->remaining > 0) {
+        relay->should_cache = 0;
+    }
+    
+    if (relay->stale) {
+        if (!relay->should_cache) {
+            evict_entry(relay->request, 1);
+        }
+        else {
+            evict_entry(relay->request, 0);
+        }
+    }
+     
+    // Add to cache if we should cache (Stage 3: only if Cache-Control allows it)
+    if (relay->should_cache && relay->response_buffer && relay->request_len < MAX_REQUEST_SIZE &&
+        relay->response_size <= MAX_RESPONSE_SIZE) {
+        add_to_cache(relay->request, relay->request_len, relay->response_buffer, relay->response_size,
+                     relay->hostname, relay->uri, relay->max_age, relay->has_max_age);
+        
+        // Warm what the page will ask for next while the client is still reading it
+        if (!serving_prefetch) {
+            prefetch_page(relay->request, relay->request_len, relay->hostname, relay->uri,
+                          relay->response_buffer, relay->response_size);
+        }
+    }
+
+    if (relay->response_buffer) {
+        free(relay->response_buffer);
+    }
+    
+    PHASE_BEGIN(PHASE_CLIENT_SEND);
+    result = drain_to_client(relay->client_socket, &relay->pending, relay->deadline);
+    PHASE_END(PHASE_CLIENT_SEND);
+    free_client_buffer(&relay->pending);
+    return result;
+}
+
+/**
+ * @brief Relay response from server to client under an origin deadline
+ * 
+ * @param server_socket Socket connected to origin server
+ * @param relay Relay with its request fields filled in
+ * @return int 0 on success, -1 on error
+ */
+static int relay_response(int server_socket, relay_state *relay) {
+    char *buffer = io_buffer();
     int headers_complete = 0;
     int total_received = 0;
     char header_buffer[BUFFER_SIZE * 4] = {0};
     
     // Read response headers first
     while (!headers_complete && total_received < (int)(sizeof(header_buffer) - 1)) {
-        int bytes = recv(server_socket, buffer, 1, 0);
-        if (bytes <= 0) return -1;
+        int bytes = io_recv(server_socket, buffer, 1, relay->deadline);
+        if (bytes <= 0) {
+            if (bytes < 0 && errno == ETIMEDOUT && total_received == 0) {
+                fprintf(stderr, "Timed out waiting for %s\n", relay->hostname);
+                io_send(relay->client_socket, gateway_timeout_response,
+                        sizeof(gateway_timeout_response) - 1, NULL);
+            }
+            return -1;
+        }
+        
+        // Origin answered, from here on only stalls count
+        if (total_received == 0) {
+            timer_arm(relay->deadline, body_idle_timeout_ms, NULL, NULL);
+            PHASE_END(PHASE_ORIGIN_WAIT);
+            PHASE_BEGIN(PHASE_ORIGIN_TRANSFER);
+        }
         
         header_buffer[total_received] = buffer[0];
         total_received++;
@@ -178,116 +722,290 @@ int forward_response(int server_socket, int client_socket, const char *request,
         if (total_received >= 4 && 
             strncmp(header_buffer + total_received - 4, "\r\n\r\n", 4) == 0) {
             headers_complete = 1;
-            
-            // Look for Content-Length in headers
-            char *cl_pos = strstr(header_buffer, "Content-Length:");
-            if (!cl_pos) {
-                cl_pos = strstr(header_buffer, "content-length:");
-            }
-            if (cl_pos) {
-                content_length = atoi(cl_pos + 15);
-                printf("Response body length %d\n", content_length); 
-                fflush(stdout);
-            } else {
-                printf("Response body length 0\n");
-                fflush(stdout);
+        }
+    }
+    
+    int result = relay_begin(relay, header_buffer, total_received);
+    
+    while (result == 0 && relay->remaining != 0) {
+        struct pollfd fds[2] = {
+            {.fd = server_socket, .events = POLLIN},
+            {.fd = relay->client_socket, .events = client_buffer_pending(&relay->pending) ? POLLOUT : 0},
+        };
+        
+        int timeout_ms = timer_remaining(relay->deadline);
+        if (timeout_ms == 0) {
+            fprintf(stderr, "Timed out relaying from %s\n", relay->hostname);
+            result = -1;
+            break;
+        }
+        
+        if (poll(fds, 2, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        
+        // Push whatever the client will take right now
+        if (fds[1].revents) {
+            if (flush_client_buffer(&relay->pending, relay->client_socket) < 0) {
+                result = -1;
+                break;
             }
         }
+        
+        if (!fds[0].revents) {
+            continue;
+        }
+        
+        int remaining = relay->remaining;
+        int to_read = (remaining > 0 && remaining < BUFFER_SIZE) ? remaining : BUFFER_SIZE;
+        int bytes = io_recv(server_socket, buffer, to_read, NULL);
+        if (bytes <= 0) break;
+        timer_arm(relay->deadline, body_idle_timeout_ms, NULL, NULL);
+        
+        result = relay_body(relay, buffer, bytes);
     }
     
-    // Send headers to client
-    if (send(client_socket, header_buffer, total_received, 0) < 0) {
+    // Origin is finished with, release it before the client catches up
+    shutdown(server_socket, SHUT_RDWR);
+    PHASE_END(PHASE_ORIGIN_TRANSFER);
+    return relay_end(relay, result);
+}
+
+/**
+ * @brief Response headers from an h2c origin, already translated to HTTP/1.1
+ * 
+ * @param ctx relay_state
+ * @param block Status line and headers
+ * @param len Length of the block
+ * @return int 0 on success, -1 on error
+ */
+static int h2_relay_headers(void *ctx, const char *block, int len) {
+    relay_state *relay = ctx;
+    
+    // Origin answered, from here on only stalls count
+    timer_arm(relay->deadline, body_idle_timeout_ms, NULL, NULL);
+    PHASE_END(PHASE_ORIGIN_WAIT);
+    PHASE_BEGIN(PHASE_ORIGIN_TRANSFER);
+    
+    return relay_begin(relay, block, len);
+}
+
+/**
+ * @brief Body bytes from an h2c origin
+ * 
+ * @param ctx relay_state
+ * @param data Body bytes
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on error
+ */
+static int h2_relay_data(void *ctx, const char *data, int len) {
+    relay_state *relay = ctx;
+    timer_arm(relay->deadline, body_idle_timeout_ms, NULL, NULL);
+    
+    if (relay_body(relay, data, len) < 0) {
         return -1;
     }
     
-    // Check if we should cache this response
-    int should_cache = 0;
-    int basic_cacheable = (g_cache_enabled && request_len < MAX_REQUEST_SIZE && 
-                          content_length >= 0 && 
-                          content_length <= MAX_RESPONSE_SIZE);
-    uint32_t max_age = 0; 
-    int has_max_age = 0;
-    if (basic_cacheable) {
-        should_cache = should_cache_response(header_buffer, &max_age, &has_max_age);
-        if (!should_cache) {
-            // Log that we're not caching due to Cache-Control
-            printf("Not caching %s %s\n", hostname, uri);
-            fflush(stdout);
-        }
+    // Push whatever the client will take right now
+    if (client_buffer_pending(&relay->pending) > 0 &&
+        flush_client_buffer(&relay->pending, relay->client_socket) < 0) {
+        return -1;
     }
+    return 0;
+}
 
-    // Prepare for possible caching
-    char *response_buffer = NULL;
-    int response_size = total_received;
+/**
+ * @brief Fetch a GET as a stream on a pooled h2c connection and relay the response
+ * 
+ * @param client_socket Socket connected to client
+ * @param headers Request headers
+ * @param header_count Number of request headers
+ * @param request Complete request string (for caching)
+ * @param request_len Length of request
+ * @param hostname Hostname of the server
+ * @param uri URI being requested
+ * @param stale Whether this is replacing a stale cache entry
+ * @return int 0 on success, -1 on error, or H2_UNSUPPORTED / H2_UNREACHABLE when
+ *             nothing was sent to the client
+ */
+int forward_h2(int client_socket, char **headers, int header_count, const char *request,
+               int request_len, const char *hostname, const char *uri, int stale) {
+    timer_entry deadline = {0};
+    timer_arm(&deadline, first_byte_timeout_ms, NULL, NULL);
+    PHASE_BEGIN(PHASE_ORIGIN_WAIT);
     
-    if (should_cache) {
-        // Allocate buffer for the complete response
-        response_buffer = malloc(MAX_RESPONSE_SIZE);
-        if (response_buffer) {
-            // Copy headers to response buffer
-            memcpy(response_buffer, header_buffer, total_received);
-        } else {
-            should_cache = 0; 
-        }
+    relay_state relay = {
+        .client_socket = client_socket,
+        .request = request,
+        .request_len = request_len,
+        .hostname = hostname,
+        .uri = uri,
+        .stale = stale,
+        .deadline = &deadline,
+    };
+    h2_sink sink = {h2_relay_headers, h2_relay_data, &relay};
+    
+    int result = h2_fetch(hostname, headers, header_count, &sink, &deadline);
+    if (relay.started) {
+        PHASE_END(PHASE_ORIGIN_TRANSFER);
+        result = relay_end(&relay, result < 0 ? -1 : 0);
+    } else if (result == -1 && errno == ETIMEDOUT) {
+        fprintf(stderr, "Timed out waiting for %s\n", hostname);
+        io_send(client_socket, gateway_timeout_response, sizeof(gateway_timeout_response) - 1, NULL);
     }
     
-    // Forward response body if Content-Length specified
-    if (content_length > 0) {
-        int remaining = content_length;
-        while (remaining > 0) {
-            int to_read = (remaining < BUFFER_SIZE) ? remaining : BUFFER_SIZE;
-            int bytes = recv(server_socket, buffer, to_read, 0);
-            if (bytes <= 0) break;
-            
-            if (send(client_socket, buffer, bytes, 0) < 0) {
-                if (response_buffer) free(response_buffer);
-                return -1;
-            }
-            
-            // Add to response buffer if caching
-            if (should_cache && response_buffer && response_size + bytes <= MAX_RESPONSE_SIZE) {
-                memcpy(response_buffer + response_size, buffer, bytes);
-                response_size += bytes;
-            } else if (should_cache) {
-                should_cache = 0; // Response too large to cache
-            }
-            
-            remaining -= bytes;
+    timer_cancel(&deadline);
+    return result;
+}
+
+/**
+ * @brief Forward response from server to client
+ * 
+ * @param server_socket Socket connected to origin server
+ * @param client_socket Socket connected to client
+ * @param request Complete request string (for caching)
+ * @param request_len Length of request
+ * @param hostname Hostname of the server
+ * @param uri URI being requested
+ * @param stale Whether this is replacing a stale cache entry
+ * @return int 0 on success, -1 on error
+ */
+int forward_response(int server_socket, int client_socket, const char *request, 
+                    int request_len, const char *hostname, const char *uri, int stale) {
+    timer_entry deadline = {0};
+    timer_arm(&deadline, first_byte_timeout_ms, NULL, NULL);
+    PHASE_BEGIN(PHASE_ORIGIN_WAIT);
+    
+    relay_state relay = {
+        .client_socket = client_socket,
+        .request = request,
+        .request_len = request_len,
+        .hostname = hostname,
+        .uri = uri,
+        .stale = stale,
+        .deadline = &deadline,
+    };
+    int result = relay_response(server_socket, &relay);
+    
+    timer_cancel(&deadline);
+    return result;
+}
+
+/**
+ * @brief Wait for a peer to start answering, serving what peers forward to us meanwhile
+ * 
+ * Nodes serve one request at a time, so two nodes forwarding to each other
+ * would otherwise both stall until the deadline. Peer requests are never
+ * forwarded again, so this nests one level at most.
+ * 
+ * @param peer_socket Socket connected to the peer
+ * @param deadline Bounds the wait
+ * @return int 0 once the peer has sent something, -1 on expiry (errno ETIMEDOUT),
+ *             if it closed without answering, or on error
+ */
+static int wait_for_peer(int peer_socket, timer_entry *deadline) {
+    while (1) {
+        dispatch_accept(0);
+        dispatch_classify();
+        
+        dispatch_client client;
+        while (dispatch_next_peer(&client) == 0) {
+            stats_request_suspend();
+            serve_client(client.socket, client.accepted_us);
+            stats_request_resume();
+        }
+        
+        struct pollfd fds[2] = {
+            {.fd = peer_socket, .events = POLLIN},
+            {.fd = io_accept_fd(dispatch_listener()), .events = POLLIN},
+        };
+        
+        int timeout_ms = timer_remaining(deadline);
+        if (timeout_ms == 0) {
+            errno = ETIMEDOUT;
+            return -1;
         }
-    } else if (content_length < 0) {
-        // No Content-Length header, read until connection closes
-        // We won't cache these responses
-        should_cache = 0;
-        if (response_buffer) {
-            free(response_buffer);
-            response_buffer = NULL;
+        // Queued connections still sending their headers may turn out to be peers
+        if (dispatch_unclassified() && timeout_ms > 1) {
+            timeout_ms = 1;
         }
         
-        int bytes;
-        while ((bytes = recv(server_socket, buffer, BUFFER_SIZE, 0)) > 0) {
-            if (send(client_socket, buffer, bytes, 0) < 0) {
-                return -1;
+        if (poll(fds, 2, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        
+        if (fds[0].revents) {
+            char byte;
+            ssize_t n = recv(peer_socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n > 0) {
+                return 0;
             }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                continue;
+            }
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
         }
     }
-    
-    if (stale) {
-        if (!should_cache) {
-            evict_entry(request, 1);
-        }
-        else {
-            evict_entry(request, 0);
-        }
+}
+
+/**
+ * @brief Fetch a miss through the cluster peer that owns it
+ * 
+ * @param client_socket Socket connected to client
+ * @param peer Owning peer's address
+ * @param headers Request headers
+ * @param header_count Number of request headers
+ * @param request Complete request string
+ * @param request_len Length of request
+ * @param hostname Hostname of the server
+ * @param uri URI being requested
+ * @param stale Whether this is replacing a stale cache entry
+ * @return int 0 on success, -1 on error, or PEER_UNREACHABLE when nothing was sent to the client
+ */
+int forward_peer(int client_socket, const char *peer, char **headers, int header_count,
+                 const char *request, int request_len, const char *hostname, const char *uri, int stale) {
+    int peer_socket = connect_to_server(peer);
+    if (peer_socket < 0) {
+        cluster_peer_failed(peer);
+        return PEER_UNREACHABLE;
     }
-     
-    // Add to cache if we should cache (Stage 3: only if Cache-Control allows it)
-    if (should_cache && response_buffer && request_len < MAX_REQUEST_SIZE && response_size <= MAX_RESPONSE_SIZE) {
-        add_to_cache(request, request_len, response_buffer, response_size, hostname, uri, max_age, has_max_age);
+    stats_add(STAT_PEER_FORWARDS, 1);
+    
+    timer_entry deadline = {0};
+    timer_arm(&deadline, first_byte_timeout_ms, NULL, NULL);
+    PHASE_BEGIN(PHASE_ORIGIN_WAIT);
+    
+    // A peer that goes away without answering is routed around like one that refused the connection
+    int result = send_request(peer_socket, headers, header_count, CLUSTER_PEER_HEADER ": 1");
+    if (result == 0) {
+        result = wait_for_peer(peer_socket, &deadline);
     }
-
-    if (response_buffer) {
-        free(response_buffer);
+    if (result < 0 && errno != ETIMEDOUT) {
+        timer_cancel(&deadline);
+        close(peer_socket);
+        cluster_peer_failed(peer);
+        return PEER_UNREACHABLE;
     }
     
-    return 0;
-}
\ No newline at end of file
+    relay_state relay = {
+        .client_socket = client_socket,
+        .request = request,
+        .request_len = request_len,
+        .hostname = hostname,
+        .uri = uri,
+        .stale = stale,
+        .via_peer = 1,
+        .deadline = &deadline,
+    };
+    result = relay_response(peer_socket, &relay);
+    
+    timer_cancel(&deadline);
+    close(peer_socket);
+    return result;
+}
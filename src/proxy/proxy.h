@@ -1,6 +1,22 @@
 #ifndef PROXY_H
 #define PROXY_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Time allowed for the origin to start answering by default (ms)
+#ifndef FIRST_BYTE_TIMEOUT_MS
+#define FIRST_BYTE_TIMEOUT_MS 30000
+#endif
+
+// Longest the origin may stall once the response has started, by default (ms)
+#ifndef BODY_IDLE_TIMEOUT_MS
+#define BODY_IDLE_TIMEOUT_MS 30000
+#endif
+
+// forward_peer() result when the peer could not be reached and nothing was sent to the client
+#define PEER_UNREACHABLE -2
+
 // Global flag for caching
 extern int g_cache_enabled;
 
@@ -8,12 +24,54 @@ extern int g_cache_enabled;
  * @brief Handle client request 
  * 
  * @param client_socket Socket connected to client
- * @return int 0 on success, -1 on error
+ * @return int 0 on success, 1 if a CONNECT tunnel now owns client_socket, -1 on error
  */
 int handle_client_request(int client_socket);
 
+/**
+ * @brief Serve one queued connection start to finish, then close it
+ * 
+ * @param client_socket Socket connected to client
+ * @param accepted_us When it was accepted (stats_now_us()), so queueing counts in latency
+ */
+void serve_client(int client_socket, uint64_t accepted_us);
+
+/**
+ * @brief Turn away a queued connection admission control shed, then close it
+ * 
+ * Answers 503 with a Retry-After instead of reading and serving the request.
+ * 
+ * @param client_socket Socket connected to client
+ */
+void shed_client(int client_socket);
+
+/**
+ * @brief Change how long origins may take to answer
+ *
+ * Starts at FIRST_BYTE_TIMEOUT_MS and BODY_IDLE_TIMEOUT_MS. Fetches already
+ * running keep the timeouts they started with.
+ *
+ * @param first_byte_ms Time allowed for the origin to start answering (0 keeps the current value)
+ * @param body_idle_ms Longest the origin may stall mid-response (0 keeps the current value)
+ */
+void set_origin_timeouts(int first_byte_ms, int body_idle_ms);
+
+/**
+ * @brief Change the largest cacheable object and the per-client buffer cap
+ *
+ * Starts at MAX_RESPONSE_SIZE and CLIENT_BUFFER_MEM_CAP. Entries already
+ * cached are kept even if they are now over the limit.
+ *
+ * @param max_object Largest body cached, at most MAX_RESPONSE_SIZE (0 keeps the current value)
+ * @param client_buffer Response bytes held in memory per client before spilling (0 keeps the current value)
+ */
+void set_relay_limits(int max_object, size_t client_buffer);
+
 /**
  * @brief Forward response from server to client
+ *
+ * Answers 504 if the origin sends nothing within the first-byte timeout and
+ * aborts if it then stalls for the body idle timeout (see set_origin_timeouts()).
  * 
  * @param server_socket Socket connected to origin server
  * @param client_socket Socket connected to client
@@ -27,4 +85,47 @@ int handle_client_request(int client_socket);
 int forward_response(int server_socket, int client_socket, const char *request, 
                     int request_len, const char *hostname, const char *uri, int stale);
 
+/**
+ * @brief Fetch a GET as a stream on a pooled h2c connection and relay the response
+ *
+ * Same deadlines and caching as forward_response().
+ * 
+ * @param client_socket Socket connected to client
+ * @param headers Request headers
+ * @param header_count Number of request headers
+ * @param request Complete request string (for caching)
+ * @param request_len Length of request
+ * @param hostname Hostname of the server
+ * @param uri URI being requested
+ * @param stale Whether this is replacing a stale cache entry
+ * @return int 0 on success, -1 on error, or H2_UNSUPPORTED / H2_UNREACHABLE when
+ *             nothing was sent to the client
+ */
+int forward_h2(int client_socket, char **headers, int header_count, const char *request,
+               int request_len, const char *hostname, const char *uri, int stale);
+
+/**
+ * @brief Fetch a miss through the cluster peer that owns it
+ *
+ * The request goes to the peer marked with CLUSTER_PEER_HEADER, so the peer
+ * serves it from its cache or its own origin fetch. The response is relayed
+ * but not cached here; the owner keeps the copy. While waiting, requests
+ * other peers forward to this node are served.
+ * 
+ * @param client_socket Socket connected to client
+ * @param peer Owning peer's address
+ * @param headers Request headers
+ * @param header_count Number of request headers
+ * @param request Complete request string
+ * @param request_len Length of request
+ * @param hostname Hostname of the server
+ * @param uri URI being requested
+ * @param stale Whether this is replacing a stale cache entry
+ * @return int 0 on success, -1 on error, or PEER_UNREACHABLE when the peer
+ *             refused or dropped the connection before answering (it is
+ *             routed around for CLUSTER_RETRY_SECONDS)
+ */
+int forward_peer(int client_socket, const char *peer, char **headers, int header_count,
+                 const char *request, int request_len, const char *hostname, const char *uri, int stale);
+
 #endif /* PROXY_H */
\ No newline at end of file
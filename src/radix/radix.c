@@ -0,0 +1,380 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "radix.h"
+
+/**
+ * Growable array of items filled by radix_collect()
+ */
+typedef struct {
+    radix_item **items;
+    long count;
+    long capacity;
+} item_list;
+
+/**
+ * @brief Length of the common prefix of two byte strings
+ *
+ * @param a First string
+ * @param a_len Length of a
+ * @param b Second string
+ * @param b_len Length of b
+ * @return size_t Number of leading bytes they share
+ */
+static size_t common_prefix(const char *a, size_t a_len, const char *b, size_t b_len) {
+    size_t n = a_len < b_len ? a_len : b_len;
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief Find the child whose edge starts with a byte
+ *
+ * @param node Parent node
+ * @param c First byte of the edge
+ * @return radix_node* Child, or NULL if there is none
+ */
+static radix_node* find_child(radix_node *node, char c) {
+    for (radix_node *child = node->children; child; child = child->sibling) {
+        if (child->label[0] == c) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocate a node with a copy of its edge label
+ *
+ * @param tree Owning tree
+ * @param label Edge label
+ * @param len Label length
+ * @return radix_node* New node, or NULL if out of memory
+ */
+static radix_node* new_node(radix_tree *tree, const char *label, size_t len) {
+    radix_node *node = calloc(1, sizeof(radix_node));
+    if (!node) {
+        return NULL;
+    }
+
+    node->label = malloc(len);
+    if (!node->label) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->label, label, len);
+    node->label_len = len;
+
+    tree->nodes++;
+    return node;
+}
+
+/**
+ * @brief Free a node unlinked from the tree
+ *
+ * @param tree Owning tree
+ * @param node Node to free
+ */
+static void free_node(radix_tree *tree, radix_node *node) {
+    free(node->label);
+    free(node);
+    tree->nodes--;
+}
+
+/**
+ * @brief Hook a node in as a child
+ *
+ * @param parent New parent
+ * @param child Node to add
+ */
+static void add_child(radix_node *parent, radix_node *child) {
+    child->parent = parent;
+    child->sibling = parent->children;
+    parent->children = child;
+}
+
+/**
+ * @brief Unhook a node from its parent's children
+ *
+ * @param child Node to remove
+ */
+static void remove_child(radix_node *child) {
+    radix_node **link = &child->parent->children;
+    while (*link != child) {
+        link = &(*link)->sibling;
+    }
+    *link = child->sibling;
+    child->sibling = NULL;
+}
+
+/**
+ * @brief Split a node's edge so its first split_at bytes become a new parent
+ *
+ * @param tree Owning tree
+ * @param node Node to split
+ * @param split_at Bytes of the label that move to the new parent
+ * @return radix_node* The new parent, or NULL if out of memory
+ */
+static radix_node* split_node(radix_tree *tree, radix_node *node, size_t split_at) {
+    radix_node *middle = new_node(tree, node->label, split_at);
+    if (!middle) {
+        return NULL;
+    }
+
+    char *rest = malloc(node->label_len - split_at);
+    if (!rest) {
+        free_node(tree, middle);
+        return NULL;
+    }
+    memcpy(rest, node->label + split_at, node->label_len - split_at);
+
+    // middle takes node's place under the parent, node hangs off middle
+    radix_node *parent = node->parent;
+    remove_child(node);
+    add_child(parent, middle);
+
+    free(node->label);
+    node->label = rest;
+    node->label_len -= split_at;
+    add_child(middle, node);
+
+    return middle;
+}
+
+/**
+ * @brief Free a node and everything below it
+ *
+ * @param tree Owning tree
+ * @param node Subtree root
+ */
+static void free_subtree(radix_tree *tree, radix_node *node) {
+    radix_node *child = node->children;
+    while (child) {
+        radix_node *next = child->sibling;
+        free_subtree(tree, child);
+        child = next;
+    }
+    free_node(tree, node);
+}
+
+/**
+ * @brief Free every node and start over empty
+ *
+ * @param tree Tree to clear
+ */
+void radix_clear(radix_tree *tree) {
+    radix_node *child = tree->root.children;
+    while (child) {
+        radix_node *next = child->sibling;
+        free_subtree(tree, child);
+        child = next;
+    }
+    memset(&tree->root, 0, sizeof(tree->root));
+}
+
+/**
+ * @brief Add an item under a key, O(key length)
+ *
+ * @param tree Tree to add to
+ * @param item Item not currently in a tree
+ * @param key Key bytes
+ * @param len Key length
+ * @return int 0 on success, -1 if out of memory
+ */
+int radix_insert(radix_tree *tree, radix_item *item, const char *key, size_t len) {
+    radix_node *node = &tree->root;
+    size_t pos = 0;
+
+    while (pos < len) {
+        radix_node *child = find_child(node, key[pos]);
+        if (!child) {
+            // Nothing shares the rest of the key, it becomes one edge
+            child = new_node(tree, key + pos, len - pos);
+            if (!child) {
+                return -1;
+            }
+            add_child(node, child);
+            node = child;
+            break;
+        }
+
+        size_t shared = common_prefix(child->label, child->label_len, key + pos, len - pos);
+        if (shared < child->label_len) {
+            child = split_node(tree, child, shared);
+            if (!child) {
+                return -1;
+            }
+        }
+
+        node = child;
+        pos += shared;
+    }
+
+    item->node = node;
+    item->prev = NULL;
+    item->next = node->items;
+    if (node->items) {
+        node->items->prev = item;
+    }
+    node->items = item;
+    return 0;
+}
+
+/**
+ * @brief Take an item out of its tree, pruning nodes left empty
+ *
+ * @param tree Tree holding the item
+ * @param item Item to remove (nothing happens if it is not in a tree)
+ */
+void radix_remove(radix_tree *tree, radix_item *item) {
+    radix_node *node = item->node;
+    if (!node) {
+        return;
+    }
+
+    if (item->prev) {
+        item->prev->next = item->next;
+    } else {
+        node->items = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    }
+    item->node = NULL;
+    item->prev = NULL;
+    item->next = NULL;
+
+    // Drop empty leaves and fold single-child nodes into their child
+    while (node != &tree->root && !node->items) {
+        radix_node *parent = node->parent;
+
+        if (!node->children) {
+            remove_child(node);
+            free_node(tree, node);
+            node = parent;
+            continue;
+        }
+
+        radix_node *only = node->children;
+        if (only->sibling) {
+            break;
+        }
+
+        char *label = malloc(node->label_len + only->label_len);
+        if (!label) {
+            // Leave the node in place, it is still a valid tree
+            break;
+        }
+        memcpy(label, node->label, node->label_len);
+        memcpy(label + node->label_len, only->label, only->label_len);
+
+        remove_child(only);
+        remove_child(node);
+        free(only->label);
+        only->label = label;
+        only->label_len += node->label_len;
+        add_child(parent, only);
+        free_node(tree, node);
+        break;
+    }
+}
+
+/**
+ * @brief Append an item to a collect list
+ *
+ * @param list List to append to
+ * @param item Item
+ * @return int 0 on success, -1 if out of memory
+ */
+static int list_append(item_list *list, radix_item *item) {
+    if (list->count == list->capacity) {
+        long capacity = list->capacity ? list->capacity * 2 : 16;
+        radix_item **items = realloc(list->items, capacity * sizeof(radix_item *));
+        if (!items) {
+            return -1;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = item;
+    return 0;
+}
+
+/**
+ * @brief Append every item in a subtree to a collect list
+ *
+ * @param node Subtree root
+ * @param list List to append to
+ * @return int 0 on success, -1 if out of memory
+ */
+static int collect_subtree(radix_node *node, item_list *list) {
+    for (radix_item *item = node->items; item; item = item->next) {
+        if (list_append(list, item) < 0) {
+            return -1;
+        }
+    }
+    for (radix_node *child = node->children; child; child = child->sibling) {
+        if (collect_subtree(child, list) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Collect the items under a key or key prefix
+ *
+ * @param tree Tree to search
+ * @param key Key or key prefix
+ * @param len Length of key
+ * @param prefix 1 to match every key starting with key, 0 for the exact key
+ * @param out Receives a malloc'd array of matching items (NULL if none)
+ * @return long Number of items, or -1 if out of memory
+ */
+long radix_collect(radix_tree *tree, const char *key, size_t len, int prefix, radix_item ***out) {
+    item_list list = {NULL, 0, 0};
+    radix_node *node = &tree->root;
+    size_t pos = 0;
+
+    *out = NULL;
+
+    // Walk down as far as the key reaches
+    while (pos < len) {
+        radix_node *child = find_child(node, key[pos]);
+        if (!child) {
+            return 0;
+        }
+
+        size_t shared = common_prefix(child->label, child->label_len, key + pos, len - pos);
+        if (shared < child->label_len) {
+            // The key ends inside this edge: only a prefix match reaches below
+            if (!prefix || pos + shared < len) {
+                return 0;
+            }
+        }
+
+        node = child;
+        pos += shared;
+    }
+
+    int failed;
+    if (prefix) {
+        failed = collect_subtree(node, &list);
+    } else {
+        failed = 0;
+        for (radix_item *item = node->items; item && !failed; item = item->next) {
+            failed = list_append(&list, item);
+        }
+    }
+
+    if (failed) {
+        free(list.items);
+        return -1;
+    }
+
+    *out = list.items;
+    return list.count;
+}
@@ -0,0 +1,79 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <stddef.h>
+
+/**
+ * Item hooked into a radix tree. Embed it in whatever owns the key; items
+ * with the same key share a node.
+ */
+typedef struct radix_item {
+    struct radix_node *node;       // Node holding the item, NULL if not in a tree
+    struct radix_item *prev;
+    struct radix_item *next;
+} radix_item;
+
+/**
+ * Compressed trie node: an edge label and the items whose key ends here
+ */
+typedef struct radix_node {
+    char *label;
+    size_t label_len;
+    struct radix_node *parent;
+    struct radix_node *children;   // First child
+    struct radix_node *sibling;    // Next child of the parent
+    radix_item *items;
+} radix_node;
+
+/**
+ * Radix tree. Zero-initialise before first use.
+ */
+typedef struct {
+    radix_node root;
+    size_t nodes;                  // Nodes besides the root
+} radix_tree;
+
+/**
+ * @brief Free every node and start over empty
+ *
+ * Items still pointing into the tree are left dangling; callers drop them too.
+ *
+ * @param tree Tree to clear
+ */
+void radix_clear(radix_tree *tree);
+
+/**
+ * @brief Add an item under a key, O(key length)
+ *
+ * @param tree Tree to add to
+ * @param item Item not currently in a tree
+ * @param key Key bytes
+ * @param len Key length
+ * @return int 0 on success, -1 if out of memory
+ */
+int radix_insert(radix_tree *tree, radix_item *item, const char *key, size_t len);
+
+/**
+ * @brief Take an item out of its tree, pruning nodes left empty
+ *
+ * @param tree Tree holding the item
+ * @param item Item to remove (nothing happens if it is not in a tree)
+ */
+void radix_remove(radix_tree *tree, radix_item *item);
+
+/**
+ * @brief Collect the items under a key or key prefix
+ *
+ * Cost is proportional to the key length plus the size of the matching
+ * subtree, not to the size of the tree.
+ *
+ * @param tree Tree to search
+ * @param key Key or key prefix
+ * @param len Length of key
+ * @param prefix 1 to match every key starting with key, 0 for the exact key
+ * @param out Receives a malloc'd array of matching items (NULL if none)
+ * @return long Number of items, or -1 if out of memory
+ */
+long radix_collect(radix_tree *tree, const char *key, size_t len, int prefix, radix_item ***out);
+
+#endif /* RADIX_H */
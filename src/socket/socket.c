@@ -4,13 +4,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <ctype.h>
 
 #include "socket.h"
+#include "io.h"
+#include "timer.h"
+#include "stats.h"
+
+/**
+ * Address family that last won the connect race for a host
+ */
+typedef struct {
+    char host[256];
+    int family;
+} origin_family;
+
+static origin_family origin_families[ORIGIN_FAMILY_SLOTS];
+static int next_family_slot;
+
+// Time allowed to connect to an origin, changed with set_connect_timeout()
+static int connect_timeout_ms = CONNECT_TIMEOUT_MS;
 
 /**
  * @brief Create dual-stack TCP listening socket (accepts both IPv4 and IPv6)
@@ -74,44 +96,290 @@ int create_listening_socket(int port) {
 }
 
 /**
- * @brief Connect to origin server
+ * @brief Split a "host[:port]" authority ("[v6addr]:port" for IPv6)
  * 
- * @param hostname Hostname to connect to
+ * @param authority Host header value or CONNECT target
+ * @param default_port Port used when the authority doesn't name one
+ * @param host Buffer receiving the host
+ * @param host_size Size of host
+ * @param port Buffer receiving the port
+ * @param port_size Size of port
+ * @return int 0 on success, -1 if the authority is malformed
+ */
+int split_host_port(const char *authority, const char *default_port,
+                    char *host, size_t host_size, char *port, size_t port_size) {
+    const char *host_start = authority;
+    const char *host_end;
+    const char *port_start = NULL;
+
+    if (*authority == '[') {
+        // Bracketed IPv6 literal
+        host_start = authority + 1;
+        host_end = strchr(host_start, ']');
+        if (!host_end) return -1;
+
+        if (host_end[1] == ':') {
+            port_start = host_end + 2;
+        } else if (host_end[1] != '\0') {
+            return -1;
+        }
+    } else {
+        host_end = strrchr(authority, ':');
+        if (host_end) {
+            port_start = host_end + 1;
+        } else {
+            host_end = authority + strlen(authority);
+        }
+    }
+
+    size_t host_len = host_end - host_start;
+    if (host_len == 0 || host_len >= host_size) return -1;
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+
+    const char *port_str = port_start ? port_start : default_port;
+    size_t port_len = strlen(port_str);
+    if (port_len == 0 || port_len > 5 || port_len >= port_size) return -1;
+    for (const char *p = port_str; *p; p++) {
+        if (!isdigit((unsigned char)*p)) return -1;
+    }
+    memcpy(port, port_str, port_len + 1);
+
+    return 0;
+}
+
+/**
+ * @brief Change the time allowed to connect to an origin
+ *
+ * @param ms Timeout in milliseconds
+ */
+void set_connect_timeout(int ms) {
+    connect_timeout_ms = ms;
+}
+
+/**
+ * @brief Connect to origin server named by a Host header (port 80 unless given)
+ * 
+ * @param hostname Host header value, "host" or "host:port"
  * @return int Socket file descriptor, or -1 on error
  */
 int connect_to_server(const char *hostname) {
-    struct addrinfo hints, *result, *rp;
-    int sockfd;
+    char host[256];
+    char port[16];
+
+    if (split_host_port(hostname, "80", host, sizeof(host), port, sizeof(port)) < 0) {
+        fprintf(stderr, "Malformed host %s\n", hostname);
+        return -1;
+    }
+    return connect_to_host(host, port);
+}
+
+/**
+ * @brief Address family that last won for a host
+ * 
+ * @param hostname Host name
+ * @return int AF_INET or AF_INET6, AF_UNSPEC if unknown
+ */
+static int preferred_family(const char *hostname) {
+    for (int i = 0; i < ORIGIN_FAMILY_SLOTS; i++) {
+        if (origin_families[i].family != AF_UNSPEC &&
+            strcasecmp(origin_families[i].host, hostname) == 0) {
+            return origin_families[i].family;
+        }
+    }
+    return AF_UNSPEC;
+}
+
+/**
+ * @brief Remember the address family that won for a host
+ * 
+ * @param hostname Host name
+ * @param family Winning family
+ */
+static void remember_family(const char *hostname, int family) {
+    for (int i = 0; i < ORIGIN_FAMILY_SLOTS; i++) {
+        if (origin_families[i].family != AF_UNSPEC &&
+            strcasecmp(origin_families[i].host, hostname) == 0) {
+            origin_families[i].family = family;
+            return;
+        }
+    }
+    
+    // Slots are reused round-robin
+    origin_family *slot = &origin_families[next_family_slot];
+    next_family_slot = (next_family_slot + 1) % ORIGIN_FAMILY_SLOTS;
+    snprintf(slot->host, sizeof(slot->host), "%s", hostname);
+    slot->family = family;
+}
+
+/**
+ * @brief Order resolved addresses for racing: alternate families, preferred one first
+ * 
+ * @param result getaddrinfo() results, in the resolver's preference order
+ * @param preferred Family to start with, AF_UNSPEC to follow the resolver
+ * @param ordered Receives up to MAX_CONNECT_CANDIDATES addresses
+ * @return int Number of candidates
+ */
+static int order_candidates(struct addrinfo *result, int preferred, struct addrinfo **ordered) {
+    struct addrinfo *first[MAX_CONNECT_CANDIDATES], *second[MAX_CONNECT_CANDIDATES];
+    int first_count = 0, second_count = 0;
+    
+    if (preferred == AF_UNSPEC && result) {
+        preferred = result->ai_family;
+    }
+    
+    for (struct addrinfo *rp = result; rp; rp = rp->ai_next) {
+        if (rp->ai_family == preferred) {
+            if (first_count < MAX_CONNECT_CANDIDATES) first[first_count++] = rp;
+        } else if (second_count < MAX_CONNECT_CANDIDATES) {
+            second[second_count++] = rp;
+        }
+    }
+    
+    int count = 0;
+    for (int i = 0; count < MAX_CONNECT_CANDIDATES && (i < first_count || i < second_count); i++) {
+        if (i < first_count) ordered[count++] = first[i];
+        if (i < second_count && count < MAX_CONNECT_CANDIDATES) ordered[count++] = second[i];
+    }
+    return count;
+}
+
+/**
+ * @brief Start a non-blocking connect to one address
+ * 
+ * @param addr Address to connect to
+ * @return int Socket with the handshake under way (or done), or -1 on error
+ */
+static int start_connect(const struct addrinfo *addr) {
+    int sockfd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+    if (sockfd < 0) {
+        return -1;
+    }
+    
+    if (connect(sockfd, addr->ai_addr, addr->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * @brief Connect to a host on an arbitrary port
+ * 
+ * @param hostname Hostname to connect to
+ * @param port Port number or service name
+ * @return int Socket file descriptor, or -1 on error
+ */
+int connect_to_host(const char *hostname, const char *port) {
+    struct addrinfo hints, *result;
     
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;    // Allow IPv4 or IPv6
     hints.ai_socktype = SOCK_STREAM;
     
     // Resolve hostname
-    int status = getaddrinfo(hostname, "80", &hints, &result);
+    PHASE_BEGIN(PHASE_DNS);
+    int status = getaddrinfo(hostname, port, &hints, &result);
+    PHASE_END(PHASE_DNS);
     if (status != 0) {
         fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
         return -1;
     }
     
-    // Try each address until one works
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sockfd == -1) continue;
+    struct addrinfo *candidates[MAX_CONNECT_CANDIDATES];
+    int candidate_count = order_candidates(result, preferred_family(hostname), candidates);
+    
+    // Attempts in flight, with the candidate each one came from
+    struct pollfd attempts[MAX_CONNECT_CANDIDATES];
+    int attempt_family[MAX_CONNECT_CANDIDATES];
+    int attempt_count = 0;
+    int next = 0;
+    int start_now = 0;
+    int sockfd = -1;
+    
+    // All attempts share one connect deadline
+    timer_entry deadline = {0};
+    timer_entry stagger = {0};
+    timer_arm(&deadline, connect_timeout_ms, NULL, NULL);
+    PHASE_BEGIN(PHASE_CONNECT);
+    
+    while (sockfd < 0 && timer_remaining(&deadline) > 0) {
+        // Start the next candidate when the last one has had its head start,
+        // or straight away if nothing is in flight
+        if (next < candidate_count &&
+            (attempt_count == 0 || start_now || timer_remaining(&stagger) == 0)) {
+            start_now = 0;
+            int fd = start_connect(candidates[next]);
+            if (fd >= 0) {
+                attempts[attempt_count].fd = fd;
+                attempts[attempt_count].events = POLLOUT;
+                attempts[attempt_count].revents = 0;
+                attempt_family[attempt_count] = candidates[next]->ai_family;
+                attempt_count++;
+                timer_arm(&stagger, CONNECT_ATTEMPT_DELAY_MS, NULL, NULL);
+            }
+            next++;
+            continue;
+        }
         
-        if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) != -1) {
-            break; // Success
+        if (attempt_count == 0) {
+            break; // Every candidate failed
         }
         
-        close(sockfd);
+        int timeout_ms = timer_remaining(&deadline);
+        if (next < candidate_count && !start_now && timer_remaining(&stagger) < timeout_ms) {
+            timeout_ms = timer_remaining(&stagger);
+        }
+        
+        if (poll(attempts, attempt_count, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        
+        for (int i = 0; i < attempt_count; i++) {
+            if (!attempts[i].revents) {
+                continue;
+            }
+            
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && !error) {
+                sockfd = attempts[i].fd;
+                remember_family(hostname, attempt_family[i]);
+                attempts[i] = attempts[--attempt_count];
+                break;
+            }
+            
+            // This one failed: drop it and let the next candidate start now
+            close(attempts[i].fd);
+            attempts[i] = attempts[attempt_count - 1];
+            attempt_family[i] = attempt_family[attempt_count - 1];
+            attempt_count--;
+            i--;
+            start_now = 1;
+        }
     }
     
+    // Losers and anything still in flight are abandoned
+    for (int i = 0; i < attempt_count; i++) {
+        close(attempts[i].fd);
+    }
+    
+    PHASE_END(PHASE_CONNECT);
+    timer_cancel(&stagger);
+    timer_cancel(&deadline);
     freeaddrinfo(result);
     
-    if (rp == NULL) {
+    if (sockfd < 0) {
         fprintf(stderr, "Could not connect to %s\n", hostname);
         return -1;
     }
     
+    // The rest of the proxy expects a blocking socket
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags >= 0) {
+        fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    
     return sockfd;
-}
\ No newline at end of file
+}
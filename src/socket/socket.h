@@ -1,6 +1,26 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <stddef.h>
+
+// Time allowed to establish a connection to the origin by default (ms)
+#ifndef CONNECT_TIMEOUT_MS
+#define CONNECT_TIMEOUT_MS 10000
+#endif
+
+// Head start each address gets before the next one joins the race (ms, RFC 8305)
+#ifndef CONNECT_ATTEMPT_DELAY_MS
+#define CONNECT_ATTEMPT_DELAY_MS 250
+#endif
+
+// Origins whose winning address family is remembered
+#ifndef ORIGIN_FAMILY_SLOTS
+#define ORIGIN_FAMILY_SLOTS 64
+#endif
+
+// Most resolved addresses raced for one connect
+#define MAX_CONNECT_CANDIDATES 16
+
 /**
  * @brief Create dual-stack TCP listening socket (accepts both IPv4 and IPv6)
  * 
@@ -10,11 +30,47 @@
 int create_listening_socket(int port);
 
 /**
- * @brief Connect to origin server
+ * @brief Split a "host[:port]" authority ("[v6addr]:port" for IPv6)
  * 
- * @param hostname Hostname to connect to
+ * @param authority Host header value or CONNECT target
+ * @param default_port Port used when the authority doesn't name one
+ * @param host Buffer receiving the host
+ * @param host_size Size of host
+ * @param port Buffer receiving the port
+ * @param port_size Size of port
+ * @return int 0 on success, -1 if the authority is malformed
+ */
+int split_host_port(const char *authority, const char *default_port,
+                    char *host, size_t host_size, char *port, size_t port_size);
+
+/**
+ * @brief Change the time allowed to connect to an origin
+ *
+ * @param ms Timeout in milliseconds, shared by all the addresses raced
+ */
+void set_connect_timeout(int ms);
+
+/**
+ * @brief Connect to origin server named by a Host header (port 80 unless given)
+ * 
+ * @param hostname Host header value, "host" or "host:port"
  * @return int Socket file descriptor, or -1 on error
  */
 int connect_to_server(const char *hostname);
 
+/**
+ * @brief Connect to a host on an arbitrary port
+ * 
+ * Resolved addresses are raced happy-eyeballs style: families alternate,
+ * starting with the one that last won for this host, and each attempt gets
+ * CONNECT_ATTEMPT_DELAY_MS before the next starts alongside it. The first
+ * handshake to complete wins. All attempts share the connect timeout
+ * (CONNECT_TIMEOUT_MS unless changed with set_connect_timeout()).
+ * 
+ * @param hostname Hostname to connect to
+ * @param port Port number or service name
+ * @return int Socket file descriptor, or -1 on error
+ */
+int connect_to_host(const char *hostname, const char *port);
+
 #endif /* SOCKET_H */
\ No newline at end of file
@@ -0,0 +1,669 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "stats.h"
+#include "log.h"
+
+/**
+ * Timing of the request a thread is serving
+ */
+typedef struct {
+    uint64_t request_start_us;
+    uint64_t ttfb_us;
+    int first_byte_seen;
+
+#ifdef HAVE_PHASE_TIMING
+    uint64_t phase_started[PHASE_COUNT];
+    uint64_t phase_us[PHASE_COUNT];
+    unsigned phase_seen;      // Bit per phase that ran
+    char method[16];
+    char host[256];
+    char uri[256];
+    const char *outcome;
+#endif
+} request_timing;
+
+/**
+ * Counters owned by one thread. Only the owner writes (relaxed atomics, no
+ * locks); readers sum every block. Blocks sit on their own cache lines.
+ */
+typedef struct {
+    _Alignas(64) uint64_t counters[STAT_COUNTERS];
+    latency_histogram histograms[HIST_COUNT];
+
+#ifdef HAVE_PHASE_TIMING
+    latency_histogram phases[PHASE_COUNT];
+#endif
+
+    // Current request, touched only by the owner
+    request_timing current;
+    request_timing suspended;     // Request set aside while a nested one is served
+} stats_worker;
+
+// Per-worker blocks
+static stats_worker workers[STATS_MAX_WORKERS];
+static int worker_count;
+
+// Block owned by the calling thread
+static _Thread_local stats_worker *local_worker;
+
+/**
+ * Names and help text for the Prometheus output, in stat_counter order
+ */
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} counter_info[STAT_COUNTERS] = {
+    {"htproxy_requests_total", "counter", "Requests whose headers were read"},
+    {"htproxy_cache_hits_total", "counter", "Requests served from a fresh cache entry"},
+    {"htproxy_cache_misses_total", "counter", "Cacheable requests not found in the cache"},
+    {"htproxy_cache_stale_hits_total", "counter", "Cache entries found expired and refetched"},
+    {"htproxy_cache_evictions_total", "counter", "Entries removed from the cache"},
+    {"htproxy_cache_bytes_total", "counter", "Response bytes served from the cache"},
+    {"htproxy_origin_bytes_total", "counter", "Response bytes relayed from origin servers"},
+    {"htproxy_active_connections", "gauge", "Client connections being served"},
+    {"htproxy_log_dropped_total", "counter", "Log lines dropped because the writer fell behind"},
+    {"htproxy_cache_expired_total", "counter", "Expired cache entries reclaimed by the sweep"},
+    {"htproxy_cache_purged_total", "counter", "Cache entries removed through the purge API"},
+    {"htproxy_origin_failures_total", "counter", "Origins that could not be resolved or connected to"},
+    {"htproxy_negative_hits_total", "counter", "Requests failed fast because their origin failed recently"},
+    {"htproxy_cache_compressed_total", "counter", "Responses stored gzip-compressed in the cache"},
+    {"htproxy_cache_compression_saved_bytes_total", "counter", "Bytes compression kept out of the cache"},
+    {"htproxy_cache_body_bytes", "gauge", "Body bytes cached entries refer to"},
+    {"htproxy_cache_body_stored_bytes", "gauge", "Body bytes stored, identical bodies counted once"},
+    {"htproxy_cache_dedup_hits_total", "counter", "Cached bodies shared with an identical body already stored"},
+    {"htproxy_dispatch_hits_ahead_total", "counter", "Cache hits served ahead of an older waiting request"},
+    {"htproxy_cache_arena_fallbacks_total", "counter", "Cache allocations served by malloc because the arena was full"},
+    {"htproxy_h2_connections_total", "counter", "h2c connections opened to origins"},
+    {"htproxy_h2_streams_total", "counter", "Requests sent as streams on h2c connections"},
+    {"htproxy_cluster_peer_forwards_total", "counter", "Misses forwarded to the peer owning the object"},
+    {"htproxy_cluster_peer_requests_total", "counter", "Requests peers forwarded to this node"},
+    {"htproxy_cluster_peer_failures_total", "counter", "Peers found unreachable and routed around"},
+    {"htproxy_admission_shed_delay_total", "counter", "Requests turned away because they waited too long"},
+    {"htproxy_admission_shed_origin_total", "counter", "Requests turned away because their origin had too many waiting"},
+    {"htproxy_prefetch_queued_total", "counter", "Links from cached HTML pages queued for prefetching"},
+    {"htproxy_prefetch_dropped_total", "counter", "Links dropped because the prefetch queue was full"},
+    {"htproxy_prefetch_fetched_total", "counter", "Prefetches answered with a 200"},
+    {"htproxy_prefetch_bytes_total", "counter", "Response bytes read by prefetches"},
+    {"htproxy_client_buffered_bytes", "gauge", "Response bytes held for clients that read slower than the origin sends"},
+    {"htproxy_client_buffered_peak_bytes", "gauge", "High-water mark of bytes held for clients"},
+    {"htproxy_client_spilled_responses_total", "counter", "Responses that outgrew the memory cap and spilled to disk"},
+    {"htproxy_client_spilled_bytes_total", "counter", "Bytes written to spill files"},
+    {"htproxy_client_stalls_total", "counter", "Sends cut short because the client socket was full"},
+    {"htproxy_origin_early_releases_total", "counter", "Origin connections released while the client was still draining"},
+    {"htproxy_tunnel_opened_total", "counter", "CONNECT tunnels established"},
+    {"htproxy_tunnel_failed_total", "counter", "CONNECT requests that never reached their target"},
+    {"htproxy_tunnel_idle_timeouts_total", "counter", "Tunnels closed for inactivity"},
+    {"htproxy_tunnel_bytes_up_total", "counter", "Bytes relayed from clients to tunnel targets"},
+    {"htproxy_tunnel_bytes_down_total", "counter", "Bytes relayed from tunnel targets to clients"},
+};
+
+/**
+ * Names and help text for the Prometheus output, in stat_histogram order
+ */
+static const struct {
+    const char *name;
+    const char *help;
+} histogram_info[HIST_COUNT] = {
+    {"htproxy_ttfb_seconds", "Time from accept to the first response byte"},
+    {"htproxy_request_seconds", "Time from accept to the response being handled"},
+};
+
+#ifdef HAVE_PHASE_TIMING
+
+// Label values for the phase histograms and keys in the access log, in request_phase order
+static const char *phase_names[PHASE_COUNT] = {
+    "headers", "dns", "connect", "origin_wait", "origin_transfer", "client_send",
+};
+
+// Room access log lines leave after the strings for the outcome and timings
+#define ACCESS_LOG_TAIL_ROOM 384
+
+#endif /* HAVE_PHASE_TIMING */
+
+/**
+ * @brief Block owned by the calling thread, claimed on first use
+ *
+ * @return stats_worker* Worker block
+ */
+static stats_worker* worker() {
+    if (!local_worker) {
+        int index = __atomic_fetch_add(&worker_count, 1, __ATOMIC_RELAXED);
+        if (index >= STATS_MAX_WORKERS) {
+            index = STATS_MAX_WORKERS - 1;
+        }
+        local_worker = &workers[index];
+    }
+    return local_worker;
+}
+
+/**
+ * @brief Add to a 64-bit counter without locking
+ *
+ * @param value Counter
+ * @param delta Amount to add
+ */
+static void add_relaxed(uint64_t *value, uint64_t delta) {
+    __atomic_fetch_add(value, delta, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Histogram bucket for a value
+ *
+ * @param micros Value in microseconds
+ * @return int Bucket index
+ */
+static int bucket_index(uint64_t micros) {
+    if (micros < HIST_SUB_BUCKETS) {
+        return (int)micros;
+    }
+
+    int exp = 63 - __builtin_clzll(micros);
+    if (exp > HIST_MAX_EXP) {
+        return HIST_BUCKETS - 1;
+    }
+
+    int sub = (micros >> (exp - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief Smallest value that falls in a bucket
+ *
+ * @param index Bucket index
+ * @return uint64_t Lower bound in microseconds
+ */
+static uint64_t bucket_lower(int index) {
+    if (index < HIST_SUB_BUCKETS) {
+        return index;
+    }
+
+    int exp = index / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_BUCKETS;
+    return (uint64_t)(HIST_SUB_BUCKETS + sub) << (exp - HIST_SUB_BITS);
+}
+
+/**
+ * @brief Add a sample to a histogram without locking
+ *
+ * @param hist Histogram owned by the calling thread
+ * @param micros Sample in microseconds
+ */
+static void record(latency_histogram *hist, uint64_t micros) {
+    add_relaxed(&hist->buckets[bucket_index(micros)], 1);
+    add_relaxed(&hist->count, 1);
+    add_relaxed(&hist->sum, micros);
+
+    if (micros > __atomic_load_n(&hist->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&hist->max, micros, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Current monotonic time in microseconds
+ *
+ * @return uint64_t Microseconds since an arbitrary fixed point
+ */
+uint64_t stats_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Add to a counter in the calling thread's block, lock-free
+ *
+ * @param counter Counter to update
+ * @param delta Amount to add (negative for gauges going down)
+ */
+void stats_add(stat_counter counter, int64_t delta) {
+    add_relaxed(&worker()->counters[counter], (uint64_t)delta);
+}
+
+/**
+ * @brief Raise a high-water mark in the calling thread's block, lock-free
+ *
+ * @param counter Gauge to raise
+ * @param value Level just reached
+ */
+void stats_max(stat_counter counter, int64_t value) {
+    uint64_t *mark = &worker()->counters[counter];
+    if (value > (int64_t)__atomic_load_n(mark, __ATOMIC_RELAXED)) {
+        __atomic_store_n(mark, (uint64_t)value, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Record a latency sample in the calling thread's histogram, lock-free
+ *
+ * @param histogram Histogram to update
+ * @param micros Sample in microseconds
+ */
+void stats_record(stat_histogram histogram, uint64_t micros) {
+    record(&worker()->histograms[histogram], micros);
+}
+
+/**
+ * @brief Mark the start of a request on the calling thread
+ */
+void stats_request_begin() {
+    stats_request_begin_at(stats_now_us());
+}
+
+/**
+ * @brief Mark the start of a request that began earlier (e.g. when it was accepted)
+ *
+ * @param start_us Start time from stats_now_us()
+ */
+void stats_request_begin_at(uint64_t start_us) {
+    stats_worker *w = worker();
+    w->current.request_start_us = start_us;
+    w->current.ttfb_us = 0;
+    w->current.first_byte_seen = 0;
+
+#ifdef HAVE_PHASE_TIMING
+    memset(w->current.phase_us, 0, sizeof(w->current.phase_us));
+    w->current.phase_seen = 0;
+    w->current.method[0] = '\0';
+    w->current.host[0] = '\0';
+    w->current.uri[0] = '\0';
+    w->current.outcome = "error";
+#endif
+}
+
+/**
+ * @brief Mark the first response byte being ready for the client (first call only)
+ */
+void stats_first_byte() {
+    stats_worker *w = worker();
+    if (w->current.request_start_us == 0 || w->current.first_byte_seen) {
+        return;
+    }
+
+    w->current.first_byte_seen = 1;
+    w->current.ttfb_us = stats_now_us() - w->current.request_start_us;
+    stats_record(HIST_TTFB, w->current.ttfb_us);
+}
+
+/**
+ * @brief Set the current request aside to serve another one on the same thread
+ */
+void stats_request_suspend() {
+    stats_worker *w = worker();
+    w->suspended = w->current;
+    w->current.request_start_us = 0;
+}
+
+/**
+ * @brief Go back to the request set aside by stats_request_suspend()
+ */
+void stats_request_resume() {
+    stats_worker *w = worker();
+    w->current = w->suspended;
+}
+
+#ifdef HAVE_PHASE_TIMING
+
+/**
+ * @brief Mark the start of a phase of the current request
+ *
+ * @param phase Phase starting
+ */
+void phase_begin(request_phase phase) {
+    worker()->current.phase_started[phase] = stats_now_us();
+}
+
+/**
+ * @brief Mark the end of a phase; repeated phases accumulate
+ *
+ * @param phase Phase ending
+ */
+void phase_end(request_phase phase) {
+    stats_worker *w = worker();
+    if (w->current.request_start_us == 0 || w->current.phase_started[phase] == 0) {
+        return;
+    }
+
+    w->current.phase_us[phase] += stats_now_us() - w->current.phase_started[phase];
+    w->current.phase_started[phase] = 0;
+    w->current.phase_seen |= 1u << phase;
+}
+
+/**
+ * @brief Copy a string into a fixed buffer, truncating
+ *
+ * @param dst Destination buffer
+ * @param size Size of dst
+ * @param src Source string (may be NULL)
+ */
+static void copy_field(char *dst, size_t size, const char *src) {
+    snprintf(dst, size, "%s", src ? src : "");
+}
+
+/**
+ * @brief Attach the request line details used by the access log
+ *
+ * @param method Request method
+ * @param host Host header value (may be NULL)
+ * @param uri Request URI
+ */
+void phase_describe(const char *method, const char *host, const char *uri) {
+    stats_worker *w = worker();
+    copy_field(w->current.method, sizeof(w->current.method), method);
+    copy_field(w->current.host, sizeof(w->current.host), host);
+    copy_field(w->current.uri, sizeof(w->current.uri), uri);
+}
+
+/**
+ * @brief Record how the request was served, for the access log
+ *
+ * @param outcome Static string such as "hit" or "miss"
+ */
+void phase_outcome(const char *outcome) {
+    worker()->current.outcome = outcome;
+}
+
+/**
+ * @brief Write a string as a JSON string literal, cut short if it doesn't fit
+ *
+ * @param out Output buffer
+ * @param room Bytes available, at least 3
+ * @param str String to quote
+ * @return size_t Length written, not counting the NUL
+ */
+static size_t json_string(char *out, size_t room, const char *str) {
+    size_t len = 0;
+    out[len++] = '"';
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        char escaped[8];
+        int n;
+        if (*p == '"' || *p == '\\') {
+            n = snprintf(escaped, sizeof(escaped), "\\%c", *p);
+        } else if (*p < 0x20) {
+            n = snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+        } else {
+            escaped[0] = *p;
+            n = 1;
+        }
+        // Keep room for the closing quote and the NUL
+        if (len + n + 2 > room) {
+            break;
+        }
+        memcpy(out + len, escaped, n);
+        len += n;
+    }
+    out[len++] = '"';
+    out[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Queue one access-log line for the request that just ended
+ *
+ * The line is built here and written by the log thread, so the serving
+ * thread never waits on the file.
+ *
+ * @param w Worker block holding the request
+ * @param total_us Total request time in microseconds
+ */
+static void write_access_log(const stats_worker *w, uint64_t total_us) {
+    if (!log_access_enabled()) {
+        return;
+    }
+
+    // A log record carries at most LOG_TEXT_SIZE - 2 bytes of text; the URI gets what
+    // the method and host leave, short of the tail
+    char line[LOG_TEXT_SIZE - 1];
+    size_t string_room = sizeof(line) - ACCESS_LOG_TAIL_ROOM;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    size_t len = snprintf(line, sizeof(line), "{\"time\":%lld.%03ld,\"method\":",
+                          (long long)now.tv_sec, now.tv_nsec / 1000000);
+    len += json_string(line + len, 64, w->current.method);
+    len += snprintf(line + len, sizeof(line) - len, ",\"host\":");
+    len += json_string(line + len, 384, w->current.host);
+    len += snprintf(line + len, sizeof(line) - len, ",\"uri\":");
+    len += json_string(line + len, string_room - len, w->current.uri);
+    len += snprintf(line + len, sizeof(line) - len, ",\"outcome\":\"%s\",\"total_us\":%llu",
+                    w->current.outcome, (unsigned long long)total_us);
+
+    if (w->current.first_byte_seen) {
+        len += snprintf(line + len, sizeof(line) - len, ",\"ttfb_us\":%llu",
+                        (unsigned long long)w->current.ttfb_us);
+    }
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (w->current.phase_seen & (1u << p)) {
+            len += snprintf(line + len, sizeof(line) - len, ",\"%s_us\":%llu", phase_names[p],
+                            (unsigned long long)w->current.phase_us[p]);
+        }
+    }
+    snprintf(line + len, sizeof(line) - len, "}");
+
+    log_event(LOG_ACCESS, line, NULL, 0, 0);
+}
+
+#endif /* HAVE_PHASE_TIMING */
+
+/**
+ * @brief Mark the end of the current request and record its total time
+ */
+void stats_request_end() {
+    stats_worker *w = worker();
+    if (w->current.request_start_us == 0) {
+        return;
+    }
+
+    uint64_t total_us = stats_now_us() - w->current.request_start_us;
+    stats_record(HIST_TOTAL, total_us);
+
+#ifdef HAVE_PHASE_TIMING
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (w->current.phase_seen & (1u << p)) {
+            record(&w->phases[p], w->current.phase_us[p]);
+        }
+        w->current.phase_started[p] = 0;
+    }
+    write_access_log(w, total_us);
+#endif
+
+    w->current.request_start_us = 0;
+}
+
+/**
+ * @brief Number of worker blocks in use
+ *
+ * @return int Worker count
+ */
+static int workers_in_use() {
+    int count = __atomic_load_n(&worker_count, __ATOMIC_RELAXED);
+    return count > STATS_MAX_WORKERS ? STATS_MAX_WORKERS : count;
+}
+
+/**
+ * @brief Sum a counter across all workers
+ *
+ * @param counter Counter to read
+ * @return int64_t Aggregated value
+ */
+int64_t stats_counter_total(stat_counter counter) {
+    uint64_t total = 0;
+    int count = workers_in_use();
+
+    for (int i = 0; i < count; i++) {
+        total += __atomic_load_n(&workers[i].counters[counter], __ATOMIC_RELAXED);
+    }
+    return (int64_t)total;
+}
+
+/**
+ * @brief Add another thread's histogram into an aggregate
+ *
+ * @param out Aggregate histogram
+ * @param hist Histogram being written concurrently by its owner
+ */
+static void merge_histogram(latency_histogram *out, const latency_histogram *hist) {
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        out->buckets[b] += __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+    }
+    out->count += __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    out->sum += __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    if (max > out->max) {
+        out->max = max;
+    }
+}
+
+/**
+ * @brief Merge a histogram across all workers
+ *
+ * @param histogram Histogram to read
+ * @param out Receives the merged histogram
+ */
+void stats_histogram_total(stat_histogram histogram, latency_histogram *out) {
+    memset(out, 0, sizeof(*out));
+    int count = workers_in_use();
+
+    for (int i = 0; i < count; i++) {
+        merge_histogram(out, &workers[i].histograms[histogram]);
+    }
+}
+
+#ifdef HAVE_PHASE_TIMING
+
+/**
+ * @brief Merge a phase histogram across all workers
+ *
+ * @param phase Phase to read
+ * @param out Receives the merged histogram
+ */
+void phase_histogram_total(request_phase phase, latency_histogram *out) {
+    memset(out, 0, sizeof(*out));
+    int count = workers_in_use();
+
+    for (int i = 0; i < count; i++) {
+        merge_histogram(out, &workers[i].phases[phase]);
+    }
+}
+
+#endif /* HAVE_PHASE_TIMING */
+
+/**
+ * @brief Estimate a quantile from a histogram
+ *
+ * @param hist Histogram to read
+ * @param quantile Quantile in [0, 1]
+ * @return uint64_t Highest value equivalent to the quantile, in microseconds
+ */
+uint64_t histogram_quantile(const latency_histogram *hist, double quantile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(quantile * hist->count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= target) {
+            uint64_t highest = b + 1 < HIST_BUCKETS ? bucket_lower(b + 1) - 1 : hist->max;
+            return highest < hist->max ? highest : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/**
+ * @brief Append formatted text, truncating at the end of the buffer
+ *
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @param len Bytes used so far, updated
+ * @param format printf-style format
+ */
+static void append(char *buf, size_t size, size_t *len, const char *format, ...) {
+    if (*len >= size) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        *len += (size_t)written < size - *len ? (size_t)written : size - *len - 1;
+    }
+}
+
+/**
+ * @brief Write all counters and histograms in Prometheus text format
+ *
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @return size_t Bytes written (output is truncated to fit)
+ */
+size_t stats_format_prometheus(char *buf, size_t size) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    size_t len = 0;
+
+    for (int c = 0; c < STAT_COUNTERS; c++) {
+        append(buf, size, &len, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n",
+               counter_info[c].name, counter_info[c].help,
+               counter_info[c].name, counter_info[c].type,
+               counter_info[c].name, (long long)stats_counter_total(c));
+    }
+
+    // Referenced over stored body bytes, 1 when nothing is shared
+    int64_t body_bytes = stats_counter_total(STAT_BODY_BYTES);
+    int64_t stored_bytes = stats_counter_total(STAT_BODY_STORED_BYTES);
+    append(buf, size, &len, "# HELP htproxy_cache_dedup_ratio Body bytes referenced per byte stored\n"
+                            "# TYPE htproxy_cache_dedup_ratio gauge\nhtproxy_cache_dedup_ratio %.3f\n",
+           stored_bytes > 0 ? (double)body_bytes / stored_bytes : 1.0);
+
+    // Histograms are exported as summaries, the buckets are too fine to ship as-is
+    for (int h = 0; h < HIST_COUNT; h++) {
+        latency_histogram hist;
+        stats_histogram_total(h, &hist);
+
+        const char *name = histogram_info[h].name;
+        append(buf, size, &len, "# HELP %s %s\n# TYPE %s summary\n",
+               name, histogram_info[h].help, name);
+
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            append(buf, size, &len, "%s{quantile=\"%g\"} %.6f\n", name, quantiles[q],
+                   histogram_quantile(&hist, quantiles[q]) / 1e6);
+        }
+        append(buf, size, &len, "%s_sum %.6f\n%s_count %llu\n",
+               name, hist.sum / 1e6, name, (unsigned long long)hist.count);
+    }
+
+#ifdef HAVE_PHASE_TIMING
+    append(buf, size, &len, "# HELP htproxy_phase_seconds Time spent in each request phase\n"
+                            "# TYPE htproxy_phase_seconds summary\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        latency_histogram hist;
+        phase_histogram_total(p, &hist);
+
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            append(buf, size, &len, "htproxy_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+                   phase_names[p], quantiles[q], histogram_quantile(&hist, quantiles[q]) / 1e6);
+        }
+        append(buf, size, &len, "htproxy_phase_seconds_sum{phase=\"%s\"} %.6f\n"
+                                "htproxy_phase_seconds_count{phase=\"%s\"} %llu\n",
+               phase_names[p], hist.sum / 1e6, phase_names[p], (unsigned long long)hist.count);
+    }
+#endif
+
+    return len;
+}
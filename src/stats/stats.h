@@ -0,0 +1,259 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ========== Constants ========== */
+// Threads that can own a counter block; later threads share the last one
+#ifndef STATS_MAX_WORKERS
+#define STATS_MAX_WORKERS 16
+#endif
+
+// Each power of two is split into 2^HIST_SUB_BITS buckets (~12.5% relative error)
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+
+// Largest tracked latency is 2^HIST_MAX_EXP microseconds (~19 hours), longer ones are clamped
+#define HIST_MAX_EXP 36
+
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB_BUCKETS)
+
+/**
+ * Monotonic counters (and one gauge) kept per worker
+ */
+typedef enum {
+    STAT_REQUESTS,            // Requests whose headers were read
+    STAT_CACHE_HITS,          // Served from a fresh cache entry
+    STAT_CACHE_MISSES,        // Cacheable requests not found in the cache
+    STAT_STALE_HITS,          // Found in the cache but expired, refetched
+    STAT_EVICTIONS,           // Entries removed from the cache
+    STAT_BYTES_FROM_CACHE,    // Response bytes served from the cache
+    STAT_BYTES_FROM_ORIGIN,   // Response bytes relayed from origins
+    STAT_ACTIVE_CONNECTIONS,  // Client connections being served (gauge)
+    STAT_LOG_DROPS,           // Log lines dropped because the writer fell behind
+    STAT_EXPIRED,             // Expired entries reclaimed before anything asked for them
+    STAT_PURGED,              // Entries removed through the purge API
+    STAT_ORIGIN_FAILURES,     // Origins that could not be resolved or connected to
+    STAT_NEGATIVE_HITS,       // Requests failed fast because their origin failed recently
+    STAT_COMPRESSED,          // Responses stored compressed in the cache
+    STAT_COMPRESSION_SAVED,   // Bytes compression kept out of the cache
+    STAT_BODY_BYTES,          // Body bytes cached entries refer to (gauge)
+    STAT_BODY_STORED_BYTES,   // Body bytes actually stored once shared (gauge)
+    STAT_DEDUP_HITS,          // Cached bodies shared with an existing identical body
+    STAT_DISPATCH_HITS_AHEAD, // Cache hits served ahead of an older waiting request
+    STAT_ARENA_FALLBACKS,     // Cache allocations sent to malloc because the arena was full
+    STAT_H2_CONNECTIONS,      // h2c connections opened to origins
+    STAT_H2_STREAMS,          // Requests sent as streams on h2c connections
+    STAT_PEER_FORWARDS,       // Misses forwarded to the cluster peer owning the object
+    STAT_PEER_REQUESTS,       // Requests cluster peers forwarded to this node
+    STAT_PEER_FAILURES,       // Cluster peers found unreachable and routed around
+    STAT_SHED_QUEUE_DELAY,    // Requests turned away with a 503 after waiting too long
+    STAT_SHED_ORIGIN_LIMIT,   // Requests turned away with a 503 because their origin had too many waiting
+    STAT_PREFETCH_QUEUED,     // Links from cached HTML pages queued for prefetching
+    STAT_PREFETCH_DROPPED,    // Links dropped because the prefetch queue was full
+    STAT_PREFETCH_FETCHED,    // Prefetches answered with a 200
+    STAT_PREFETCH_BYTES,      // Response bytes prefetches read, counted against the budget
+    STAT_CLIENT_BUFFERED,     // Response bytes held for slow clients (gauge)
+    STAT_CLIENT_BUFFER_PEAK,  // Most response bytes a thread has held for clients at once (gauge)
+    STAT_CLIENT_SPILLS,       // Responses that outgrew the memory cap and spilled to disk
+    STAT_CLIENT_SPILL_BYTES,  // Bytes written to spill files
+    STAT_CLIENT_STALLS,       // Flushes cut short by a full client socket
+    STAT_EARLY_RELEASES,      // Origins released while the client was still draining
+    STAT_TUNNELS_OPENED,      // CONNECT tunnels established
+    STAT_TUNNELS_FAILED,      // CONNECT requests that never reached their target
+    STAT_TUNNEL_IDLE_TIMEOUTS,// Tunnels closed for inactivity
+    STAT_TUNNEL_BYTES_UP,     // Bytes relayed from clients to tunnel targets
+    STAT_TUNNEL_BYTES_DOWN,   // Bytes relayed from tunnel targets to clients
+    STAT_COUNTERS
+} stat_counter;
+
+/**
+ * Latency histograms kept per worker
+ */
+typedef enum {
+    HIST_TTFB,                // Accept to first response byte queued for the client
+    HIST_TOTAL,               // Accept to response fully handled
+    HIST_COUNT
+} stat_histogram;
+
+/**
+ * Phases of a request, timed when built with HAVE_PHASE_TIMING
+ */
+typedef enum {
+    PHASE_HEADERS,            // Reading the client's request headers
+    PHASE_DNS,                // Resolving the origin (getaddrinfo)
+    PHASE_CONNECT,            // TCP handshake with the origin
+    PHASE_ORIGIN_WAIT,        // Request sent until the origin's first byte
+    PHASE_ORIGIN_TRANSFER,    // Origin's first byte until its last
+    PHASE_CLIENT_SEND,        // Writing what is left to the client
+    PHASE_COUNT
+} request_phase;
+
+/**
+ * HDR-style log-linear latency histogram in microseconds
+ */
+typedef struct {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;             // Microseconds
+    uint64_t max;             // Microseconds
+} latency_histogram;
+
+/**
+ * @brief Current monotonic time in microseconds
+ *
+ * @return uint64_t Microseconds since an arbitrary fixed point
+ */
+uint64_t stats_now_us();
+
+/**
+ * @brief Add to a counter in the calling thread's block, lock-free
+ *
+ * @param counter Counter to update
+ * @param delta Amount to add (negative for gauges going down)
+ */
+void stats_add(stat_counter counter, int64_t delta);
+
+/**
+ * @brief Raise a high-water mark in the calling thread's block, lock-free
+ *
+ * Totals add up the threads' marks, an upper bound on the process-wide one.
+ *
+ * @param counter Gauge to raise
+ * @param value Level just reached
+ */
+void stats_max(stat_counter counter, int64_t value);
+
+/**
+ * @brief Record a latency sample in the calling thread's histogram, lock-free
+ *
+ * @param histogram Histogram to update
+ * @param micros Sample in microseconds
+ */
+void stats_record(stat_histogram histogram, uint64_t micros);
+
+/**
+ * @brief Mark the start of a request on the calling thread
+ */
+void stats_request_begin();
+
+/**
+ * @brief Mark the start of a request that began earlier (e.g. when it was accepted)
+ *
+ * @param start_us Start time from stats_now_us()
+ */
+void stats_request_begin_at(uint64_t start_us);
+
+/**
+ * @brief Mark the first response byte being ready for the client (first call only)
+ */
+void stats_first_byte();
+
+/**
+ * @brief Mark the end of the current request and record its total time
+ */
+void stats_request_end();
+
+/**
+ * @brief Set the current request aside to serve another one on the same thread
+ *
+ * One level only: the nested request must end before stats_request_resume().
+ */
+void stats_request_suspend();
+
+/**
+ * @brief Go back to the request set aside by stats_request_suspend()
+ */
+void stats_request_resume();
+
+#ifdef HAVE_PHASE_TIMING
+
+/**
+ * @brief Mark the start of a phase of the current request
+ *
+ * @param phase Phase starting
+ */
+void phase_begin(request_phase phase);
+
+/**
+ * @brief Mark the end of a phase; repeated phases accumulate
+ *
+ * @param phase Phase ending
+ */
+void phase_end(request_phase phase);
+
+/**
+ * @brief Attach the request line details used by the access log
+ *
+ * @param method Request method
+ * @param host Host header value (may be NULL)
+ * @param uri Request URI
+ */
+void phase_describe(const char *method, const char *host, const char *uri);
+
+/**
+ * @brief Record how the request was served, for the access log
+ *
+ * @param outcome Static string such as "hit" or "miss"
+ */
+void phase_outcome(const char *outcome);
+
+/**
+ * @brief Merge a phase histogram across all workers
+ *
+ * @param phase Phase to read
+ * @param out Receives the merged histogram
+ */
+void phase_histogram_total(request_phase phase, latency_histogram *out);
+
+#define PHASE_BEGIN(phase) phase_begin(phase)
+#define PHASE_END(phase) phase_end(phase)
+#define PHASE_DESCRIBE(method, host, uri) phase_describe(method, host, uri)
+#define PHASE_OUTCOME(outcome) phase_outcome(outcome)
+
+#else
+
+// Timing compiled out, the call sites cost nothing
+#define PHASE_BEGIN(phase) ((void)0)
+#define PHASE_END(phase) ((void)0)
+#define PHASE_DESCRIBE(method, host, uri) ((void)0)
+#define PHASE_OUTCOME(outcome) ((void)0)
+
+#endif /* HAVE_PHASE_TIMING */
+
+/**
+ * @brief Sum a counter across all workers
+ *
+ * @param counter Counter to read
+ * @return int64_t Aggregated value
+ */
+int64_t stats_counter_total(stat_counter counter);
+
+/**
+ * @brief Merge a histogram across all workers
+ *
+ * @param histogram Histogram to read
+ * @param out Receives the merged histogram
+ */
+void stats_histogram_total(stat_histogram histogram, latency_histogram *out);
+
+/**
+ * @brief Estimate a quantile from a histogram
+ *
+ * @param hist Histogram to read
+ * @param quantile Quantile in [0, 1]
+ * @return uint64_t Highest value equivalent to the quantile, in microseconds
+ */
+uint64_t histogram_quantile(const latency_histogram *hist, double quantile);
+
+/**
+ * @brief Write all counters and histograms in Prometheus text format
+ *
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @return size_t Bytes written (output is truncated to fit)
+ */
+size_t stats_format_prometheus(char *buf, size_t size);
+
+#endif /* STATS_H */
@@ -0,0 +1,348 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+
+// Total span of the wheel in ticks; later deadlines are parked in the last slot
+#define WHEEL_RANGE ((uint64_t)1 << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+/**
+ * Hierarchical timer wheel. Level L slot i holds timers whose deadline falls in
+ * a 64^L tick block congruent to i; when the lower levels wrap, that block is
+ * cascaded down a level.
+ */
+typedef struct {
+    timer_entry slots[TIMER_LEVELS][TIMER_SLOTS];  // Circular list sentinels
+    int level_count[TIMER_LEVELS];
+    uint64_t current;                              // Next tick to process
+    int count;
+    int initialised;
+} timer_wheel;
+
+// Global timer wheel instance
+static timer_wheel wheel;
+
+/**
+ * @brief Bit shift for a wheel level
+ *
+ * @param level Wheel level
+ * @return int Shift in bits
+ */
+static int level_shift(int level) {
+    return TIMER_SLOT_BITS * level;
+}
+
+/**
+ * @brief Check whether a slot list is empty
+ *
+ * @param slot Slot sentinel
+ * @return int 1 if empty, 0 otherwise
+ */
+static int slot_empty(const timer_entry *slot) {
+    return slot->next == slot;
+}
+
+/**
+ * @brief Unlink a timer from whatever list it is on
+ *
+ * @param timer Timer to unlink
+ */
+static void unlink_timer(timer_entry *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/**
+ * @brief Find the level a timer belongs on
+ *
+ * @param timer Timer being placed
+ * @return int Wheel level
+ */
+static int timer_level(const timer_entry *timer) {
+    uint64_t expires = timer->expires < wheel.current ? wheel.current : timer->expires;
+    uint64_t delta = expires - wheel.current;
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << level_shift(level + 1))) {
+        level++;
+    }
+    return level;
+}
+
+/**
+ * @brief Place a timer in the slot matching its deadline
+ *
+ * @param timer Timer to insert
+ */
+static void wheel_insert(timer_entry *timer) {
+    uint64_t expires = timer->expires < wheel.current ? wheel.current : timer->expires;
+    if (expires - wheel.current >= WHEEL_RANGE) {
+        // Beyond the wheel's range, re-placed when the last level cascades
+        expires = wheel.current + WHEEL_RANGE - 1;
+    }
+
+    int level = timer_level(timer);
+    timer_entry *slot = &wheel.slots[level][(expires >> level_shift(level)) & SLOT_MASK];
+
+    timer->prev = slot->prev;
+    timer->next = slot;
+    slot->prev->next = timer;
+    slot->prev = timer;
+
+    timer->level = level;
+    wheel.level_count[level]++;
+    wheel.count++;
+}
+
+/**
+ * @brief Remove every timer from a slot into a local list
+ *
+ * @param level Wheel level
+ * @param index Slot index
+ * @param list Sentinel receiving the timers
+ */
+static void take_slot(int level, int index, timer_entry *list) {
+    timer_entry *slot = &wheel.slots[level][index];
+    list->next = list;
+    list->prev = list;
+
+    while (!slot_empty(slot)) {
+        timer_entry *timer = slot->next;
+        unlink_timer(timer);
+
+        timer->prev = list->prev;
+        timer->next = list;
+        list->prev->next = timer;
+        list->prev = timer;
+
+        timer->level = -1;
+        wheel.level_count[level]--;
+        wheel.count--;
+    }
+}
+
+/**
+ * @brief Move the timers of one slot down to the lower levels
+ *
+ * @param level Wheel level to cascade from
+ * @param index Slot index
+ */
+static void cascade(int level, int index) {
+    timer_entry list;
+    take_slot(level, index, &list);
+
+    while (!slot_empty(&list)) {
+        timer_entry *timer = list.next;
+        unlink_timer(timer);
+        wheel_insert(timer);
+    }
+}
+
+/**
+ * @brief Initialise the timer wheel
+ */
+void timer_init() {
+    memset(&wheel, 0, sizeof(wheel));
+
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int i = 0; i < TIMER_SLOTS; i++) {
+            wheel.slots[level][i].next = &wheel.slots[level][i];
+            wheel.slots[level][i].prev = &wheel.slots[level][i];
+        }
+    }
+
+    wheel.current = timer_now();
+    wheel.initialised = 1;
+}
+
+/**
+ * @brief Current monotonic time in milliseconds
+ *
+ * @return uint64_t Milliseconds since an arbitrary fixed point
+ */
+uint64_t timer_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Arm (or re-arm) a timer, O(1)
+ *
+ * @param timer Timer to arm
+ * @param timeout_ms Milliseconds from now until expiry
+ * @param callback Function run on expiry, or NULL for a plain deadline
+ * @param arg Owner data passed through timer->arg
+ */
+void timer_arm(timer_entry *timer, uint32_t timeout_ms, void (*callback)(timer_entry *), void *arg) {
+    if (!wheel.initialised) {
+        timer_init();
+    }
+
+    if (timer->pending) {
+        timer_cancel(timer);
+    }
+
+    timer->expires = timer_now() + timeout_ms;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->pending = 1;
+    wheel_insert(timer);
+}
+
+/**
+ * @brief Cancel a timer if armed, O(1)
+ *
+ * @param timer Timer to cancel
+ */
+void timer_cancel(timer_entry *timer) {
+    if (!timer->pending) {
+        return;
+    }
+
+    // Timers already pulled off the wheel by timer_advance() are not counted
+    if (timer->level >= 0) {
+        wheel.level_count[timer->level]--;
+        wheel.count--;
+    }
+
+    unlink_timer(timer);
+    timer->pending = 0;
+}
+
+/**
+ * @brief Milliseconds left before a timer expires
+ *
+ * @param timer Timer to inspect
+ * @return int Remaining milliseconds (0 once expired), or -1 if timer is NULL
+ */
+int timer_remaining(const timer_entry *timer) {
+    if (!timer) {
+        return -1;
+    }
+
+    uint64_t now = timer_now();
+    if (timer->expires <= now) {
+        return 0;
+    }
+
+    uint64_t left = timer->expires - now;
+    return left > INT_MAX ? INT_MAX : (int)left;
+}
+
+/**
+ * @brief Milliseconds until the next timer could fire, for use as a poll timeout
+ *
+ * @return int Milliseconds to wait, or -1 if no timers are armed
+ */
+int timer_next_timeout() {
+    if (wheel.count == 0) {
+        return -1;
+    }
+
+    uint64_t next = UINT64_MAX;
+
+    // Level 0 slots map to exact ticks
+    if (wheel.level_count[0] > 0) {
+        for (int i = 0; i < TIMER_SLOTS; i++) {
+            uint64_t tick = wheel.current + i;
+            if (!slot_empty(&wheel.slots[0][tick & SLOT_MASK])) {
+                next = tick;
+                break;
+            }
+        }
+    }
+
+    // Higher levels only need a wakeup when their next occupied slot cascades
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        if (wheel.level_count[level] == 0) {
+            continue;
+        }
+
+        int shift = level_shift(level);
+        uint64_t block = (wheel.current + ((uint64_t)1 << shift) - 1) >> shift;
+        for (int i = 0; i < TIMER_SLOTS; i++) {
+            if (!slot_empty(&wheel.slots[level][(block + i) & SLOT_MASK])) {
+                uint64_t tick = (block + i) << shift;
+                if (tick < next) {
+                    next = tick;
+                }
+                break;
+            }
+        }
+    }
+
+    uint64_t now = timer_now();
+    if (next <= now) {
+        return 0;
+    }
+    return next - now > INT_MAX ? INT_MAX : (int)(next - now);
+}
+
+/**
+ * @brief Run callbacks for every timer that has expired
+ */
+void timer_advance() {
+    if (!wheel.initialised) {
+        return;
+    }
+
+    uint64_t now = timer_now();
+
+    while (wheel.current <= now) {
+        if (wheel.count == 0) {
+            wheel.current = now + 1;
+            break;
+        }
+
+        uint64_t tick = wheel.current;
+        int index = tick & SLOT_MASK;
+
+        // Lower levels wrapped, pull the matching blocks down
+        if (index == 0) {
+            for (int level = 1; level < TIMER_LEVELS; level++) {
+                int shift = level_shift(level);
+                if (tick & (((uint64_t)1 << shift) - 1)) {
+                    break;
+                }
+                cascade(level, (tick >> shift) & SLOT_MASK);
+            }
+        }
+
+        if (wheel.level_count[0] == 0) {
+            // Nothing due before the next block boundary
+            uint64_t boundary = (tick | SLOT_MASK) + 1;
+            wheel.current = boundary <= now + 1 ? boundary : now + 1;
+            continue;
+        }
+
+        timer_entry expired;
+        take_slot(0, index, &expired);
+        wheel.current = tick + 1;
+
+        while (!slot_empty(&expired)) {
+            timer_entry *timer = expired.next;
+            unlink_timer(timer);
+
+            if (timer->expires > tick) {
+                // Parked beyond the wheel's range, not due yet
+                wheel_insert(timer);
+                continue;
+            }
+
+            timer->pending = 0;
+            if (timer->callback) {
+                timer->callback(timer);
+            }
+        }
+    }
+}
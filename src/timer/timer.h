@@ -0,0 +1,77 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+/* ========== Constants ========== */
+// Wheel geometry: 4 levels of 64 slots at 1 ms per tick (~4.6 hours of range)
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+/**
+ * Timer entry, embedded in whatever owns the deadline (no allocation on arm).
+ * Zero-initialise before first use.
+ */
+typedef struct timer_entry {
+    uint64_t expires;                              // Absolute deadline (monotonic ms)
+    void (*callback)(struct timer_entry *timer);   // Run on expiry, may be NULL
+    void *arg;                                     // Owner data for the callback
+    int pending;                                   // 1 while armed and not yet fired
+    int level;                                     // Wheel level while queued
+
+    // Wheel slot linked list pointers
+    struct timer_entry *prev;
+    struct timer_entry *next;
+} timer_entry;
+
+/**
+ * @brief Initialise the timer wheel
+ */
+void timer_init();
+
+/**
+ * @brief Current monotonic time in milliseconds
+ *
+ * @return uint64_t Milliseconds since an arbitrary fixed point
+ */
+uint64_t timer_now();
+
+/**
+ * @brief Arm (or re-arm) a timer, O(1)
+ *
+ * @param timer Timer to arm
+ * @param timeout_ms Milliseconds from now until expiry
+ * @param callback Function run on expiry, or NULL for a plain deadline
+ * @param arg Owner data passed through timer->arg
+ */
+void timer_arm(timer_entry *timer, uint32_t timeout_ms, void (*callback)(timer_entry *), void *arg);
+
+/**
+ * @brief Cancel a timer if armed, O(1)
+ *
+ * @param timer Timer to cancel
+ */
+void timer_cancel(timer_entry *timer);
+
+/**
+ * @brief Milliseconds left before a timer expires
+ *
+ * @param timer Timer to inspect
+ * @return int Remaining milliseconds (0 once expired), or -1 if timer is NULL
+ */
+int timer_remaining(const timer_entry *timer);
+
+/**
+ * @brief Milliseconds until the next timer could fire, for use as a poll timeout
+ *
+ * @return int Milliseconds to wait, or -1 if no timers are armed
+ */
+int timer_next_timeout();
+
+/**
+ * @brief Run callbacks for every timer that has expired
+ */
+void timer_advance();
+
+#endif /* TIMER_H */
@@ -0,0 +1,408 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "tunnel.h"
+#include "http.h"
+#include "socket.h"
+#include "io.h"
+#include "log.h"
+#include "stats.h"
+
+/**
+ * One direction of a tunnel. Bytes wait in a pipe between the two splices,
+ * so a slow reader on one end only stops reads from the other.
+ */
+typedef struct {
+    int from;                 // Socket read from
+    int to;                   // Socket written to
+    int pipe[2];              // Bytes read from `from` and not yet written to `to`
+    size_t queued;            // Bytes in the pipe
+    int reading;              // `from` hasn't reached EOF
+    int shut;                 // EOF passed on to `to`
+    uint64_t bytes;           // Bytes delivered to `to`
+} tunnel_direction;
+
+/**
+ * Established tunnel, owned by the relay thread once handed over
+ */
+typedef struct {
+    int client_socket;
+    int server_socket;
+    tunnel_direction up;      // Client to target
+    tunnel_direction down;    // Target to client
+    uint64_t active_ms;       // When bytes last moved
+    int poll_index;           // Client socket's slot in the poll set, server's follows
+    char host[MAX_HOSTNAME_SIZE];
+    char port[16];
+} tunnel;
+
+// Idle time before a tunnel is torn down, changed with set_tunnel_idle_timeout()
+static int idle_timeout_ms = TUNNEL_IDLE_TIMEOUT_MS;
+
+// Tunnels open or being set up, checked against TUNNEL_MAX before connecting
+static int tunnel_count;
+
+// Tunnels handed over by the serving loop, not yet picked up by the relay thread
+static tunnel *handoff[TUNNEL_MAX];
+static int handoff_count;
+static pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Written to when a tunnel is handed over, so the relay thread's poll() wakes up
+static int wake_pipe[2] = {-1, -1};
+static int started;
+
+// Tunnels being relayed, touched by the relay thread only
+static tunnel *active[TUNNEL_MAX];
+static int active_count;
+
+static const char established_response[] =
+    "HTTP/1.1 200 Connection Established\r\n\r\n";
+
+static const char bad_request_response[] =
+    "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static const char bad_gateway_response[] =
+    "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static const char unavailable_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+/**
+ * @brief Current monotonic time in milliseconds
+ *
+ * @return uint64_t Milliseconds since an arbitrary fixed point
+ */
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Set up one direction of a tunnel
+ *
+ * @param dir Direction to set up
+ * @param from Socket read from
+ * @param to Socket written to
+ * @return int 0 on success, -1 if no pipe could be made
+ */
+static int direction_init(tunnel_direction *dir, int from, int to) {
+    memset(dir, 0, sizeof(*dir));
+    dir->from = from;
+    dir->to = to;
+    dir->reading = 1;
+    if (pipe2(dir->pipe, O_NONBLOCK) < 0) {
+        perror("pipe2");
+        dir->pipe[0] = dir->pipe[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close a direction's pipe
+ *
+ * @param dir Direction set up by direction_init()
+ */
+static void direction_close(tunnel_direction *dir) {
+    if (dir->pipe[0] >= 0) close(dir->pipe[0]);
+    if (dir->pipe[1] >= 0) close(dir->pipe[1]);
+}
+
+/**
+ * @brief Move what is ready in one direction without blocking
+ *
+ * @param dir Direction to pump
+ * @param counter Byte counter for the direction
+ * @return int 1 if bytes moved, 0 if nothing did, -1 on error
+ */
+static int direction_pump(tunnel_direction *dir, stat_counter counter) {
+    int moved = 0;
+
+    if (dir->reading && dir->queued < IO_SPLICE_CHUNK) {
+        ssize_t in = splice(dir->from, NULL, dir->pipe[1], NULL, IO_SPLICE_CHUNK - dir->queued,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in > 0) {
+            dir->queued += in;
+            moved = 1;
+        } else if (in == 0) {
+            dir->reading = 0;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+    }
+
+    if (dir->queued > 0) {
+        ssize_t out = splice(dir->pipe[0], NULL, dir->to, NULL, dir->queued,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (out > 0) {
+            dir->queued -= out;
+            dir->bytes += out;
+            stats_add(counter, out);
+            moved = 1;
+        } else if (out < 0 && errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+    }
+
+    // Sender finished and everything it sent is delivered, pass the FIN along
+    if (!dir->reading && dir->queued == 0 && !dir->shut) {
+        shutdown(dir->to, SHUT_WR);
+        dir->shut = 1;
+    }
+    return moved;
+}
+
+/**
+ * @brief Poll events a direction waits for on its two sockets
+ *
+ * @param dir Direction
+ * @param from_events Added to for the socket read from
+ * @param to_events Added to for the socket written to
+ */
+static void direction_events(const tunnel_direction *dir, short *from_events, short *to_events) {
+    if (dir->reading && dir->queued < IO_SPLICE_CHUNK) {
+        *from_events |= POLLIN;
+    }
+    if (dir->queued > 0) {
+        *to_events |= POLLOUT;
+    }
+}
+
+/**
+ * @brief Tear a tunnel down and log its byte counts
+ *
+ * @param t Tunnel, freed here
+ */
+static void tunnel_close(tunnel *t) {
+    log_event(LOG_TUNNEL_CLOSED, t->host, t->port, t->up.bytes, t->down.bytes);
+
+    direction_close(&t->up);
+    direction_close(&t->down);
+    close(t->client_socket);
+    close(t->server_socket);
+    free(t);
+
+    stats_add(STAT_ACTIVE_CONNECTIONS, -1);
+    __atomic_fetch_sub(&tunnel_count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Move tunnels handed over by the serving loop into the active set
+ */
+static void take_handoffs() {
+    char drain[64];
+    while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+
+    pthread_mutex_lock(&handoff_lock);
+    for (int i = 0; i < handoff_count; i++) {
+        active[active_count++] = handoff[i];
+    }
+    handoff_count = 0;
+    pthread_mutex_unlock(&handoff_lock);
+}
+
+/**
+ * @brief Relay thread: move bytes for every open tunnel as its sockets turn ready
+ *
+ * @param arg Unused
+ * @return void* Never returns
+ */
+static void* relay_loop(void *arg) {
+    (void)arg;
+    static struct pollfd fds[1 + 2 * TUNNEL_MAX];
+
+    while (1) {
+        take_handoffs();
+
+        uint64_t now = now_ms();
+        int idle_ms = __atomic_load_n(&idle_timeout_ms, __ATOMIC_RELAXED);
+        int timeout_ms = -1;
+        int nfds = 1;
+        fds[0] = (struct pollfd){.fd = wake_pipe[0], .events = POLLIN};
+
+        for (int i = 0; i < active_count; i++) {
+            tunnel *t = active[i];
+
+            uint64_t idle_until = t->active_ms + idle_ms;
+            if (now >= idle_until) {
+                stats_add(STAT_TUNNEL_IDLE_TIMEOUTS, 1);
+                tunnel_close(t);
+                active[i--] = active[--active_count];
+                continue;
+            }
+            if (timeout_ms < 0 || idle_until - now < (uint64_t)timeout_ms) {
+                timeout_ms = (int)(idle_until - now);
+            }
+
+            short client_events = 0, server_events = 0;
+            direction_events(&t->up, &client_events, &server_events);
+            direction_events(&t->down, &server_events, &client_events);
+
+            t->poll_index = nfds;
+            fds[nfds++] = (struct pollfd){.fd = t->client_socket, .events = client_events};
+            fds[nfds++] = (struct pollfd){.fd = t->server_socket, .events = server_events};
+        }
+
+        if (poll(fds, nfds, timeout_ms) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            continue;
+        }
+
+        now = now_ms();
+        for (int i = 0; i < active_count; i++) {
+            tunnel *t = active[i];
+            short revents = fds[t->poll_index].revents | fds[t->poll_index + 1].revents;
+            if (!revents) {
+                continue;
+            }
+
+            int up = direction_pump(&t->up, STAT_TUNNEL_BYTES_UP);
+            int down = up < 0 ? -1 : direction_pump(&t->down, STAT_TUNNEL_BYTES_DOWN);
+            if (up > 0 || down > 0) {
+                t->active_ms = now;
+            }
+
+            // A reset end stays ready forever, so stop once it has nothing left to give
+            int hung_up = (revents & (POLLERR | POLLHUP | POLLNVAL)) && up == 0 && down == 0;
+
+            if (up < 0 || down < 0 || hung_up || (t->up.shut && t->down.shut)) {
+                tunnel_close(t);
+                active[i--] = active[--active_count];
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start the thread that relays bytes for every open tunnel
+ *
+ * @return int 0 on success, -1 on error
+ */
+int tunnel_start() {
+    if (pipe2(wake_pipe, O_NONBLOCK) < 0) {
+        perror("pipe2");
+        return -1;
+    }
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, relay_loop, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start tunnel thread: %s\n", strerror(err));
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+        return -1;
+    }
+    pthread_detach(thread);
+    started = 1;
+    return 0;
+}
+
+/**
+ * @brief Change how long a tunnel may sit idle before it is torn down
+ *
+ * @param ms Timeout in milliseconds
+ */
+void set_tunnel_idle_timeout(int ms) {
+    __atomic_store_n(&idle_timeout_ms, ms, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Answer a CONNECT that won't be tunnelled
+ *
+ * @param client_socket Socket connected to client
+ * @param response Response to send
+ * @param response_len Its length
+ * @return int -1
+ */
+static int refuse(int client_socket, const char *response, size_t response_len) {
+    stats_add(STAT_TUNNELS_FAILED, 1);
+    io_send(client_socket, response, response_len, NULL);
+    return -1;
+}
+
+/**
+ * @brief Open a CONNECT tunnel and hand it to the relay thread
+ *
+ * @param client_socket Socket connected to client
+ * @param target CONNECT target in "host:port" form ("[v6addr]:port" for IPv6)
+ * @return int 1 if the relay thread now owns client_socket, -1 on error
+ */
+int run_tunnel(int client_socket, const char *target) {
+    tunnel *t = calloc(1, sizeof(tunnel));
+    if (!t) {
+        perror("calloc");
+        return refuse(client_socket, unavailable_response, sizeof(unavailable_response) - 1);
+    }
+
+    if (split_host_port(target, TUNNEL_DEFAULT_PORT, t->host, sizeof(t->host),
+                        t->port, sizeof(t->port)) < 0) {
+        fprintf(stderr, "Malformed CONNECT target %s\n", target);
+        free(t);
+        return refuse(client_socket, bad_request_response, sizeof(bad_request_response) - 1);
+    }
+
+    if (!started || __atomic_fetch_add(&tunnel_count, 1, __ATOMIC_RELAXED) >= TUNNEL_MAX) {
+        if (started) {
+            __atomic_fetch_sub(&tunnel_count, 1, __ATOMIC_RELAXED);
+        }
+        fprintf(stderr, "No room for a tunnel to %s %s\n", t->host, t->port);
+        free(t);
+        return refuse(client_socket, unavailable_response, sizeof(unavailable_response) - 1);
+    }
+
+    log_event(LOG_CONNECTING, t->host, t->port, 0, 0);
+
+    // Connecting is bounded by the connect timeout; only relaying moves off this thread
+    t->server_socket = connect_to_host(t->host, t->port);
+    if (t->server_socket < 0) {
+        fprintf(stderr, "Failed to connect to %s %s\n", t->host, t->port);
+        __atomic_fetch_sub(&tunnel_count, 1, __ATOMIC_RELAXED);
+        free(t);
+        return refuse(client_socket, bad_gateway_response, sizeof(bad_gateway_response) - 1);
+    }
+    t->client_socket = client_socket;
+
+    if (direction_init(&t->up, client_socket, t->server_socket) < 0 ||
+        direction_init(&t->down, t->server_socket, client_socket) < 0 ||
+        io_send(client_socket, established_response, sizeof(established_response) - 1, NULL) < 0) {
+        direction_close(&t->up);
+        direction_close(&t->down);
+        close(t->server_socket);
+        __atomic_fetch_sub(&tunnel_count, 1, __ATOMIC_RELAXED);
+        free(t);
+        stats_add(STAT_TUNNELS_FAILED, 1);
+        return -1;
+    }
+    stats_add(STAT_TUNNELS_OPENED, 1);
+
+    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+    fcntl(t->server_socket, F_SETFL, fcntl(t->server_socket, F_GETFL) | O_NONBLOCK);
+    t->active_ms = now_ms();
+
+    // tunnel_count keeps the relay thread's arrays from overflowing
+    pthread_mutex_lock(&handoff_lock);
+    handoff[handoff_count++] = t;
+    pthread_mutex_unlock(&handoff_lock);
+
+    char wake = 1;
+    if (write(wake_pipe[1], &wake, 1) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+    return 1;
+}
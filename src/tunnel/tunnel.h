@@ -0,0 +1,46 @@
+#ifndef TUNNEL_H
+#define TUNNEL_H
+
+/* ========== Constants ========== */
+// Tunnel torn down after this long without traffic in either direction, by default (ms)
+#ifndef TUNNEL_IDLE_TIMEOUT_MS
+#define TUNNEL_IDLE_TIMEOUT_MS 60000
+#endif
+
+// Tunnels open at once; each holds two sockets and two pipes
+#ifndef TUNNEL_MAX
+#define TUNNEL_MAX 64
+#endif
+
+// Port used when a CONNECT target doesn't name one
+#define TUNNEL_DEFAULT_PORT "443"
+
+/**
+ * @brief Start the thread that relays bytes for every open tunnel
+ *
+ * @return int 0 on success, -1 on error
+ */
+int tunnel_start();
+
+/**
+ * @brief Change how long a tunnel may sit idle before it is torn down
+ *
+ * Applies to tunnels already open as well as new ones.
+ *
+ * @param ms Timeout in milliseconds
+ */
+void set_tunnel_idle_timeout(int ms);
+
+/**
+ * @brief Serve a CONNECT request by opening the tunnel and handing it to the relay thread
+ *
+ * Connecting happens on the caller's thread; relaying doesn't, so the serving
+ * loop is free again as soon as the client has its 200.
+ *
+ * @param client_socket Socket connected to client
+ * @param target CONNECT target in "host:port" form ("[v6addr]:port" for IPv6)
+ * @return int 1 if the relay thread now owns client_socket, -1 on error
+ */
+int run_tunnel(int client_socket, const char *target);
+
+#endif /* TUNNEL_H */
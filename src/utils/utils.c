@@ -1,4 +1,11 @@
 #include "utils.h"
+#include "cache.h"
+#include "arena.h"
+#include "h2.h"
+#include "cluster.h"
+#include "dispatch.h"
+#include "prefetch.h"
+#include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,34 +18,139 @@
  */
 void print_usage(const char *prog_name)
 {
-    fprintf(stderr, "Usage: %s -p <listen-port> [-c]\n", prog_name);
+    fprintf(stderr, "Usage: %s -p <listen-port> [-c] [-a <admin-port>] [-n <status|connect>=<seconds>]...\n"
+                    "          [-H <arena-size>[k|m|g]] [-N <numa-node>] [-2 <host[:port]|*>]...\n"
+                    "          [-P <peer-host:port>]... [-I <self-host:port>] [-Q <target-ms>]\n"
+                    "          [-L <origin-limit>] [-b <backlog>] [-F <prefetch-workers>] [-B <bytes-per-second>[k|m|g]]\n"
+                    "          [-C <config-file>] [-l <access-log>]\n",
+            prog_name);
     exit(EXIT_FAILURE);
 }
 
 /**
- * @brief Parses and validates command-line arguments for -p and optional -c flags.
+ * @brief Parse a negative-caching TTL ("404=30", "connect=5")
  *
- * Expects at least 3 arguments: `-p <listen-port>`, and optionally `-c`.
- * If missing or invalid, prints usage and exits.
+ * @param spec Argument text
+ * @param status Receives the status, or NEGATIVE_STATUS_CONNECT
+ * @param seconds Receives the TTL
+ * @return int 0 on success, -1 if malformed
+ */
+int parse_negative_ttl(const char *spec, int *status, int *seconds)
+{
+    const char *eq = strchr(spec, '=');
+    if (!eq || eq == spec || !eq[1])
+    {
+        return -1;
+    }
+    for (const char *p = eq + 1; *p; ++p)
+    {
+        if (!isdigit((unsigned char)*p))
+        {
+            return -1;
+        }
+    }
+
+    if ((size_t)(eq - spec) == strlen("connect") && !strncmp(spec, "connect", eq - spec))
+    {
+        *status = NEGATIVE_STATUS_CONNECT;
+    }
+    else
+    {
+        for (const char *p = spec; p < eq; ++p)
+        {
+            if (!isdigit((unsigned char)*p))
+            {
+                return -1;
+            }
+        }
+        *status = atoi(spec);
+    }
+
+    *seconds = atoi(eq + 1);
+    return 0;
+}
+
+/**
+ * @brief Parse a byte count with an optional k/m/g suffix ("512m")
+ *
+ * @param text Argument text
+ * @param bytes Receives the value
+ * @return int 0 on success, -1 if malformed
+ */
+int parse_size(const char *text, size_t *bytes)
+{
+    if (!isdigit((unsigned char)*text))
+    {
+        return -1;
+    }
+
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (tolower((unsigned char)*end))
+    {
+    case 'k': value <<= 10; end++; break;
+    case 'm': value <<= 20; end++; break;
+    case 'g': value <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0')
+    {
+        return -1;
+    }
+
+    *bytes = (size_t)value;
+    return 0;
+}
+
+/**
+ * @brief Parses and validates command-line arguments for -p and optional -c / -a / -n / -H / -N / -2 / -P / -I / -Q / -L / -b / -F / -B / -C / -l flags.
+ *
+ * Expects at least 3 arguments: `-p <listen-port>`, and optionally `-c`,
+ * `-a <admin-port>`, any number of `-n <status>=<seconds>` negative-caching
+ * TTLs, `-H <size>` for a huge-page cache arena and `-N <node>` to bind it
+ * and the proxy to a NUMA node, and any number of `-2 <origin>` origins to
+ * fetch from over h2c. Any number of `-P <host:port>` cluster peers, with
+ * `-I <host:port>` naming this node on the ring. `-Q <ms>` sets the
+ * queueing delay target requests are shed against, `-L <n>` how many
+ * requests for one origin may wait at once and `-b <n>` the listen
+ * backlog. `-F <n>` prefetches links from cached HTML pages with n
+ * fetches in flight, within `-B <size>` bytes per second. `-C <path>`
+ * names a config file read after these options, whose settings override
+ * them. `-l <path>` appends a JSON line per request to an access log
+ * (PHASE_TIMING builds). If missing or invalid, prints usage and exits.
  *
  * @param argc Argument count
  * @param argv Argument vector
  * @param port Output pointer for storing listen port
  * @param c_flag Output pointer for storing presence of -c flag (1 if set, 0 otherwise)
+ * @param admin_port Output pointer for storing admin port (0 if -a not given)
+ * @param backlog Output pointer for storing listen backlog (0 if -b not given)
+ * @param config_path Output pointer for storing the config file path (NULL if -C not given)
  */
-void parse_args(int argc, char *argv[], int *port, int *c_flag)
+void parse_args(int argc, char *argv[], int *port, int *c_flag, int *admin_port, int *backlog,
+                const char **config_path)
 {
     *port = -1;
     *c_flag = 0;
+    *admin_port = 0;
+    *backlog = 0;
+    *config_path = NULL;
+
+    size_t arena_size = 0;
+    int numa_node = -1;
+    int target_ms = DISPATCH_TARGET_MS;
+    int origin_limit = DISPATCH_ORIGIN_LIMIT;
+    int prefetch_workers = 0;
+    size_t prefetch_budget = 0;
 
-    if (argc < 3 || argc > 4)
+    if (argc < 3)
     {
         print_usage(argv[0]); // Invalid argument count
     }
 
     for (int i = 1; i < argc; i++)
     {
-        if (!strcmp(argv[i], "-p") && i + 1 < argc)
+        if ((!strcmp(argv[i], "-p") || !strcmp(argv[i], "-a")) && i + 1 < argc)
         {
             // Check that the port is a number
             for (char *p = argv[i + 1]; *p; ++p)
@@ -48,7 +160,138 @@ void parse_args(int argc, char *argv[], int *port, int *c_flag)
                     print_usage(argv[0]);
                 }
             }
-            *port = atoi(argv[++i]);
+            int value = atoi(argv[i + 1]);
+            if (value <= 0)
+            {
+                print_usage(argv[0]);
+            }
+            if (!strcmp(argv[i], "-p"))
+            {
+                *port = value;
+            }
+            else
+            {
+                *admin_port = value;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            int status, seconds;
+            if (parse_negative_ttl(argv[i + 1], &status, &seconds) < 0 ||
+                set_negative_ttl(status, seconds) < 0)
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-H") && i + 1 < argc)
+        {
+            if (parse_size(argv[i + 1], &arena_size) < 0)
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-N") && i + 1 < argc)
+        {
+            for (char *p = argv[i + 1]; *p; ++p)
+            {
+                if (!isdigit(*p))
+                {
+                    print_usage(argv[0]);
+                }
+            }
+            numa_node = atoi(argv[i + 1]);
+            if (numa_node > ARENA_MAX_NODE)
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-2") && i + 1 < argc)
+        {
+            if (h2_add_origin(argv[i + 1]) < 0)
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if ((!strcmp(argv[i], "-P") || !strcmp(argv[i], "-I")) && i + 1 < argc)
+        {
+            int result = !strcmp(argv[i], "-P") ? cluster_add_peer(argv[i + 1])
+                                                : cluster_set_self(argv[i + 1]);
+            if (result < 0)
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if ((!strcmp(argv[i], "-Q") || !strcmp(argv[i], "-L") || !strcmp(argv[i], "-b")) &&
+                 i + 1 < argc)
+        {
+            for (char *p = argv[i + 1]; *p; ++p)
+            {
+                if (!isdigit(*p))
+                {
+                    print_usage(argv[0]);
+                }
+            }
+            int value = atoi(argv[i + 1]);
+            if (!strcmp(argv[i], "-Q"))
+            {
+                target_ms = value;
+            }
+            else if (!strcmp(argv[i], "-L"))
+            {
+                origin_limit = value;
+            }
+            else if (value > 0)
+            {
+                *backlog = value;
+            }
+            else
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-F") && i + 1 < argc)
+        {
+            for (char *p = argv[i + 1]; *p; ++p)
+            {
+                if (!isdigit(*p))
+                {
+                    print_usage(argv[0]);
+                }
+            }
+            prefetch_workers = atoi(argv[i + 1]);
+            i++;
+        }
+        else if (!strcmp(argv[i], "-B") && i + 1 < argc)
+        {
+            if (parse_size(argv[i + 1], &prefetch_budget) < 0 || prefetch_budget == 0)
+            {
+                print_usage(argv[0]);
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-C") && i + 1 < argc)
+        {
+            *config_path = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+        {
+#ifdef HAVE_PHASE_TIMING
+            if (log_open_access(argv[i + 1]) < 0)
+            {
+                exit(EXIT_FAILURE);
+            }
+#else
+            fprintf(stderr, "Access log needs a PHASE_TIMING=1 build, -l ignored\n");
+#endif
+            i++;
         }
         else if (!strcmp(argv[i], "-c"))
         {
@@ -65,6 +308,13 @@ void parse_args(int argc, char *argv[], int *port, int *c_flag)
     {
         print_usage(argv[0]);
     }
+
+    arena_configure(arena_size, numa_node);
+    dispatch_configure(target_ms, origin_limit);
+    if (prefetch_configure(prefetch_workers, prefetch_budget) < 0)
+    {
+        print_usage(argv[0]);
+    }
 }
 
 /**
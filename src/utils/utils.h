@@ -13,14 +13,37 @@
 void print_usage(const char *prog_name);
 
 /**
- * @brief Parses and validates command-line arguments for -p and optional -c flags.
+ * @brief Parses and validates command-line arguments for -p and optional -c / -a / -n / -H / -N / -2 / -P / -I / -Q / -L / -b / -F / -B / -C / -l flags.
  *
  * @param argc Argument count
  * @param argv Argument vector
  * @param port Output pointer for storing listen port
  * @param c_flag Output pointer for storing presence of -c flag (1 if set, 0 otherwise)
+ * @param admin_port Output pointer for storing admin port (0 if -a not given)
+ * @param backlog Output pointer for storing listen backlog (0 if -b not given)
+ * @param config_path Output pointer for storing the config file path (NULL if -C not given)
  */
-void parse_args(int argc, char *argv[], int *port, int *c_flag);
+void parse_args(int argc, char *argv[], int *port, int *c_flag, int *admin_port, int *backlog,
+                const char **config_path);
+
+/**
+ * @brief Parse a negative-caching TTL ("404=30", "connect=5")
+ *
+ * @param spec Text to parse
+ * @param status Receives the status, or NEGATIVE_STATUS_CONNECT
+ * @param seconds Receives the TTL
+ * @return int 0 on success, -1 if malformed
+ */
+int parse_negative_ttl(const char *spec, int *status, int *seconds);
+
+/**
+ * @brief Parse a byte count with an optional k/m/g suffix ("512m")
+ *
+ * @param text Text to parse
+ * @param bytes Receives the value
+ * @return int 0 on success, -1 if malformed
+ */
+int parse_size(const char *text, size_t *bytes);
 
 /**
  * @brief Trims whitespace from the beginning and end of a string
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "buffer.h"
+#include "io.h"
+#include "stats.h"
+
+/*
+ * Checks that the client buffer's backpressure accounting reaches the
+ * metrics endpoint. Run with "make test"; exits non-zero if any check fails.
+ */
+
+#define MEM_CAP 4096
+#define RESPONSE_SIZE (64 * 1024)
+
+static int failures;
+static char metrics[64 * 1024];
+
+/**
+ * @brief Read one series from the Prometheus output
+ *
+ * @param name Series name
+ * @return long long Its value, or -1 if it is missing
+ */
+static long long metric(const char *name) {
+    char prefix[128];
+    snprintf(prefix, sizeof(prefix), "\n%s ", name);
+
+    const char *line = strstr(metrics, prefix);
+    return line ? atoll(line + strlen(prefix)) : -1;
+}
+
+/**
+ * @brief Compare a series against what the test did
+ *
+ * @param name Series name
+ * @param low Smallest accepted value
+ * @param high Largest accepted value
+ */
+static void check_metric(const char *name, long long low, long long high) {
+    long long value = metric(name);
+    if (value < low || value > high) {
+        fprintf(stderr, "FAIL %s = %lld, expected %lld..%lld\n", name, value, low, high);
+        failures++;
+    }
+}
+
+/**
+ * @brief Main function.
+ *
+ * @return int 0 if every check passed, 1 otherwise
+ */
+int main() {
+    if (io_init() < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // A client that never reads, with a small receive window
+    int fds[2];
+    int small = 4096;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return EXIT_FAILURE;
+    }
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+    static char response[RESPONSE_SIZE];
+    memset(response, 'x', sizeof(response));
+
+    client_buffer buf;
+    init_client_buffer(&buf, MEM_CAP);
+    if (append_to_client_buffer(&buf, response, sizeof(response)) < 0 ||
+        flush_client_buffer(&buf, fds[0]) < 0) {
+        fprintf(stderr, "FAIL buffering the response\n");
+        return EXIT_FAILURE;
+    }
+    size_t pending = client_buffer_pending(&buf);
+
+    stats_format_prometheus(metrics, sizeof(metrics));
+    check_metric("htproxy_client_buffered_bytes", pending, pending);
+    check_metric("htproxy_client_buffered_peak_bytes", RESPONSE_SIZE, RESPONSE_SIZE);
+    check_metric("htproxy_client_spilled_responses_total", 1, 1);
+    check_metric("htproxy_client_spilled_bytes_total", RESPONSE_SIZE - MEM_CAP, RESPONSE_SIZE);
+    check_metric("htproxy_client_stalls_total", 1, 1);
+
+    // Dropping the response gives the bytes back but keeps the mark
+    free_client_buffer(&buf);
+    stats_format_prometheus(metrics, sizeof(metrics));
+    check_metric("htproxy_client_buffered_bytes", 0, 0);
+    check_metric("htproxy_client_buffered_peak_bytes", RESPONSE_SIZE, RESPONSE_SIZE);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All buffer metrics checks passed\n");
+    return EXIT_SUCCESS;
+}
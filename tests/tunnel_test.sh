@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Checks that an open CONNECT tunnel doesn't hold up other clients: a plain
+# GET must be answered while a tunnel sits idle waiting on its origin.
+# Run with "make test"; exits non-zero if any check fails.
+#
+# Environment: PROXY (binary, default ./htproxy), PROXY_PORT (18090),
+# ORIGIN_PORT (18091)
+
+TESTS_DIR=$(dirname "$0")
+ORIGIN="$TESTS_DIR/../bench/origin"
+PROXY=${PROXY:-./htproxy}
+PROXY_PORT=${PROXY_PORT:-18090}
+ORIGIN_PORT=${ORIGIN_PORT:-18091}
+
+"$ORIGIN" -p "$ORIGIN_PORT" &
+ORIGIN_PID=$!
+"$PROXY" -p "$PROXY_PORT" > /dev/null 2>&1 &
+PROXY_PID=$!
+trap 'kill $ORIGIN_PID $PROXY_PID 2>/dev/null' EXIT INT TERM
+sleep 0.5
+
+failures=0
+
+# Tunnel whose origin stays silent for 3 s
+curl -s -o /dev/null -w '%{http_code}' -m 10 -p -x "127.0.0.1:$PROXY_PORT" \
+    "http://127.0.0.1:$ORIGIN_PORT/obj/tunnelled?size=100&delay=3000" > "$TESTS_DIR/.tunnel_status" &
+TUNNEL_PID=$!
+sleep 0.5
+
+# Served while the tunnel is open, well before its origin answers
+status=$(curl -s -o /dev/null -w '%{http_code}' -m 2 -x "127.0.0.1:$PROXY_PORT" \
+    "http://127.0.0.1:$ORIGIN_PORT/obj/plain?size=100")
+if [ "$status" != "200" ]; then
+    echo "FAIL GET during an idle tunnel: status $status" >&2
+    failures=$((failures + 1))
+fi
+
+# The tunnel itself still completes
+wait $TUNNEL_PID
+status=$(cat "$TESTS_DIR/.tunnel_status")
+rm -f "$TESTS_DIR/.tunnel_status"
+if [ "$status" != "200" ]; then
+    echo "FAIL request through the tunnel: status $status" >&2
+    failures=$((failures + 1))
+fi
+
+if [ $failures -ne 0 ]; then
+    echo "$failures check(s) failed" >&2
+    exit 1
+fi
+echo "All tunnel checks passed"